@@ -7,7 +7,9 @@
 
 #import <ScreenSaver/ScreenSaver.h>
 #include "fluere_drawing.h"
+#include "fluere_render.h"
 #include "palettes.h"
+#include "colortable_transform.h"
 
 // name of the configure sheet XIB file
 #define kConfigSheetXIB @"ConfigureSheet"
@@ -18,10 +20,11 @@
 #define kDefaultsNumKnotsValue    4
 
 // state of the view; these typically cycle through
-// calcState (compute a new drawing) -->
+// calcState (wait for the first pass of the next drawing) -->
 // fadeInState (animate the drawing fading in from black) -->
 // normalState (animate the drawing) -->
-// fadeOutState (animate the drawing, fading to black) -->
+// fadeOutState (animate the drawing, fading to black, while the next
+//               one is computed) -->
 typedef enum 
   {
     calcState,
@@ -54,18 +57,25 @@ typedef enum
   // the palette
   palette_list_ptr paletteList_;
   unsigned char colortable_[256 * 3 * 2];  // 256 colors * {rgb} * 2 cycles
+  unsigned char fadedtable_[256 * 3];      // this frame's colors, faded
+  colortable_transform fade_;
 
   // image data
   unsigned char *imgData_;
   fluere_drawing_ptr  fractal_;
 
+  // the next drawing, computed in the background
+  unsigned char *nextData_;
+  fluere_drawing_ptr  nextFractal_;
+  fluere_render_ptr render_;
+  BOOL nextShown_;            // has it been swapped in yet?
+
   // color stuff
   CGDataProviderRef theProvider_;
   CGColorSpaceRef rgbspace_;
 
   ViewState viewstate_;
   double fadeAmount_;
-  BOOL doneCalculating_;
   
   // file numbering for screenshots
   int filenum_;
@@ -78,6 +88,8 @@ typedef enum
 
 - (void) makeColorTable;
 - (void) newImage;
+- (void) checkNextImage;
+- (void) updateImage;
 - (void) savePNGImage;
 
 
@@ -7,6 +7,8 @@
 ///
 
 #import "FluereView.h"
+#include "fluere_spec.h"
+#include "fluere_anim.h"
 
 
 @implementation FluereView
@@ -52,14 +54,14 @@
     fclose(palfile);
 
     fadeAmount_ = 0.0;  // completely faded
+    init_colortable_transform(&fade_);
     viewstate_ = calcState;
-    doneCalculating_ = FALSE;
     animCounter_ = 0;
-    animResetValue_ = 12 *30*2;  //12 seconds (30 frames/sec* 2 tics/frame)
+    animResetValue_ = FLUERE_VIEW_RESET;  //12 seconds (30 frames/sec* 2 tics/frame)
 
     filenum_ = 1;
 
-    [self setAnimationTimeInterval:1/30.0];
+    [self setAnimationTimeInterval:1.0/FLUERE_VIEW_FPS];
   }
   return self;
 }
@@ -84,17 +86,11 @@
   switch (viewstate_)
   {
     case normalState:   // draw the image
+    case fadeInState:   // (the fading is done in its colors)
+    case fadeOutState:
       CGContextDrawImage(cgcontext, cg, fractalImage_);
       break;
 
-    case fadeInState:
-    case fadeOutState:  // draw the image with fading
-      CGContextSetRGBFillColor( cgcontext, 0.0, 0.0, 0.0, 1.0 );
-      CGContextFillRect(cgcontext, cg);
-      CGContextSetAlpha(cgcontext, fadeAmount_);
-      CGContextDrawImage(cgcontext, cg, fractalImage_);      
-      break;
-
     case calcState:
     default:            // draw a black screen
       CGContextSetRGBFillColor( cgcontext, 0.0, 0.0, 0.0, 1.0 );
@@ -106,15 +102,10 @@
 
 - (void)animateOneFrame
 {
+  [self checkNextImage];
 
   if (viewstate_ == calcState)
   {
-    if (!doneCalculating_)
-    {
-      doneCalculating_ = TRUE;
-      [self newImage];
-    }
-
     [self setNeedsDisplay:YES];
     return;
   }
@@ -123,7 +114,7 @@
   switch (viewstate_)
   {
     case fadeInState:
-      fadeAmount_ += 0.05;
+      fadeAmount_ += 1.0/FLUERE_VIEW_FADE_FRAMES;
       if (fadeAmount_ >= 1)
       {
         fadeAmount_ = 1.0;
@@ -132,20 +123,20 @@
       break;
 
     case fadeOutState:
-      fadeAmount_ -= 0.05;
+      fadeAmount_ -= 1.0/FLUERE_VIEW_FADE_FRAMES;
       if (fadeAmount_ <= 0)
       {
         fadeAmount_ = 0;
         viewstate_ = calcState;
-        doneCalculating_ = TRUE;
-        [self newImage];
       }
       break;
 
     case normalState:
       if (animCounter_ > animResetValue_)
       {
+        // start on the next drawing while this one fades out
         viewstate_ = fadeOutState;
+        [self newImage];
       }
       break;
 
@@ -153,13 +144,34 @@
       NSLog(@"How did I get here?");
   }
 
-  animCounter_ += 2;
+  animCounter_ += FLUERE_VIEW_STEP;
 
 
 
   // update the picture
+  [self updateImage];
+
+  [self setNeedsDisplay:YES];
+
+  return;
+}
+
+// make the image from the image data and the current colors; while
+// fading, the colors themselves are faded toward black, which costs
+// nothing per pixel
+- (void) updateImage
+{
   CGColorSpaceRef theColorspace;
-  theColorspace = CGColorSpaceCreateIndexed(rgbspace_, 255, colortable_+3*(animCounter_ % 256));
+  const unsigned char *colors = colortable_+3*(animCounter_ % 256);
+
+  if (viewstate_ == fadeInState || viewstate_ == fadeOutState)
+  {
+    set_colortable_fade(&fade_, fadeAmount_, NULL);
+    transform_colortable(&fade_, colors, 256, fadedtable_);
+    colors = fadedtable_;
+  }
+
+  theColorspace = CGColorSpaceCreateIndexed(rgbspace_, 255, colors);
 
   if (fractalImage_) CGImageRelease(fractalImage_);
   fractalImage_ = CGImageCreate (width_,
@@ -175,10 +187,6 @@
       kCGRenderingIntentDefault);
 
   CGColorSpaceRelease( theColorspace );
-
-  [self setNeedsDisplay:YES];
-
-  return;
 }
 
 // this keeps Cocoa from unneccessarily redrawing our superview
@@ -233,8 +241,8 @@
   [[self defaults] synchronize];
 
   viewstate_ = calcState;
-  doneCalculating_ = FALSE;
   fadeAmount_ = 0;
+  [self newImage];
 
   [NSApp endSheet: configureSheet_];
 }
@@ -265,6 +273,16 @@
   CGImageDestinationFinalize(dr);
   CFRelease(dr);
   [outURL release];
+
+  // and the spec next to it, so the drawing can be made again at any size
+  NSString *specname = [[filename stringByDeletingPathExtension]
+      stringByAppendingPathExtension:@"fluerespec"];
+  FILE *specfile = fopen([specname fileSystemRepresentation], "w");
+  if (specfile)
+  {
+    save_fluere_spec_text(fractal_, specfile);
+    fclose(specfile);
+  }
 }
 
 - (void) keyDown: (NSEvent*) theEvent
@@ -277,8 +295,8 @@
     if ((viewstate_ == normalState) || (viewstate_ = fadeInState))
     {
       viewstate_ = calcState;
-      doneCalculating_ = FALSE;
       fadeAmount_ = 0;
+      [self newImage];
       return;	  
     }
   }
@@ -304,24 +322,76 @@
 }
 
 
+// start computing a new drawing in the background; checkNextImage
+// shows it once there's something to show
 - (void) newImage
 {
+  // stop the last one, if it's still going
+  delete_fluere_render(render_);
+  render_ = NULL;
+
   style1_ = random() % 5;
   style2_ = random() % 5;
   numKnots_ = [[self defaults] integerForKey: kDefaultsNumKnotsKey];
 
+  if (nextFractal_)
+    delete_fluere_drawing(nextFractal_);
 
-  if (fractal_)
-    delete_fluere_drawing(fractal_);
+  nextFractal_ = init_fluere_drawing(width_, height_, numKnots_, style1_, style2_);
+  if (!nextFractal_)
+    return;
+  set_fluere_kernels(nextFractal_, vector_kernels);
+  if (!nextData_)
+    nextData_ = malloc(width_*height_);
 
-  fractal_ = init_fluere_drawing(width_, height_, numKnots_, style1_, style2_);
-  if (!imgData_)
-    imgData_ = malloc(width_*height_);
-  fill_pixels(fractal_, imgData_);
+  render_ = start_fluere_render(nextFractal_, nextData_, 0);
+  nextShown_ = NO;
+}
 
-  [self makeColorTable];
+// once we're waiting for it and its first pass is done, swap in the
+// drawing being computed and start fading it in; the rest of the passes
+// fill in while it's on the screen
+- (void) checkNextImage
+{
+  if (!render_)
+  {
+    if (viewstate_ == calcState)
+      [self newImage];
+    return;
+  }
+
+  if (!nextShown_)
+  {
+    if (is_fluere_render_done(render_) &&
+        get_fluere_render_passes(render_) == 0)
+    {
+      // it stopped before its first pass (say, out of memory); the
+      // next frame starts another
+      delete_fluere_render(render_);
+      render_ = NULL;
+    }
+    else if (viewstate_ == calcState &&
+             get_fluere_render_passes(render_) > 0)
+    {
+      unsigned char *data = imgData_;
+      fluere_drawing_ptr fractal = fractal_;
 
-  viewstate_ = fadeInState;
+      imgData_ = nextData_;
+      fractal_ = nextFractal_;
+      nextData_ = data;
+      nextFractal_ = fractal;
+
+      [self makeColorTable];
+      nextShown_ = YES;
+      viewstate_ = fadeInState;
+      fadeAmount_ = 0;
+    }
+  }
+  else if (is_fluere_render_done(render_))
+  {
+    delete_fluere_render(render_);
+    render_ = NULL;
+  }
 }
 
 - (void) makeColorTable
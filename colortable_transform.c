@@ -0,0 +1,95 @@
+/**
+ * \file colortable_transform.c
+ *
+ * \brief Changing the colors of a color table.
+ *
+ * The fade is kept in fixed point, out of 256, so that blending a byte
+ * is a multiply, an add and a shift, and the two ends of a fade give
+ * back exactly the colors and exactly the fade color.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <math.h>
+
+#include "colortable_transform.h"
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Makes t the identity.
+ */
+void init_colortable_transform(colortable_transform *t)
+{
+  int ii;
+
+  for (ii = 0; ii < 256; ++ii)
+    t->curve[ii] = ii;
+
+  t->fade = 256;
+  t->fade_color[0] = 0;
+  t->fade_color[1] = 0;
+  t->fade_color[2] = 0;
+}
+
+/**
+ * Makes the curve for the brightness and gamma.
+ */
+void set_colortable_tone(colortable_transform *t,
+                         double brightness,
+                         double gamma)
+{
+  int ii;
+
+  for (ii = 0; ii < 256; ++ii)
+  {
+    double v = 255 * brightness * pow(ii / 255.0, 1 / gamma) + 0.5;
+
+    t->curve[ii] = (v <= 0) ? 0 : (v >= 255) ? 255 : (unsigned char) v;
+  }
+}
+
+/**
+ * Sets the fade, rounded to 256ths.
+ */
+void set_colortable_fade(colortable_transform *t,
+                         double amount,
+                         const unsigned char *color)
+{
+  t->fade = (amount <= 0) ? 0 : (amount >= 1) ? 256
+          : (int) (256 * amount + 0.5);
+
+  t->fade_color[0] = color ? color[0] : 0;
+  t->fade_color[1] = color ? color[1] : 0;
+  t->fade_color[2] = color ? color[2] : 0;
+}
+
+/**
+ * Transforms the colors.
+ */
+void transform_colortable(const colortable_transform *t,
+                          const unsigned char *ctable,
+                          int num_colors,
+                          unsigned char *out)
+{
+  int f = t->fade;
+  int base[3];
+  int ii;
+
+  /* the fade color's share of each channel, and the rounding */
+  for (ii = 0; ii < 3; ++ii)
+    base[ii] = t->fade_color[ii] * (256 - f) + 128;
+
+  for (ii = 0; ii < num_colors; ++ii)
+  {
+    out[0] = (t->curve[ctable[0]] * f + base[0]) >> 8;
+    out[1] = (t->curve[ctable[1]] * f + base[1]) >> 8;
+    out[2] = (t->curve[ctable[2]] * f + base[2]) >> 8;
+    ctable += 3;
+    out += 3;
+  }
+}
+
+/*@}*/
@@ -0,0 +1,67 @@
+/**
+ * \file colortable_transform.h
+ *
+ * \brief Changing the colors of a color table: fading them to a color,
+ * and changing their brightness and gamma.
+ *
+ * Since a drawing is an indexed image, changing its 256 colors changes
+ * every pixel at once, so a fade costs nothing per pixel.  The
+ * brightness and gamma are made into a curve once, when they change;
+ * after that a table is transformed with a lookup and a blend for each
+ * byte, which is quick enough to do every frame.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef COLORTABLE_TRANSFORM_H
+#define COLORTABLE_TRANSFORM_H
+
+
+/** a change to the colors of a color table */
+struct colortable_transform_struct
+{
+  unsigned char curve[256];     /**< each red, green or blue value after
+                                     the brightness and gamma */
+  int fade;                     /**< how much of the colors is left,
+                                     out of 256 */
+  unsigned char fade_color[3];  /**< the color they fade to */
+};
+typedef struct colortable_transform_struct colortable_transform;
+
+
+/**
+ * Makes t leave the colors as they are.
+ */
+void init_colortable_transform(colortable_transform *t);
+
+/**
+ * Sets the brightness and gamma: each red, green and blue value v (out
+ * of 255) becomes 255 * brightness * (v / 255)^(1 / gamma).  So a
+ * brightness of 1 and a gamma of 1 change nothing, a higher gamma
+ * brightens the darker colors, and a brightness above 1 saturates the
+ * brighter ones.  gamma must be more than 0.
+ */
+void set_colortable_tone(colortable_transform *t,
+                         double brightness,
+                         double gamma);
+
+/**
+ * Sets the fade: amount 1 leaves the colors as they are, amount 0 turns
+ * them all into color (red, green and blue bytes; NULL for black), and
+ * amounts in between mix the two.
+ */
+void set_colortable_fade(colortable_transform *t,
+                         double amount,
+                         const unsigned char *color);
+
+/**
+ * Transforms num_colors colors of ctable into out (which may be
+ * ctable), with the brightness and gamma first and the fade after.
+ */
+void transform_colortable(const colortable_transform *t,
+                          const unsigned char *ctable,
+                          int num_colors,
+                          unsigned char *out);
+
+
+#endif
@@ -0,0 +1,262 @@
+/**
+ * \file flow_check.c
+ *
+ * \brief flow-check: checks the vector kernels of every style against
+ * get_flow_value and friends on every instruction set the processor
+ * has.
+ *
+ * The vector flow kernel takes one log per pixel instead of one per
+ * knot, and wave uses the vector log and sin, so their values before
+ * quantizing differ a little from the reference, and a pixel near the
+ * edge of a color band may land in the next one.  The spin kernel skips the twists of far knots, and leaf
+ * and rays estimate their terms in float lanes, falling back to the
+ * exact arithmetic near a band's edge; they must all come out the
+ * same as the reference.  Leaf and rays are also drawn with their
+ * knots moved to whole and half pixels, where the terms land on band
+ * edges most often, so the fallback is tried.  This draws drawings of
+ * each style with 1 to 50 knots at a few sizes and seeds and fails if
+ * any pixel's 0-255 value is further than the style's tolerance from
+ * the reference's (counting 255 and 0 as neighbors, since the colors
+ * wrap around).
+ *
+ * Run with "make check".  Exits with status 1 if a tolerance is
+ * broken.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fluere_private.h"
+#include "vector_math.h"
+
+
+/** the largest flow or wave difference allowed, unless --tolerance says
+ * otherwise */
+#define DEFAULT_TOLERANCE 1
+
+/** seeds drawn for each knot count and size */
+#define SEEDS 3
+
+/** a style to check, and the reference it's held to */
+struct style_check_struct
+{
+  int style;
+  const char *name;
+  unsigned char (*get_value)(fluere_drawing_ptr s, point where);
+  int exact;              /**< must it match exactly, whatever the
+                               --tolerance? */
+  int snap;               /**< also draw it with snapped knots? */
+};
+typedef struct style_check_struct style_check;
+
+/** the styles checked */
+static const style_check checks[] =
+{
+  {flow, "flow", get_flow_value, 0, 0},
+  {wave, "wave", get_wave_value, 0, 0},
+  {spin, "spin", get_spin_value, 1, 0},
+  {leaf, "leaf", get_leaf_value, 1, 1},
+  {rays, "rays", get_rays_value, 1, 1}
+};
+
+/** private declarations */
+
+static void usage(FILE *f);
+static int snap_knots(fluere_drawing *s);
+static int check_drawing(fluere_drawing *s, const style_check *c,
+                         int tolerance, int *worst,
+                         long *num_off, long *num_pixels);
+
+
+/**
+ * Checks the kernels of every style
+ */
+int main(int argc, char **argv)
+{
+  static const int knots[] = {1, 2, 3, 4, 5, 7, 10, 16, 25, 33, 50};
+  static const int sizes[][2] = {{640, 360}, {333, 97}, {1920, 64}};
+  int num_knots = sizeof(knots) / sizeof(knots[0]);
+  int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+  int num_checks = sizeof(checks) / sizeof(checks[0]);
+  vector_isa best = get_best_vector_isa();
+  int tolerance = DEFAULT_TOLERANCE;
+  int failures = 0;
+  int isa;
+  int cc;
+  int ii;
+
+  for (ii = 1; ii < argc; ++ii)
+  {
+    if (!strcmp(argv[ii], "--tolerance") && ii + 1 < argc)
+      tolerance = atoi(argv[++ii]);
+    else if (!strcmp(argv[ii], "--help"))
+    {
+      usage(stdout);
+      return 0;
+    }
+    else
+    {
+      usage(stderr);
+      return 1;
+    }
+  }
+
+  for (cc = 0; cc < num_checks; ++cc)
+  {
+    const style_check *c = &checks[cc];
+    int style_tolerance = c->exact ? 0 : tolerance;
+
+    for (isa = generic_isa; isa <= avx512_isa; ++isa)
+    {
+      int worst = 0;
+      int bad = 0;
+      long num_off = 0;
+      long num_pixels = 0;
+      int kk;
+      int zz;
+      unsigned long long seed;
+
+      if (isa > (int) best)
+      {
+        printf("%s %-8s skipped: not supported here\n", c->name,
+               get_vector_isa_name((vector_isa) isa));
+        continue;
+      }
+      set_vector_isa((vector_isa) isa);
+
+      for (kk = 0; kk < num_knots; ++kk)
+      {
+        for (zz = 0; zz < num_sizes; ++zz)
+        {
+          /* the seeds past SEEDS are drawn with snapped knots */
+          for (seed = 1; seed <= (c->snap ? 2 * SEEDS : SEEDS); ++seed)
+          {
+            fluere_drawing *s = init_fluere_drawing_seeded(
+                sizes[zz][0], sizes[zz][1], knots[kk], c->style, c->style,
+                seed * 1000003 + knots[kk]);
+
+            if (!s || (seed > SEEDS && !snap_knots(s)))
+            {
+              fprintf(stderr, "flow-check: out of memory\n");
+              return 1;
+            }
+            if (!check_drawing(s, c, style_tolerance, &worst, &num_off,
+                               &num_pixels))
+            {
+              if (!bad++)
+                printf("%s %-8s %d knots %dx%d seed %llu is off by more "
+                       "than %d\n", c->name,
+                       get_vector_isa_name((vector_isa) isa),
+                       knots[kk], sizes[zz][0], sizes[zz][1], seed,
+                       style_tolerance);
+            }
+            delete_fluere_drawing(s);
+          }
+        }
+      }
+
+      printf("%s %-8s %ld pixels  %ld off  worst %d  %s\n", c->name,
+             get_vector_isa_name((vector_isa) isa), num_pixels, num_off,
+             worst, bad ? "FAIL" : "ok");
+      if (bad)
+        failures++;
+    }
+  }
+
+  printf("%s\n", failures ? "FAILED" : "within tolerance");
+  return failures ? 1 : 0;
+}
+
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Prints the usage message
+ */
+static void usage(FILE *f)
+{
+  fprintf(f, "usage: flow-check [--tolerance N]\n\n"
+             "Checks the vector kernels of every style against the exact\n"
+             "ones on every instruction set; fails if a flow or wave pixel\n"
+             "is off by more than N (default %d) or another pixel is off\n"
+             "at all.\n",
+             DEFAULT_TOLERANCE);
+}
+
+/**
+ * Moves the knots of s to the nearest whole or half pixel, and packs
+ * them again.  Returns 0 if there isn't the memory.
+ */
+static int snap_knots(fluere_drawing *s)
+{
+  int ii;
+
+  for (ii = 0; ii < s->num_knots; ++ii)
+  {
+    s->knots[ii].x = floor(2 * s->knots[ii].x + 0.5) / 2;
+    s->knots[ii].y = floor(2 * s->knots[ii].y + 0.5) / 2;
+  }
+
+  delete_knot_packs(s);
+  return init_knot_packs(s);
+}
+
+/**
+ * Compares every pixel of the drawing, filled with the vector kernel
+ * for c's style from each end of each row, with c's reference.  Keeps
+ * count of the pixels that differ and the largest difference; returns
+ * 1 if none is over tolerance.
+ */
+static int check_drawing(fluere_drawing *s, const style_check *c,
+                         int tolerance, int *worst,
+                         long *num_off, long *num_pixels)
+{
+  unsigned char *row_data = malloc(s->width);
+  int ok = 1;
+  int row;
+  int x;
+
+  if (!row_data)
+  {
+    fprintf(stderr, "flow-check: out of memory\n");
+    exit(1);
+  }
+
+  for (row = 0; row < s->height; ++row)
+  {
+    /* the even and odd pixels, as the checkerboard does, and so spans
+     * of every length and start are tried */
+    fill_style_span(s, c->style, row, 0, 2, (s->width + 1) / 2, row_data);
+    fill_style_span(s, c->style, row, 1, 2, s->width / 2, row_data + 1);
+
+    for (x = 0; x < s->width; ++x)
+    {
+      point where;
+      int diff;
+
+      where.x = x;
+      where.y = row;
+      diff = abs(row_data[x] - c->get_value(s, where));
+      if (diff > 128)
+        diff = 256 - diff;
+
+      if (diff > 0)
+        (*num_off)++;
+      if (diff > *worst)
+        *worst = diff;
+      if (diff > tolerance)
+        ok = 0;
+    }
+    *num_pixels += s->width;
+  }
+
+  free(row_data);
+  return ok;
+}
+
+/*@}*/
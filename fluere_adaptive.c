@@ -0,0 +1,761 @@
+/**
+ * \file fluere_adaptive.c
+ *
+ * \brief Fills a drawing by interpolating between samples wherever the
+ * values are smooth enough, and computing every pixel elsewhere.
+ *
+ * The drawing is cut into ADAPTIVE_TILE x ADAPTIVE_TILE tiles, and each
+ * style's pixels in a tile are handled separately, since the styles are
+ * drawn in a checkerboard.  For flow, wave and spin, the unquantized
+ * value is sampled on a 3x3 grid over the tile; if the second
+ * differences of the samples say bilinear interpolation is good to
+ * within max_error, the tile is interpolated.  If not, each quarter of
+ * the tile gets the same test on a grid twice as fine, and the quarters
+ * that fail are computed pixel by pixel with the drawing's kernels.
+ *
+ * The value is turned into a pixel with (int) val % 256, so
+ * interpolation is done on the values, not the pixels.  Because of the
+ * truncation, a negative value gives one more than a positive value 256
+ * lower, so tiles whose samples aren't all the same sign, and further
+ * than max_error from 0, are never interpolated.  Neither are tiles
+ * near a knot, where the values aren't smooth.  Spin's value jumps by
+ * 256 at the edges of the spokes, where fmod wraps, and its twists
+ * wiggle too fast for the samples to follow, so spin tiles are also
+ * computed if an edge may cross them or if a bound on the twists says
+ * they can't be interpolated.  With max_error at most 0.5, every
+ * interpolated pixel is then within one of the computed one.
+ *
+ * Leaf and rays are made of flat bands, so interpolating is no use;
+ * instead, a tile that lies within one octant around every knot and
+ * whose corners are in the same band of every knot is filled with one
+ * value.  If it doesn't, the same test is made on its 4x4 cells, and
+ * the cells that fail are computed.  Near the knots the bands are too
+ * narrow for that to pay, and the tiles are computed.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "fluere_private.h"
+#include "thread_pool.h"
+
+/** size of the square tiles; they are split in 4 once (or in 16 cells,
+    for leaf and rays) */
+#define ADAPTIVE_TILE 16
+
+/** size of the cells leaf and rays tiles are split into */
+#define BAND_CELL 4
+
+/** number of cells across a tile */
+#define BAND_CELLS (ADAPTIVE_TILE / BAND_CELL)
+
+/** tiles where more band edges than this cross each cell are computed */
+#define BAND_EDGES 1.0
+
+
+/** what fill_adaptive_tile needs to know */
+struct adaptive_job_struct
+{
+  fluere_drawing *s;      /**< the drawing */
+  unsigned char *data;    /**< the image data, width x height */
+  int tiles_across;       /**< number of tiles in each row of tiles */
+  double max_error;       /**< largest error allowed in the values */
+  long evaluations;       /**< pixel values computed so far */
+};
+typedef struct adaptive_job_struct adaptive_job;
+
+/**
+ * one style's samples over a tile, on a 5x5 grid 4 pixels apart; a
+ * block of the tile uses every one or every other of them
+ */
+struct tile_samples_struct
+{
+  int style;              /**< the style */
+  int x0;                 /**< position of sample [0][0] */
+  int y0;
+  int done[5][5];         /**< has the sample been computed? */
+  double value[5][5];     /**< the unquantized value */
+};
+typedef struct tile_samples_struct tile_samples;
+
+/** private declarations */
+
+static void fill_adaptive_tile(void *arg, int tile);
+static long fill_smooth_block(adaptive_job *job, tile_samples *t, int parity,
+                              int gx, int gy, int size);
+static int get_smooth_samples(adaptive_job *job, tile_samples *t,
+                              int gx, int gy, int size, double v[3][3],
+                              int *negative, long *evaluations);
+static long fill_banded_tile(adaptive_job *job, int style, int parity,
+                             int x0, int y0);
+static long get_cell_values(const fluere_drawing *s, int style,
+                            int x0, int y0,
+                            int same[BAND_CELLS][BAND_CELLS],
+                            int val[BAND_CELLS][BAND_CELLS]);
+static void fill_band_cell(adaptive_job *job, int parity, int x0, int y0,
+                           int size, int val);
+static int get_band_value(const fluere_drawing *s, int style,
+                          int x0, int y0, int x1, int y1, int *val,
+                          long *terms);
+static int get_octant(const fluere_drawing *s, int kk, double x, double y);
+static double count_band_edges(const fluere_drawing *s, int style,
+                               int x0, int y0);
+static long fill_block_exactly(adaptive_job *job, int parity,
+                               int x0, int y0, int size);
+static int is_near_a_knot(const fluere_drawing *s, int x0, int y0, int size);
+static double get_twist_error(const fluere_drawing *s, int x0, int y0,
+                              int size);
+static int may_cross_spoke_edge(const fluere_drawing *s, int x0, int y0,
+                                int size);
+static double get_raw_value(const fluere_drawing *s, int style,
+                            double x, double y);
+static int get_band_term(const fluere_drawing *s, int style, int kk,
+                         double x, double y);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * same as fill_pixels_parallel, but interpolates where it can; see the
+ * top of this file.  Returns the number of pixel values computed.
+ */
+long fill_pixels_adaptive(fluere_drawing_ptr s,
+                          unsigned char* data,
+                          int nthreads,
+                          double max_error)
+{
+  adaptive_job job;
+  int tiles_down = (s->height + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE;
+
+  job.s = s;
+  job.data = data;
+  job.tiles_across = (s->width + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE;
+  job.max_error = max_error;
+  job.evaluations = 0;
+
+  run_tiles(get_shared_thread_pool(),
+            job.tiles_across * tiles_down,
+            nthreads,
+            fill_adaptive_tile,
+            &job);
+
+  return job.evaluations;
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Fills one tile, a style at a time
+ */
+static void fill_adaptive_tile(void *arg, int tile)
+{
+  adaptive_job *job = arg;
+  int x0 = (tile % job->tiles_across) * ADAPTIVE_TILE;
+  int y0 = (tile / job->tiles_across) * ADAPTIVE_TILE;
+  long evaluations = 0;
+  int parity;
+
+  /* style1 is on the pixels where x + y is even */
+  for (parity = 0; parity < 2; ++parity)
+  {
+    int style = parity ? job->s->style2 : job->s->style1;
+
+    if (style == leaf || style == rays)
+    {
+      evaluations += fill_banded_tile(job, style, parity, x0, y0);
+    }
+    else
+    {
+      tile_samples t;
+      int ii;
+      int jj;
+
+      /* the samples needn't be on the style's pixels, so both styles
+       * sample the tile's corners; that way no pixel is outside them */
+      t.style = style;
+      t.x0 = x0;
+      t.y0 = y0;
+      for (jj = 0; jj < 5; ++jj)
+        for (ii = 0; ii < 5; ++ii)
+          t.done[jj][ii] = 0;
+
+      evaluations += fill_smooth_block(job, &t, parity, 0, 0, ADAPTIVE_TILE);
+    }
+  }
+
+  __atomic_fetch_add(&job->evaluations, evaluations, __ATOMIC_RELAXED);
+}
+
+/**
+ * Fills the pixels of one parity in the block of size x size pixels
+ * starting at grid point (gx, gy) of t, by interpolating if the
+ * samples allow it, or else by splitting it in 4 or computing it.
+ * Returns the number of values computed.
+ */
+static long fill_smooth_block(adaptive_job *job, tile_samples *t, int parity,
+                              int gx, int gy, int size)
+{
+  fluere_drawing *s = job->s;
+  int spacing = size / 2;         /* pixels between samples */
+  int x0 = t->x0 + 4 * gx;
+  int y0 = t->y0 + 4 * gy;
+  double v[3][3];
+  long evaluations = 0;
+  int negative;
+  int ii;
+  int jj;
+  int x;
+  int y;
+
+  if (!get_smooth_samples(job, t, gx, gy, size, v, &negative, &evaluations))
+  {
+    if (size <= 8)
+      return evaluations + fill_block_exactly(job, parity, x0, y0, size);
+
+    for (jj = 0; jj < 2; ++jj)
+      for (ii = 0; ii < 2; ++ii)
+        evaluations += fill_smooth_block(job, t, parity,
+                                         gx + (size / 8) * ii,
+                                         gy + (size / 8) * jj,
+                                         size / 2);
+    return evaluations;
+  }
+
+  for (y = y0; y < y0 + size && y < s->height; ++y)
+  {
+    double fy = (double) (y - y0) / spacing;
+    int cy = (fy < 1) ? 0 : 1;
+    unsigned char *out = job->data + y * s->width;
+
+    fy -= cy;
+    for (x = x0 + ((x0 + y + parity) & 1); x < x0 + size && x < s->width;
+         x += 2)
+    {
+      double fx = (double) (x - x0) / spacing;
+      int cx = (fx < 1) ? 0 : 1;
+      double val;
+
+      fx -= cx;
+      val = (1 - fy) * ((1 - fx) * v[cy][cx] + fx * v[cy][cx + 1]) +
+            fy * ((1 - fx) * v[cy + 1][cx] + fx * v[cy + 1][cx + 1]);
+
+      /* as (int) val % 256 would for a value of the samples' sign */
+      out[x] = ((long) floor(val) + (negative && val != floor(val))) & 255;
+    }
+  }
+
+  return evaluations;
+}
+
+/**
+ * Gets the 3x3 samples of a block of t into v, computing the ones that
+ * aren't done yet and adding them to evaluations, and says if the block
+ * can be interpolated from them.  negative is set if the samples are
+ * negative.
+ */
+static int get_smooth_samples(adaptive_job *job, tile_samples *t,
+                              int gx, int gy, int size, double v[3][3],
+                              int *negative, long *evaluations)
+{
+  fluere_drawing *s = job->s;
+  int stride = size / 8;          /* grid points between samples */
+  int x0 = t->x0 + 4 * gx;
+  int y0 = t->y0 + 4 * gy;
+  double d2x = 0;
+  double d2y = 0;
+  int num_positive = 0;
+  int num_negative = 0;
+  int ii;
+  int jj;
+
+  if (is_near_a_knot(s, x0, y0, size))
+    return 0;
+  if (t->style == spin)
+  {
+    if (get_twist_error(s, x0, y0, size) > job->max_error / 2)
+      return 0;
+    ++*evaluations;
+    if (may_cross_spoke_edge(s, x0, y0, size))
+      return 0;
+  }
+
+  for (jj = 0; jj < 3; ++jj)
+  {
+    for (ii = 0; ii < 3; ++ii)
+    {
+      int sx = gx + ii * stride;
+      int sy = gy + jj * stride;
+
+      if (!t->done[sy][sx])
+      {
+        t->value[sy][sx] = get_raw_value(s, t->style, t->x0 + 4 * sx,
+                                         t->y0 + 4 * sy);
+        t->done[sy][sx] = 1;
+        ++*evaluations;
+      }
+      v[jj][ii] = t->value[sy][sx];
+
+      /* far enough from 0 that no pixel between them can have the
+       * other sign */
+      if (v[jj][ii] > job->max_error)
+        ++num_positive;
+      else if (v[jj][ii] < -job->max_error)
+        ++num_negative;
+    }
+  }
+
+  /* the same sign everywhere (this also rules out NaNs) */
+  if (num_positive != 9 && num_negative != 9)
+    return 0;
+  *negative = (num_negative == 9);
+
+  /* bilinear interpolation is off by about (d2x + d2y) / 8; allow
+   * twice that */
+  for (jj = 0; jj < 3; ++jj)
+  {
+    d2x = fmax(d2x, fabs(v[jj][0] - 2 * v[jj][1] + v[jj][2]));
+    d2y = fmax(d2y, fabs(v[0][jj] - 2 * v[1][jj] + v[2][jj]));
+  }
+
+  return (d2x + d2y) / 4 <= job->max_error;
+}
+
+/**
+ * Fills the leaf or rays pixels of one parity in a tile.  If the tile
+ * lies in one band of every knot, it is filled with one value;
+ * otherwise the same test is made on each BAND_CELL x BAND_CELL cell,
+ * the cells that pass are filled with their value and the rest are
+ * computed.  Returns the number of values computed, counting the
+ * corners as the knot terms computed over the number of knots, since
+ * the tests stop at the first knot that fails them.
+ */
+static long fill_banded_tile(adaptive_job *job, int style, int parity,
+                             int x0, int y0)
+{
+  fluere_drawing *s = job->s;
+  int x1 = ((x0 + ADAPTIVE_TILE < s->width) ? x0 + ADAPTIVE_TILE
+                                            : s->width) - 1;
+  int y1 = ((y0 + ADAPTIVE_TILE < s->height) ? y0 + ADAPTIVE_TILE
+                                             : s->height) - 1;
+  int same[BAND_CELLS][BAND_CELLS];
+  int val[BAND_CELLS][BAND_CELLS];
+  long evaluations = 0;
+  long terms = 0;
+  int ii;
+  int jj;
+
+  if (count_band_edges(s, style, x0, y0) > BAND_EDGES)
+    return fill_block_exactly(job, parity, x0, y0, ADAPTIVE_TILE);
+
+  if (get_band_value(s, style, x0, y0, x1, y1, &val[0][0], &terms))
+  {
+    fill_band_cell(job, parity, x0, y0, ADAPTIVE_TILE, val[0][0]);
+    return (terms + s->num_knots - 1) / s->num_knots;
+  }
+
+  terms += get_cell_values(s, style, x0, y0, same, val);
+  evaluations += (terms + s->num_knots - 1) / s->num_knots;
+
+  for (jj = 0; jj < BAND_CELLS; ++jj)
+  {
+    for (ii = 0; ii < BAND_CELLS; ++ii)
+    {
+      int cx = x0 + ii * BAND_CELL;
+      int cy = y0 + jj * BAND_CELL;
+
+      if (cx >= s->width || cy >= s->height)
+        continue;
+      if (same[jj][ii])
+        fill_band_cell(job, parity, cx, cy, BAND_CELL, val[jj][ii]);
+      else
+        evaluations += fill_block_exactly(job, parity, cx, cy, BAND_CELL);
+    }
+  }
+
+  return evaluations;
+}
+
+/**
+ * Works out which cells of a tile lie in one band of every knot, as
+ * get_band_value does for the tile, and the value of those that do.
+ * It goes a knot at a time, getting the knot's band at each corner of
+ * the cells, so each corner is only computed once, and it stops early
+ * if no cell is left.  Returns the number of knot terms computed.
+ */
+static long get_cell_values(const fluere_drawing *s, int style,
+                            int x0, int y0,
+                            int same[BAND_CELLS][BAND_CELLS],
+                            int val[BAND_CELLS][BAND_CELLS])
+{
+  int term[BAND_CELLS + 1][BAND_CELLS + 1];
+  int octant[BAND_CELLS + 1][BAND_CELLS + 1];
+  long terms = 0;
+  int kk;
+  int ii;
+  int jj;
+
+  for (jj = 0; jj < BAND_CELLS; ++jj)
+  {
+    for (ii = 0; ii < BAND_CELLS; ++ii)
+    {
+      same[jj][ii] = 1;
+      val[jj][ii] = 0;
+    }
+  }
+
+  for (kk = 0; kk < s->num_knots; ++kk)
+  {
+    int left = 0;
+
+    /* the corners of the cells are the first pixels of the next cells,
+     * so a cell that passes takes in its last row and column */
+    for (jj = 0; jj <= BAND_CELLS; ++jj)
+    {
+      for (ii = 0; ii <= BAND_CELLS; ++ii)
+      {
+        int x = x0 + ii * BAND_CELL;
+        int y = y0 + jj * BAND_CELL;
+
+        term[jj][ii] = get_band_term(s, style, kk, x, y);
+        octant[jj][ii] = get_octant(s, kk, x, y);
+      }
+    }
+
+    for (jj = 0; jj < BAND_CELLS; ++jj)
+    {
+      for (ii = 0; ii < BAND_CELLS; ++ii)
+      {
+        int t = term[jj][ii];
+        int o = octant[jj][ii];
+
+        if (!same[jj][ii])
+          continue;
+        if (o == 0 ||
+            octant[jj][ii + 1] != o || octant[jj + 1][ii] != o ||
+            octant[jj + 1][ii + 1] != o ||
+            term[jj][ii + 1] != t || term[jj + 1][ii] != t ||
+            term[jj + 1][ii + 1] != t)
+        {
+          same[jj][ii] = 0;
+          continue;
+        }
+        val[jj][ii] += t;
+        ++left;
+      }
+    }
+
+    terms += (BAND_CELLS + 1) * (BAND_CELLS + 1);
+    if (!left)
+      break;
+  }
+
+  return terms;
+}
+
+/**
+ * Fills the pixels of one parity in a block with val
+ */
+static void fill_band_cell(adaptive_job *job, int parity, int x0, int y0,
+                           int size, int val)
+{
+  fluere_drawing *s = job->s;
+  int x1 = (x0 + size < s->width) ? x0 + size : s->width;
+  int y1 = (y0 + size < s->height) ? y0 + size : s->height;
+  int x;
+  int y;
+
+  for (y = y0; y < y1; ++y)
+  {
+    unsigned char *out = job->data + y * s->width;
+
+    for (x = x0 + ((x0 + y + parity) & 1); x < x1; x += 2)
+      out[x] = val % 256;
+  }
+}
+
+/**
+ * Says if the leaf or rays value is the same all over the rectangle
+ * (x0, y0) - (x1, y1), and if so puts it in val.  That's so if, for
+ * every knot, the rectangle is strictly inside one octant around it
+ * (where the term only grows or shrinks with the angle) and the
+ * corners are in the same band.  The number of knot terms computed is
+ * added to terms.
+ */
+static int get_band_value(const fluere_drawing *s, int style,
+                          int x0, int y0, int x1, int y1, int *val,
+                          long *terms)
+{
+  int corner_x[4];
+  int corner_y[4];
+  int kk;
+  int cc;
+
+  corner_x[0] = x0;  corner_y[0] = y0;
+  corner_x[1] = x1;  corner_y[1] = y0;
+  corner_x[2] = x0;  corner_y[2] = y1;
+  corner_x[3] = x1;  corner_y[3] = y1;
+
+  *val = 0;
+  for (kk = 0; kk < s->num_knots; ++kk)
+  {
+    int term = get_band_term(s, style, kk, x0, y0);
+    int octant = get_octant(s, kk, x0, y0);
+
+    ++*terms;
+    if (octant == 0)
+      return 0;
+    for (cc = 1; cc < 4; ++cc)
+    {
+      ++*terms;
+      if (get_octant(s, kk, corner_x[cc], corner_y[cc]) != octant ||
+          get_band_term(s, style, kk, corner_x[cc], corner_y[cc]) != term)
+        return 0;
+    }
+
+    *val += term;
+  }
+
+  return 1;
+}
+
+/**
+ * Returns which of the 8 octants around knot kk (x, y) is strictly
+ * inside, from 1 to 8, or 0 if it is on the edge of one.  A rectangle
+ * whose corners are all in the same octant is inside it.
+ */
+static int get_octant(const fluere_drawing *s, int kk, double x, double y)
+{
+  double dx = x - s->knots[kk].x;
+  double dy = y - s->knots[kk].y;
+
+  if (dx == 0 || dy == 0 || fabs(dx) == fabs(dy))
+    return 0;
+  return 1 + (dx > 0) + 2 * (dy > 0) + 4 * (fabs(dx) > fabs(dy));
+}
+
+/**
+ * Returns about how many band edges cross a cell of a tile.  Each knot
+ * has 600 / discrete bands around it, so at a distance r they are
+ * about r * discrete / 95 pixels apart.
+ */
+static double count_band_edges(const fluere_drawing *s, int style,
+                               int x0, int y0)
+{
+  int discrete = (style == leaf) ? s->leafdiscrete : s->raysdiscrete;
+  double cx = x0 + ADAPTIVE_TILE / 2;
+  double cy = y0 + ADAPTIVE_TILE / 2;
+  double edges = 0;
+  int kk;
+
+  for (kk = 0; kk < s->num_knots; ++kk)
+  {
+    double dx = cx - s->knots[kk].x;
+    double dy = cy - s->knots[kk].y;
+
+    edges += 95.0 * BAND_CELL / (discrete * fmax(sqrt(dx*dx + dy*dy), 1));
+  }
+
+  return edges;
+}
+
+/**
+ * Computes the pixels of one parity in a block with the drawing's
+ * kernels.  Returns the number of pixels.
+ */
+static long fill_block_exactly(adaptive_job *job, int parity,
+                               int x0, int y0, int size)
+{
+  fluere_drawing *s = job->s;
+  int x1 = (x0 + size < s->width) ? x0 + size : s->width;
+  int y1 = (y0 + size < s->height) ? y0 + size : s->height;
+  long evaluations = 0;
+  int y;
+
+  for (y = y0; y < y1; ++y)
+  {
+    int x = x0 + ((x0 + y + parity) & 1);
+    int count = (x1 - x + 1) / 2;
+
+    if (count > 0)
+    {
+      fill_span(s, y, x, 2, count, job->data + y * s->width + x);
+      evaluations += count;
+    }
+  }
+
+  return evaluations;
+}
+
+/**
+ * Is any knot within size pixels of the block?  Close to a knot the
+ * values change too fast (or, for wave, wiggle too fast) to sample.
+ */
+static int is_near_a_knot(const fluere_drawing *s, int x0, int y0, int size)
+{
+  int kk;
+
+  for (kk = 0; kk < s->num_knots; ++kk)
+  {
+    if (s->knots[kk].x > x0 - size && s->knots[kk].x < x0 + 2 * size &&
+        s->knots[kk].y > y0 - size && s->knots[kk].y < y0 + 2 * size)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Returns a bound on the error of interpolating spin's twists over a
+ * block.  The twists wiggle every 20 or so pixels, so the samples can
+ * miss how much they bend; instead, each knot's twist
+ * c sin(r/f) exp(-r/d) is bent at most c exp(-r/d) (g^2 + g/r) along x
+ * or y, with g = 1/f + 1/d, and bilinear interpolation between samples
+ * h apart is off by at most h^2/8 times the bend along x plus along y.
+ */
+static double get_twist_error(const fluere_drawing *s, int x0, int y0,
+                              int size)
+{
+  double spacing = size / 2;
+  double bend = 0;
+  int kk;
+
+  for (kk = 0; kk < s->num_knots; ++kk)
+  {
+    const knot *k = &s->knots[kk];
+    double dx = fmax(fmax(x0 - k->x, k->x - (x0 + size)), 0);
+    double dy = fmax(fmax(y0 - k->y, k->y - (y0 + size)), 0);
+    double r = fmax(sqrt(dx*dx + dy*dy), 1);
+    double g = 1 / k->frequency + 1 / k->decay;
+
+    bend += 256 * k->sectors * k->amplitude * k->sectors *
+            exp(-r / k->decay) * (g*g + g/r);
+  }
+
+  return spacing * spacing / 8 * 2 * bend;
+}
+
+/**
+ * Might an edge of a spoke, where spin's fmod wraps and the value jumps
+ * by 256, cross the block?  The pixels past an edge can't be
+ * interpolated, and the samples can miss two edges close together, so
+ * this looks at each knot's angle at the middle of the block instead:
+ * over the block it can't change by more than the block's angular size
+ * plus twice the largest twist.  Costs about one pixel value.
+ */
+static int may_cross_spoke_edge(const fluere_drawing *s, int x0, int y0,
+                                int size)
+{
+  double cx = x0 + size / 2.0;
+  double cy = y0 + size / 2.0;
+  double half = size * M_SQRT1_2;    /* from the middle to a corner */
+  int kk;
+
+  for (kk = 0; kk < s->num_knots; ++kk)
+  {
+    const knot *k = &s->knots[kk];
+    double dx = cx - k->x;
+    double dy = cy - k->y;
+    double r = sqrt(dx*dx + dy*dy);
+    double period = 1.0 / k->sectors;
+    double angle;
+    double spread;
+    double a;
+
+    if (r <= half)
+      return 1;
+
+    angle = atan2(dy, dx);
+    spread = asin(half / r) +
+             2 * k->amplitude * k->sectors * exp(-(r - half) / k->decay);
+
+    /* atan2 jumps by 2 pi behind the knot */
+    if (M_PI - fabs(angle) <= spread)
+      return 1;
+
+    a = angle + k->amplitude * k->sectors *
+        sin(r / k->frequency) * exp(-r / k->decay);
+    a = fmod(a, period);
+    if (a < 0)
+      a += period;
+    if (fmin(a, period - a) <= spread)
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Returns the value of a flow, wave or spin pixel before it is turned
+ * into a pixel value; see get_flow_value and friends.
+ */
+static double get_raw_value(const fluere_drawing *s, int style,
+                            double x, double y)
+{
+  double val = 0.0;
+  int ii;
+
+  for (ii = 0; ii < s->num_knots; ++ii)
+  {
+    const knot *k = &s->knots[ii];
+    double dx = x - k->x;
+    double dy = y - k->y;
+    double r;
+    double a;
+
+    switch (style)
+    {
+      case flow:
+        val += k->flowsign * log(dx*dx + dy*dy);
+        break;
+
+      case wave:
+        val += k->wavesign * sin(1.5 * log(dx*dx + dy*dy));
+        break;
+
+      case spin:
+        r = sqrt(dx*dx + dy*dy);
+        a = (dx == 0 && dy == 0) ? 0.0 : atan2(dy, dx);
+        a += k->amplitude * k->sectors *
+             sin(r/k->frequency) * exp(-r/k->decay);
+        a = k->sectors * fmod(a, 1.0 / k->sectors);
+        val += k->spinsign * a;
+        break;
+    }
+  }
+
+  if (style == spin)
+    return 256 * val;
+  return val * (100/s->num_knots);
+}
+
+/**
+ * Returns knot kk's term of a leaf or rays pixel; see get_leaf_value.
+ */
+static int get_band_term(const fluere_drawing *s, int style, int kk,
+                         double x, double y)
+{
+  double dx = x - s->knots[kk].x;
+  double dy = y - s->knots[kk].y;
+  double big = fmax(fabs(dx), fabs(dy));
+  double small = fmin(fabs(dx), fabs(dy));
+  int sign = (style == leaf) ? s->knots[kk].leafsign : s->knots[kk].rayssign;
+  int discrete = (style == leaf) ? s->leafdiscrete : s->raysdiscrete;
+  double a;
+
+  if (big == 0)
+    a = 0.0;
+  else
+    a = sign * 75 * (small/big) * (small/big);
+
+  return ((int) a / discrete) * discrete;
+}
+
+/*@}*/
@@ -0,0 +1,512 @@
+/**
+ * \file fluere_anim.c
+ *
+ * \brief Writing and playing .fluere animation files.
+ *
+ * The file is
+ *
+ \verbatim
+   offset  size
+        0     4   "FLAN"
+        4     1   version
+        5     3   zero
+        8     4   width
+       12     4   height
+       16     4   frames per
+       20     4   this many seconds
+       24     4   number of color tables, t
+       28     4   number of segments, s
+       32     4   size of the compressed pixels, p
+       36  768t   the color tables
+  36+768t   24s   the segments
+               p   the pixels, as fluere_codec.h compresses them
+ \endverbatim
+ *
+ * and a segment is
+ *
+ \verbatim
+   offset  size
+        0     4   number of frames
+        4     4   color table
+        8     4   offset of the first frame
+       12     4   step (two's complement)
+       16     2   fade of the first frame, out of 256
+       18     2   fade of the last frame
+       20     3   fade color
+       23     1   zero
+ \endverbatim
+ *
+ * with the numbers little endian.  A frame's fade is found by going
+ * evenly, and rounding, from the segment's first fade to its last.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "fluere_anim.h"
+#include "fluere_codec.h"
+#include "fluere_private.h"
+#include "colortable_transform.h"
+
+/** the version of the format */
+#define ANIM_VERSION 1
+
+/** bytes in the header, and in a segment */
+#define ANIM_HEADER_SIZE 36
+#define ANIM_SEGMENT_SIZE 24
+
+/** bytes in a color table */
+#define ANIM_CTABLE_SIZE (256 * 3)
+
+/** the most color tables or segments a file can have */
+#define ANIM_MAX_ITEMS 65536
+
+
+/** an animation */
+struct fluere_anim_struct
+{
+  int width;                        /**< size of the frames */
+  int height;
+  int fps_num;                      /**< frames per */
+  int fps_den;                      /**< this many seconds */
+  int num_frames;                   /**< frames in all the segments */
+  unsigned char *ctables;           /**< the color tables */
+  int num_ctables;
+  fluere_anim_segment *segments;    /**< the timeline */
+  int *first_frames;                /**< where each segment starts */
+  int num_segments;
+  unsigned char *data;              /**< the drawing's pixels */
+};
+typedef struct fluere_anim_struct fluere_anim;
+
+/** private declarations */
+
+static int read_anim(fluere_anim *a,
+                     const unsigned char *header,
+                     const unsigned char *buf);
+static int read_anim_pixels(fluere_anim *a,
+                            const unsigned char *header,
+                            FILE *f,
+                            int nthreads);
+static int is_good_segment(const fluere_anim_segment *g, int num_ctables);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Works out FluereView's timeline.  In animateOneFrame the fade and the
+ * colors move before each frame is drawn, so the first frame of the
+ * fade in is already a step in, and the last frame of the fade out is
+ * black.
+ */
+int fluere_view_timeline(int ctable, fluere_anim_segment *segments)
+{
+  int fades = FLUERE_VIEW_FADE_FRAMES;
+  /* the frame that sees the colors turned past FLUERE_VIEW_RESET */
+  int last_full = FLUERE_VIEW_RESET / FLUERE_VIEW_STEP + 2;
+  int ii;
+
+  for (ii = 0; ii < FLUERE_VIEW_SEGMENTS; ++ii)
+  {
+    segments[ii].ctable = ctable;
+    segments[ii].step = FLUERE_VIEW_STEP;
+    memset(segments[ii].fade_color, 0, 3);
+  }
+
+  segments[0].num_frames = fades;
+  segments[0].offset = FLUERE_VIEW_STEP;
+  segments[0].fade_first = (256 + fades / 2) / fades;
+  segments[0].fade_last = 256;
+
+  segments[1].num_frames = last_full - fades;
+  segments[1].offset = FLUERE_VIEW_STEP * (fades + 1);
+  segments[1].fade_first = 256;
+  segments[1].fade_last = 256;
+
+  segments[2].num_frames = fades;
+  segments[2].offset = FLUERE_VIEW_STEP * (last_full + 1);
+  segments[2].fade_first = (256 * (fades - 1) + fades / 2) / fades;
+  segments[2].fade_last = 0;
+
+  return FLUERE_VIEW_SEGMENTS;
+}
+
+/**
+ * Turns by the step for each frame, and goes evenly from the first
+ * fade to the last.
+ */
+void get_fluere_segment_frame(const fluere_anim_segment *g,
+                              int frame,
+                              int *offset,
+                              int *fade)
+{
+  int n = g->num_frames - 1;
+
+  *offset = (int) ((g->offset + (long long) g->step * frame) % 256 + 256)
+            % 256;
+  if (n <= 0)
+    *fade = g->fade_first;
+  else
+  {
+    *fade = (int) (((long long) g->fade_first * (n - frame)
+                    + (long long) g->fade_last * frame + n / 2) / n);
+  }
+}
+
+/**
+ * Writes the animation.
+ */
+int save_fluere_anim(FILE *f,
+                     const unsigned char *data,
+                     int width,
+                     int height,
+                     const unsigned char *ctables,
+                     int num_ctables,
+                     const fluere_anim_segment *segments,
+                     int num_segments,
+                     int fps_num,
+                     int fps_den,
+                     int nthreads)
+{
+  unsigned char header[ANIM_HEADER_SIZE];
+  unsigned char segment[ANIM_SEGMENT_SIZE];
+  size_t bound = get_fluere_codec_bound(width, height);
+  unsigned char *packed;
+  size_t size;
+  long long frames = 0;
+  int ii;
+
+  if (num_ctables < 1 || num_ctables > ANIM_MAX_ITEMS ||
+      num_segments < 1 || num_segments > ANIM_MAX_ITEMS ||
+      fps_num < 1 || fps_den < 1)
+    return 0;
+
+  for (ii = 0; ii < num_segments; ++ii)
+  {
+    if (!is_good_segment(segments + ii, num_ctables))
+      return 0;
+    frames += segments[ii].num_frames;
+    if (frames > INT_MAX)
+      return 0;
+  }
+
+  packed = malloc(bound);
+  if (!packed)
+    return 0;
+
+  size = encode_fluere_pixels(data, width, height, nthreads, packed, bound);
+  if (size == 0)
+  {
+    free(packed);
+    return 0;
+  }
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, "FLAN", 4);
+  header[4] = ANIM_VERSION;
+  put_u32(header + 8, width);
+  put_u32(header + 12, height);
+  put_u32(header + 16, fps_num);
+  put_u32(header + 20, fps_den);
+  put_u32(header + 24, num_ctables);
+  put_u32(header + 28, num_segments);
+  put_u32(header + 32, size);
+  fwrite(header, 1, sizeof(header), f);
+
+  fwrite(ctables, 1, (size_t) ANIM_CTABLE_SIZE * num_ctables, f);
+
+  for (ii = 0; ii < num_segments; ++ii)
+  {
+    const fluere_anim_segment *g = segments + ii;
+
+    put_u32(segment, g->num_frames);
+    put_u32(segment + 4, g->ctable);
+    put_u32(segment + 8, g->offset & 255);
+    put_u32(segment + 12, (unsigned long) g->step & 0xffffffffUL);
+    segment[16] = g->fade_first & 0xff;
+    segment[17] = g->fade_first >> 8;
+    segment[18] = g->fade_last & 0xff;
+    segment[19] = g->fade_last >> 8;
+    memcpy(segment + 20, g->fade_color, 3);
+    segment[23] = 0;
+    fwrite(segment, 1, sizeof(segment), f);
+  }
+
+  fwrite(packed, 1, size, f);
+  free(packed);
+
+  return !ferror(f);
+}
+
+/**
+ * Reads an animation, checking everything in it.  The color tables and
+ * segments are read first, and the pixels only once the header's size
+ * for them has been checked against the size of the frames.
+ */
+fluere_anim_ptr load_fluere_anim(FILE *f, int nthreads)
+{
+  unsigned char header[ANIM_HEADER_SIZE];
+  unsigned char *buf;
+  fluere_anim *a;
+  unsigned long num_ctables;
+  unsigned long num_segments;
+  size_t size;
+  int ok;
+
+  if (fread(header, 1, ANIM_HEADER_SIZE, f) != ANIM_HEADER_SIZE ||
+      memcmp(header, "FLAN", 4) != 0 || header[4] != ANIM_VERSION)
+    return NULL;
+
+  num_ctables = get_u32(header + 24);
+  num_segments = get_u32(header + 28);
+  if (num_ctables < 1 || num_ctables > ANIM_MAX_ITEMS ||
+      num_segments < 1 || num_segments > ANIM_MAX_ITEMS)
+    return NULL;
+
+  a = calloc(1, sizeof(fluere_anim));
+  if (!a)
+    return NULL;
+
+  size = ANIM_CTABLE_SIZE * num_ctables + ANIM_SEGMENT_SIZE * num_segments;
+  buf = malloc(size);
+  ok = buf && fread(buf, 1, size, f) == size &&
+       read_anim(a, header, buf);
+
+  free(buf);
+  ok = ok && read_anim_pixels(a, header, f, nthreads);
+  if (!ok)
+  {
+    delete_fluere_anim(a);
+    return NULL;
+  }
+  return a;
+}
+
+/**
+ * Gets the size of the frames.
+ */
+void get_fluere_anim_size(fluere_anim_ptr a, int *width, int *height)
+{
+  *width = a->width;
+  *height = a->height;
+}
+
+/**
+ * Returns the number of frames.
+ */
+int get_fluere_anim_frames(fluere_anim_ptr a)
+{
+  return a->num_frames;
+}
+
+/**
+ * Gets the frame rate.
+ */
+void get_fluere_anim_fps(fluere_anim_ptr a, int *fps_num, int *fps_den)
+{
+  *fps_num = a->fps_num;
+  *fps_den = a->fps_den;
+}
+
+/**
+ * Returns the pixels.
+ */
+const unsigned char* get_fluere_anim_pixels(fluere_anim_ptr a)
+{
+  return a->data;
+}
+
+/**
+ * Finds the frame's segment, and turns and fades its color table.
+ */
+void get_fluere_anim_colors(fluere_anim_ptr a,
+                            int frame,
+                            unsigned char *colors)
+{
+  const fluere_anim_segment *g;
+  const unsigned char *ctable;
+  colortable_transform t;
+  int seg = a->num_segments - 1;
+  int offset;
+  int fade;
+  int ii;
+
+  frame %= a->num_frames;
+  if (frame < 0)
+    frame += a->num_frames;
+
+  while (a->first_frames[seg] > frame)
+    seg--;
+  g = a->segments + seg;
+  frame -= a->first_frames[seg];
+
+  ctable = a->ctables + ANIM_CTABLE_SIZE * g->ctable;
+  get_fluere_segment_frame(g, frame, &offset, &fade);
+  for (ii = 0; ii < 256; ++ii)
+    memcpy(colors + 3 * ii, ctable + 3 * ((ii + offset) & 255), 3);
+
+  init_colortable_transform(&t);
+  set_colortable_fade(&t, fade / 256.0, g->fade_color);
+  transform_colortable(&t, colors, 256, colors);
+}
+
+/**
+ * Makes a frame's colors into a table of pixels, and looks the pixels
+ * up in it.
+ */
+void render_fluere_anim_frame(fluere_anim_ptr a,
+                              int frame,
+                              fluere_pixel_format format,
+                              void *out,
+                              int stride,
+                              int nthreads)
+{
+  unsigned char colors[ANIM_CTABLE_SIZE];
+  fluere_pixel_table t;
+
+  get_fluere_anim_colors(a, frame, colors);
+  init_fluere_pixel_table(&t, colors, 0, format);
+  expand_fluere_pixels(a->data, a->width, a->height, &t, out, stride,
+                       nthreads);
+}
+
+/**
+ * Frees the animation.
+ */
+void delete_fluere_anim(fluere_anim_ptr a)
+{
+  if (!a)
+    return;
+
+  free(a->ctables);
+  free(a->segments);
+  free(a->first_frames);
+  free(a->data);
+  free(a);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Fills in a's timeline from the header and the color tables and
+ * segments after it, which load_fluere_anim has found the size of.
+ * Returns 0 if they aren't good.
+ */
+static int read_anim(fluere_anim *a,
+                     const unsigned char *header,
+                     const unsigned char *buf)
+{
+  const unsigned char *p;
+  long long frames = 0;
+  int ii;
+
+  if (get_u32(header + 16) < 1 || get_u32(header + 16) > INT_MAX ||
+      get_u32(header + 20) < 1 || get_u32(header + 20) > INT_MAX)
+    return 0;
+  a->fps_num = get_u32(header + 16);
+  a->fps_den = get_u32(header + 20);
+  a->num_ctables = get_u32(header + 24);
+  a->num_segments = get_u32(header + 28);
+
+  a->ctables = malloc(ANIM_CTABLE_SIZE * a->num_ctables);
+  a->segments = malloc(sizeof(fluere_anim_segment) * a->num_segments);
+  a->first_frames = malloc(sizeof(int) * a->num_segments);
+  if (!a->ctables || !a->segments || !a->first_frames)
+    return 0;
+
+  memcpy(a->ctables, buf, ANIM_CTABLE_SIZE * a->num_ctables);
+  p = buf + ANIM_CTABLE_SIZE * a->num_ctables;
+
+  for (ii = 0; ii < a->num_segments; ++ii)
+  {
+    fluere_anim_segment *g = a->segments + ii;
+    unsigned long num_frames = get_u32(p);
+    unsigned long step = get_u32(p + 12);
+
+    if (num_frames > INT_MAX || get_u32(p + 4) > INT_MAX)
+      return 0;
+
+    g->num_frames = (int) num_frames;
+    g->ctable = (int) get_u32(p + 4);
+    g->offset = get_u32(p + 8) & 255;
+    g->step = (step & 0x80000000UL) ? -(int) (0xffffffffUL - step) - 1
+                                    : (int) step;
+    g->fade_first = p[16] | p[17] << 8;
+    g->fade_last = p[18] | p[19] << 8;
+    memcpy(g->fade_color, p + 20, 3);
+    if (!is_good_segment(g, a->num_ctables))
+      return 0;
+
+    a->first_frames[ii] = (int) frames;
+    frames += g->num_frames;
+    if (frames > INT_MAX)
+      return 0;
+
+    p += ANIM_SEGMENT_SIZE;
+  }
+  a->num_frames = (int) frames;
+
+  return 1;
+}
+
+/**
+ * Reads a's pixels, whose compressed size is in the header, from the
+ * rest of f, once the size is found to be no more than the codec can
+ * take for the header's width and height.  Returns 0 if they aren't
+ * good.
+ */
+static int read_anim_pixels(fluere_anim *a,
+                            const unsigned char *header,
+                            FILE *f,
+                            int nthreads)
+{
+  unsigned long packed_size = get_u32(header + 32);
+  unsigned long w = get_u32(header + 8);
+  unsigned long h = get_u32(header + 12);
+  unsigned char *packed;
+  int width;
+  int height;
+  int ok;
+
+  if (w < 1 || w > INT_MAX || h < 1 || h > INT_MAX ||
+      packed_size > get_fluere_codec_bound((int) w, (int) h))
+    return 0;
+
+  packed = malloc(packed_size);
+  ok = packed && fread(packed, 1, packed_size, f) == packed_size &&
+       get_fluere_codec_size(packed, packed_size, &width, &height) &&
+       (unsigned long) width == w && (unsigned long) height == h;
+
+  if (ok)
+  {
+    a->width = width;
+    a->height = height;
+    a->data = malloc((size_t) width * height);
+    ok = a->data && decode_fluere_pixels(packed, packed_size, a->data,
+                                         nthreads);
+  }
+
+  free(packed);
+  return ok;
+}
+
+/**
+ * checks that a segment plays: it has frames, uses one of the
+ * num_ctables color tables, and fades by no more than 256
+ */
+static int is_good_segment(const fluere_anim_segment *g, int num_ctables)
+{
+  return g->num_frames >= 1 &&
+         g->ctable >= 0 && g->ctable < num_ctables &&
+         g->fade_first >= 0 && g->fade_first <= 256 &&
+         g->fade_last >= 0 && g->fade_last <= 256;
+}
+
+/*@}*/
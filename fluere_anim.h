@@ -0,0 +1,146 @@
+/**
+ * \file fluere_anim.h
+ *
+ * \brief The .fluere animation file: one drawing's pixels, a few color
+ * tables, and a timeline of how the colors turn and fade, which is all
+ * a fluere animation is.  A 4K loop that takes hundreds of megabytes as
+ * video takes a few hundred kilobytes this way, and any frame can be
+ * made straight from it with one lookup for each pixel.
+ *
+ * The timeline is a list of segments, each some frames of one color
+ * table, turning by the same step every frame, and fading evenly from
+ * one amount to another.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_ANIM_H
+#define FLUERE_ANIM_H
+
+#include <stdio.h>
+
+#include "fluere_expand.h"
+
+/** how the screen saver shows a drawing, at 30 frames a second: each
+    frame turns the colors by FLUERE_VIEW_STEP, the drawing fades in
+    and out over FLUERE_VIEW_FADE_FRAMES, and it starts to fade out
+    once the colors have turned by FLUERE_VIEW_RESET */
+#define FLUERE_VIEW_FPS 30
+#define FLUERE_VIEW_STEP 2
+#define FLUERE_VIEW_FADE_FRAMES 20
+#define FLUERE_VIEW_RESET (12 * FLUERE_VIEW_FPS * FLUERE_VIEW_STEP)
+
+/** the most segments fluere_view_timeline makes */
+#define FLUERE_VIEW_SEGMENTS 3
+
+
+/** frames of a timeline that change in the same way */
+struct fluere_anim_segment_struct
+{
+  int num_frames;                 /**< frames in the segment */
+  int ctable;                     /**< which color table */
+  int offset;                     /**< how far the colors are turned in
+                                       the first frame, as in
+                                       fluere_expand.h */
+  int step;                       /**< and how much more each frame */
+  int fade_first;                 /**< how much of the colors is left,
+                                       out of 256, in the first frame, */
+  int fade_last;                  /**< and in the last */
+  unsigned char fade_color[3];    /**< what the rest is */
+};
+typedef struct fluere_anim_segment_struct fluere_anim_segment;
+
+/** an animation read from a file */
+typedef struct fluere_anim_struct *fluere_anim_ptr;
+
+
+/**
+ * Fills in segments (which has room for FLUERE_VIEW_SEGMENTS) with the
+ * way the screen saver shows a drawing with color table ctable, from
+ * the first frame of its fade in to the last of its fade out.  Returns
+ * the number of segments.
+ */
+int fluere_view_timeline(int ctable, fluere_anim_segment *segments);
+
+/**
+ * Gets how far the colors are turned (0 to 255) in a frame of segment
+ * g, and how much of them is left, out of 256.
+ */
+void get_fluere_segment_frame(const fluere_anim_segment *g,
+                              int frame,
+                              int *offset,
+                              int *fade);
+
+/**
+ * Writes an animation: the width x height pixels of a drawing, which
+ * are compressed on nthreads threads, num_ctables color tables of 256
+ * colors one after another, and a timeline of num_segments segments,
+ * played at fps_num / fps_den frames a second.  Returns 1 if it was
+ * written, and 0 without writing anything if it isn't an animation
+ * load_fluere_anim would read.
+ */
+int save_fluere_anim(FILE *f,
+                     const unsigned char *data,
+                     int width,
+                     int height,
+                     const unsigned char *ctables,
+                     int num_ctables,
+                     const fluere_anim_segment *segments,
+                     int num_segments,
+                     int fps_num,
+                     int fps_den,
+                     int nthreads);
+
+/**
+ * Reads an animation from the rest of f, decompressing its pixels on
+ * nthreads threads.  Returns NULL if it isn't a good one.
+ */
+fluere_anim_ptr load_fluere_anim(FILE *f, int nthreads);
+
+/**
+ * Gets the size of the animation's frames.
+ */
+void get_fluere_anim_size(fluere_anim_ptr a, int *width, int *height);
+
+/**
+ * Returns the number of frames in the animation.
+ */
+int get_fluere_anim_frames(fluere_anim_ptr a);
+
+/**
+ * Gets the frame rate, as frames per *fps_den seconds.
+ */
+void get_fluere_anim_fps(fluere_anim_ptr a, int *fps_num, int *fps_den);
+
+/**
+ * Returns the pixels of the drawing.  They belong to the animation.
+ */
+const unsigned char* get_fluere_anim_pixels(fluere_anim_ptr a);
+
+/**
+ * Makes the 256 colors of a frame (which wraps around, so the
+ * animation loops) into colors: the pixels of the frame are the
+ * drawing's pixels looked up in them.
+ */
+void get_fluere_anim_colors(fluere_anim_ptr a,
+                            int frame,
+                            unsigned char *colors);
+
+/**
+ * Makes a frame as packed pixels, into rows of stride bytes at out,
+ * on nthreads threads (see expand_fluere_pixels).
+ */
+void render_fluere_anim_frame(fluere_anim_ptr a,
+                              int frame,
+                              fluere_pixel_format format,
+                              void *out,
+                              int stride,
+                              int nthreads);
+
+/**
+ * Frees an animation.
+ */
+void delete_fluere_anim(fluere_anim_ptr a);
+
+
+#endif
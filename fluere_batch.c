@@ -0,0 +1,900 @@
+/**
+ * \file fluere_batch.c
+ *
+ * \brief Making and writing many drawings at once, as a pipeline.
+ *
+ * A drawing travels through the pipeline in a slot, which holds its
+ * pixel buffer and everything else it needs.  There are a fixed number
+ * of slots, made up front: the spec stage takes a free one for each
+ * source, and the write stage hands it back once the file is written,
+ * so the spec stage waits (and so does everything before a full queue)
+ * whenever the pipeline is full.  Between each two stages is a queue
+ * of at most queue_length slots.
+ *
+ * Rendering and encoding each drawing is done on one thread, with
+ * several drawings being rendered or encoded at once; that needs no
+ * coordination between threads inside a drawing, and the threads of
+ * different stages overlap without waiting for each other.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "fluere_batch.h"
+#include "fluere_codec.h"
+#include "fluere_export.h"
+#include "fluere_gif.h"
+#include "fluere_anim.h"
+#include "fluere_random.h"
+#include "fluere_spec.h"
+#include "thread_pool.h"
+
+/** the stages, in order */
+enum
+{
+  spec_stage,
+  render_stage,
+  colorize_stage,
+  encode_stage,
+  write_stage,
+  num_stages
+};
+
+static const char *stage_names[num_stages] =
+  { "spec", "render", "colorize", "encode", "write" };
+
+static const char *output_extensions[8] =
+  { "png", "ppm", "pgm", "flpx", "gif", "y4m", "yuv", "fluere" };
+
+
+/** one drawing on its way through the pipeline */
+struct batch_slot_struct
+{
+  int index;                          /**< which source it's from */
+  unsigned long long seed;            /**< the seed, if it's from one */
+  int from_spec;                      /**< whether it's from a spec file */
+  fluere_drawing_ptr s;               /**< the drawing, until rendered */
+  fluere_choices choices;             /**< what its seed chose */
+  unsigned char *pixels;              /**< width x height */
+  unsigned char ctable[256 * 3 * 2];  /**< its colors */
+  unsigned char *packed;              /**< for flpx_output, kept */
+  size_t packed_size;                 /**< bytes used in packed */
+  char *stream;                       /**< the file from open_memstream */
+  size_t stream_size;                 /**< bytes in stream */
+  int failed;                         /**< set if something went wrong */
+};
+typedef struct batch_slot_struct batch_slot;
+
+/** a queue of slots between two stages */
+struct batch_queue_struct
+{
+  batch_slot **slots;       /**< capacity of them, in a ring */
+  int capacity;             /**< the most slots it holds */
+  int head;                 /**< the next slot to take */
+  int count;                /**< slots in it */
+  int producers;            /**< threads that may still add slots */
+  pthread_mutex_t lock;     /**< protects everything above */
+  pthread_cond_t not_empty; /**< signaled when a slot is added */
+  pthread_cond_t not_full;  /**< signaled when a slot is taken */
+};
+typedef struct batch_queue_struct batch_queue;
+
+/** how a stage did */
+struct batch_stage_struct
+{
+  int threads;      /**< threads working on it */
+  int items;        /**< drawings it handled */
+  double busy;      /**< seconds spent on them, by all its threads */
+};
+typedef struct batch_stage_struct batch_stage;
+
+/** what run_fluere_batch returns */
+struct fluere_batch_result_struct
+{
+  int num_drawings;             /**< drawings asked for */
+  int failures;                 /**< drawings that failed */
+  double seconds;               /**< how long it all took */
+  batch_stage stages[num_stages];
+  unsigned char *sheet;         /**< the contact sheet, or NULL */
+  int sheet_width;              /**< size of the contact sheet */
+  int sheet_height;
+  int thumb_width;              /**< size of each thumbnail */
+  int thumb_height;
+  int columns;                  /**< thumbnails across */
+};
+typedef struct fluere_batch_result_struct fluere_batch_result;
+
+/** a batch while it runs */
+struct batch_run_struct
+{
+  const fluere_batch_settings *b;
+  char **sources;
+  int num_sources;
+  batch_queue queues[num_stages];   /**< queues[i] feeds stage i; the
+                                         first holds the free slots */
+  fluere_batch_result *result;
+  pthread_mutex_t lock;             /**< protects result */
+};
+typedef struct batch_run_struct batch_run;
+
+/** one of a stage's threads */
+struct batch_worker_struct
+{
+  batch_run *run;
+  int stage;
+  pthread_t thread;
+};
+typedef struct batch_worker_struct batch_worker;
+
+/** private declarations */
+
+static void init_queue(batch_queue *q, int capacity, int producers);
+static void destroy_queue(batch_queue *q);
+static void push_slot(batch_queue *q, batch_slot *slot);
+static batch_slot* pop_slot(batch_queue *q);
+static void stop_producing(batch_queue *q);
+static void *stage_main(void *arg);
+static void make_spec(batch_run *run, batch_slot *slot);
+static void render(batch_run *run, batch_slot *slot);
+static void colorize(batch_run *run, batch_slot *slot);
+static void encode(batch_run *run, batch_slot *slot);
+static void write_file(batch_run *run, batch_slot *slot);
+static void make_thumbnail(batch_run *run, batch_slot *slot);
+static void fail(batch_run *run, batch_slot *slot, const char *why);
+static double get_time(void);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Fills in the default settings.
+ */
+void init_fluere_batch_settings(fluere_batch_settings *b)
+{
+  memset(b, 0, sizeof(*b));
+  b->width = 1920;
+  b->height = 1080;
+  b->num_knots = 4;
+  b->style1 = -1;
+  b->style2 = -1;
+  b->palette = -1;
+  b->kernels = vector_kernels;
+  b->output = png_output;
+  b->level = 6;
+  b->frames = 128;
+  b->frame_step = 2;
+  b->gif_delay = 3;
+  b->directory = ".";
+  b->queue_length = 4;
+  b->columns = 10;
+}
+
+/**
+ * Makes the choices a seed gives a drawing.
+ */
+void get_fluere_choices(const fluere_batch_settings *b,
+                        unsigned long long seed,
+                        int num_palettes,
+                        fluere_choices *c)
+{
+  fluere_random r;
+  int style1;
+  int style2;
+  int palette;
+
+  /* always the same draws, whatever is set, so each choice only
+   * depends on the seed */
+  init_fluere_random(&r, ~seed);
+  style1 = random_below(&r, 5);
+  style2 = random_below(&r, 5);
+  palette = (num_palettes > 0) ? random_below(&r, num_palettes) : 0;
+
+  c->style1 = (b->style1 >= 0) ? b->style1 : style1;
+  c->style2 = (b->style2 >= 0) ? b->style2 : style2;
+  c->palette = (b->palette >= 0) ? b->palette : palette;
+  c->ctable_seed = next_random(&r);
+}
+
+/**
+ * Runs the pipeline over all the sources.
+ */
+fluere_batch_result_ptr run_fluere_batch(const fluere_batch_settings *b,
+                                         char **sources,
+                                         int num_sources)
+{
+  batch_run run;
+  fluere_batch_result *result;
+  batch_worker *workers;
+  batch_slot *slots;
+  int threads[num_stages];
+  int num_workers = 0;
+  int num_slots;
+  double start;
+  int ii;
+  int jj;
+
+  if (b->width <= 0 || b->height <= 0 ||
+      b->output == y4m_output || b->output == yuv_output)
+    return NULL;
+
+  threads[spec_stage] = 1;
+  threads[render_stage] = (b->render_threads > 0)
+                          ? b->render_threads : get_number_of_processors();
+  threads[colorize_stage] = 1;
+  threads[encode_stage] = (b->encode_threads > 0)
+                          ? b->encode_threads : get_number_of_processors();
+  threads[write_stage] = 1;
+
+  result = calloc(1, sizeof(fluere_batch_result));
+  if (!result)
+    return NULL;
+  result->num_drawings = num_sources;
+
+  if (b->thumb_width > 0 && num_sources > 0)
+  {
+    result->thumb_width = b->thumb_width;
+    result->thumb_height = b->thumb_width * b->height / b->width;
+    if (result->thumb_height < 1)
+      result->thumb_height = 1;
+    result->columns = (b->columns > 0 && b->columns < num_sources)
+                      ? b->columns : num_sources;
+    result->sheet_width = result->columns * result->thumb_width;
+    result->sheet_height = result->thumb_height
+      * ((num_sources + result->columns - 1) / result->columns);
+    result->sheet = calloc((size_t) 3 * result->sheet_width,
+                           result->sheet_height);
+    if (!result->sheet)
+    {
+      free(result);
+      return NULL;
+    }
+  }
+
+  /* a slot for each thread, and enough to fill a queue */
+  num_slots = b->queue_length;
+  for (ii = 0; ii < num_stages; ++ii)
+  {
+    num_slots += threads[ii];
+    num_workers += threads[ii];
+  }
+
+  slots = calloc(num_slots, sizeof(batch_slot));
+  workers = malloc(sizeof(batch_worker) * num_workers);
+  if (!slots || !workers)
+  {
+    free(slots);
+    free(workers);
+    delete_fluere_batch_result(result);
+    return NULL;
+  }
+
+  for (ii = 0; ii < num_slots; ++ii)
+  {
+    slots[ii].pixels = malloc((size_t) b->width * b->height);
+    if (!slots[ii].pixels)
+    {
+      while (ii-- > 0)
+        free(slots[ii].pixels);
+      free(slots);
+      free(workers);
+      delete_fluere_batch_result(result);
+      return NULL;
+    }
+  }
+
+  run.b = b;
+  run.sources = sources;
+  run.num_sources = num_sources;
+  run.result = result;
+  pthread_mutex_init(&run.lock, NULL);
+
+  /* the free slots come back from the write stage */
+  init_queue(&run.queues[spec_stage], num_slots, threads[write_stage]);
+  for (ii = 0; ii < num_slots; ++ii)
+    push_slot(&run.queues[spec_stage], slots + ii);
+  for (ii = spec_stage + 1; ii < num_stages; ++ii)
+  {
+    init_queue(&run.queues[ii], (b->queue_length > 0) ? b->queue_length : 1,
+               threads[ii - 1]);
+  }
+
+  start = get_time();
+
+  for (ii = 0, num_workers = 0; ii < num_stages; ++ii)
+  {
+    result->stages[ii].threads = threads[ii];
+    for (jj = 0; jj < threads[ii]; ++jj, ++num_workers)
+    {
+      workers[num_workers].run = &run;
+      workers[num_workers].stage = ii;
+      pthread_create(&workers[num_workers].thread, NULL, stage_main,
+                     workers + num_workers);
+    }
+  }
+
+  for (ii = 0; ii < num_workers; ++ii)
+    pthread_join(workers[ii].thread, NULL);
+
+  result->seconds = get_time() - start;
+
+  for (ii = 0; ii < num_stages; ++ii)
+    destroy_queue(&run.queues[ii]);
+  pthread_mutex_destroy(&run.lock);
+
+  for (ii = 0; ii < num_slots; ++ii)
+  {
+    free(slots[ii].pixels);
+    free(slots[ii].packed);
+  }
+  free(slots);
+  free(workers);
+
+  return result;
+}
+
+/**
+ * Returns the number of drawings that failed.
+ */
+int get_fluere_batch_failures(fluere_batch_result_ptr r)
+{
+  return r->failures;
+}
+
+/**
+ * Prints how the batch went.
+ */
+void print_fluere_batch_report(fluere_batch_result_ptr r, FILE *f)
+{
+  int ii;
+
+  fprintf(f, "batch: %d drawings (%d failed) in %.2f s, %.1f a second\n",
+          r->num_drawings, r->failures, r->seconds,
+          (r->seconds > 0) ? r->num_drawings / r->seconds : 0.0);
+  fprintf(f, "  %-10s %8s %8s %10s %10s %10s\n", "stage", "threads",
+          "items", "busy s", "ms each", "a second");
+
+  for (ii = 0; ii < num_stages; ++ii)
+  {
+    batch_stage *stage = r->stages + ii;
+    double each = (stage->items > 0) ? stage->busy / stage->items : 0;
+
+    /* what the stage could keep up with if it never waited */
+    fprintf(f, "  %-10s %8d %8d %10.2f %10.2f %10.1f\n", stage_names[ii],
+            stage->threads, stage->items, stage->busy, 1000 * each,
+            (each > 0) ? stage->threads / each : 0.0);
+  }
+}
+
+/**
+ * Writes the contact sheet.
+ */
+int write_fluere_contact_sheet(fluere_batch_result_ptr r,
+                               FILE *f,
+                               int ppm,
+                               int level)
+{
+  if (!r->sheet)
+    return 0;
+
+  if (ppm)
+  {
+    fprintf(f, "P6\n%d %d\n255\n", r->sheet_width, r->sheet_height);
+    fwrite(r->sheet, 3 * r->sheet_width, r->sheet_height, f);
+    return !ferror(f);
+  }
+
+  return write_fluere_rgb_png(f, r->sheet, r->sheet_width, r->sheet_height,
+                              level, 0);
+}
+
+/**
+ * Frees the result.
+ */
+void delete_fluere_batch_result(fluere_batch_result_ptr r)
+{
+  free(r->sheet);
+  free(r);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Makes an empty queue that holds capacity slots, which producers
+ * threads will add to.
+ */
+static void init_queue(batch_queue *q, int capacity, int producers)
+{
+  q->slots = malloc(sizeof(batch_slot *) * capacity);
+  q->capacity = capacity;
+  q->head = 0;
+  q->count = 0;
+  q->producers = producers;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+}
+
+/**
+ * Frees what a queue holds.
+ */
+static void destroy_queue(batch_queue *q)
+{
+  pthread_cond_destroy(&q->not_full);
+  pthread_cond_destroy(&q->not_empty);
+  pthread_mutex_destroy(&q->lock);
+  free(q->slots);
+}
+
+/**
+ * Adds a slot to the back of the queue, waiting for room if it's full.
+ */
+static void push_slot(batch_queue *q, batch_slot *slot)
+{
+  pthread_mutex_lock(&q->lock);
+  while (q->count == q->capacity)
+    pthread_cond_wait(&q->not_full, &q->lock);
+  q->slots[(q->head + q->count) % q->capacity] = slot;
+  q->count++;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * Takes the slot at the front of the queue, waiting for one if it's
+ * empty.  Returns NULL once it's empty and nothing more will be added.
+ */
+static batch_slot* pop_slot(batch_queue *q)
+{
+  batch_slot *slot = NULL;
+
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0 && q->producers > 0)
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  if (q->count > 0)
+  {
+    slot = q->slots[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return slot;
+}
+
+/**
+ * Tells the queue one of the threads adding to it is done.
+ */
+static void stop_producing(batch_queue *q)
+{
+  pthread_mutex_lock(&q->lock);
+  if (--q->producers == 0)
+    pthread_cond_broadcast(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * The main loop of a stage's threads: take a drawing from the stage's
+ * queue, work on it, and pass it to the next stage.  The spec stage
+ * takes a free slot for each source instead, and the write stage hands
+ * the slots back.
+ */
+static void *stage_main(void *arg)
+{
+  batch_worker *w = arg;
+  batch_run *run = w->run;
+  batch_queue *in = run->queues + w->stage;
+  batch_queue *out = run->queues + (w->stage + 1) % num_stages;
+  int next = 0;
+  int items = 0;
+  double busy = 0;
+
+  for (;;)
+  {
+    batch_slot *slot;
+    double t0;
+
+    if (w->stage == spec_stage && next == run->num_sources)
+      break;
+
+    slot = pop_slot(in);
+    if (!slot)
+      break;
+
+    t0 = get_time();
+
+    switch (w->stage)
+    {
+      case spec_stage:
+        slot->index = next++;
+        make_spec(run, slot);
+        break;
+      case render_stage:
+        render(run, slot);
+        break;
+      case colorize_stage:
+        colorize(run, slot);
+        break;
+      case encode_stage:
+        encode(run, slot);
+        break;
+      default:
+        write_file(run, slot);
+        break;
+    }
+
+    busy += get_time() - t0;
+    items++;
+
+    push_slot(out, slot);
+  }
+
+  /* nobody waits for the free slots to run out */
+  if (w->stage != write_stage)
+    stop_producing(out);
+
+  pthread_mutex_lock(&run->lock);
+  run->result->stages[w->stage].items += items;
+  run->result->stages[w->stage].busy += busy;
+  pthread_mutex_unlock(&run->lock);
+
+  return NULL;
+}
+
+/**
+ * Makes the drawing for a slot's source.
+ */
+static void make_spec(batch_run *run, batch_slot *slot)
+{
+  const fluere_batch_settings *b = run->b;
+  const char *source = run->sources[slot->index];
+  int num_palettes = b->palettes ? get_number_of_palettes(b->palettes) : 0;
+  char *end;
+
+  slot->failed = 0;
+  slot->s = NULL;
+  slot->seed = strtoull(source, &end, 0);
+  slot->from_spec = (*source == '\0' || *end != '\0');
+
+  if (slot->from_spec)
+  {
+    FILE *f = fopen(source, "rb");
+
+    if (!f)
+    {
+      fail(run, slot, "can't read it");
+      return;
+    }
+
+    slot->s = load_fluere_spec_text(f, b->width, b->height);
+    if (!slot->s)
+    {
+      rewind(f);
+      slot->s = load_fluere_spec(f, b->width, b->height);
+    }
+    fclose(f);
+
+    if (!slot->s)
+    {
+      fail(run, slot, "isn't a good spec");
+      return;
+    }
+
+    /* the colors come from the seed the spec was made from */
+    get_fluere_choices(b, get_fluere_drawing_seed(slot->s), num_palettes,
+                       &slot->choices);
+  }
+  else
+  {
+    get_fluere_choices(b, slot->seed, num_palettes, &slot->choices);
+    slot->s = init_fluere_drawing_seeded(b->width, b->height, b->num_knots,
+                                         (fluere_style) slot->choices.style1,
+                                         (fluere_style) slot->choices.style2,
+                                         slot->seed);
+    if (!slot->s)
+    {
+      fail(run, slot, "couldn't be made");
+      return;
+    }
+  }
+
+  if (slot->choices.palette >= num_palettes && b->palettes)
+    fail(run, slot, "has no such palette");
+  else
+    set_fluere_kernels(slot->s, b->kernels);
+}
+
+/**
+ * Fills a slot's pixels, from the cache if they're there, then frees
+ * its drawing.
+ */
+static void render(batch_run *run, batch_slot *slot)
+{
+  fluere_cache_ptr cache = run->b->cache;
+
+  if (slot->s)
+  {
+    fluere_image_ptr img = NULL;
+
+    if (!slot->failed && cache)
+      img = find_fluere_image(cache, slot->s);
+    if (img)
+    {
+      memcpy(slot->pixels, get_fluere_image_data(img),
+             (size_t) run->b->width * run->b->height);
+      release_fluere_image(img);
+    }
+    else if (!slot->failed)
+    {
+      fill_pixels(slot->s, slot->pixels);
+      if (cache)
+        store_fluere_image(cache, slot->s, slot->pixels);
+    }
+    delete_fluere_drawing(slot->s);
+    slot->s = NULL;
+  }
+}
+
+/**
+ * Makes a slot's color table and its thumbnail on the contact sheet.
+ */
+static void colorize(batch_run *run, batch_slot *slot)
+{
+  const fluere_batch_settings *b = run->b;
+
+  if (slot->failed)
+    return;
+
+  if (b->palettes)
+  {
+    get_colortable_seeded(get_palette(b->palettes, slot->choices.palette),
+                          slot->ctable, b->randomize, b->stripes,
+                          slot->choices.ctable_seed);
+  }
+
+  if (run->result->sheet)
+    make_thumbnail(run, slot);
+}
+
+/**
+ * Encodes a slot's pixels as a file, in memory.
+ */
+static void encode(batch_run *run, batch_slot *slot)
+{
+  const fluere_batch_settings *b = run->b;
+  const unsigned char *ctable = b->palettes ? slot->ctable : NULL;
+  FILE *f;
+  int ok;
+
+  slot->stream = NULL;
+  slot->stream_size = 0;
+  slot->packed_size = 0;
+
+  if (slot->failed)
+    return;
+
+  if (b->output == flpx_output)
+  {
+    size_t bound = get_fluere_codec_bound(b->width, b->height);
+
+    if (!slot->packed)
+      slot->packed = malloc(bound);
+    if (slot->packed)
+    {
+      slot->packed_size = encode_fluere_pixels(slot->pixels, b->width,
+                                               b->height, 1, slot->packed,
+                                               bound);
+    }
+    if (slot->packed_size == 0)
+      fail(run, slot, "couldn't be encoded");
+    return;
+  }
+
+  f = open_memstream(&slot->stream, &slot->stream_size);
+  if (!f)
+  {
+    fail(run, slot, "couldn't be encoded");
+    return;
+  }
+
+  if (b->output == png_output)
+  {
+    ok = write_fluere_png(f, slot->pixels, b->width, b->height, ctable,
+                          b->rgb, b->level, 1);
+  }
+  else if (b->output == anim_output)
+  {
+    fluere_anim_segment segments[FLUERE_VIEW_SEGMENTS];
+    int n = fluere_view_timeline(0, segments);
+
+    ok = save_fluere_anim(f, slot->pixels, b->width, b->height, ctable, 1,
+                          segments, n, FLUERE_VIEW_FPS, 1, 1);
+  }
+  else if (b->output == gif_output)
+  {
+    ok = write_fluere_gif(f, slot->pixels, b->width, b->height, ctable,
+                          b->frames, b->frame_step, b->gif_delay);
+  }
+  else
+  {
+    ok = write_fluere_pnm(f, slot->pixels, b->width, b->height,
+                          (b->output == ppm_output) ? ctable : NULL);
+  }
+
+  if (fclose(f) != 0 || !ok)
+    fail(run, slot, "couldn't be encoded");
+}
+
+/**
+ * Writes a slot's file, named after its source.
+ */
+static void write_file(batch_run *run, batch_slot *slot)
+{
+  const fluere_batch_settings *b = run->b;
+  const char *bytes = slot->stream ? slot->stream
+                                   : (const char *) slot->packed;
+  size_t size = slot->stream ? slot->stream_size : slot->packed_size;
+  size_t length = strlen(b->directory) + 40;
+  char *path;
+  FILE *f;
+
+  if (slot->failed)
+    return;
+
+  if (slot->from_spec)
+  {
+    const char *source = run->sources[slot->index];
+    const char *name = strrchr(source, '/');
+    const char *dot;
+    int n;
+
+    name = name ? name + 1 : source;
+    dot = strrchr(name, '.');
+    n = (dot && dot != name) ? (int) (dot - name) : (int) strlen(name);
+
+    path = malloc(length + n);
+    if (path)
+    {
+      sprintf(path, "%s/%.*s.%s", b->directory, n, name,
+              output_extensions[b->output]);
+    }
+  }
+  else
+  {
+    path = malloc(length);
+    if (path)
+    {
+      sprintf(path, "%s/%016llx.%s", b->directory, slot->seed,
+              output_extensions[b->output]);
+    }
+  }
+
+  f = path ? fopen(path, "wb") : NULL;
+  if (!f || fwrite(bytes, 1, size, f) != size)
+    fail(run, slot, "couldn't be written");
+  if (f && fclose(f) != 0 && !slot->failed)
+    fail(run, slot, "couldn't be written");
+
+  free(path);
+  free(slot->stream);
+  slot->stream = NULL;
+}
+
+/**
+ * Shrinks a slot's drawing onto its place on the contact sheet, each
+ * thumbnail pixel the average color of the pixels it covers.
+ */
+static void make_thumbnail(batch_run *run, batch_slot *slot)
+{
+  fluere_batch_result *r = run->result;
+  int width = run->b->width;
+  int height = run->b->height;
+  int tw = r->thumb_width;
+  int th = r->thumb_height;
+  int column = slot->index % r->columns;
+  int row = slot->index / r->columns;
+  unsigned char *out = r->sheet
+    + 3 * ((size_t) row * th * r->sheet_width + (size_t) column * tw);
+  const unsigned char *ctable = run->b->palettes ? slot->ctable : NULL;
+  unsigned long *sums = calloc(3 * tw, sizeof(unsigned long));
+  int ty;
+  int tx;
+  int x;
+  int y;
+
+  if (!sums)
+    return;
+
+  for (ty = 0; ty < th; ++ty)
+  {
+    int y0 = (int) ((long long) ty * height / th);
+    int y1 = (int) ((long long) (ty + 1) * height / th);
+
+    if (y1 <= y0)
+      y1 = y0 + 1;
+
+    memset(sums, 0, sizeof(unsigned long) * 3 * tw);
+    for (y = y0; y < y1; ++y)
+    {
+      const unsigned char *p = slot->pixels + (size_t) y * width;
+
+      for (tx = 0; tx < tw; ++tx)
+      {
+        int x0 = (int) ((long long) tx * width / tw);
+        int x1 = (int) ((long long) (tx + 1) * width / tw);
+        unsigned long *sum = sums + 3 * tx;
+
+        if (x1 <= x0)
+          x1 = x0 + 1;
+        for (x = x0; x < x1; ++x)
+        {
+          if (ctable)
+          {
+            const unsigned char *color = ctable + 3 * p[x];
+
+            sum[0] += color[0];
+            sum[1] += color[1];
+            sum[2] += color[2];
+          }
+          else
+          {
+            sum[0] += p[x];
+            sum[1] += p[x];
+            sum[2] += p[x];
+          }
+        }
+      }
+    }
+
+    for (tx = 0; tx < tw; ++tx)
+    {
+      int x0 = (int) ((long long) tx * width / tw);
+      int x1 = (int) ((long long) (tx + 1) * width / tw);
+      unsigned char *pixel = out + 3 * ((size_t) ty * r->sheet_width + tx);
+      unsigned long n;
+
+      if (x1 <= x0)
+        x1 = x0 + 1;
+      n = (unsigned long) (x1 - x0) * (y1 - y0);
+      pixel[0] = (sums[3 * tx] + n / 2) / n;
+      pixel[1] = (sums[3 * tx + 1] + n / 2) / n;
+      pixel[2] = (sums[3 * tx + 2] + n / 2) / n;
+    }
+  }
+
+  free(sums);
+}
+
+/**
+ * Marks a slot as failed, and says why on stderr.
+ */
+static void fail(batch_run *run, batch_slot *slot, const char *why)
+{
+  slot->failed = 1;
+
+  pthread_mutex_lock(&run->lock);
+  run->result->failures++;
+  fprintf(stderr, "fluere batch: %s %s\n", run->sources[slot->index], why);
+  pthread_mutex_unlock(&run->lock);
+}
+
+/**
+ * Returns the time in seconds on a clock that only goes forward.
+ */
+static double get_time(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/*@}*/
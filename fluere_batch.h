@@ -0,0 +1,154 @@
+/**
+ * \file fluere_batch.h
+ *
+ * \brief Making and writing many drawings at once, as a pipeline.
+ *
+ * Each drawing goes through five stages: its spec is made (from a seed
+ * or a spec file), it is rendered, colorized, encoded and written to a
+ * file.  Each stage has threads of its own, and the stages pass the
+ * drawings along through short queues, so while one drawing is being
+ * encoded the next ones are already being rendered and no core sits
+ * idle waiting for a slow stage.  Only a few drawings are in the
+ * pipeline at once; their buffers are used again for the drawings that
+ * come after them.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_BATCH_H
+#define FLUERE_BATCH_H
+
+#include <stdio.h>
+
+#include "fluere_drawing.h"
+#include "fluere_cache.h"
+#include "palettes.h"
+
+
+/** the kinds of file a drawing can be written as */
+typedef enum
+{
+  png_output,     /**< PNG, indexed or 24-bit (see fluere_export.h) */
+  ppm_output,     /**< binary PPM */
+  pgm_output,     /**< binary PGM of the indices, with no colors */
+  flpx_output,    /**< the indices, compressed (see fluere_codec.h) */
+  gif_output,     /**< animated GIF, its colors cycling (see
+                       fluere_gif.h) */
+  y4m_output,     /**< Y4M video of the colors cycling, and */
+  yuv_output,     /**< the same as raw YUV (see fluere_video.h); these
+                       are too big to make in a batch */
+  anim_output     /**< a .fluere animation of the colors cycling as the
+                       screen saver shows them (see fluere_anim.h) */
+} fluere_output;
+
+/** how to make and write the drawings of a batch */
+struct fluere_batch_settings_struct
+{
+  int width;                  /**< size of every drawing; specs are */
+  int height;                 /**< scaled to it */
+  int num_knots;              /**< knots in drawings made from seeds */
+  int style1;                 /**< the styles of drawings made from seeds, */
+  int style2;                 /**< or -1 to choose them from the seed */
+  palette_list_ptr palettes;  /**< the palettes, or NULL for pgm_output
+                                   and flpx_output */
+  int palette;                /**< which palette, or -1 to choose it from
+                                   the seed */
+  int randomize;              /**< get_colortable's flags */
+  int stripes;
+  fluere_kernels kernels;     /**< how to compute the pixels */
+  fluere_output output;       /**< what to write */
+  int rgb;                    /**< for png_output, 24-bit color */
+  int level;                  /**< zlib level for png_output */
+  int frames;                 /**< frames of an animation, */
+  int frame_step;             /**< how far the colors move each frame, */
+  int gif_delay;              /**< and how long it's shown in a GIF, in
+                                   1/100 s */
+  const char *directory;      /**< where to write the files */
+  int render_threads;         /**< threads rendering drawings, and */
+  int encode_threads;         /**< encoding them; 0 for one per processor */
+  int queue_length;           /**< drawings each queue holds */
+  int thumb_width;            /**< width of the contact sheet's thumbnails,
+                                   or 0 for no contact sheet */
+  int columns;                /**< thumbnails across the contact sheet */
+  fluere_cache_ptr cache;     /**< where drawings rendered before are
+                                   found and new ones kept, or NULL */
+};
+typedef struct fluere_batch_settings_struct fluere_batch_settings;
+
+/** what is chosen at random for a drawing made from a seed */
+struct fluere_choices_struct
+{
+  int style1;                       /**< the styles */
+  int style2;
+  int palette;                      /**< which palette */
+  unsigned long long ctable_seed;   /**< for get_colortable_seeded */
+};
+typedef struct fluere_choices_struct fluere_choices;
+
+/** what a finished batch tells about itself */
+typedef struct fluere_batch_result_struct *fluere_batch_result_ptr;
+
+
+/**
+ * Fills in the defaults: 1920 x 1080, 4 knots, styles and palette
+ * chosen from each seed, vector kernels, indexed PNGs at zlib level 6,
+ * GIFs of one cycle of colors (128 frames, 2 apart, 3/100 s each),
+ * the current directory, a thread per processor for each of rendering
+ * and encoding, no contact sheet and no cache.  palettes is left NULL.
+ */
+void init_fluere_batch_settings(fluere_batch_settings *b);
+
+/**
+ * Makes the choices that a drawing made from seed gets from it, taking
+ * the styles and palette from b where they are set.  num_palettes is
+ * the number of palettes to choose from.
+ */
+void get_fluere_choices(const fluere_batch_settings *b,
+                        unsigned long long seed,
+                        int num_palettes,
+                        fluere_choices *c);
+
+/**
+ * Makes and writes a drawing for each of the num_sources sources, which
+ * are either seeds (numbers, in decimal or 0x hex) or the names of spec
+ * files (text or binary).  A drawing from seed N is written as
+ * N in 16 hex digits, and one from a spec as the spec's name without
+ * its directory or extension, with the extension of the output.  A
+ * drawing that fails (say, from a bad spec) is reported on stderr and
+ * the rest carry on.  With b->cache, drawings found in it aren't
+ * rendered again, and the others are put in it.  Returns NULL if the
+ * batch couldn't start at all, or the output is video.
+ */
+fluere_batch_result_ptr run_fluere_batch(const fluere_batch_settings *b,
+                                         char **sources,
+                                         int num_sources);
+
+/**
+ * Returns the number of drawings that failed.
+ */
+int get_fluere_batch_failures(fluere_batch_result_ptr r);
+
+/**
+ * Prints how long the batch took and how many drawings each stage can
+ * get through in a second, busy as it was, so the slowest stage shows.
+ */
+void print_fluere_batch_report(fluere_batch_result_ptr r, FILE *f);
+
+/**
+ * Writes the contact sheet: every drawing's thumbnail, in the order of
+ * the sources, columns across, as a 24-bit PNG (or a PPM if ppm is
+ * set).  Drawings that failed are left black.  Returns 0 if it
+ * couldn't be written, or there is no contact sheet.
+ */
+int write_fluere_contact_sheet(fluere_batch_result_ptr r,
+                               FILE *f,
+                               int ppm,
+                               int level);
+
+/**
+ * Frees the result.
+ */
+void delete_fluere_batch_result(fluere_batch_result_ptr r);
+
+
+#endif
@@ -0,0 +1,613 @@
+/**
+ * \file fluere_bench.c
+ *
+ * \brief fluere-bench: times the style kernels over style pairs, knot
+ * counts, sizes and ways of computing the pixels.
+ *
+ * Each case is a drawing made from a fixed seed.  Filling a whole 8K
+ * drawing with 500 knots takes minutes, so each repetition fills
+ * evenly spaced rows of the drawing with fill_pixels_region, as many
+ * as it takes to fill --min-time (all of them for small cases); the
+ * rows are spread over the whole drawing so that every part of it is
+ * counted.  The median of the repetitions is reported, along with the
+ * fastest, the mean and the standard deviation, as CSV and/or JSON so
+ * runs of different builds and kernels can be compared.  Tables for
+ * table_kernels are made before the clock starts.
+ *
+ * More than 100 knots is past what the screen saver allows (50), and
+ * flow and wave come out flat there, but the kernels do the same work
+ * per knot, so those cases still show how the time grows.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "fluere_drawing.h"
+#include "thread_pool.h"
+#include "vector_math.h"
+
+/** the most of each thing that can be swept */
+#define MAX_SWEEP 16
+
+/** a size to sweep */
+struct bench_size_struct
+{
+  const char *name;
+  int width;
+  int height;
+};
+typedef struct bench_size_struct bench_size;
+
+/** what to sweep, and how */
+struct bench_options_struct
+{
+  int styles[5];                  /**< which styles to pair up */
+  int num_styles;
+  int all_pairs;                  /**< both orders of each pair */
+  int knots[MAX_SWEEP];           /**< the knot counts */
+  int num_knots;
+  bench_size sizes[MAX_SWEEP];    /**< the sizes */
+  int num_sizes;
+  fluere_kernels kernels[3];      /**< the ways of computing pixels */
+  int num_kernels;
+  int reps;                       /**< repetitions of each case */
+  double min_time;                /**< seconds each repetition takes */
+  int nthreads;                   /**< threads filling rows */
+  const char *csv;                /**< where to write CSV, or NULL */
+  const char *json;               /**< where to write JSON, or NULL */
+  int quiet;                      /**< don't show progress */
+};
+typedef struct bench_options_struct bench_options;
+
+/** the rows one repetition fills */
+struct bench_job_struct
+{
+  fluere_drawing_ptr s;
+  int width;
+  int height;
+  int num_rows;
+  unsigned char *data;            /**< num_rows x width */
+};
+typedef struct bench_job_struct bench_job;
+
+/** the timing of one case */
+struct bench_result_struct
+{
+  int rows;                       /**< rows filled in each repetition */
+  double median;                  /**< nanoseconds per pixel */
+  double fastest;
+  double mean;
+  double stddev;
+};
+typedef struct bench_result_struct bench_result;
+
+static const char *style_names[5] = { "flow", "wave", "spin", "leaf", "rays" };
+
+static const char *kernel_names[3] = { "exact", "vector", "table" };
+
+static const bench_size known_sizes[4] =
+{
+  { "preview", 320, 180 },
+  { "1080p", 1920, 1080 },
+  { "4k", 3840, 2160 },
+  { "8k", 7680, 4320 }
+};
+
+/** the seed every case is drawn from */
+#define BENCH_SEED 0x666c756572650000ULL
+
+/** private declarations */
+
+static void usage(FILE *f);
+static int parse_options(int argc, char **argv, bench_options *o);
+static int parse_list(const char *arg, const char **names, int num_names,
+                      int *out, int max);
+static int time_case(bench_options *o, int style1, int style2, int knots,
+                     const bench_size *size, fluere_kernels kernels,
+                     bench_result *r);
+static double time_rows(bench_job *job, int nthreads);
+static void fill_bench_row(void *arg, int tile);
+static int compare_doubles(const void *a, const void *b);
+static double get_time(void);
+
+
+int main(int argc, char **argv)
+{
+  bench_options o;
+  FILE *csv = NULL;
+  FILE *json = NULL;
+  const char *isa;
+  int num_cases;
+  int done = 0;
+  int first = 1;
+  int kk;
+  int zz;
+  int nn;
+  int ii;
+  int jj;
+
+  if (!parse_options(argc, argv, &o))
+    return 2;
+
+  isa = get_vector_isa_name(get_vector_isa());
+
+  if (o.csv)
+  {
+    csv = (strcmp(o.csv, "-") == 0) ? stdout : fopen(o.csv, "w");
+    if (!csv)
+    {
+      fprintf(stderr, "fluere-bench: can't write %s\n", o.csv);
+      return 1;
+    }
+    fprintf(csv, "kernels,isa,style1,style2,knots,size,width,height,"
+                 "threads,reps,rows,ns_per_pixel,ns_per_pixel_knot,"
+                 "pixels_per_second,fastest_ns_per_pixel,"
+                 "mean_ns_per_pixel,stddev_ns_per_pixel\n");
+  }
+
+  if (o.json)
+  {
+    json = (strcmp(o.json, "-") == 0) ? stdout : fopen(o.json, "w");
+    if (!json)
+    {
+      fprintf(stderr, "fluere-bench: can't write %s\n", o.json);
+      return 1;
+    }
+    fprintf(json, "{\n  \"isa\": \"%s\",\n  \"compiler\": \"%s\",\n"
+                  "  \"threads\": %d,\n  \"reps\": %d,\n"
+                  "  \"min_time\": %g,\n  \"results\": [",
+            isa, __VERSION__, o.nthreads, o.reps, o.min_time);
+  }
+
+  num_cases = o.num_kernels * o.num_sizes * o.num_knots
+              * (o.all_pairs ? o.num_styles * o.num_styles
+                             : o.num_styles * (o.num_styles + 1) / 2);
+
+  /* start the threads before the clock does */
+  get_shared_thread_pool();
+
+  for (kk = 0; kk < o.num_kernels; ++kk)
+  {
+    for (zz = 0; zz < o.num_sizes; ++zz)
+    {
+      for (nn = 0; nn < o.num_knots; ++nn)
+      {
+        for (ii = 0; ii < o.num_styles; ++ii)
+        {
+          for (jj = o.all_pairs ? 0 : ii; jj < o.num_styles; ++jj)
+          {
+            int style1 = o.styles[ii];
+            int style2 = o.styles[jj];
+            bench_size *size = o.sizes + zz;
+            bench_result r;
+
+            if (!time_case(&o, style1, style2, o.knots[nn], size,
+                           o.kernels[kk], &r))
+            {
+              fprintf(stderr, "fluere-bench: out of memory\n");
+              return 1;
+            }
+            done++;
+
+            if (!o.quiet)
+            {
+              fprintf(stderr, "[%d/%d] %s %s/%s %d knots %s: "
+                              "%.2f ns/pixel (+-%.1f%%)\n",
+                      done, num_cases, kernel_names[o.kernels[kk]],
+                      style_names[style1], style_names[style2],
+                      o.knots[nn], size->name, r.median,
+                      (r.mean > 0) ? 100 * r.stddev / r.mean : 0.0);
+            }
+
+            if (csv)
+            {
+              /* the exact kernels don't use the instruction set */
+              fprintf(csv, "%s,%s,%s,%s,%d,%s,%d,%d,%d,%d,%d,"
+                           "%.4f,%.4f,%.0f,%.4f,%.4f,%.4f\n",
+                      kernel_names[o.kernels[kk]],
+                      (o.kernels[kk] == exact_kernels) ? "-" : isa,
+                      style_names[style1], style_names[style2], o.knots[nn],
+                      size->name, size->width, size->height, o.nthreads,
+                      o.reps, r.rows, r.median, r.median / o.knots[nn],
+                      1e9 / r.median, r.fastest, r.mean, r.stddev);
+              fflush(csv);
+            }
+
+            if (json)
+            {
+              fprintf(json, "%s\n    { \"kernels\": \"%s\", ",
+                      first ? "" : ",", kernel_names[o.kernels[kk]]);
+              if (o.kernels[kk] != exact_kernels)
+                fprintf(json, "\"isa\": \"%s\", ", isa);
+              fprintf(json, "\"style1\": \"%s\", \"style2\": \"%s\", "
+                            "\"knots\": %d, \"size\": \"%s\", "
+                            "\"width\": %d, \"height\": %d, "
+                            "\"rows\": %d, \"ns_per_pixel\": %.4f, "
+                            "\"ns_per_pixel_knot\": %.4f, "
+                            "\"pixels_per_second\": %.0f, "
+                            "\"fastest_ns_per_pixel\": %.4f, "
+                            "\"mean_ns_per_pixel\": %.4f, "
+                            "\"stddev_ns_per_pixel\": %.4f }",
+                      style_names[style1], style_names[style2], o.knots[nn],
+                      size->name, size->width, size->height, r.rows,
+                      r.median, r.median / o.knots[nn], 1e9 / r.median,
+                      r.fastest, r.mean, r.stddev);
+              first = 0;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (csv && csv != stdout)
+    fclose(csv);
+  if (json)
+  {
+    fprintf(json, "\n  ]\n}\n");
+    if (json != stdout)
+      fclose(json);
+  }
+
+  return 0;
+}
+
+/**
+ * Prints how to use the tool.
+ */
+static void usage(FILE *f)
+{
+  fprintf(f,
+"usage: fluere-bench [options]\n"
+"\n"
+"  --csv FILE          write the results as CSV (- for stdout; the\n"
+"                      default if neither --csv nor --json is given)\n"
+"  --json FILE         write the results as JSON (- for stdout)\n"
+"  --styles LIST       styles to pair up (default all five)\n"
+"  --all-pairs         both orders of each pair, not just one\n"
+"  --knots LIST        knot counts (default 1,4,16,50,500)\n"
+"  --sizes LIST        preview, 1080p, 4k, 8k or WxH (default all four)\n"
+"  --kernels LIST      exact, vector, table (default all three)\n"
+"  --reps N            repetitions of each case (default 5)\n"
+"  --min-time SECONDS  how long each repetition takes at least, by\n"
+"                      filling enough rows (default 0.02)\n"
+"  --threads N         threads filling the rows (default 1)\n"
+"  --quiet             don't show progress on stderr\n"
+"  --help              print this\n");
+}
+
+/**
+ * Fills in o from the command line.  Returns 0 (after saying why) if
+ * it doesn't make sense.
+ */
+static int parse_options(int argc, char **argv, bench_options *o)
+{
+  enum
+  {
+    csv_option = 256,
+    json_option,
+    styles_option,
+    all_pairs_option,
+    knots_option,
+    sizes_option,
+    kernels_option,
+    reps_option,
+    min_time_option,
+    threads_option,
+    quiet_option,
+    help_option
+  };
+  static const struct option long_options[] =
+  {
+    { "csv",       required_argument, NULL, csv_option },
+    { "json",      required_argument, NULL, json_option },
+    { "styles",    required_argument, NULL, styles_option },
+    { "all-pairs", no_argument,       NULL, all_pairs_option },
+    { "knots",     required_argument, NULL, knots_option },
+    { "sizes",     required_argument, NULL, sizes_option },
+    { "kernels",   required_argument, NULL, kernels_option },
+    { "reps",      required_argument, NULL, reps_option },
+    { "min-time",  required_argument, NULL, min_time_option },
+    { "threads",   required_argument, NULL, threads_option },
+    { "quiet",     no_argument,       NULL, quiet_option },
+    { "help",      no_argument,       NULL, help_option },
+    { NULL, 0, NULL, 0 }
+  };
+  static const int default_knots[5] = { 1, 4, 16, 50, 500 };
+  int kernels[3];
+  int c;
+  int ii;
+
+  memset(o, 0, sizeof(*o));
+  for (ii = 0; ii < 5; ++ii)
+  {
+    o->styles[ii] = ii;
+    o->knots[ii] = default_knots[ii];
+  }
+  o->num_styles = 5;
+  o->num_knots = 5;
+  for (ii = 0; ii < 4; ++ii)
+    o->sizes[ii] = known_sizes[ii];
+  o->num_sizes = 4;
+  o->kernels[0] = exact_kernels;
+  o->kernels[1] = vector_kernels;
+  o->kernels[2] = table_kernels;
+  o->num_kernels = 3;
+  o->reps = 5;
+  o->min_time = 0.02;
+  o->nthreads = 1;
+
+  while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+  {
+    switch (c)
+    {
+      case csv_option:
+        o->csv = optarg;
+        break;
+      case json_option:
+        o->json = optarg;
+        break;
+      case styles_option:
+        o->num_styles = parse_list(optarg, style_names, 5, o->styles, 5);
+        if (o->num_styles <= 0)
+        {
+          fprintf(stderr, "fluere-bench: bad styles %s\n", optarg);
+          return 0;
+        }
+        break;
+      case all_pairs_option:
+        o->all_pairs = 1;
+        break;
+      case knots_option:
+        o->num_knots = parse_list(optarg, NULL, 0, o->knots, MAX_SWEEP);
+        for (ii = 0; ii < o->num_knots; ++ii)
+        {
+          if (o->knots[ii] < 1)
+            o->num_knots = 0;
+        }
+        if (o->num_knots <= 0)
+        {
+          fprintf(stderr, "fluere-bench: bad knots %s\n", optarg);
+          return 0;
+        }
+        break;
+      case sizes_option:
+      {
+        char *copy = strdup(optarg);
+        char *name;
+
+        o->num_sizes = 0;
+        for (name = strtok(copy, ","); name && o->num_sizes < MAX_SWEEP;
+             name = strtok(NULL, ","))
+        {
+          bench_size *size = o->sizes + o->num_sizes;
+
+          size->name = NULL;
+          for (ii = 0; ii < 4; ++ii)
+          {
+            if (strcmp(name, known_sizes[ii].name) == 0)
+              *size = known_sizes[ii];
+          }
+          if (!size->name)
+          {
+            if (sscanf(name, "%dx%d", &size->width, &size->height) != 2 ||
+                size->width <= 0 || size->height <= 0)
+            {
+              fprintf(stderr, "fluere-bench: bad size %s\n", name);
+              return 0;
+            }
+            size->name = strdup(name);
+          }
+          o->num_sizes++;
+        }
+        free(copy);
+        if (o->num_sizes == 0)
+        {
+          fprintf(stderr, "fluere-bench: bad sizes %s\n", optarg);
+          return 0;
+        }
+        break;
+      }
+      case kernels_option:
+        o->num_kernels = parse_list(optarg, kernel_names, 3, kernels, 3);
+        if (o->num_kernels <= 0)
+        {
+          fprintf(stderr, "fluere-bench: bad kernels %s\n", optarg);
+          return 0;
+        }
+        for (ii = 0; ii < o->num_kernels; ++ii)
+          o->kernels[ii] = (fluere_kernels) kernels[ii];
+        break;
+      case reps_option:
+        o->reps = atoi(optarg);
+        if (o->reps < 1)
+          o->reps = 1;
+        break;
+      case min_time_option:
+        o->min_time = atof(optarg);
+        break;
+      case threads_option:
+        o->nthreads = atoi(optarg);
+        if (o->nthreads <= 0)
+          o->nthreads = get_number_of_processors();
+        break;
+      case quiet_option:
+        o->quiet = 1;
+        break;
+      case help_option:
+        usage(stdout);
+        exit(0);
+      default:
+        usage(stderr);
+        return 0;
+    }
+  }
+
+  if (optind < argc)
+  {
+    usage(stderr);
+    return 0;
+  }
+
+  if (!o->csv && !o->json)
+    o->csv = "-";
+
+  return 1;
+}
+
+/**
+ * Reads a comma separated list into out: of names (returning each
+ * one's index in names) or, if names is NULL, of numbers.  Returns the
+ * number read, or -1 if one isn't any of the names.
+ */
+static int parse_list(const char *arg, const char **names, int num_names,
+                      int *out, int max)
+{
+  char *copy = strdup(arg);
+  char *item;
+  int n = 0;
+  int ii;
+
+  for (item = strtok(copy, ","); item && n < max; item = strtok(NULL, ","))
+  {
+    if (!names)
+      out[n++] = atoi(item);
+    else
+    {
+      for (ii = 0; ii < num_names; ++ii)
+      {
+        if (strcmp(item, names[ii]) == 0)
+          break;
+      }
+      if (ii == num_names)
+      {
+        n = -1;
+        break;
+      }
+      out[n++] = ii;
+    }
+  }
+
+  free(copy);
+  return n;
+}
+
+/**
+ * Times one case: fills enough rows to take o->min_time, o->reps
+ * times.  Returns 0 if there isn't the memory for it.
+ */
+static int time_case(bench_options *o, int style1, int style2, int knots,
+                     const bench_size *size, fluere_kernels kernels,
+                     bench_result *r)
+{
+  double times[o->reps];
+  bench_job job;
+  double t;
+  double sum = 0;
+  double sum_squares = 0;
+  int ii;
+
+  job.s = init_fluere_drawing_seeded(size->width, size->height, knots,
+                                     (fluere_style) style1,
+                                     (fluere_style) style2, BENCH_SEED);
+  job.data = malloc((size_t) size->width * size->height);
+  if (!job.s || !job.data)
+  {
+    if (job.s)
+      delete_fluere_drawing(job.s);
+    free(job.data);
+    return 0;
+  }
+  set_fluere_kernels(job.s, kernels);
+  job.width = size->width;
+  job.height = size->height;
+
+  /* warm up (and make the tables), then see how long a row takes */
+  job.num_rows = 1;
+  time_rows(&job, 1);
+  t = time_rows(&job, 1);
+
+  job.num_rows = (t > 0) ? (int) ceil(o->min_time * o->nthreads / t) : 1;
+  if (job.num_rows > size->height)
+    job.num_rows = size->height;
+  if (job.num_rows < 1)
+    job.num_rows = 1;
+
+  for (ii = 0; ii < o->reps; ++ii)
+  {
+    times[ii] = 1e9 * time_rows(&job, o->nthreads)
+                / ((double) job.num_rows * size->width);
+    sum += times[ii];
+    sum_squares += times[ii] * times[ii];
+  }
+
+  qsort(times, o->reps, sizeof(double), compare_doubles);
+
+  r->rows = job.num_rows;
+  r->median = (o->reps & 1) ? times[o->reps / 2]
+              : 0.5 * (times[o->reps / 2 - 1] + times[o->reps / 2]);
+  r->fastest = times[0];
+  r->mean = sum / o->reps;
+  r->stddev = (o->reps > 1)
+    ? sqrt(fmax(0, (sum_squares - sum * r->mean) / (o->reps - 1))) : 0;
+
+  free(job.data);
+  delete_fluere_drawing(job.s);
+  return 1;
+}
+
+/**
+ * Fills the job's rows on nthreads threads, and returns how long it
+ * took in seconds.
+ */
+static double time_rows(bench_job *job, int nthreads)
+{
+  double t0 = get_time();
+
+  run_tiles(get_shared_thread_pool(), job->num_rows, nthreads,
+            fill_bench_row, job);
+
+  return get_time() - t0;
+}
+
+/**
+ * Fills one of the job's rows; row i of num_rows is the one that far
+ * down the drawing.
+ */
+static void fill_bench_row(void *arg, int tile)
+{
+  bench_job *job = arg;
+  int y = (int) (((long long) 2 * tile + 1) * job->height
+                 / (2 * job->num_rows));
+
+  fill_pixels_region(job->s, 0, y, job->width, 1,
+                     job->data + (size_t) tile * job->width, job->width);
+}
+
+/**
+ * For sorting the times.
+ */
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Returns the time in seconds on a clock that only goes forward.
+ */
+static double get_time(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
@@ -0,0 +1,517 @@
+/**
+ * \file fluere_cache.c
+ *
+ * \brief A cache of filled drawings on disk.
+ *
+ * Each image is a file named after the 64-bit FNV-1a hash of its key,
+ * which is the drawing's binary spec followed by its fluere_kernels and
+ * (since the vector kernels can differ in the last bit between them)
+ * the vector instruction set.  The file is
+ *
+ \verbatim
+   offset  size
+        0     4   "FLIC"
+        4     1   version
+        5     1   kernels
+        6     1   vector instruction set
+        7     1   zero
+        8     4   width
+       12     4   height
+       16     4   size of the spec
+       20     n   the spec
+     20+n   w*h   the pixels
+ \endverbatim
+ *
+ * with the numbers little endian.  The whole key is checked when an
+ * image is found, so two drawings with the same hash can't be mixed
+ * up.  The time each file was last used is kept as its modification
+ * time.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "fluere_cache.h"
+#include "fluere_private.h"
+#include "fluere_spec.h"
+#include "vector_math.h"
+
+/** the version of the image files */
+#define CACHE_VERSION 1
+
+/** bytes in an image file before the spec */
+#define CACHE_HEADER_SIZE 20
+
+/** the end of the name of every image file */
+#define CACHE_SUFFIX ".fli"
+
+/** temporary files older than this (in seconds) were left by a crash */
+#define CACHE_STALE_TEMP 3600
+
+
+/** a cache directory */
+struct fluere_cache_struct
+{
+  char *dir;            /**< where the files are */
+  long long max_bytes;  /**< how much they may take */
+};
+
+/** the pixels of a filled drawing */
+struct fluere_image_struct
+{
+  const unsigned char *data;  /**< the pixels */
+  void *map;                  /**< the mapped file, or NULL */
+  size_t map_size;            /**< its size */
+  unsigned char *owned;       /**< the pixels if they were computed */
+};
+
+/** one file found by trim_fluere_cache */
+struct cache_entry_struct
+{
+  char name[64];        /**< its name in the directory */
+  long long size;       /**< its size in bytes */
+  double last_used;     /**< its modification time, in seconds */
+};
+typedef struct cache_entry_struct cache_entry;
+
+/** counts the temporary files made by this process, to name them */
+static unsigned int temp_counter = 0;
+
+
+/** private declarations */
+
+static unsigned char* make_key(fluere_drawing *s, size_t *size);
+static unsigned long long hash_key(const unsigned char *key, size_t size);
+static char* get_path(fluere_cache_ptr c, const char *name);
+static int write_all(int fd, const unsigned char *p, size_t n);
+static double get_mtime(const struct stat *st);
+static int compare_entries(const void *a, const void *b);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Opens a cache directory
+ */
+fluere_cache_ptr open_fluere_cache(const char *dir, long long max_bytes)
+{
+  fluere_cache_ptr c;
+
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    return NULL;
+
+  c = malloc(sizeof(struct fluere_cache_struct));
+  if (!c)
+    return NULL;
+
+  c->dir = strdup(dir);
+  c->max_bytes = max_bytes;
+  if (!c->dir)
+  {
+    free(c);
+    return NULL;
+  }
+
+  return c;
+}
+
+/**
+ * Frees a cache
+ */
+void close_fluere_cache(fluere_cache_ptr c)
+{
+  if (!c)
+    return;
+  free(c->dir);
+  free(c);
+}
+
+/**
+ * Looks for an image in the cache
+ */
+fluere_image_ptr find_fluere_image(fluere_cache_ptr c,
+                                   fluere_drawing_ptr s)
+{
+  fluere_image_ptr img = NULL;
+  unsigned char *key;
+  unsigned char *map;
+  size_t key_size;
+  size_t spec_size;
+  size_t size;
+  struct stat st;
+  char name[64];
+  char *path;
+  int fd;
+
+  key = make_key(s, &key_size);
+  if (!key)
+    return NULL;
+  spec_size = key_size - 2;
+
+  snprintf(name, sizeof(name), "%016llx" CACHE_SUFFIX,
+           hash_key(key, key_size));
+  path = get_path(c, name);
+  fd = path ? open(path, O_RDONLY) : -1;
+
+  size = CACHE_HEADER_SIZE + spec_size + (size_t) s->width * s->height;
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size == (off_t) size)
+  {
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      if (memcmp(map, "FLIC", 4) == 0 && map[4] == CACHE_VERSION &&
+          map[5] == key[spec_size] && map[6] == key[spec_size + 1] &&
+          get_u32(map + 8) == (unsigned long) s->width &&
+          get_u32(map + 12) == (unsigned long) s->height &&
+          get_u32(map + 16) == spec_size &&
+          memcmp(map + CACHE_HEADER_SIZE, key, spec_size) == 0 &&
+          (img = calloc(1, sizeof(struct fluere_image_struct))) != NULL)
+      {
+        img->map = map;
+        img->map_size = size;
+        img->data = map + CACHE_HEADER_SIZE + spec_size;
+
+        /* it's the most recently used now */
+        utimes(path, NULL);
+      }
+      else
+        munmap(map, size);
+    }
+  }
+
+  if (fd >= 0)
+    close(fd);
+  free(path);
+  free(key);
+
+  return img;
+}
+
+/**
+ * Puts an image in the cache
+ */
+int store_fluere_image(fluere_cache_ptr c,
+                       fluere_drawing_ptr s,
+                       const unsigned char *data)
+{
+  unsigned char header[CACHE_HEADER_SIZE];
+  unsigned char *key;
+  size_t key_size;
+  size_t spec_size;
+  char name[64];
+  char temp[96];
+  char *path;
+  char *temp_path;
+  int stored = 0;
+  int fd;
+
+  key = make_key(s, &key_size);
+  if (!key)
+    return 0;
+  spec_size = key_size - 2;
+
+  snprintf(name, sizeof(name), "%016llx" CACHE_SUFFIX,
+           hash_key(key, key_size));
+  snprintf(temp, sizeof(temp), "%s.tmp%ld.%u", name, (long) getpid(),
+           __atomic_fetch_add(&temp_counter, 1, __ATOMIC_RELAXED));
+  path = get_path(c, name);
+  temp_path = get_path(c, temp);
+
+  memcpy(header, "FLIC", 4);
+  header[4] = CACHE_VERSION;
+  header[5] = key[spec_size];
+  header[6] = key[spec_size + 1];
+  header[7] = 0;
+  put_u32(header + 8, s->width);
+  put_u32(header + 12, s->height);
+  put_u32(header + 16, spec_size);
+
+  fd = -1;
+  if (path && temp_path)
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd >= 0)
+  {
+    /* the data has to be on the disk before the name is */
+    stored = write_all(fd, header, CACHE_HEADER_SIZE) &&
+             write_all(fd, key, spec_size) &&
+             write_all(fd, data, (size_t) s->width * s->height) &&
+             fsync(fd) == 0;
+    stored = (close(fd) == 0) && stored;
+    stored = stored && rename(temp_path, path) == 0;
+    if (!stored)
+      unlink(temp_path);
+  }
+
+  if (stored)
+  {
+    /* and the name has to be on the disk before anything else */
+    fd = open(c->dir, O_RDONLY);
+    if (fd >= 0)
+    {
+      fsync(fd);
+      close(fd);
+    }
+    trim_fluere_cache(c);
+  }
+
+  free(temp_path);
+  free(path);
+  free(key);
+
+  return stored;
+}
+
+/**
+ * Finds or fills an image
+ */
+fluere_image_ptr get_fluere_image(fluere_cache_ptr c,
+                                  fluere_drawing_ptr s,
+                                  int nthreads)
+{
+  fluere_image_ptr img = NULL;
+
+  if (c)
+    img = find_fluere_image(c, s);
+  if (img)
+    return img;
+
+  img = calloc(1, sizeof(struct fluere_image_struct));
+  if (!img)
+    return NULL;
+  img->owned = malloc((size_t) s->width * s->height);
+  if (!img->owned)
+  {
+    free(img);
+    return NULL;
+  }
+  img->data = img->owned;
+
+  fill_pixels_parallel(s, img->owned, nthreads);
+  if (c)
+    store_fluere_image(c, s, img->owned);
+
+  return img;
+}
+
+/**
+ * Returns the pixels of an image
+ */
+const unsigned char* get_fluere_image_data(fluere_image_ptr img)
+{
+  return img->data;
+}
+
+/**
+ * Frees an image
+ */
+void release_fluere_image(fluere_image_ptr img)
+{
+  if (!img)
+    return;
+  if (img->map)
+    munmap(img->map, img->map_size);
+  free(img->owned);
+  free(img);
+}
+
+/**
+ * Deletes the oldest images until the cache is within its budget, and
+ * any temporary files left by a crash.
+ */
+void trim_fluere_cache(fluere_cache_ptr c)
+{
+  cache_entry *entries = NULL;
+  int num_entries = 0;
+  int max_entries = 0;
+  long long total = 0;
+  struct timeval now;
+  struct dirent *d;
+  struct stat st;
+  DIR *dir;
+  int ii;
+
+  dir = opendir(c->dir);
+  if (!dir)
+    return;
+
+  gettimeofday(&now, NULL);
+
+  while ((d = readdir(dir)) != NULL)
+  {
+    size_t len = strlen(d->d_name);
+    char *path;
+    int is_image;
+    int is_temp;
+
+    if (len >= sizeof(entries->name))
+      continue;
+
+    is_image = len > strlen(CACHE_SUFFIX) &&
+               strcmp(d->d_name + len - strlen(CACHE_SUFFIX),
+                      CACHE_SUFFIX) == 0;
+    is_temp = strstr(d->d_name, CACHE_SUFFIX ".tmp") != NULL;
+    if (!is_image && !is_temp)
+      continue;
+
+    path = get_path(c, d->d_name);
+    if (!path || stat(path, &st) != 0)
+    {
+      free(path);
+      continue;
+    }
+
+    if (is_temp)
+    {
+      if (now.tv_sec - get_mtime(&st) > CACHE_STALE_TEMP)
+        unlink(path);
+      free(path);
+      continue;
+    }
+    free(path);
+
+    if (num_entries == max_entries)
+    {
+      cache_entry *more;
+
+      max_entries = max_entries ? 2 * max_entries : 64;
+      more = realloc(entries, sizeof(cache_entry) * max_entries);
+      if (!more)
+        break;
+      entries = more;
+    }
+
+    strcpy(entries[num_entries].name, d->d_name);
+    entries[num_entries].size = st.st_size;
+    entries[num_entries].last_used = get_mtime(&st);
+    total += st.st_size;
+    ++num_entries;
+  }
+  closedir(dir);
+
+  if (total > c->max_bytes)
+  {
+    qsort(entries, num_entries, sizeof(cache_entry), compare_entries);
+
+    for (ii = 0; ii < num_entries && total > c->max_bytes; ++ii)
+    {
+      char *path = get_path(c, entries[ii].name);
+
+      /* images that are mapped stay good until they're released */
+      if (path && unlink(path) == 0)
+        total -= entries[ii].size;
+      free(path);
+    }
+  }
+
+  free(entries);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Makes the key of a drawing: its binary spec, then its kernels and
+ * the vector instruction set.  size is set to the whole size.
+ */
+static unsigned char* make_key(fluere_drawing *s, size_t *size)
+{
+  size_t spec_size = encode_fluere_spec(s, NULL, 0);
+  unsigned char *key = malloc(spec_size + 2);
+
+  if (!key)
+    return NULL;
+
+  encode_fluere_spec(s, key, spec_size);
+  key[spec_size] = s->kernels;
+  key[spec_size + 1] = (s->kernels == exact_kernels) ? 0 : get_vector_isa();
+  *size = spec_size + 2;
+
+  return key;
+}
+
+/**
+ * the 64-bit FNV-1a hash of a key
+ */
+static unsigned long long hash_key(const unsigned char *key, size_t size)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  size_t ii;
+
+  for (ii = 0; ii < size; ++ii)
+    h = (h ^ key[ii]) * 1099511628211ULL;
+
+  return h;
+}
+
+/**
+ * the path of a file in the cache directory, which the caller frees
+ */
+static char* get_path(fluere_cache_ptr c, const char *name)
+{
+  size_t size = strlen(c->dir) + strlen(name) + 2;
+  char *path = malloc(size);
+
+  if (path)
+    snprintf(path, size, "%s/%s", c->dir, name);
+  return path;
+}
+
+/**
+ * writes all n bytes, returning 1 if they were written
+ */
+static int write_all(int fd, const unsigned char *p, size_t n)
+{
+  while (n > 0)
+  {
+    ssize_t written = write(fd, p, n);
+
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return 0;
+    p += written;
+    n -= written;
+  }
+  return 1;
+}
+
+/**
+ * the modification time of a file, in seconds, to the nanosecond where
+ * the system keeps it
+ */
+static double get_mtime(const struct stat *st)
+{
+#if defined(__APPLE__)
+  return st->st_mtimespec.tv_sec + 1e-9 * st->st_mtimespec.tv_nsec;
+#else
+  return st->st_mtim.tv_sec + 1e-9 * st->st_mtim.tv_nsec;
+#endif
+}
+
+/**
+ * orders cache entries from the one used longest ago
+ */
+static int compare_entries(const void *a, const void *b)
+{
+  const cache_entry *ea = a;
+  const cache_entry *eb = b;
+
+  if (ea->last_used < eb->last_used)
+    return -1;
+  return ea->last_used > eb->last_used;
+}
+
+/*@}*/
@@ -0,0 +1,85 @@
+/**
+ * \file fluere_cache.h
+ *
+ * \brief A cache of filled drawings on disk, so a drawing that has
+ * been filled before can be mapped into memory instead of computed.
+ *
+ * The images are kept in a directory, one file per image, named after
+ * a hash of the drawing's spec (see fluere_spec.h) and how its pixels
+ * are computed.  Images found in the cache are mapped read-only, with
+ * no copy.  Files are written under a temporary name and renamed into
+ * place, so a crash never leaves a partial image behind, and several
+ * processes can share one directory.  When the files take more than
+ * the cache's budget, the ones used longest ago are deleted.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_CACHE_H
+#define FLUERE_CACHE_H
+
+#include "fluere_drawing.h"
+
+
+typedef struct fluere_cache_struct *fluere_cache_ptr;
+
+/** the pixels of a filled drawing, from the cache or just computed */
+typedef struct fluere_image_struct *fluere_image_ptr;
+
+
+/**
+ * Opens the cache in the directory dir, making the directory if it
+ * isn't there, that keeps its files under max_bytes in all.  Returns
+ * NULL if the directory can't be made.
+ */
+fluere_cache_ptr open_fluere_cache(const char *dir, long long max_bytes);
+
+/**
+ * Frees the cache.  The files stay, and images from it are still good.
+ */
+void close_fluere_cache(fluere_cache_ptr c);
+
+/**
+ * Returns the image of s from the cache, or NULL if it isn't there.
+ */
+fluere_image_ptr find_fluere_image(fluere_cache_ptr c,
+                                   fluere_drawing_ptr s);
+
+/**
+ * Puts data, the filled drawing s (width x height), in the cache, and
+ * deletes old images if that puts the cache over its budget.  Returns
+ * 1 if it was stored.
+ */
+int store_fluere_image(fluere_cache_ptr c,
+                       fluere_drawing_ptr s,
+                       const unsigned char *data);
+
+/**
+ * Returns the image of s from the cache if it's there, and otherwise
+ * fills it with fill_pixels_parallel on nthreads threads and stores
+ * it.  c may be NULL, to just fill it.  Returns NULL if there isn't
+ * enough memory.
+ */
+fluere_image_ptr get_fluere_image(fluere_cache_ptr c,
+                                  fluere_drawing_ptr s,
+                                  int nthreads);
+
+/**
+ * Returns the pixels of an image: width x height bytes, as fill_pixels
+ * would give them, good until the image is released.
+ */
+const unsigned char* get_fluere_image_data(fluere_image_ptr img);
+
+/**
+ * Unmaps or frees an image.
+ */
+void release_fluere_image(fluere_image_ptr img);
+
+/**
+ * Deletes the images used longest ago until the cache is within its
+ * budget.  store_fluere_image does this itself.
+ */
+void trim_fluere_cache(fluere_cache_ptr c);
+
+
+#endif
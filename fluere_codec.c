@@ -0,0 +1,1162 @@
+/**
+ * \file fluere_codec.c
+ *
+ * \brief A lossless compressed format for the pixels of a fluere
+ * drawing.
+ *
+ * Each pixel is predicted from the pixels above and to the left of it,
+ * and the difference from the prediction (mod 256, so the wrap from 255
+ * to 0 costs nothing) is coded.  The two styles of a drawing are drawn
+ * in a checkerboard, so the prediction can use the pixels of the
+ * pixel's own style or (when both styles are the same) the pixels right
+ * next to it; each band is coded both ways and the smaller is kept.
+ * Runs of zero differences are coded as one symbol, and the symbols are
+ * coded with rANS, using symbol frequencies that each band counts
+ * separately for a few contexts: how big the differences next to the
+ * pixel were.
+ *
+ * The compressed data is
+ *
+ \verbatim
+   offset  size
+        0     4   "FLPX"
+        4     1   version
+        5     3   zero
+        8     4   width
+       12     4   height
+       16     4   rows in each band
+       20     4   number of bands
+       24   8*n   the size of each band, and the CRC-32 of its pixels
+   24+8*n         the bands
+ \endverbatim
+ *
+ * with the numbers little endian.  A band is a byte giving how it is
+ * predicted (or that its pixels are stored as they are), then the
+ * frequencies of the symbols in each context, then the rANS state and
+ * bytes.  The
+ * predictions don't look outside the band, so the bands can be decoded
+ * in any order.  Damaged data can still decode to some pixels, so each
+ * band's pixels are checked against its CRC (the same as PNG's) once
+ * they are decoded.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fluere_codec.h"
+#include "fluere_private.h"
+#include "thread_pool.h"
+
+/** the version of the format; 2 added the CRCs */
+#define CODEC_VERSION 2
+
+/** bytes before the band sizes */
+#define CODEC_HEADER_SIZE 24
+
+/** bytes for each band after the header: its size and CRC */
+#define BAND_ENTRY_SIZE 8
+
+/** rows in each band */
+#define CODEC_BAND_ROWS 64
+
+/** the frequencies of a band's symbols add up to 1 << PROB_BITS */
+#define PROB_BITS 12
+#define PROB_SCALE (1 << PROB_BITS)
+
+/** the rANS state is kept in [RANS_LOW, 256 * RANS_LOW) */
+#define RANS_LOW (1u << 23)
+
+/** symbol RUN_SYMBOL + k is a run of 2^k + (k more bits) zeros */
+#define RUN_SYMBOL 256
+#define MAX_RUN_BITS 15
+#define MAX_RUN ((1 << (MAX_RUN_BITS + 1)) - 1)
+#define NUM_SYMBOLS (RUN_SYMBOL + MAX_RUN_BITS + 1)
+
+/** number of contexts whose symbols are counted separately */
+#define NUM_CONTEXTS 7
+
+/** most bytes the frequencies of a band can take */
+#define MAX_TABLE_SIZE (3 * NUM_SYMBOLS)
+
+/** images bigger than this (16384 x 16384) are taken for damaged data */
+#define MAX_PIXELS (1LL << 28)
+
+
+/** how the pixels of a band are predicted */
+typedef enum
+{
+  stored_band,      /**< not predicted; the pixels are stored as they are */
+  lattice_band,     /**< from pixels of the same style; see predict */
+  neighbor_band     /**< from the pixels next to it */
+} band_mode;
+
+/** the frequencies of a band's symbols, with what rANS needs */
+struct symbol_table_struct
+{
+  unsigned int freq[NUM_SYMBOLS];   /**< out of PROB_SCALE */
+  unsigned int start[NUM_SYMBOLS];  /**< sum of the frequencies before */
+};
+typedef struct symbol_table_struct symbol_table;
+
+/** the memory encode_band works in */
+struct band_workspace_struct
+{
+  unsigned char *z;                          /**< the differences */
+  unsigned int *tokens;                      /**< the symbols */
+  unsigned int (*counts)[NUM_SYMBOLS];       /**< for each context */
+  symbol_table *tables;                      /**< for each context */
+};
+typedef struct band_workspace_struct band_workspace;
+
+/** what the band functions need to know about the image */
+struct codec_job_struct
+{
+  unsigned char *data;          /**< the pixels */
+  const unsigned char *in;      /**< compressed bands, when decoding */
+  unsigned char *out;           /**< room for bands, when encoding */
+  size_t *offsets;              /**< where each band is in in or out */
+  size_t *sizes;                /**< the size of each band */
+  unsigned long *crcs;          /**< the CRC of each band's pixels */
+  int width;                    /**< width of the image */
+  int height;                   /**< height of the image */
+  int failed;                   /**< set if a band was bad */
+};
+typedef struct codec_job_struct codec_job;
+
+/** a streaming decoder */
+struct fluere_decoder_struct
+{
+  unsigned char *pending;   /**< bytes that haven't been decoded */
+  size_t have;              /**< how many */
+  size_t capacity;          /**< room for them */
+  int width;                /**< size of the image, once it's known */
+  int height;
+  int band_rows;            /**< rows in each band */
+  int num_bands;            /**< number of bands, or 0 before the header */
+  size_t *sizes;            /**< the size of each band */
+  unsigned long *crcs;      /**< the CRC of each band's pixels */
+  int next_band;            /**< the band to decode next */
+  unsigned char *data;      /**< the pixels */
+  int failed;               /**< was the data bad? */
+};
+
+
+/** private declarations */
+
+static int read_header(const unsigned char *in, size_t size,
+                       int *width, int *height, int *num_bands);
+static unsigned long get_crc(const unsigned char *bytes, size_t n);
+
+static inline unsigned char get_median(unsigned char a, unsigned char b,
+                                       unsigned char c);
+static inline unsigned char predict(int mode, const unsigned char *row,
+                                    int r, int x, int width);
+static inline int get_context(int mode, const unsigned char *z,
+                              int r, int x, int width);
+static void get_residuals(int mode, const unsigned char *data,
+                          int width, int rows, unsigned char *z);
+static void apply_residuals(int mode, unsigned char *data,
+                            int width, int rows);
+static int tokenize(int mode, const unsigned char *z, int width, int rows,
+                    unsigned int *tokens,
+                    unsigned int counts[NUM_CONTEXTS][NUM_SYMBOLS]);
+static void normalize_counts(const unsigned int *counts, symbol_table *t);
+static size_t write_table(const symbol_table *t, unsigned char *out);
+static size_t read_table(const unsigned char *in, size_t size,
+                         symbol_table *t);
+
+static size_t code_band(int mode, const unsigned char *data,
+                        int width, int rows, band_workspace *w,
+                        unsigned char *scratch, size_t scratch_size);
+static size_t encode_band(const unsigned char *data, int width, int rows,
+                          unsigned char *out);
+static int decode_band(const unsigned char *in, size_t size,
+                       unsigned char *data, int width, int rows,
+                       unsigned long crc);
+static void encode_band_tile(void *arg, int band);
+static void decode_band_tile(void *arg, int band);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Bytes needed for the worst case
+ */
+size_t get_fluere_codec_bound(int width, int height)
+{
+  size_t num_bands = (height + CODEC_BAND_ROWS - 1) / CODEC_BAND_ROWS;
+
+  if (width <= 0 || height <= 0 || (long long) width * height > MAX_PIXELS)
+    return 0;
+
+  /* a band is never bigger than its pixels and its mode */
+  return CODEC_HEADER_SIZE + (BAND_ENTRY_SIZE + 1) * num_bands +
+         (size_t) width * height;
+}
+
+/**
+ * Compresses an image
+ */
+size_t encode_fluere_pixels(const unsigned char *data,
+                            int width,
+                            int height,
+                            int nthreads,
+                            unsigned char *out,
+                            size_t size)
+{
+  int num_bands = (height + CODEC_BAND_ROWS - 1) / CODEC_BAND_ROWS;
+  size_t pos = CODEC_HEADER_SIZE + BAND_ENTRY_SIZE * (size_t) num_bands;
+  codec_job job;
+  int band;
+
+  if (width <= 0 || height <= 0 ||
+      (long long) width * height > MAX_PIXELS || size < pos)
+    return 0;
+
+  memset(&job, 0, sizeof(job));
+  job.data = (unsigned char *) data;
+  job.width = width;
+  job.height = height;
+  job.out = malloc((size_t) width * height + num_bands);
+  job.offsets = malloc(sizeof(size_t) * num_bands);
+  job.sizes = malloc(sizeof(size_t) * num_bands);
+  job.crcs = malloc(sizeof(unsigned long) * num_bands);
+  if (!job.out || !job.offsets || !job.sizes || !job.crcs)
+  {
+    free(job.out);
+    free(job.offsets);
+    free(job.sizes);
+    free(job.crcs);
+    return 0;
+  }
+
+  /* each band gets room for its pixels and mode */
+  for (band = 0; band < num_bands; ++band)
+    job.offsets[band] = (size_t) band * (CODEC_BAND_ROWS * width + 1);
+
+  run_tiles(get_shared_thread_pool(), num_bands, nthreads,
+            encode_band_tile, &job);
+
+  memset(out, 0, CODEC_HEADER_SIZE);
+  memcpy(out, "FLPX", 4);
+  out[4] = CODEC_VERSION;
+  put_u32(out + 8, width);
+  put_u32(out + 12, height);
+  put_u32(out + 16, CODEC_BAND_ROWS);
+  put_u32(out + 20, num_bands);
+
+  for (band = 0; band < num_bands && pos; ++band)
+  {
+    unsigned char *entry = out + CODEC_HEADER_SIZE + BAND_ENTRY_SIZE * band;
+
+    put_u32(entry, job.sizes[band]);
+    put_u32(entry + 4, job.crcs[band]);
+    if (pos + job.sizes[band] > size)
+      pos = 0;
+    else
+    {
+      memcpy(out + pos, job.out + job.offsets[band], job.sizes[band]);
+      pos += job.sizes[band];
+    }
+  }
+
+  free(job.out);
+  free(job.offsets);
+  free(job.sizes);
+  free(job.crcs);
+
+  return pos;
+}
+
+/**
+ * Reads the size of an image
+ */
+int get_fluere_codec_size(const unsigned char *in,
+                          size_t size,
+                          int *width,
+                          int *height)
+{
+  int num_bands;
+
+  return read_header(in, size, width, height, &num_bands) &&
+         size >= CODEC_HEADER_SIZE + BAND_ENTRY_SIZE * (size_t) num_bands;
+}
+
+/**
+ * Decompresses an image
+ */
+int decode_fluere_pixels(const unsigned char *in,
+                         size_t size,
+                         unsigned char *data,
+                         int nthreads)
+{
+  codec_job job;
+  size_t pos;
+  int num_bands;
+  int band;
+
+  memset(&job, 0, sizeof(job));
+  if (!read_header(in, size, &job.width, &job.height, &num_bands) ||
+      size < CODEC_HEADER_SIZE + BAND_ENTRY_SIZE * (size_t) num_bands)
+    return 0;
+
+  job.data = data;
+  job.in = in;
+  job.offsets = malloc(sizeof(size_t) * num_bands);
+  job.sizes = malloc(sizeof(size_t) * num_bands);
+  job.crcs = malloc(sizeof(unsigned long) * num_bands);
+  if (!job.offsets || !job.sizes || !job.crcs)
+    job.failed = 1;
+
+  pos = CODEC_HEADER_SIZE + BAND_ENTRY_SIZE * (size_t) num_bands;
+  for (band = 0; band < num_bands && !job.failed; ++band)
+  {
+    const unsigned char *entry = in + CODEC_HEADER_SIZE +
+                                 BAND_ENTRY_SIZE * band;
+
+    job.offsets[band] = pos;
+    job.sizes[band] = get_u32(entry);
+    job.crcs[band] = get_u32(entry + 4);
+    pos += job.sizes[band];
+    if (pos > size)
+      job.failed = 1;
+  }
+
+  if (!job.failed)
+    run_tiles(get_shared_thread_pool(), num_bands, nthreads,
+              decode_band_tile, &job);
+
+  free(job.offsets);
+  free(job.sizes);
+  free(job.crcs);
+
+  return !job.failed;
+}
+
+/**
+ * Starts a streaming decoder
+ */
+fluere_decoder_ptr init_fluere_decoder(void)
+{
+  return calloc(1, sizeof(struct fluere_decoder_struct));
+}
+
+/**
+ * Decodes whatever bands are complete
+ */
+int feed_fluere_decoder(fluere_decoder_ptr d,
+                        const unsigned char *bytes,
+                        size_t size)
+{
+  size_t used = 0;
+  int rows;
+
+  if (d->failed)
+    return -1;
+
+  if (d->have + size > d->capacity)
+  {
+    size_t capacity = d->capacity ? d->capacity : 4096;
+    unsigned char *more;
+
+    while (capacity < d->have + size)
+      capacity *= 2;
+    more = realloc(d->pending, capacity);
+    if (!more)
+    {
+      d->failed = 1;
+      return -1;
+    }
+    d->pending = more;
+    d->capacity = capacity;
+  }
+  memcpy(d->pending + d->have, bytes, size);
+  d->have += size;
+
+  if (d->num_bands == 0 && d->have >= CODEC_HEADER_SIZE)
+  {
+    int num_bands;
+    int band;
+
+    if (!read_header(d->pending, d->have, &d->width, &d->height,
+                     &num_bands))
+    {
+      d->failed = 1;
+      return -1;
+    }
+    if (d->have < CODEC_HEADER_SIZE + BAND_ENTRY_SIZE * (size_t) num_bands)
+      return 0;
+
+    d->sizes = malloc(sizeof(size_t) * num_bands);
+    d->crcs = malloc(sizeof(unsigned long) * num_bands);
+    d->data = malloc((size_t) d->width * d->height);
+    if (!d->sizes || !d->crcs || !d->data)
+    {
+      d->failed = 1;
+      return -1;
+    }
+    for (band = 0; band < num_bands; ++band)
+    {
+      const unsigned char *entry = d->pending + CODEC_HEADER_SIZE +
+                                   BAND_ENTRY_SIZE * band;
+
+      d->sizes[band] = get_u32(entry);
+      d->crcs[band] = get_u32(entry + 4);
+    }
+
+    d->band_rows = get_u32(d->pending + 16);
+    d->num_bands = num_bands;
+    used = CODEC_HEADER_SIZE + BAND_ENTRY_SIZE * (size_t) num_bands;
+  }
+
+  while (d->num_bands > 0 && d->next_band < d->num_bands &&
+         d->have - used >= d->sizes[d->next_band])
+  {
+    int row0 = d->next_band * d->band_rows;
+    int rows = (row0 + d->band_rows < d->height) ? d->band_rows
+                                                 : d->height - row0;
+
+    if (!decode_band(d->pending + used, d->sizes[d->next_band],
+                     d->data + (size_t) row0 * d->width, d->width, rows,
+                     d->crcs[d->next_band]))
+    {
+      d->failed = 1;
+      return -1;
+    }
+    used += d->sizes[d->next_band];
+    ++d->next_band;
+  }
+
+  memmove(d->pending, d->pending + used, d->have - used);
+  d->have -= used;
+
+  rows = d->next_band * d->band_rows;
+  return (rows < d->height) ? rows : d->height;
+}
+
+/**
+ * Returns the pixels decoded so far
+ */
+const unsigned char* get_fluere_decoder_data(fluere_decoder_ptr d,
+                                             int *width,
+                                             int *height)
+{
+  if (d->num_bands == 0)
+    return NULL;
+
+  *width = d->width;
+  *height = d->height;
+  return d->data;
+}
+
+/**
+ * Frees a decoder
+ */
+void delete_fluere_decoder(fluere_decoder_ptr d)
+{
+  if (!d)
+    return;
+  free(d->pending);
+  free(d->sizes);
+  free(d->crcs);
+  free(d->data);
+  free(d);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Checks the header, not counting the band sizes after it.  Returns 1
+ * if it is good.
+ */
+static int read_header(const unsigned char *in, size_t size,
+                       int *width, int *height, int *num_bands)
+{
+  unsigned long w;
+  unsigned long h;
+  unsigned long band_rows;
+  unsigned long n;
+
+  if (size < CODEC_HEADER_SIZE || memcmp(in, "FLPX", 4) != 0 ||
+      in[4] != CODEC_VERSION)
+    return 0;
+
+  w = get_u32(in + 8);
+  h = get_u32(in + 12);
+  band_rows = get_u32(in + 16);
+  n = get_u32(in + 20);
+  if (w == 0 || h == 0 || w > INT_MAX || h > INT_MAX ||
+      (long long) w * h > MAX_PIXELS ||
+      band_rows != CODEC_BAND_ROWS || n != (h + band_rows - 1) / band_rows)
+    return 0;
+
+  *width = w;
+  *height = h;
+  *num_bands = n;
+  return 1;
+}
+
+/**
+ * Returns the CRC-32 of n bytes, as PNG and zlib compute it, eight
+ * bytes at a time with a table for each ("slicing by 8").  The tables
+ * are made each time; that's quick next to decoding a band.
+ */
+static unsigned long get_crc(const unsigned char *bytes, size_t n)
+{
+  unsigned int table[8][256];
+  unsigned int crc = 0xffffffffu;
+  int ii;
+  int jj;
+
+  for (ii = 0; ii < 256; ++ii)
+  {
+    unsigned int c = ii;
+
+    for (jj = 0; jj < 8; ++jj)
+      c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    table[0][ii] = c;
+  }
+  for (ii = 0; ii < 256; ++ii)
+  {
+    for (jj = 1; jj < 8; ++jj)
+      table[jj][ii] = (table[jj - 1][ii] >> 8) ^
+                      table[0][table[jj - 1][ii] & 0xff];
+  }
+
+  for (; n >= 8; n -= 8, bytes += 8)
+  {
+    unsigned int lo = crc ^ (bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+                             ((unsigned int) bytes[3] << 24));
+    unsigned int hi = bytes[4] | (bytes[5] << 8) |
+                      (bytes[6] << 16) | ((unsigned int) bytes[7] << 24);
+
+    crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+          table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+          table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+          table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+  }
+  for (; n > 0; --n, ++bytes)
+    crc = table[0][(crc ^ *bytes) & 0xff] ^ (crc >> 8);
+
+  return crc ^ 0xffffffffu;
+}
+
+/**
+ * The median predictor of LOCO-I: a + b - c, clamped to the range of
+ * a and b.  The differences are taken mod 256, from c, so a wrap from
+ * 255 to 0 looks like any other step.
+ */
+static inline unsigned char get_median(unsigned char a, unsigned char b,
+                                       unsigned char c)
+{
+  int da = (signed char) (unsigned char) (a - c);
+  int db = (signed char) (unsigned char) (b - c);
+  int big = (da > db) ? da : db;
+  int small = (da < db) ? da : db;
+
+  if (big <= 0)
+    return c + small;
+  if (small >= 0)
+    return c + big;
+  return c + da + db;
+}
+
+/**
+ * Predicts pixel x of row r of a band, where row points at the row.
+ * For lattice_band, this is the median of the pixels of the same style
+ * up-left, up-right and two up; for neighbor_band, of the pixels left,
+ * up and up-left.  Near the edges of the band, whatever neighbors there
+ * are are used.
+ */
+static inline unsigned char predict(int mode, const unsigned char *row,
+                                    int r, int x, int width)
+{
+  const unsigned char *up1 = row - width;
+
+  if (mode == neighbor_band)
+  {
+    if (r >= 1 && x >= 1)
+      return get_median(row[x - 1], up1[x], up1[x - 1]);
+    if (r >= 1)
+      return up1[x];
+    return (x >= 1) ? row[x - 1] : 0;
+  }
+
+  if (r >= 2 && x >= 1 && x + 1 < width)
+    return get_median(up1[x - 1], up1[x + 1], up1[x - width]);
+  if (r >= 1)
+  {
+    if (x >= 1)
+      return up1[x - 1];
+    return (x + 1 < width) ? up1[x + 1] : up1[x];
+  }
+  if (x >= 2)
+    return row[x - 2];
+  return (x == 1) ? row[0] : 0;
+}
+
+/**
+ * The context of pixel x of row r of a band: how big the zigzagged
+ * differences of the pixels next to it were, from 0 (all zero) to
+ * NUM_CONTEXTS - 1.  These are the pixels the prediction uses, and the
+ * one to the left of the pixel's style.  The symbols in each context
+ * are counted separately.
+ */
+static inline int get_context(int mode, const unsigned char *z,
+                              int r, int x, int width)
+{
+  static const int limits[NUM_CONTEXTS - 1] = { 0, 2, 4, 8, 16, 40 };
+  const unsigned char *zrow = z + (size_t) r * width;
+  int left = (mode == neighbor_band) ? 1 : 2;
+  int sum = 0;
+  int ctx;
+
+  if (x >= left)
+    sum += zrow[x - left];
+  if (r >= 1 && x >= 1)
+    sum += zrow[x - width - 1];
+  if (r >= 1 && x + 1 < width)
+    sum += zrow[x - width + 1];
+  if (mode == neighbor_band && r >= 1)
+    sum += zrow[x - width];
+
+  for (ctx = 0; ctx < NUM_CONTEXTS - 1 && sum > limits[ctx]; ++ctx)
+    ;
+  return ctx;
+}
+
+/**
+ * Computes the zigzagged difference of each pixel of a band from its
+ * prediction: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+ */
+static void get_residuals(int mode, const unsigned char *data,
+                          int width, int rows, unsigned char *z)
+{
+  int r;
+  int x;
+
+  for (r = 0; r < rows; ++r)
+  {
+    const unsigned char *row = data + (size_t) r * width;
+    unsigned char *zrow = z + (size_t) r * width;
+
+    for (x = 0; x < width; ++x)
+    {
+      signed char diff;
+
+      diff = (signed char) (unsigned char) (row[x] - predict(mode, row, r, x,
+                                                             width));
+      zrow[x] = (diff >= 0) ? 2 * diff : -2 * diff - 1;
+    }
+  }
+}
+
+/**
+ * Turns the zigzagged differences that fill a band back into pixels, in
+ * place; each prediction only reads pixels that are done.
+ */
+static void apply_residuals(int mode, unsigned char *data,
+                            int width, int rows)
+{
+  int r;
+  int x;
+
+  for (r = 0; r < rows; ++r)
+  {
+    unsigned char *row = data + (size_t) r * width;
+
+    for (x = 0; x < width; ++x)
+    {
+      unsigned char z = row[x];
+      unsigned char diff = (z & 1) ? -((z + 1) >> 1) : (z >> 1);
+
+      row[x] = predict(mode, row, r, x, width) + diff;
+    }
+  }
+}
+
+/**
+ * Turns the differences of a band into symbols, with the runs of zeros
+ * as single symbols, counting each one in its context.  Each token is
+ * the symbol in bits 0-8, the number of extra bits in 9-12, the context
+ * in 13-15, and the extra bits from 16 up.  Returns the number of
+ * tokens.
+ */
+static int tokenize(int mode, const unsigned char *z, int width, int rows,
+                    unsigned int *tokens,
+                    unsigned int counts[NUM_CONTEXTS][NUM_SYMBOLS])
+{
+  size_t n = (size_t) width * rows;
+  size_t ii = 0;
+  int num_tokens = 0;
+
+  memset(counts, 0, sizeof(unsigned int) * NUM_CONTEXTS * NUM_SYMBOLS);
+
+  while (ii < n)
+  {
+    int ctx = get_context(mode, z, ii / width, ii % width, width);
+    size_t run = 0;
+
+    while (ii + run < n && z[ii + run] == 0 && run < MAX_RUN)
+      ++run;
+
+    if (run >= 2)
+    {
+      unsigned int k = 1;
+
+      while ((run >> (k + 1)) != 0)
+        ++k;
+      tokens[num_tokens++] = (RUN_SYMBOL + k) | (k << 9) | (ctx << 13) |
+                             ((run - (1u << k)) << 16);
+      ++counts[ctx][RUN_SYMBOL + k];
+      ii += run;
+    }
+    else
+    {
+      tokens[num_tokens++] = z[ii] | (ctx << 13);
+      ++counts[ctx][z[ii]];
+      ++ii;
+    }
+  }
+
+  return num_tokens;
+}
+
+/**
+ * Scales the counts to frequencies that add up to PROB_SCALE, keeping
+ * every symbol that was seen.  A context with no symbols gets all zero
+ * frequencies.
+ */
+static void normalize_counts(const unsigned int *counts, symbol_table *t)
+{
+  unsigned long long total = 0;
+  int sum = 0;
+  int ii;
+
+  for (ii = 0; ii < NUM_SYMBOLS; ++ii)
+    total += counts[ii];
+
+  for (ii = 0; ii < NUM_SYMBOLS; ++ii)
+  {
+    t->freq[ii] = 0;
+    if (counts[ii])
+    {
+      t->freq[ii] = (unsigned int) ((counts[ii] * (unsigned long long)
+                                     PROB_SCALE + total / 2) / total);
+      if (t->freq[ii] == 0)
+        t->freq[ii] = 1;
+    }
+    sum += t->freq[ii];
+  }
+
+  /* take the rounding out of the biggest frequencies */
+  while (total > 0 && sum != PROB_SCALE)
+  {
+    int biggest = 0;
+
+    for (ii = 1; ii < NUM_SYMBOLS; ++ii)
+    {
+      if (t->freq[ii] > t->freq[biggest])
+        biggest = ii;
+    }
+
+    if (sum < PROB_SCALE)
+    {
+      t->freq[biggest] += PROB_SCALE - sum;
+      sum = PROB_SCALE;
+    }
+    else
+    {
+      int cut = sum - PROB_SCALE;
+
+      if (cut > (int) t->freq[biggest] / 2)
+        cut = t->freq[biggest] / 2;
+      t->freq[biggest] -= cut;
+      sum -= cut;
+    }
+  }
+
+  for (ii = 0, sum = 0; ii < NUM_SYMBOLS; ++ii)
+  {
+    t->start[ii] = sum;
+    sum += t->freq[ii];
+  }
+}
+
+/**
+ * Writes the frequencies as 7-bit groups, low first, with a run of
+ * zero frequencies as a 0 and the number of zeros after it.  Returns
+ * the number of bytes.
+ */
+static size_t write_table(const symbol_table *t, unsigned char *out)
+{
+  size_t pos = 0;
+  int ii = 0;
+
+  while (ii < NUM_SYMBOLS)
+  {
+    unsigned int v = t->freq[ii];
+
+    if (v == 0)
+    {
+      int more = 0;
+
+      while (ii + 1 + more < NUM_SYMBOLS && t->freq[ii + 1 + more] == 0)
+        ++more;
+      out[pos++] = 0;
+      v = more;
+      ii += more;
+    }
+
+    while (v >= 0x80)
+    {
+      out[pos++] = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+    out[pos++] = v;
+    ++ii;
+  }
+
+  return pos;
+}
+
+/**
+ * Reads what write_table wrote.  Returns the number of bytes, or 0 if
+ * they are bad.
+ */
+static size_t read_table(const unsigned char *in, size_t size,
+                         symbol_table *t)
+{
+  size_t pos = 0;
+  unsigned int sum = 0;
+  int ii = 0;
+
+  while (ii < NUM_SYMBOLS)
+  {
+    unsigned int v = 0;
+    int shift = 0;
+    int is_run;
+
+    if (pos >= size)
+      return 0;
+    is_run = (in[pos] == 0);
+    if (is_run)
+      ++pos;
+
+    do
+    {
+      if (pos >= size || shift > 14)
+        return 0;
+      v |= (in[pos] & 0x7f) << shift;
+      shift += 7;
+    } while (in[pos++] & 0x80);
+
+    if (is_run)
+    {
+      if (ii + 1 + (int) v > NUM_SYMBOLS)
+        return 0;
+      memset(t->freq + ii, 0, sizeof(unsigned int) * (v + 1));
+      ii += v + 1;
+    }
+    else
+    {
+      t->freq[ii++] = v;
+      sum += v;
+      if (sum > PROB_SCALE)
+        return 0;
+    }
+  }
+
+  if (sum != PROB_SCALE && sum != 0)
+    return 0;
+
+  for (ii = 0, sum = 0; ii < NUM_SYMBOLS; ++ii)
+  {
+    t->start[ii] = sum;
+    sum += t->freq[ii];
+  }
+
+  return pos;
+}
+
+/**
+ * Codes a band of rows with one way of predicting it into scratch,
+ * which has room for scratch_size bytes, using z, tokens, counts and
+ * tables as workspace.  Returns the size of the coded band, which is
+ * at the start of scratch.
+ */
+static size_t code_band(int mode, const unsigned char *data,
+                        int width, int rows, band_workspace *w,
+                        unsigned char *scratch, size_t scratch_size)
+{
+  unsigned char *p;
+  unsigned char *end = scratch + scratch_size;
+  unsigned int x = RANS_LOW;
+  size_t table_size = 0;
+  int num_tokens;
+  int ctx;
+  int ii;
+
+  get_residuals(mode, data, width, rows, w->z);
+  num_tokens = tokenize(mode, w->z, width, rows, w->tokens, w->counts);
+
+  scratch[0] = mode;
+  for (ctx = 0; ctx < NUM_CONTEXTS; ++ctx)
+  {
+    normalize_counts(w->counts[ctx], &w->tables[ctx]);
+    table_size += write_table(&w->tables[ctx], scratch + 1 + table_size);
+  }
+
+  /* rANS codes backwards, from the end of the scratch space */
+  p = end;
+  for (ii = num_tokens - 1; ii >= 0; --ii)
+  {
+    unsigned int token = w->tokens[ii];
+    const symbol_table *t = &w->tables[(token >> 13) & 7];
+    unsigned int symbol = token & 0x1ff;
+    unsigned int num_bits = (token >> 9) & 0xf;
+    unsigned int freq = t->freq[symbol];
+    unsigned int x_max;
+
+    if (num_bits)
+    {
+      /* the extra bits are a symbol with frequency 1 in 2^num_bits */
+      x_max = (RANS_LOW >> num_bits) << 8;
+      while (x >= x_max)
+      {
+        *--p = x & 0xff;
+        x >>= 8;
+      }
+      x = (x << num_bits) + (token >> 16);
+    }
+
+    x_max = ((RANS_LOW >> PROB_BITS) << 8) * freq;
+    while (x >= x_max)
+    {
+      *--p = x & 0xff;
+      x >>= 8;
+    }
+    x = ((x / freq) << PROB_BITS) + (x % freq) + t->start[symbol];
+  }
+  p -= 4;
+  put_u32(p, x);
+
+  memmove(scratch + 1 + table_size, p, end - p);
+  return 1 + table_size + (end - p);
+}
+
+/**
+ * Codes a band of rows both ways, keeping the smaller, or stores it if
+ * that's smaller still.  out has room for the pixels and a byte.
+ * Returns the size.
+ */
+static size_t encode_band(const unsigned char *data, int width, int rows,
+                          unsigned char *out)
+{
+  size_t n = (size_t) width * rows;
+  size_t scratch_size = 2 * n + NUM_CONTEXTS * MAX_TABLE_SIZE + 16;
+  unsigned char *scratch[2];
+  size_t sizes[2] = { 0, 0 };
+  band_workspace w;
+  size_t size = 0;
+  int best = 0;
+
+  w.counts = malloc(sizeof(unsigned int) * NUM_CONTEXTS * NUM_SYMBOLS);
+  w.tables = malloc(sizeof(symbol_table) * NUM_CONTEXTS);
+  w.z = malloc(n);
+  w.tokens = malloc(sizeof(unsigned int) * n);
+  scratch[0] = malloc(scratch_size);
+  scratch[1] = malloc(scratch_size);
+
+  if (w.counts && w.tables && w.z && w.tokens && scratch[0] && scratch[1])
+  {
+    sizes[0] = code_band(lattice_band, data, width, rows, &w,
+                         scratch[0], scratch_size);
+    sizes[1] = code_band(neighbor_band, data, width, rows, &w,
+                         scratch[1], scratch_size);
+    best = (sizes[1] < sizes[0]) ? 1 : 0;
+    size = sizes[best];
+  }
+
+  if (size > 0 && size < n + 1)
+    memcpy(out, scratch[best], size);
+  else
+  {
+    out[0] = stored_band;
+    memcpy(out + 1, data, n);
+    size = n + 1;
+  }
+
+  free(w.counts);
+  free(w.tables);
+  free(w.z);
+  free(w.tokens);
+  free(scratch[0]);
+  free(scratch[1]);
+
+  return size;
+}
+
+/**
+ * Decodes a band of rows.  Returns 1 if it was good, and its pixels
+ * have the CRC crc.
+ */
+static int decode_band(const unsigned char *in, size_t size,
+                       unsigned char *data, int width, int rows,
+                       unsigned long crc)
+{
+  size_t n = (size_t) width * rows;
+  const unsigned char *p;
+  const unsigned char *end = in + size;
+  unsigned short (*lookup)[PROB_SCALE];
+  symbol_table *tables;
+  size_t pos = 0;
+  unsigned int x;
+  int good = 0;
+  int mode;
+  int ctx;
+  int ii;
+
+  if (size < 1)
+    return 0;
+
+  if (in[0] == stored_band)
+  {
+    if (size != n + 1)
+      return 0;
+    memcpy(data, in + 1, n);
+    return get_crc(data, n) == crc;
+  }
+  mode = in[0];
+  if (mode != lattice_band && mode != neighbor_band)
+    return 0;
+
+  lookup = malloc(sizeof(unsigned short) * NUM_CONTEXTS * PROB_SCALE);
+  tables = malloc(sizeof(symbol_table) * NUM_CONTEXTS);
+  if (!lookup || !tables)
+  {
+    free(lookup);
+    free(tables);
+    return 0;
+  }
+
+  p = in + 1;
+  for (ctx = 0; ctx < NUM_CONTEXTS; ++ctx)
+  {
+    size_t table_size = read_table(p, end - p, &tables[ctx]);
+
+    if (table_size == 0)
+      break;
+    p += table_size;
+
+    for (ii = 0; ii < NUM_SYMBOLS; ++ii)
+    {
+      unsigned int slot;
+      unsigned int stop = tables[ctx].start[ii] + tables[ctx].freq[ii];
+
+      for (slot = tables[ctx].start[ii]; slot < stop; ++slot)
+        lookup[ctx][slot] = ii;
+    }
+  }
+
+  if (ctx == NUM_CONTEXTS && end - p >= 4)
+  {
+    x = get_u32(p);
+    p += 4;
+    good = 1;
+
+    while (pos < n && good)
+    {
+      const symbol_table *t;
+      unsigned int slot = x & (PROB_SCALE - 1);
+      unsigned int symbol;
+
+      ctx = get_context(mode, data, pos / width, pos % width, width);
+      t = &tables[ctx];
+      if (t->start[NUM_SYMBOLS - 1] + t->freq[NUM_SYMBOLS - 1] == 0)
+      {
+        /* nothing was coded in this context */
+        good = 0;
+        break;
+      }
+
+      symbol = lookup[ctx][slot];
+      x = t->freq[symbol] * (x >> PROB_BITS) + slot - t->start[symbol];
+      while (x < RANS_LOW && p < end)
+        x = (x << 8) | *p++;
+
+      if (symbol < RUN_SYMBOL)
+        data[pos++] = symbol;
+      else
+      {
+        int k = symbol - RUN_SYMBOL;
+        size_t run = (1u << k) + (x & ((1u << k) - 1));
+
+        x >>= k;
+        while (x < RANS_LOW && p < end)
+          x = (x << 8) | *p++;
+
+        if (run > n - pos)
+          good = 0;
+        else
+        {
+          memset(data + pos, 0, run);
+          pos += run;
+        }
+      }
+    }
+
+    /* the coder ends where it started */
+    good = good && x == RANS_LOW && p == end;
+  }
+
+  free(lookup);
+  free(tables);
+
+  if (!good)
+    return 0;
+  apply_residuals(mode, data, width, rows);
+  return get_crc(data, n) == crc;
+}
+
+/**
+ * Encodes one band for encode_fluere_pixels
+ */
+static void encode_band_tile(void *arg, int band)
+{
+  codec_job *job = arg;
+  int row0 = band * CODEC_BAND_ROWS;
+  int rows = (row0 + CODEC_BAND_ROWS < job->height) ? CODEC_BAND_ROWS
+                                                    : job->height - row0;
+
+  job->sizes[band] = encode_band(job->data + (size_t) row0 * job->width,
+                                 job->width, rows,
+                                 job->out + job->offsets[band]);
+  job->crcs[band] = get_crc(job->data + (size_t) row0 * job->width,
+                            (size_t) job->width * rows);
+}
+
+/**
+ * Decodes one band for decode_fluere_pixels
+ */
+static void decode_band_tile(void *arg, int band)
+{
+  codec_job *job = arg;
+  int row0 = band * CODEC_BAND_ROWS;
+  int rows = (row0 + CODEC_BAND_ROWS < job->height) ? CODEC_BAND_ROWS
+                                                    : job->height - row0;
+
+  if (!decode_band(job->in + job->offsets[band], job->sizes[band],
+                   job->data + (size_t) row0 * job->width, job->width, rows,
+                   job->crcs[band]))
+    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+}
+
+/*@}*/
@@ -0,0 +1,94 @@
+/**
+ * \file fluere_codec.h
+ *
+ * \brief A lossless compressed format for the pixels of a fluere
+ * drawing, which does much better than deflate on the smooth fields
+ * that wrap around at 256 that fluere draws.
+ *
+ * The image is cut into bands of rows that are coded separately, so
+ * they can be encoded and decoded on several threads, and decoded one
+ * at a time as the bytes arrive.  Each band carries a CRC of its
+ * pixels, so damaged data is caught rather than decoded wrong.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_CODEC_H
+#define FLUERE_CODEC_H
+
+#include <stddef.h>
+
+
+typedef struct fluere_decoder_struct *fluere_decoder_ptr;
+
+
+/**
+ * Returns the most bytes encode_fluere_pixels can take for an image of
+ * width x height pixels, or 0 if it won't take an image that size.
+ */
+size_t get_fluere_codec_bound(int width, int height);
+
+/**
+ * Compresses the width x height pixels in data into out, which holds
+ * size bytes, using nthreads threads (all of them if nthreads <= 0).
+ * Returns the number of bytes written, or 0 if they don't fit or the
+ * image has more than 16384 x 16384 pixels; they always fit in
+ * get_fluere_codec_bound bytes.
+ */
+size_t encode_fluere_pixels(const unsigned char *data,
+                            int width,
+                            int height,
+                            int nthreads,
+                            unsigned char *out,
+                            size_t size);
+
+/**
+ * Reads the size of the image in the size bytes at in.  Returns 1 if
+ * they start with a good header.
+ */
+int get_fluere_codec_size(const unsigned char *in,
+                          size_t size,
+                          int *width,
+                          int *height);
+
+/**
+ * Decompresses the size bytes at in into data, which must hold the
+ * width x height pixels that get_fluere_codec_size gives, using
+ * nthreads threads.  Returns 1 if the data was good.
+ */
+int decode_fluere_pixels(const unsigned char *in,
+                         size_t size,
+                         unsigned char *data,
+                         int nthreads);
+
+/**
+ * Starts decoding compressed pixels that come in pieces, say from a
+ * file or socket.
+ */
+fluere_decoder_ptr init_fluere_decoder(void);
+
+/**
+ * Gives the decoder the next size bytes, and decodes every band that
+ * is complete.  Returns the number of rows of the image that are
+ * decoded so far, or -1 if the data is bad.
+ */
+int feed_fluere_decoder(fluere_decoder_ptr d,
+                        const unsigned char *bytes,
+                        size_t size);
+
+/**
+ * Returns the pixels decoded so far, and the size of the image, or
+ * NULL if the header hasn't come in yet.  The data belongs to the
+ * decoder.
+ */
+const unsigned char* get_fluere_decoder_data(fluere_decoder_ptr d,
+                                             int *width,
+                                             int *height);
+
+/**
+ * Frees a decoder.
+ */
+void delete_fluere_decoder(fluere_decoder_ptr d);
+
+
+#endif
@@ -10,93 +10,32 @@
 #include <math.h>
 
 #include "fluere_drawing.h"
+#include "fluere_private.h"
+#include "fluere_random.h"
+#include "thread_pool.h"
 
+/** size of the square tiles used by fill_pixels_parallel */
+#define TILE_SIZE 64
 
-/** holds an integer point */
-struct point_struct
-{
-  int x;  /**<   x value */
-  int y;  /**<   y value */
-};
-typedef struct point_struct point;
 
-/** 
- * holds data for one "knot"
- *
- * Knots control the appearance of a fluere drawing.  Essentially,
- * the value (color) of each point in the drawing is some function
- * related to the distance or angle to each of the knots.
- */
-struct knot_struct
+/** what fill_tile needs to know about the drawing being filled */
+struct tile_job_struct
 {
-  /*@{*/
-  /** location of the point */
-  double x;
-  double y;
-  /*@}*/
-  
-  /*@{*/
-  /** ---- used for "flow" ---- */
-  double flowsign;     /**< +/-1; is the knot a source or sink for flow? */
-  /*@}*/
-  
-  /*@{*/
-  /** ---- used for "spin" ---- */
-  double spinsign;   /**< +/-1; clockwise or counterclockwise? */
-  double sectors;    /**< n/(2 pi), where n is the number of "spokes" going to the point */
-  double amplitude;   /*< if the spins are "twisted" then these control */
-  double frequency;   /*< the size and shape of the twists.*/
-  double decay;
-  /*@}*/
-  
-  /*@{*/
-  /** ---- used for "wave" ---- */
-  double wavesign;
-  /*@}*/
-  
-  /*@{*/
-  /** ---- used for "leaf" ---- */
-  int leafsign;
-  /*@}*/
-  
-  /*@{*/
-  /** ---- used for "rays" ---- */
-  int rayssign;
-  /*@}*/
-  
+  fluere_drawing_ptr s;   /**< the drawing */
+  unsigned char *data;    /**< the image data, width x height */
+  int tiles_across;       /**< number of tiles in each row of tiles */
 };
-typedef struct knot_struct knot;
-
-
-/** this holds the parameters to make a fluere drawing */
-struct fluere_drawing_struct
-{
-  /** we can show up to 2 styles at once */
-  int style1;    
-  int style2;
-
-  /** When drawing leaves or rays, should it be continuous or discrete?
-   * If these values are 1, then this will be continuous; larger values
-   * give increasingly larger discrete angle sections.*/
-  int leafdiscrete;  
-  int raysdiscrete;
-
-  int num_knots; /**< number of knots */
-  knot *knots;   /**< the knot data */
-
-  int width;     /**< width of the drawing */
-  int height;    /**< height of the drawing */
-};
-typedef struct fluere_drawing_struct fluere_drawing;
+typedef struct tile_job_struct tile_job;
 
 /** private declarations */
 
 double max(double a, double b);
 double min(double a, double b);
-double drandom();
-int coinflip();
+void define_knots(fluere_drawing_ptr s, fluere_random *r);
 
-void define_knots(fluere_drawing_ptr s);
+void fill_tile(void *arg, int tile);
+void fill_row(fluere_drawing_ptr s, int row, int col0, int col1,
+              unsigned char *out);
 
 unsigned char get_value( fluere_drawing_ptr s, point where );
 unsigned char get_spin_value( fluere_drawing_ptr s, point where );
@@ -114,7 +53,7 @@ unsigned char get_rays_value( fluere_drawing_ptr s, point where );
  *
  * Basic parameters for the drawing (width, height, number of knots,
  * and the drawing styles) are passed in; everything else is chosen
- * randomly within the function.
+ * randomly within the function, from a seed taken from random().
  */
 fluere_drawing_ptr init_fluere_drawing(
     int width, 
@@ -122,21 +61,62 @@ fluere_drawing_ptr init_fluere_drawing(
     int num_knots,
     fluere_style style1,
     fluere_style style2 )
+{
+  unsigned long long seed;
+
+  /* random() gives 31 bits at a time */
+  seed = (unsigned long long) random() << 62;
+  seed ^= (unsigned long long) random() << 31;
+  seed ^= (unsigned long long) random();
+
+  return init_fluere_drawing_seeded(width, height, num_knots,
+                                    style1, style2, seed);
+}
+
+/**
+ * Makes a new fluere drawing, choosing everything else from seed.
+ */
+fluere_drawing_ptr init_fluere_drawing_seeded(
+    int width,
+    int height,
+    int num_knots,
+    fluere_style style1,
+    fluere_style style2,
+    unsigned long long seed )
 {
   fluere_drawing_ptr sd;
+  fluere_random r;
 
   sd = malloc(sizeof(fluere_drawing));
+  if (!sd)
+    return NULL;
+  init_fluere_random(&r, seed);
 
   sd->width = width;
   sd->height = height;
   sd->style1 = style1;
   sd->style2 = style2;
-  sd->leafdiscrete = 1 + 3*(random() % 3);  /* 1,4,7 */
-  sd->raysdiscrete = 1 + 3*(random() % 3);  /* 1,4,7 */
+  sd->seed = seed;
+  sd->leafdiscrete = 1 + 3*random_below(&r, 3);  /* 1,4,7 */
+  sd->raysdiscrete = 1 + 3*random_below(&r, 3);  /* 1,4,7 */
 
   sd->num_knots = num_knots;
   sd->knots = malloc(sizeof(knot) * num_knots);
-  define_knots(sd);
+  if (!sd->knots && num_knots > 0)
+  {
+    free(sd);
+    return NULL;
+  }
+  define_knots(sd, &r);
+  if (!init_knot_packs(sd))
+  {
+    free(sd->knots);
+    free(sd);
+    return NULL;
+  }
+
+  sd->kernels = exact_kernels;
+  sd->tables = NULL;
 
   return sd;
 }
@@ -154,28 +134,99 @@ fluere_drawing_ptr init_fluere_drawing(
  */
 void fill_pixels(fluere_drawing_ptr s,
                  unsigned char* data)
+{
+  fill_pixels_region(s, 0, 0, s->width, s->height, data, s->width);
+}
+
+/**
+ * fills in the w x h rectangle of the drawing whose top left pixel is
+ * (x0, y0).  Row y0 + j goes to data + j * stride; the bytes between
+ * the rows are left alone.
+ */
+void fill_pixels_region(fluere_drawing_ptr s,
+                        int x0,
+                        int y0,
+                        int w,
+                        int h,
+                        unsigned char* data,
+                        int stride)
 {
   int row;
-  int col;
-  point where;
 
-  for (row = 0; row < s->height; ++row)
+  if (w <= 0)
+    return;
+
+  for (row = y0; row < y0 + h; ++row)
   {
-    for (col = 0; col < s->width; ++col)
-    {
-      where.x = col;
-      where.y = row;
-      
-      data[row * s->width + col] = get_value(s, where);
-    }
+    fill_row(s, row, x0, x0 + w, data + (row - y0) * (long) stride);
   }
 }
 
+/**
+ * same as fill_pixels, but uses several threads.
+ *
+ * The drawing is cut into TILE_SIZE x TILE_SIZE tiles, which are handed
+ * out to the threads of the shared pool.  Tiles near knots in the spin and
+ * wave styles cost much more than others, so threads that run out of
+ * tiles steal from the ones that are still busy.
+ */
+void fill_pixels_parallel(fluere_drawing_ptr s,
+                          unsigned char* data,
+                          int nthreads)
+{
+  tile_job job;
+  int tiles_down = (s->height + TILE_SIZE - 1) / TILE_SIZE;
+
+  job.s = s;
+  job.data = data;
+  job.tiles_across = (s->width + TILE_SIZE - 1) / TILE_SIZE;
+
+  run_tiles(get_shared_thread_pool(),
+            job.tiles_across * tiles_down,
+            nthreads,
+            fill_tile,
+            &job);
+}
+
+/**
+ * chooses how the pixel values are computed; see fluere_kernels.
+ * New drawings use exact_kernels.  The tables for table_kernels are
+ * made here, so the first drawing of each size takes a while; if there
+ * isn't enough memory for them, the vector kernels are used instead.
+ */
+void set_fluere_kernels(fluere_drawing_ptr s, fluere_kernels kernels)
+{
+  s->kernels = kernels;
+
+  if (kernels == table_kernels && !s->tables)
+    s->tables = acquire_style_tables(s->width, s->height,
+                                     s->style1, s->style2);
+}
+
+/**
+ * returns the seed the drawing was made from
+ */
+unsigned long long get_fluere_drawing_seed(fluere_drawing_ptr s)
+{
+  return s->seed;
+}
+
+/**
+ * gives the size of the drawing in pixels
+ */
+void get_fluere_drawing_size(fluere_drawing_ptr s, int *width, int *height)
+{
+  *width = s->width;
+  *height = s->height;
+}
+
 /**
  * frees the memory for a fluere drawing
  */
 void delete_fluere_drawing(fluere_drawing_ptr s)
 {
+  release_style_tables(s->tables);
+  delete_knot_packs(s);
   free(s->knots);
   free(s);
 }
@@ -201,22 +252,6 @@ double min(double a, double b)
   return (a < b) ? a : b;
 }
 
-/**
- * returns a random number uniformly in the interval [0,1).
- */
-double drandom()
-{
-  return (double) random() / (double) RAND_MAX;
-}
-
-/**
- * returns 0 or 1 with probability 1/2
- */
-int coinflip()
-{
-  return (random() % 2 == 1);
-}
-
 /*@}*/
 
 /** @name Private drawing functions */
@@ -225,7 +260,7 @@ int coinflip()
 /*
  * Define the locations and characteristics of each of the knots.
  */
-void define_knots(fluere_drawing_ptr s)
+void define_knots(fluere_drawing_ptr s, fluere_random *r)
 {
   int ii;
   double zoom = 1.1;  /* magnification factor */
@@ -239,21 +274,21 @@ void define_knots(fluere_drawing_ptr s)
      * then some knots may lie outside the screen; as zoom --> 0
      * the knots will appear near the center of the screen.
      */
-    s->knots[ii].x = zoom * s->width * drandom() - origin_x;
-    s->knots[ii].y = zoom * s->height * drandom() - origin_y;
+    s->knots[ii].x = zoom * s->width * random_double(r) - origin_x;
+    s->knots[ii].y = zoom * s->height * random_double(r) - origin_y;
 
     /* for each of the drawing types, give a sign for the knot to
      * determine whether colors will be cycling in-or-out, or
      * clockwise-or-counterclockwise.
      */
-    s->knots[ii].flowsign = coinflip() ? 1.0 : -1.0;
-    s->knots[ii].spinsign = coinflip() ? 1.0 : -1.0;
-    s->knots[ii].leafsign = coinflip() ? 1.0 : -1.0;
-    s->knots[ii].rayssign = coinflip() ? 1.0 : -1.0;
-    s->knots[ii].wavesign = coinflip() ? 1.0 : -1.0;
+    s->knots[ii].flowsign = random_coin(r) ? 1.0 : -1.0;
+    s->knots[ii].spinsign = random_coin(r) ? 1.0 : -1.0;
+    s->knots[ii].leafsign = random_coin(r) ? 1.0 : -1.0;
+    s->knots[ii].rayssign = random_coin(r) ? 1.0 : -1.0;
+    s->knots[ii].wavesign = random_coin(r) ? 1.0 : -1.0;
 
     /* for spin: how many "spokes" (palette rotations) will the knot have? */
-    int nspokes = 1 + random() % 7;  /* 1, 2, ..., 7 */
+    int nspokes = 1 + random_below(r, 7);  /* 1, 2, ..., 7 */
     s->knots[ii].sectors = nspokes / (2 * M_PI);
 
     /* also for spin, set the characteristics of the additional 
@@ -261,11 +296,87 @@ void define_knots(fluere_drawing_ptr s)
      * 0, in which case there is no waviness.  The formula for 
      * the exponential decay factor was found to give visually pleasing
      * results. */
-    s->knots[ii].frequency = 6*drandom() + 3; /* 3 to 9 */
-    s->knots[ii].amplitude = coinflip() ? 0 : 
+    s->knots[ii].frequency = 6*random_double(r) + 3; /* 3 to 9 */
+    s->knots[ii].amplitude = random_coin(r) ? 0 : 
         8 * s->knots[ii].frequency / (nspokes*nspokes);
-    s->knots[ii].decay = 20 + drandom()*30;  /* 20 to 50 */
+    s->knots[ii].decay = 20 + random_double(r)*30;  /* 20 to 50 */
+  }
+}
+
+/*
+ * fills in one tile of the image data for fill_pixels_parallel
+ */
+void fill_tile(void *arg, int tile)
+{
+  tile_job *job = arg;
+  fluere_drawing_ptr s = job->s;
+  int row0 = (tile / job->tiles_across) * TILE_SIZE;
+  int col0 = (tile % job->tiles_across) * TILE_SIZE;
+  int row1 = (row0 + TILE_SIZE < s->height) ? row0 + TILE_SIZE : s->height;
+  int col1 = (col0 + TILE_SIZE < s->width) ? col0 + TILE_SIZE : s->width;
+
+  fill_pixels_region(s, col0, row0, col1 - col0, row1 - row0,
+                     job->data + row0 * s->width + col0, s->width);
+}
+
+/*
+ * fills in the pixels col0 .. col1-1 of one row; out[0] is the pixel
+ * at col0.
+ */
+void fill_row(fluere_drawing_ptr s, int row, int col0, int col1,
+              unsigned char *out)
+{
+  int col;
+  point where;
+
+  if (s->kernels == exact_kernels)
+  {
+    for (col = col0; col < col1; ++col)
+    {
+      where.x = col;
+      where.y = row;
+
+      out[col - col0] = get_value(s, where);
+    }
+  }
+  else
+  {
+    /* style1 is on the pixels where row + col is even */
+    int first1 = col0 + ((row + col0) & 1);
+    int first2 = col0 + ((row + col0 + 1) & 1);
+
+    fill_span(s, row, first1, 2, (col1 - first1 + 1) / 2,
+              out + (first1 - col0));
+    fill_span(s, row, first2, 2, (col1 - first2 + 1) / 2,
+              out + (first2 - col0));
+  }
+}
+
+/*
+ * fills in the pixels x0, x0+step, ... of one row, which all have the
+ * same style, with the drawing's kernels
+ */
+void fill_span(fluere_drawing_ptr s, int row, int x0, int step, int count,
+               unsigned char *out)
+{
+  int style = ((row + x0) % 2 == 0) ? s->style1 : s->style2;
+  int ii;
+  point where;
+
+  if (s->kernels == exact_kernels)
+  {
+    for (ii = 0; ii < count; ++ii)
+    {
+      where.x = x0 + step * ii;
+      where.y = row;
+
+      out[step * ii] = get_value(s, where);
+    }
   }
+  else if (s->kernels == table_kernels && s->tables)
+    fill_table_span(s, style, row, x0, step, count, out);
+  else
+    fill_style_span(s, style, row, x0, step, count, out);
 }
 
 /*
@@ -20,11 +20,29 @@ typedef enum
   rays
 } fluere_style;
 
+/** ways to compute the pixel values */
+typedef enum
+{
+  exact_kernels,    /**< one pixel at a time with libm; the reference */
+  vector_kernels,   /**< several pixels at a time with SIMD instructions;
+                         a few pixels may be one index off from exact */
+  table_kernels     /**< each knot's term read from a table of offsets,
+                         with the knots snapped to half pixels; close to
+                         exact, but not the same */
+} fluere_kernels;
+
 typedef struct fluere_drawing_struct *fluere_drawing_ptr;
 
+/**
+ * called by fill_pixels_progressive after each pass, with the pass
+ * just finished (0, 1, ...) and the number of passes
+ */
+typedef void (*fill_progress_function)(void *arg, int pass, int num_passes);
+
 
 /** 
- * Allocates a new fluere drawing 
+ * Allocates a new fluere drawing.  Returns NULL if there isn't the
+ * memory for it.
  */
 fluere_drawing_ptr init_fluere_drawing(
     int width, 
@@ -33,6 +51,32 @@ fluere_drawing_ptr init_fluere_drawing(
     fluere_style style1,
     fluere_style style2 );
 
+/**
+ * Same as init_fluere_drawing, but the knots (and everything else that
+ * is chosen at random) come from seed instead of random(), so the same
+ * arguments always give the same drawing.  This doesn't touch any
+ * shared state, so drawings can be made on several threads at once.
+ * Returns NULL if there isn't the memory for it.
+ */
+fluere_drawing_ptr init_fluere_drawing_seeded(
+    int width,
+    int height,
+    int num_knots,
+    fluere_style style1,
+    fluere_style style2,
+    unsigned long long seed );
+
+/**
+ * Returns the seed a drawing was made from; init_fluere_drawing_seeded
+ * with it and the same size, knots and styles makes the same drawing.
+ */
+unsigned long long get_fluere_drawing_seed(fluere_drawing_ptr s);
+
+/**
+ * Gives the width and height of a drawing, in pixels.
+ */
+void get_fluere_drawing_size(fluere_drawing_ptr s, int *width, int *height);
+
 /** 
  * Fills the array "data" of image data for a fluere drawing.
  * data must already be allocated by the user of size width x height
@@ -44,6 +88,81 @@ fluere_drawing_ptr init_fluere_drawing(
 void fill_pixels(fluere_drawing_ptr s,      /* in */
                  unsigned char* data);      /* out */ 
 
+/**
+ * Same as fill_pixels, but only fills the w x h rectangle whose top
+ * left pixel is (x0, y0), into a buffer with any number of bytes per
+ * row: pixel (x0 + i, y0 + j) goes to data[j * stride + i], and the
+ * rest of the buffer is left alone.  The pixels are exactly the same
+ * as fill_pixels would give, so the drawing can be split into pieces
+ * that are filled separately (say, by different threads or processes)
+ * straight into their place in a frame buffer.  The rectangle may go
+ * past the edges of the drawing; the pattern just carries on.
+ */
+void fill_pixels_region(fluere_drawing_ptr s,    /* in */
+                        int x0,                  /* in */
+                        int y0,                  /* in */
+                        int w,                   /* in */
+                        int h,                   /* in */
+                        unsigned char* data,     /* out */
+                        int stride);             /* in */
+
+/**
+ * Same as fill_pixels, but splits the drawing into tiles and spreads
+ * them over nthreads threads from a pool shared by the whole process.
+ * If nthreads <= 0, one thread per processor is used.  The data is
+ * exactly the same as fill_pixels would give.
+ */
+void fill_pixels_parallel(fluere_drawing_ptr s,   /* in */
+                          unsigned char* data,    /* out */
+                          int nthreads);          /* in */
+
+/**
+ * Same as fill_pixels_parallel, but fills the drawing in passes of
+ * increasing density: first one pixel in 16, then one in 4, then the
+ * rest, without computing any pixel twice.  After the first two passes
+ * the missing pixels are filled in from the nearest pixel of the same
+ * style, so the data always holds a whole (blocky) image, and progress
+ * (if not NULL) is called after each pass so it can be shown.  The
+ * final data is exactly the same as fill_pixels would give.  If there
+ * isn't the memory to start, data is left as it was.
+ */
+void fill_pixels_progressive(fluere_drawing_ptr s,               /* in */
+                             unsigned char* data,                /* out */
+                             int nthreads,                       /* in */
+                             fill_progress_function progress,    /* in */
+                             void *arg);                         /* in */
+
+/**
+ * Same as fill_pixels_parallel, but only computes the pixels where the
+ * drawing isn't smooth.  Elsewhere, flow, wave and spin are bilinearly
+ * interpolated from samples 4 or 8 pixels apart, wherever the samples
+ * say the values (which are turned into pixels with (int) val % 256)
+ * are off by less than max_error; 0.5 or less gives pixels that are
+ * mostly right, and off by one at worst.  Leaf and rays are only
+ * filled in without computing them where the pixels are all the same,
+ * so they come out exact, but save much less.  Near the knots
+ * everything is computed.  Returns the number of pixel values computed,
+ * including the samples, to compare with width x height.
+ */
+long fill_pixels_adaptive(fluere_drawing_ptr s,     /* in */
+                          unsigned char* data,      /* out */
+                          int nthreads,             /* in */
+                          double max_error);        /* in */
+
+/**
+ * Chooses how fill_pixels computes the pixel values.  New drawings
+ * use exact_kernels.
+ */
+void set_fluere_kernels(fluere_drawing_ptr s, fluere_kernels kernels);
+
+/**
+ * Frees the tables kept for table_kernels that no drawing is using.
+ * The tables depend only on the size of the drawing, so they are kept
+ * for the next drawing of the same size until this is called (or a
+ * drawing of another size needs tables).
+ */
+void free_fluere_tables(void);
+
 /**
  * Deletes a fluere drawing
  */
@@ -0,0 +1,513 @@
+/**
+ * \file fluere_expand.c
+ *
+ * \brief Turning the pixels of a drawing into packed color pixels.
+ *
+ * The color table is first made into a table of 256 finished pixels,
+ * so each pixel of the image is then just one lookup and one store.
+ * On x86 the lookups are done eight or sixteen at a time with vector
+ * gathers, and 24-bit pixels are squeezed out of the gathered 32-bit
+ * ones with a shuffle.  An image bigger than EXPAND_STREAM_BYTES is
+ * written with non-temporal stores, which go straight to memory
+ * instead of pushing everything else out of the cache: nothing is
+ * going to read the pixels again until the display or the encoder
+ * does.  The rows are done in bands of EXPAND_BAND on the thread pool.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fluere_expand.h"
+#include "thread_pool.h"
+#include "vector_math.h"
+#include "vector_targets.h"
+
+/** rows expanded as one tile */
+#define EXPAND_BAND 16
+
+/** images with more bytes than this are written past the cache */
+#define EXPAND_STREAM_BYTES (4 << 20)
+
+
+/** expands count pixels; stream says out may be written past the cache */
+typedef void (*expand_kernel)(const fluere_pixel_table *t,
+                              const unsigned char *data,
+                              int count,
+                              unsigned char *out,
+                              int stream);
+
+/** what expand_band needs to know about the image */
+struct expand_job_struct
+{
+  const unsigned char *data;      /**< the pixel values */
+  int width;                      /**< size of the image */
+  int height;
+  const fluere_pixel_table *t;    /**< their pixels */
+  unsigned char *out;             /**< where the rows go */
+  int stride;                     /**< bytes from one row to the next */
+  expand_kernel kernel;           /**< for the table's format */
+  int stream;                     /**< whether to write past the cache */
+};
+typedef struct expand_job_struct expand_job;
+
+/** private declarations */
+
+static expand_kernel get_expand_kernel(fluere_pixel_format format);
+static void expand_band(void *arg, int tile);
+static void expand32_generic(const fluere_pixel_table *t,
+                             const unsigned char *data,
+                             int count,
+                             unsigned char *out,
+                             int stream);
+static void expand24_generic(const fluere_pixel_table *t,
+                             const unsigned char *data,
+                             int count,
+                             unsigned char *out,
+                             int stream);
+static void expand16_generic(const fluere_pixel_table *t,
+                             const unsigned char *data,
+                             int count,
+                             unsigned char *out,
+                             int stream);
+
+
+#if VM_X86
+
+BEGIN_TARGET("avx2")
+
+/**
+ * expand32_generic, eight pixels at a time.
+ */
+static void expand32_avx2(const fluere_pixel_table *t,
+                          const unsigned char *data,
+                          int count,
+                          unsigned char *out,
+                          int stream)
+{
+  const int *pixels = (const int*) t->pixels;
+  int x = 0;
+
+  if (stream)
+  {
+    /* the streaming stores must be aligned */
+    x = (int) ((32 - ((uintptr_t) out & 31)) & 31) / 4;
+    if (x > count)
+      x = count;
+    expand32_generic(t, data, x, out, 0);
+  }
+
+  for (; x + 8 <= count; x += 8)
+  {
+    __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)
+                                                     (data + x)));
+    __m256i p = _mm256_i32gather_epi32(pixels, v, 4);
+
+    if (stream)
+      _mm256_stream_si256((__m256i*) (out + 4 * x), p);
+    else
+      _mm256_storeu_si256((__m256i*) (out + 4 * x), p);
+  }
+
+  expand32_generic(t, data + x, count - x, out + 4 * x, 0);
+}
+
+/**
+ * expand24_generic, eight pixels at a time.  These stores can't be
+ * aligned, so they always go through the cache.
+ */
+static void expand24_avx2(const fluere_pixel_table *t,
+                          const unsigned char *data,
+                          int count,
+                          unsigned char *out,
+                          int stream)
+{
+  const int *pixels = (const int*) t->pixels;
+  const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10,
+                                        12, 13, 14, -1, -1, -1, -1,
+                                        0, 1, 2, 4, 5, 6, 8, 9, 10,
+                                        12, 13, 14, -1, -1, -1, -1);
+  const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  int x;
+
+  (void) stream;
+
+  for (x = 0; x + 8 <= count; x += 8)
+  {
+    __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)
+                                                     (data + x)));
+    __m256i p = _mm256_i32gather_epi32(pixels, v, 4);
+
+    /* 12 bytes at the bottom of each half, then the halves together */
+    p = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(p, pack), join);
+    _mm_storeu_si128((__m128i*) (out + 3 * x), _mm256_castsi256_si128(p));
+    _mm_storel_epi64((__m128i*) (out + 3 * x + 16),
+                     _mm256_extracti128_si256(p, 1));
+  }
+
+  expand24_generic(t, data + x, count - x, out + 3 * x, 0);
+}
+
+/**
+ * expand16_generic, sixteen pixels at a time.
+ */
+static void expand16_avx2(const fluere_pixel_table *t,
+                          const unsigned char *data,
+                          int count,
+                          unsigned char *out,
+                          int stream)
+{
+  const int *pixels = (const int*) t->pixels;
+  int x = 0;
+
+  if (stream)
+  {
+    x = (int) ((32 - ((uintptr_t) out & 31)) & 31) / 2;
+    if (x > count)
+      x = count;
+    expand16_generic(t, data, x, out, 0);
+  }
+
+  for (; x + 16 <= count; x += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*) (data + x));
+    __m256i lo = _mm256_i32gather_epi32(pixels, _mm256_cvtepu8_epi32(v), 4);
+    __m256i hi = _mm256_i32gather_epi32(pixels,
+                                        _mm256_cvtepu8_epi32(
+                                          _mm_srli_si128(v, 8)), 4);
+    /* packing works within each half, so put the quarters back in order */
+    __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+
+    if (stream)
+      _mm256_stream_si256((__m256i*) (out + 2 * x), p);
+    else
+      _mm256_storeu_si256((__m256i*) (out + 2 * x), p);
+  }
+
+  expand16_generic(t, data + x, count - x, out + 2 * x, 0);
+}
+
+/**
+ * Waits for the streaming stores to finish.
+ */
+static void end_streaming_avx2(void)
+{
+  _mm_sfence();
+}
+
+END_TARGET
+
+BEGIN_TARGET("avx512f,avx2")
+
+/**
+ * expand32_generic, sixteen pixels at a time.
+ */
+static void expand32_avx512(const fluere_pixel_table *t,
+                            const unsigned char *data,
+                            int count,
+                            unsigned char *out,
+                            int stream)
+{
+  const int *pixels = (const int*) t->pixels;
+  int x = 0;
+
+  if (stream)
+  {
+    x = (int) ((64 - ((uintptr_t) out & 63)) & 63) / 4;
+    if (x > count)
+      x = count;
+    expand32_generic(t, data, x, out, 0);
+  }
+
+  for (; x + 16 <= count; x += 16)
+  {
+    __m512i v = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)
+                                                     (data + x)));
+    __m512i p = _mm512_i32gather_epi32(v, pixels, 4);
+
+    if (stream)
+      _mm512_stream_si512((void*) (out + 4 * x), p);
+    else
+      _mm512_storeu_si512((void*) (out + 4 * x), p);
+  }
+
+  expand32_avx2(t, data + x, count - x, out + 4 * x, 0);
+}
+
+/**
+ * expand16_generic, sixteen pixels at a time.
+ */
+static void expand16_avx512(const fluere_pixel_table *t,
+                            const unsigned char *data,
+                            int count,
+                            unsigned char *out,
+                            int stream)
+{
+  const int *pixels = (const int*) t->pixels;
+  int x = 0;
+
+  if (stream)
+  {
+    x = (int) ((32 - ((uintptr_t) out & 31)) & 31) / 2;
+    if (x > count)
+      x = count;
+    expand16_generic(t, data, x, out, 0);
+  }
+
+  for (; x + 16 <= count; x += 16)
+  {
+    __m512i v = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)
+                                                     (data + x)));
+    __m256i p = _mm512_cvtepi32_epi16(_mm512_i32gather_epi32(v, pixels, 4));
+
+    if (stream)
+      _mm256_stream_si256((__m256i*) (out + 2 * x), p);
+    else
+      _mm256_storeu_si256((__m256i*) (out + 2 * x), p);
+  }
+
+  expand16_generic(t, data + x, count - x, out + 2 * x, 0);
+}
+
+END_TARGET
+
+#endif
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Returns the bytes in a pixel of a format.
+ */
+int get_fluere_pixel_size(fluere_pixel_format format)
+{
+  switch (format)
+  {
+    case rgb888_pixels:  return 3;
+    case rgb565_pixels:  return 2;
+    default:             return 4;
+  }
+}
+
+/**
+ * Makes the table of pixels.  Each pixel is put together a byte at a
+ * time and copied into its entry, so storing an entry writes the bytes
+ * in the right order whichever way round the machine is.
+ */
+void init_fluere_pixel_table(fluere_pixel_table *t,
+                             const unsigned char *ctable,
+                             int offset,
+                             fluere_pixel_format format)
+{
+  int ii;
+
+  t->format = format;
+  offset &= 255;
+
+  for (ii = 0; ii < 256; ++ii)
+  {
+    const unsigned char *c = ctable + 3 * ((ii + offset) & 255);
+    unsigned char bytes[4] = { 0, 0, 0, 0 };
+    unsigned short rgb565;
+
+    switch (format)
+    {
+      case bgra8888_pixels:
+        bytes[0] = c[2];
+        bytes[1] = c[1];
+        bytes[2] = c[0];
+        bytes[3] = 255;
+        break;
+
+      case rgb565_pixels:
+        /* rounded, so white stays white */
+        rgb565 = ((c[0] * 31 + 127) / 255) << 11
+               | ((c[1] * 63 + 127) / 255) << 5
+               | ((c[2] * 31 + 127) / 255);
+        memcpy(bytes, &rgb565, 2);
+        break;
+
+      default:
+        bytes[0] = c[0];
+        bytes[1] = c[1];
+        bytes[2] = c[2];
+        bytes[3] = (format == rgb888_pixels) ? 0 : 255;
+    }
+
+    memcpy(&t->pixels[ii], bytes, 4);
+  }
+}
+
+/**
+ * Expands a row on the calling thread, through the cache.
+ */
+void expand_fluere_row(const fluere_pixel_table *t,
+                       const unsigned char *data,
+                       int count,
+                       void *out)
+{
+  if (count > 0)
+    get_expand_kernel(t->format)(t, data, count, out, 0);
+}
+
+/**
+ * Expands an image in bands on the thread pool.
+ */
+void expand_fluere_pixels(const unsigned char *data,
+                          int width,
+                          int height,
+                          const fluere_pixel_table *t,
+                          void *out,
+                          int stride,
+                          int nthreads)
+{
+  int size = get_fluere_pixel_size(t->format);
+  expand_job job;
+
+  if (width <= 0 || height <= 0)
+    return;
+
+  job.data = data;
+  job.width = width;
+  job.height = height;
+  job.t = t;
+  job.out = out;
+  job.stride = stride;
+  job.kernel = get_expand_kernel(t->format);
+  /* only the vector kernels stream, and they need every pixel on its
+     own boundary */
+  job.stream = ((size_t) stride * height > EXPAND_STREAM_BYTES
+                && get_vector_isa() >= avx2_isa
+                && size != 3
+                && ((uintptr_t) out | (uintptr_t) stride) % size == 0);
+
+  run_tiles(get_shared_thread_pool(),
+            (height + EXPAND_BAND - 1) / EXPAND_BAND, nthreads,
+            expand_band, &job);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Returns the kernel for a format, for the instruction set chosen by
+ * vector_math.  SSE2 has no gather, so it gets the plain kernels.
+ */
+static expand_kernel get_expand_kernel(fluere_pixel_format format)
+{
+  int bytes = get_fluere_pixel_size(format);
+
+  switch (get_vector_isa())
+  {
+#if VM_X86
+    case avx512_isa:
+      return (bytes == 4) ? expand32_avx512
+           : (bytes == 3) ? expand24_avx2 : expand16_avx512;
+    case avx2_isa:
+      return (bytes == 4) ? expand32_avx2
+           : (bytes == 3) ? expand24_avx2 : expand16_avx2;
+#endif
+    default:
+      return (bytes == 4) ? expand32_generic
+           : (bytes == 3) ? expand24_generic : expand16_generic;
+  }
+}
+
+/**
+ * Expands one band of rows.
+ */
+static void expand_band(void *arg, int tile)
+{
+  expand_job *job = arg;
+  int row0 = tile * EXPAND_BAND;
+  int row1 = (row0 + EXPAND_BAND < job->height) ? row0 + EXPAND_BAND
+                                                 : job->height;
+  int row;
+
+  for (row = row0; row < row1; ++row)
+    job->kernel(job->t, job->data + (size_t) row * job->width, job->width,
+                job->out + (size_t) row * job->stride, job->stream);
+
+#if VM_X86
+  /* another thread is going to use the pixels once the tiles are done */
+  if (job->stream)
+    end_streaming_avx2();
+#endif
+}
+
+/**
+ * Expands count pixels of 4 bytes.
+ */
+static void expand32_generic(const fluere_pixel_table *t,
+                             const unsigned char *data,
+                             int count,
+                             unsigned char *out,
+                             int stream)
+{
+  const unsigned int *pixels = t->pixels;
+  int x;
+
+  (void) stream;
+
+  for (x = 0; x + 4 <= count; x += 4)
+  {
+    unsigned int p[4];
+
+    p[0] = pixels[data[x]];
+    p[1] = pixels[data[x + 1]];
+    p[2] = pixels[data[x + 2]];
+    p[3] = pixels[data[x + 3]];
+    memcpy(out + 4 * x, p, sizeof(p));
+  }
+
+  for (; x < count; ++x)
+    memcpy(out + 4 * x, &pixels[data[x]], 4);
+}
+
+/**
+ * Expands count pixels of 3 bytes.  Every pixel but the last is
+ * written as 4 bytes, the fourth of which the next pixel overwrites.
+ */
+static void expand24_generic(const fluere_pixel_table *t,
+                             const unsigned char *data,
+                             int count,
+                             unsigned char *out,
+                             int stream)
+{
+  const unsigned int *pixels = t->pixels;
+  int x;
+
+  (void) stream;
+
+  if (count <= 0)
+    return;
+
+  for (x = 0; x < count - 1; ++x)
+    memcpy(out + 3 * x, &pixels[data[x]], 4);
+
+  memcpy(out + 3 * x, &pixels[data[x]], 3);
+}
+
+/**
+ * Expands count pixels of 2 bytes.
+ */
+static void expand16_generic(const fluere_pixel_table *t,
+                             const unsigned char *data,
+                             int count,
+                             unsigned char *out,
+                             int stream)
+{
+  const unsigned int *pixels = t->pixels;
+  int x;
+
+  (void) stream;
+
+  for (x = 0; x < count; ++x)
+    memcpy(out + 2 * x, &pixels[data[x]], 2);
+}
+
+/*@}*/
@@ -0,0 +1,77 @@
+/**
+ * \file fluere_expand.h
+ *
+ * \brief Turning the pixels of a drawing into packed color pixels, for
+ * showing them (or writing them) anywhere that doesn't take an indexed
+ * image.
+ *
+ * The colors come from a color table made by get_colortable, turned by
+ * an offset the way the screen saver cycles them: pixel value v gets
+ * color (v + offset) % 256, as with colortable + 3 * offset.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_EXPAND_H
+#define FLUERE_EXPAND_H
+
+
+/** layouts of packed pixels, by the order of their bytes in memory */
+typedef enum
+{
+  rgba8888_pixels,  /**< red, green, blue, 255 */
+  bgra8888_pixels,  /**< blue, green, red, 255 */
+  rgb888_pixels,    /**< red, green, blue */
+  rgb565_pixels     /**< 16 bits in the machine's byte order: red in the
+                         top 5, green in the middle 6, blue in the low 5 */
+} fluere_pixel_format;
+
+/** a color table made into packed pixels of one format */
+struct fluere_pixel_table_struct
+{
+  fluere_pixel_format format;   /**< the layout */
+  unsigned int pixels[256];     /**< each value's pixel, in the low bytes
+                                     in memory order */
+};
+typedef struct fluere_pixel_table_struct fluere_pixel_table;
+
+
+/**
+ * Returns the bytes in a pixel of a format.
+ */
+int get_fluere_pixel_size(fluere_pixel_format format);
+
+/**
+ * Makes t from the first 256 colors of ctable (red, green and blue
+ * bytes), turned by offset.  This is cheap enough to do every frame.
+ */
+void init_fluere_pixel_table(fluere_pixel_table *t,
+                             const unsigned char *ctable,
+                             int offset,
+                             fluere_pixel_format format);
+
+/**
+ * Expands count pixel values into packed pixels at out, on the calling
+ * thread.
+ */
+void expand_fluere_row(const fluere_pixel_table *t,
+                       const unsigned char *data,
+                       int count,
+                       void *out);
+
+/**
+ * Expands a width x height image, into rows of stride bytes at out,
+ * on nthreads threads from the shared pool (one per processor if
+ * nthreads <= 0).  Large images are written past the cache, since they
+ * are on their way to a display or a file.
+ */
+void expand_fluere_pixels(const unsigned char *data,
+                          int width,
+                          int height,
+                          const fluere_pixel_table *t,
+                          void *out,
+                          int stride,
+                          int nthreads);
+
+
+#endif
@@ -0,0 +1,626 @@
+/**
+ * \file fluere_export.c
+ *
+ * \brief Writing filled drawings as PPM, PGM and PNG files.
+ *
+ * A PNG's rows are filtered and compressed in bands of PNG_BAND rows
+ * on the thread pool.  Each band is a raw deflate stream of its own
+ * that ends byte aligned (with a sync flush, or with stored blocks),
+ * so the bands can just be put one after another, with the zlib
+ * header in front and the Adler-32 of all the rows, put together from
+ * the bands' checksums, behind.  Each band goes in an IDAT chunk of
+ * its own.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "fluere_export.h"
+#include "fluere_expand.h"
+#include "thread_pool.h"
+
+/** rows of a PNG filtered and compressed as one piece */
+#define PNG_BAND 64
+
+/** the most bytes a stored deflate block holds */
+#define STORED_BLOCK 65535
+
+/** the modulus of Adler-32 */
+#define ADLER_BASE 65521
+
+/** the most bytes Adler-32 can add up before its sums must be reduced */
+#define ADLER_NMAX 5552
+
+
+/** one compressed band of a PNG */
+struct png_piece_struct
+{
+  unsigned char *bytes;   /**< the deflate stream */
+  size_t size;            /**< bytes in it */
+  size_t length;          /**< bytes of filtered rows it holds */
+  unsigned long adler;    /**< Adler-32 of the filtered rows */
+};
+typedef struct png_piece_struct png_piece;
+
+/** what compress_band needs to know about the image */
+struct png_job_struct
+{
+  const unsigned char *data;    /**< the pixels */
+  const unsigned char *colors;  /**< or 24-bit colors, if not NULL */
+  int width;                    /**< width of the image */
+  int height;                   /**< height of the image */
+  const unsigned char *ctable;  /**< the colors, for the palette */
+  fluere_pixel_table colors24;  /**< and as 24-bit pixels, for rgb */
+  int rgb;                      /**< whether to write 24-bit color */
+  int level;                    /**< zlib level, or 0 to store */
+  png_piece *pieces;            /**< one for each band */
+  int failed;                   /**< set if a band ran out of memory */
+};
+typedef struct png_job_struct png_job;
+
+/** a file being written, a chunk at a time */
+struct png_writer_struct
+{
+  FILE *f;                    /**< where it goes */
+  unsigned long crc;          /**< CRC-32 of the chunk so far */
+  unsigned long table[256];   /**< for computing the CRC */
+};
+typedef struct png_writer_struct png_writer;
+
+/** private declarations */
+
+static int write_png(FILE *f, png_job *job, int nthreads);
+static void compress_band(void *arg, int tile);
+static const unsigned char* get_rgb_row(png_job *job,
+                                        int row,
+                                        unsigned char *buf);
+static void filter_rgb_row(const unsigned char *cur,
+                           const unsigned char *prev,
+                           int n,
+                           unsigned char *out,
+                           unsigned char *scratch);
+static size_t store_band(const unsigned char *raw,
+                         size_t length,
+                         int last,
+                         unsigned char *out);
+static unsigned long get_adler(const unsigned char *bytes, size_t n);
+static unsigned long combine_adler(unsigned long adler1,
+                                   unsigned long adler2,
+                                   size_t length2);
+static void begin_chunk(png_writer *w, const char *type, size_t length);
+static void add_to_chunk(png_writer *w, const unsigned char *bytes, size_t n);
+static void end_chunk(png_writer *w);
+static void put_u32(unsigned char *p, unsigned long v);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Writes the pixels as a binary PPM or PGM file.
+ */
+int write_fluere_pnm(FILE *f,
+                     const unsigned char *data,
+                     int width,
+                     int height,
+                     const unsigned char *ctable)
+{
+  fluere_pixel_table colors24;
+  unsigned char *row;
+  int y;
+
+  fprintf(f, "%s\n%d %d\n255\n", ctable ? "P6" : "P5", width, height);
+
+  if (!ctable)
+  {
+    fwrite(data, 1, (size_t) width * height, f);
+    return !ferror(f);
+  }
+
+  row = malloc((size_t) 3 * width);
+  if (!row)
+    return 0;
+
+  init_fluere_pixel_table(&colors24, ctable, 0, rgb888_pixels);
+
+  for (y = 0; y < height; ++y)
+  {
+    expand_fluere_row(&colors24, data + (size_t) y * width, width, row);
+    fwrite(row, 1, (size_t) 3 * width, f);
+  }
+
+  free(row);
+
+  return !ferror(f);
+}
+
+/**
+ * Writes the pixels as a PNG file.
+ */
+int write_fluere_png(FILE *f,
+                     const unsigned char *data,
+                     int width,
+                     int height,
+                     const unsigned char *ctable,
+                     int rgb,
+                     int level,
+                     int nthreads)
+{
+  png_job job;
+
+  job.data = data;
+  job.colors = NULL;
+  job.width = width;
+  job.height = height;
+  job.ctable = ctable;
+  job.rgb = rgb && ctable;
+  job.level = level;
+  if (job.rgb)
+    init_fluere_pixel_table(&job.colors24, ctable, 0, rgb888_pixels);
+
+  return write_png(f, &job, nthreads);
+}
+
+/**
+ * Writes 24-bit colors as a PNG file.
+ */
+int write_fluere_rgb_png(FILE *f,
+                         const unsigned char *colors,
+                         int width,
+                         int height,
+                         int level,
+                         int nthreads)
+{
+  png_job job;
+
+  job.data = NULL;
+  job.colors = colors;
+  job.width = width;
+  job.height = height;
+  job.ctable = NULL;
+  job.rgb = 1;
+  job.level = level;
+
+  return write_png(f, &job, nthreads);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Compresses the image that job describes and writes it as a PNG file.
+ */
+static int write_png(FILE *f, png_job *job, int nthreads)
+{
+  static const unsigned char signature[8] =
+    { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  int num_bands = (job->height + PNG_BAND - 1) / PNG_BAND;
+  unsigned char header[13];
+  unsigned char bytes[4];
+  unsigned long adler = 1;
+  png_writer w;
+  int ok;
+  int ii;
+
+  if (job->width <= 0 || job->height <= 0)
+    return 0;
+
+#ifndef HAVE_ZLIB
+  job->level = 0;
+#endif
+  if (job->level > 9)
+    job->level = 9;
+
+  job->failed = 0;
+  job->pieces = calloc(num_bands, sizeof(png_piece));
+  if (!job->pieces)
+    return 0;
+
+  run_tiles(get_shared_thread_pool(), num_bands, nthreads, compress_band,
+            job);
+
+  ok = !job->failed;
+  if (ok)
+  {
+    w.f = f;
+    for (ii = 0; ii < 256; ++ii)
+    {
+      unsigned long c = ii;
+      int k;
+
+      for (k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+      w.table[ii] = c;
+    }
+
+    fwrite(signature, 1, sizeof(signature), f);
+
+    put_u32(header, job->width);
+    put_u32(header + 4, job->height);
+    header[8] = 8;
+    header[9] = job->rgb ? 2 : job->ctable ? 3 : 0;
+    header[10] = 0;
+    header[11] = 0;
+    header[12] = 0;
+    begin_chunk(&w, "IHDR", sizeof(header));
+    add_to_chunk(&w, header, sizeof(header));
+    end_chunk(&w);
+
+    if (job->ctable && !job->rgb)
+    {
+      begin_chunk(&w, "PLTE", 3 * 256);
+      add_to_chunk(&w, job->ctable, 3 * 256);
+      end_chunk(&w);
+    }
+
+    for (ii = 0; ii < num_bands; ++ii)
+    {
+      png_piece *piece = job->pieces + ii;
+      int first = (ii == 0);
+      int last = (ii == num_bands - 1);
+
+      adler = combine_adler(adler, piece->adler, piece->length);
+
+      begin_chunk(&w, "IDAT", piece->size + 2 * first + 4 * last);
+      if (first)
+      {
+        /* the zlib header; the second byte tells roughly which level */
+        bytes[0] = 0x78;
+        bytes[1] = (job->level <= 1) ? 0x01 : (job->level <= 5) ? 0x5e
+                 : (job->level == 6) ? 0x9c : 0xda;
+        add_to_chunk(&w, bytes, 2);
+      }
+      add_to_chunk(&w, piece->bytes, piece->size);
+      if (last)
+      {
+        put_u32(bytes, adler);
+        add_to_chunk(&w, bytes, 4);
+      }
+      end_chunk(&w);
+    }
+
+    begin_chunk(&w, "IEND", 0);
+    end_chunk(&w);
+
+    ok = !ferror(f);
+  }
+
+  for (ii = 0; ii < num_bands; ++ii)
+    free(job->pieces[ii].bytes);
+  free(job->pieces);
+
+  return ok;
+}
+
+/**
+ * Filters one band of rows and compresses them into its piece.
+ */
+static void compress_band(void *arg, int tile)
+{
+  png_job *job = arg;
+  png_piece *piece = job->pieces + tile;
+  int width = job->width;
+  int row0 = tile * PNG_BAND;
+  int row1 = (row0 + PNG_BAND < job->height) ? row0 + PNG_BAND
+                                              : job->height;
+  int last = (row1 == job->height);
+  size_t row_bytes = (size_t) (job->rgb ? 3 : 1) * width;
+  size_t length = (row1 - row0) * (row_bytes + 1);
+  unsigned char *raw = malloc(length);
+  unsigned char *out = raw;
+  size_t bound;
+  int row;
+
+  if (!raw)
+  {
+    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  if (job->rgb)
+  {
+    unsigned char *rows = malloc(7 * row_bytes);
+    const unsigned char *prev;
+    const unsigned char *cur;
+
+    if (!rows)
+    {
+      free(raw);
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+      return;
+    }
+
+    if (row0 > 0)
+      prev = get_rgb_row(job, row0 - 1, rows);
+    else
+    {
+      memset(rows, 0, row_bytes);
+      prev = rows;
+    }
+
+    for (row = row0; row < row1; ++row)
+    {
+      /* the two rows take turns in the buffers */
+      cur = get_rgb_row(job, row, rows + ((row - row0 + 1) & 1) * row_bytes);
+      filter_rgb_row(cur, prev, (int) row_bytes, out, rows + 2 * row_bytes);
+      out += row_bytes + 1;
+      prev = cur;
+    }
+
+    free(rows);
+  }
+  else
+  {
+    /* the PNG spec suggests no filtering for indexed images */
+    for (row = row0; row < row1; ++row)
+    {
+      *out++ = 0;
+      memcpy(out, job->data + (size_t) row * width, row_bytes);
+      out += row_bytes;
+    }
+  }
+
+  piece->length = length;
+  piece->adler = get_adler(raw, length);
+
+  bound = length + 5 * (length / STORED_BLOCK + 1);
+
+#ifdef HAVE_ZLIB
+  if (job->level > 0)
+  {
+    z_stream z;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, job->level, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) == Z_OK)
+    {
+      /* room for the sync flush's empty block, too */
+      bound = deflateBound(&z, length) + 16;
+      piece->bytes = malloc(bound);
+      if (piece->bytes)
+      {
+        z.next_in = raw;
+        z.avail_in = length;
+        z.next_out = piece->bytes;
+        z.avail_out = bound;
+        deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+        piece->size = bound - z.avail_out;
+        if (z.avail_in != 0)
+        {
+          free(piece->bytes);
+          piece->bytes = NULL;
+        }
+      }
+      deflateEnd(&z);
+    }
+    free(raw);
+
+    if (!piece->bytes)
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+#endif
+
+  piece->bytes = malloc(bound);
+  if (piece->bytes)
+    piece->size = store_band(raw, length, last, piece->bytes);
+  else
+    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+
+  free(raw);
+}
+
+/**
+ * Filters a row of n bytes of 24-bit color into out, with the filter
+ * type in front, using whichever of the five PNG filters gives the
+ * smallest sum of the bytes taken as signed differences.  prev is the
+ * row above (all zeros for the first row), and scratch has room for
+ * 5n bytes.
+ */
+static void filter_rgb_row(const unsigned char *cur,
+                           const unsigned char *prev,
+                           int n,
+                           unsigned char *out,
+                           unsigned char *scratch)
+{
+  long best_sum = -1;
+  int best = 0;
+  int type;
+  int ii;
+
+  for (type = 0; type < 5; ++type)
+  {
+    unsigned char *f = scratch + (size_t) type * n;
+    long sum = 0;
+
+    for (ii = 0; ii < n; ++ii)
+    {
+      int a = (ii >= 3) ? cur[ii - 3] : 0;
+      int b = prev[ii];
+      int c = (ii >= 3) ? prev[ii - 3] : 0;
+      int pred;
+
+      switch (type)
+      {
+        case 0: pred = 0; break;
+        case 1: pred = a; break;
+        case 2: pred = b; break;
+        case 3: pred = (a + b) >> 1; break;
+        default:
+        {
+          int p = a + b - c;
+          int pa = abs(p - a);
+          int pb = abs(p - b);
+          int pc = abs(p - c);
+
+          pred = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+          break;
+        }
+      }
+
+      f[ii] = (unsigned char) (cur[ii] - pred);
+      sum += abs((signed char) f[ii]);
+    }
+
+    if (best_sum < 0 || sum < best_sum)
+    {
+      best_sum = sum;
+      best = type;
+    }
+  }
+
+  out[0] = best;
+  memcpy(out + 1, scratch + (size_t) best * n, n);
+}
+
+/**
+ * Returns row of the image in 24-bit color: straight from the colors
+ * if the job has them, and otherwise looked up into buf.
+ */
+static const unsigned char* get_rgb_row(png_job *job,
+                                        int row,
+                                        unsigned char *buf)
+{
+  if (job->colors)
+    return job->colors + (size_t) 3 * job->width * row;
+
+  expand_fluere_row(&job->colors24, job->data + (size_t) job->width * row,
+                    job->width, buf);
+  return buf;
+}
+
+/**
+ * Writes length bytes as stored deflate blocks, the last of them
+ * marked final if last is set.  Returns the number of bytes written.
+ */
+static size_t store_band(const unsigned char *raw,
+                         size_t length,
+                         int last,
+                         unsigned char *out)
+{
+  unsigned char *start = out;
+  size_t done = 0;
+
+  do
+  {
+    size_t n = (length - done < STORED_BLOCK) ? length - done
+                                              : STORED_BLOCK;
+
+    out[0] = (last && done + n == length) ? 1 : 0;
+    out[1] = n & 0xff;
+    out[2] = n >> 8;
+    out[3] = ~n & 0xff;
+    out[4] = (~n >> 8) & 0xff;
+    memcpy(out + 5, raw + done, n);
+    out += 5 + n;
+    done += n;
+  } while (done < length);
+
+  return out - start;
+}
+
+/**
+ * Returns the Adler-32 of n bytes.
+ */
+static unsigned long get_adler(const unsigned char *bytes, size_t n)
+{
+  unsigned long a = 1;
+  unsigned long b = 0;
+
+  while (n > 0)
+  {
+    size_t k = (n < ADLER_NMAX) ? n : ADLER_NMAX;
+
+    n -= k;
+    while (k-- > 0)
+    {
+      a += *bytes++;
+      b += a;
+    }
+    a %= ADLER_BASE;
+    b %= ADLER_BASE;
+  }
+
+  return (b << 16) | a;
+}
+
+/**
+ * Returns the Adler-32 of two runs of bytes put together, from the
+ * Adler-32 of each and the length of the second.
+ */
+static unsigned long combine_adler(unsigned long adler1,
+                                   unsigned long adler2,
+                                   size_t length2)
+{
+  unsigned long n = length2 % ADLER_BASE;
+  unsigned long a1 = adler1 & 0xffff;
+  unsigned long b1 = adler1 >> 16;
+  unsigned long a2 = adler2 & 0xffff;
+  unsigned long b2 = adler2 >> 16;
+  unsigned long a = (a1 + a2 + ADLER_BASE - 1) % ADLER_BASE;
+  unsigned long b = (b1 + b2 + n * ((a1 + ADLER_BASE - 1) % ADLER_BASE))
+                    % ADLER_BASE;
+
+  return (b << 16) | a;
+}
+
+/**
+ * Writes the length and type of a chunk, and starts its CRC.
+ */
+static void begin_chunk(png_writer *w, const char *type, size_t length)
+{
+  unsigned char bytes[4];
+
+  put_u32(bytes, length);
+  fwrite(bytes, 1, 4, w->f);
+
+  w->crc = 0xffffffffUL;
+  add_to_chunk(w, (const unsigned char *) type, 4);
+}
+
+/**
+ * Writes bytes of a chunk, adding them to its CRC.
+ */
+static void add_to_chunk(png_writer *w, const unsigned char *bytes, size_t n)
+{
+  unsigned long crc = w->crc;
+  size_t ii;
+
+  for (ii = 0; ii < n; ++ii)
+    crc = w->table[(crc ^ bytes[ii]) & 0xff] ^ (crc >> 8);
+  w->crc = crc;
+
+  fwrite(bytes, 1, n, w->f);
+}
+
+/**
+ * Writes the CRC at the end of a chunk.
+ */
+static void end_chunk(png_writer *w)
+{
+  unsigned char bytes[4];
+
+  put_u32(bytes, w->crc ^ 0xffffffffUL);
+  fwrite(bytes, 1, 4, w->f);
+}
+
+/**
+ * Stores a 32-bit number big endian, as PNG wants.
+ */
+static void put_u32(unsigned char *p, unsigned long v)
+{
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+/*@}*/
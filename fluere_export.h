@@ -0,0 +1,61 @@
+/**
+ * \file fluere_export.h
+ *
+ * \brief Writing filled drawings as image files.
+ *
+ * The pixels are the width x height indices that fill_pixels gives,
+ * and ctable is a color table made by get_colortable: 256 colors of
+ * red, green and blue (only the first 768 bytes are used).
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_EXPORT_H
+#define FLUERE_EXPORT_H
+
+#include <stdio.h>
+
+
+/**
+ * Writes the pixels as a binary PPM file, with the colors from ctable,
+ * or as a binary PGM file of the indices themselves if ctable is NULL.
+ * Returns 1 if it was written.
+ */
+int write_fluere_pnm(FILE *f,
+                     const unsigned char *data,
+                     int width,
+                     int height,
+                     const unsigned char *ctable);
+
+/**
+ * Writes the pixels as a PNG file: with rgb set, as 24-bit color from
+ * ctable; otherwise as an indexed image with ctable for its palette,
+ * or as gray levels of the indices if ctable is NULL.  level is the
+ * zlib compression level, 1 to 9, or 0 to store the pixels without
+ * compressing them (which is all that can be done when this is built
+ * without zlib).  The rows are compressed in pieces on nthreads
+ * threads from the shared pool (one per processor if nthreads <= 0).
+ * Returns 1 if it was written.
+ */
+int write_fluere_png(FILE *f,
+                     const unsigned char *data,
+                     int width,
+                     int height,
+                     const unsigned char *ctable,
+                     int rgb,
+                     int level,
+                     int nthreads);
+
+/**
+ * Same as write_fluere_png, but for an image that's already in 24-bit
+ * color: width x height pixels of red, green and blue bytes.
+ */
+int write_fluere_rgb_png(FILE *f,
+                         const unsigned char *colors,
+                         int width,
+                         int height,
+                         int level,
+                         int nthreads);
+
+
+#endif
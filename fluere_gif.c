@@ -0,0 +1,308 @@
+/**
+ * \file fluere_gif.c
+ *
+ * \brief Writing a drawing as an animated GIF.
+ *
+ * The pixels are LZW compressed once, 8 bits to a value, straight into
+ * the 255-byte sub-blocks a GIF keeps its image data in, and the same
+ * bytes are then written for every frame.  The LZW table is found
+ * through a hash of (prefix code, value) pairs, and once it has all
+ * 4096 codes it's cleared and started again, which is what most
+ * encoders do and what every decoder expects.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fluere_gif.h"
+
+/** LZW codes are at most this many bits */
+#define LZW_MAX_BITS 12
+
+/** the codes that mean clear the table and end of data, with 8-bit
+    values */
+#define LZW_CLEAR 256
+#define LZW_END 257
+
+/** slots in the hash table; a power of 2, half again as many as the
+    codes it holds */
+#define LZW_HASH_BITS 13
+#define LZW_HASH_SIZE (1 << LZW_HASH_BITS)
+
+/** bytes in a sub-block of image data */
+#define SUB_BLOCK 255
+
+
+/** the compressed pixels, as they're being made */
+struct lzw_stream_struct
+{
+  unsigned char *bytes;   /**< sub-blocks, each with its length first */
+  size_t size;            /**< bytes in it */
+  size_t capacity;        /**< room for them */
+  size_t block;           /**< where the open sub-block's length is */
+  unsigned long bits;     /**< bits not yet written */
+  int num_bits;           /**< how many */
+  int failed;             /**< set if it ran out of memory */
+};
+typedef struct lzw_stream_struct lzw_stream;
+
+/** private declarations */
+
+static unsigned char *compress_pixels(const unsigned char *data,
+                                      size_t n,
+                                      size_t *size);
+static void put_code(lzw_stream *z, int code, int code_bits);
+static void put_byte(lzw_stream *z, int byte);
+static void put_u16(FILE *f, int v);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Writes the GIF.
+ */
+int write_fluere_gif(FILE *f,
+                     const unsigned char *data,
+                     int width,
+                     int height,
+                     const unsigned char *ctable,
+                     int num_frames,
+                     int step,
+                     int delay)
+{
+  static const unsigned char looping[19] =
+    { 0x21, 0xff, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E',
+      '2', '.', '0', 3, 1, 0, 0, 0 };
+  unsigned char colors[256 * 3];
+  unsigned char *image;
+  size_t size;
+  int frame;
+  int ii;
+
+  if (width <= 0 || height <= 0 || width > 65535 || height > 65535 ||
+      num_frames < 1)
+    return 0;
+
+  image = compress_pixels(data, (size_t) width * height, &size);
+  if (!image)
+    return 0;
+
+  fwrite("GIF89a", 1, 6, f);
+  put_u16(f, width);
+  put_u16(f, height);
+  /* no global color table; every frame has its own */
+  putc(0, f);
+  putc(0, f);
+  putc(0, f);
+
+  if (num_frames > 1)
+    fwrite(looping, 1, sizeof(looping), f);
+
+  for (frame = 0; frame < num_frames && !ferror(f); ++frame)
+  {
+    int offset = (int) (((long long) frame * step % 256 + 256) % 256);
+
+    if (num_frames > 1)
+    {
+      /* the graphic control extension: leave the frame in place, for
+         delay */
+      putc(0x21, f);
+      putc(0xf9, f);
+      putc(4, f);
+      putc(1 << 2, f);
+      put_u16(f, delay);
+      putc(0, f);
+      putc(0, f);
+    }
+
+    /* the whole image, with 256 colors of its own */
+    putc(0x2c, f);
+    put_u16(f, 0);
+    put_u16(f, 0);
+    put_u16(f, width);
+    put_u16(f, height);
+    putc(0x80 | 7, f);
+
+    for (ii = 0; ii < 256; ++ii)
+      memcpy(colors + 3 * ii, ctable + 3 * ((ii + offset) & 255), 3);
+    fwrite(colors, 1, sizeof(colors), f);
+
+    putc(8, f);
+    fwrite(image, 1, size, f);
+  }
+
+  putc(0x3b, f);
+
+  free(image);
+
+  return !ferror(f);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Compresses n pixel values, into sub-blocks ending with an empty one.
+ * Returns them (to be freed), and their size in size, or NULL if it
+ * runs out of memory.
+ */
+static unsigned char *compress_pixels(const unsigned char *data,
+                                      size_t n,
+                                      size_t *size)
+{
+  /* each slot holds a (prefix, value) pair plus one, or 0 if empty */
+  unsigned int *keys = calloc(LZW_HASH_SIZE, sizeof(unsigned int));
+  unsigned short *codes = malloc(LZW_HASH_SIZE * sizeof(unsigned short));
+  lzw_stream z;
+  int next_code = LZW_END + 1;
+  int code_bits = 9;
+  int prefix;
+  size_t ii;
+
+  memset(&z, 0, sizeof(z));
+  z.capacity = n / 2 + 1024;
+  z.bytes = malloc(z.capacity);
+  if (!keys || !codes || !z.bytes)
+  {
+    free(keys);
+    free(codes);
+    free(z.bytes);
+    return NULL;
+  }
+
+  put_code(&z, LZW_CLEAR, code_bits);
+
+  prefix = data[0];
+  for (ii = 1; ii < n; ++ii)
+  {
+    int value = data[ii];
+    unsigned int key = ((unsigned int) prefix << 8 | value) + 1;
+    unsigned int slot = (key * 2654435761u) >> (32 - LZW_HASH_BITS);
+
+    while (keys[slot] != 0 && keys[slot] != key)
+      slot = (slot + 1) & (LZW_HASH_SIZE - 1);
+
+    if (keys[slot] == key)
+    {
+      prefix = codes[slot];
+      continue;
+    }
+
+    /* the decoder makes each code a step behind, so the codes only
+       get wider once it has used up the narrower ones too */
+    if (next_code > (1 << code_bits) && code_bits < LZW_MAX_BITS)
+      code_bits++;
+    put_code(&z, prefix, code_bits);
+
+    if (next_code < (1 << LZW_MAX_BITS))
+    {
+      keys[slot] = key;
+      codes[slot] = next_code++;
+    }
+    else
+    {
+      put_code(&z, LZW_CLEAR, code_bits);
+      memset(keys, 0, LZW_HASH_SIZE * sizeof(unsigned int));
+      next_code = LZW_END + 1;
+      code_bits = 9;
+    }
+
+    prefix = value;
+  }
+
+  if (next_code > (1 << code_bits) && code_bits < LZW_MAX_BITS)
+    code_bits++;
+  put_code(&z, prefix, code_bits);
+  if (next_code + 1 > (1 << code_bits) && code_bits < LZW_MAX_BITS)
+    code_bits++;
+  put_code(&z, LZW_END, code_bits);
+
+  /* the last bits, the open sub-block's length and the empty one */
+  if (z.num_bits > 0)
+    put_byte(&z, z.bits & 0xff);
+  if (z.size > z.block)
+    z.bytes[z.block] = z.size - z.block - 1;
+  z.bytes[z.size++] = 0;
+
+  free(keys);
+  free(codes);
+
+  if (z.failed)
+  {
+    free(z.bytes);
+    return NULL;
+  }
+
+  *size = z.size;
+  return z.bytes;
+}
+
+/**
+ * Adds a code, code_bits wide, lowest bits first.
+ */
+static void put_code(lzw_stream *z, int code, int code_bits)
+{
+  z->bits |= (unsigned long) code << z->num_bits;
+  z->num_bits += code_bits;
+
+  while (z->num_bits >= 8)
+  {
+    put_byte(z, z->bits & 0xff);
+    z->bits >>= 8;
+    z->num_bits -= 8;
+  }
+}
+
+/**
+ * Adds a byte of image data, starting a new sub-block when the last
+ * one is full.  There's always room left for the empty sub-block at
+ * the end.
+ */
+static void put_byte(lzw_stream *z, int byte)
+{
+  if (z->failed)
+    return;
+
+  if (z->size + 3 > z->capacity)
+  {
+    unsigned char *bytes = realloc(z->bytes, 2 * z->capacity);
+
+    if (!bytes)
+    {
+      z->failed = 1;
+      return;
+    }
+    z->bytes = bytes;
+    z->capacity *= 2;
+  }
+
+  if (z->size == z->block)
+  {
+    /* room for the new sub-block's length, filled in when it's full */
+    z->size++;
+  }
+
+  z->bytes[z->size++] = byte;
+
+  if (z->size - z->block - 1 == SUB_BLOCK)
+  {
+    z->bytes[z->block] = SUB_BLOCK;
+    z->block = z->size;
+  }
+}
+
+/**
+ * Writes a 16-bit number, low byte first.
+ */
+static void put_u16(FILE *f, int v)
+{
+  putc(v & 0xff, f);
+  putc((v >> 8) & 0xff, f);
+}
+
+/*@}*/
@@ -0,0 +1,40 @@
+/**
+ * \file fluere_gif.h
+ *
+ * \brief Writing a drawing as an animated GIF, its colors cycling the
+ * way the screen saver cycles them.
+ *
+ * Every frame has the same pixels and only the colors move, so the
+ * pixels are compressed once, and each frame is that same compressed
+ * data after a color table of its own.  Writing many frames takes not
+ * much longer than writing one.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_GIF_H
+#define FLUERE_GIF_H
+
+#include <stdio.h>
+
+
+/**
+ * Writes the pixels as a GIF of num_frames frames that loops forever.
+ * Frame k shows pixel value v in color (v + k * step) % 256 of ctable
+ * (a color table made by get_colortable; only its first 768 bytes are
+ * used), for delay hundredths of a second.  So 128 frames with a step
+ * of 2 and a delay of 3 make one whole cycle at about the screen
+ * saver's speed.  With one frame, it's a plain still GIF.  The image
+ * can be at most 65535 pixels on a side.  Returns 1 if it was written.
+ */
+int write_fluere_gif(FILE *f,
+                     const unsigned char *data,
+                     int width,
+                     int height,
+                     const unsigned char *ctable,
+                     int num_frames,
+                     int step,
+                     int delay);
+
+
+#endif
@@ -0,0 +1,301 @@
+/**
+ * \file fluere_kernels.c
+ *
+ * \brief Vector kernels that compute a span of pixels of one style at
+ * a time, with the instruction set picked when the program runs.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fluere_private.h"
+#include "vector_math.h"
+#include "vector_targets.h"
+
+
+/** the most the twist of a knot that spin_span leaves out may change a
+    pixel's value by, in steps of one pixel value */
+#define SPIN_CULL 0x1p-16
+
+/** room for the rounding of the values spin_span compares */
+#define SPIN_SLACK 0x1p-20
+
+/** how near a whole number band_span's estimate of 75 (small/big)^2,
+    in floats, may be before it is checked with doubles; it is never
+    more than about 2^-15 from the value the scalar code rounds down */
+#define LEAF_GUARD 0x1p-12f
+
+/** the range of big^2 in which band_span's floats keep their precision */
+#define LEAF_BIG2_MIN 0x1p-60f
+#define LEAF_BIG2_MAX 0x1p60f
+
+
+/** computes count pixels of one style; see fill_style_span */
+typedef void (*span_kernel)(const fluere_drawing *s,
+                            int row,
+                            int x0,
+                            int step,
+                            int count,
+                            unsigned char *out);
+
+/** one knot's term of a leaf or rays pixel, for band_span */
+static int band_term(double dx, double dy, double sign75, int discrete);
+
+
+#define VM_WIDTH 2
+#define VM_SUFFIX generic
+#define VM_ISA 0
+#include "vector_math_impl.h"
+#include "fluere_kernels_impl.h"
+#undef VM_WIDTH
+#undef VM_SUFFIX
+#undef VM_ISA
+#undef VM_HAVE_FMA
+
+#if VM_X86
+
+BEGIN_TARGET("sse2")
+#define VM_WIDTH 2
+#define VM_SUFFIX sse2
+#define VM_ISA 1
+#include "vector_math_impl.h"
+#include "fluere_kernels_impl.h"
+#undef VM_WIDTH
+#undef VM_SUFFIX
+#undef VM_ISA
+#undef VM_HAVE_FMA
+END_TARGET
+
+BEGIN_TARGET("avx2,fma")
+#define VM_WIDTH 4
+#define VM_SUFFIX avx2
+#define VM_ISA 2
+#include "vector_math_impl.h"
+#include "fluere_kernels_impl.h"
+#undef VM_WIDTH
+#undef VM_SUFFIX
+#undef VM_ISA
+#undef VM_HAVE_FMA
+END_TARGET
+
+BEGIN_TARGET("avx512f,avx512dq,avx2,fma")
+#define VM_WIDTH 8
+#define VM_SUFFIX avx512
+#define VM_ISA 3
+#include "vector_math_impl.h"
+#include "fluere_kernels_impl.h"
+#undef VM_WIDTH
+#undef VM_SUFFIX
+#undef VM_ISA
+#undef VM_HAVE_FMA
+END_TARGET
+
+#endif
+
+
+/** private declarations */
+
+static int init_knot_pack(knot_pack *p, const knot *knots, int num_knots,
+                          int style);
+static double cull_radius2(const knot *k);
+
+
+/**
+ * Lays out the knots for the vector kernels of the drawing's styles
+ */
+int init_knot_packs(fluere_drawing *s)
+{
+  int style;
+
+  memset(s->packs, 0, sizeof(s->packs));
+
+  for (style = flow; style <= rays; ++style)
+  {
+    if ((style == s->style1 || style == s->style2) &&
+        !init_knot_pack(&s->packs[style], s->knots, s->num_knots, style))
+    {
+      delete_knot_packs(s);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Frees the knot packs
+ */
+void delete_knot_packs(fluere_drawing *s)
+{
+  int style;
+
+  for (style = flow; style <= rays; ++style)
+  {
+    free(s->packs[style].block);
+    s->packs[style].block = NULL;
+  }
+}
+
+/**
+ * Fills every step'th pixel of a span with one style, using the kernels
+ * for the instruction set chosen by vector_math (the best one the
+ * processor has, unless set_vector_isa says otherwise).
+ */
+void fill_style_span(const fluere_drawing *s,
+                     int style,
+                     int row,
+                     int x0,
+                     int step,
+                     int count,
+                     unsigned char *out)
+{
+  const span_kernel *kernels;
+  int ii;
+
+  if (count <= 0)
+    return;
+
+  if (style < flow || style > rays)
+  {
+    for (ii = 0; ii < count; ++ii)
+      out[step * ii] = 0;
+    return;
+  }
+
+  switch (get_vector_isa())
+  {
+#if VM_X86
+    case avx512_isa:  kernels = span_kernels_avx512;  break;
+    case avx2_isa:    kernels = span_kernels_avx2;    break;
+    case sse2_isa:    kernels = span_kernels_sse2;    break;
+#endif
+    default:          kernels = span_kernels_generic;
+  }
+
+  kernels[style](s, row, x0, step, count, out);
+}
+
+/**
+ * Copies the fields one style needs out of the knots.  The knots keep
+ * their order, except that for flow the positive ones and for spin the
+ * twisted ones are moved (in order) to the front.  Returns 0 if there
+ * isn't the memory for them.
+ */
+static int init_knot_pack(knot_pack *p, const knot *knots, int num_knots,
+                          int style)
+{
+  int padded = (num_knots + 7) & ~7;
+  int num_arrays = (style == spin) ? 9 : 3;
+  int pass;
+  int ii;
+  int kk;
+  void *block;
+
+  if (padded == 0)
+    padded = 8;
+  memset(p, 0, sizeof(knot_pack));
+  if (posix_memalign(&block, 64, sizeof(double) * padded * num_arrays) != 0)
+    return 0;
+
+  p->block = block;
+  p->count = num_knots;
+  p->x = p->block;
+  p->y = p->x + padded;
+  p->sign = p->y + padded;
+  if (style == spin)
+  {
+    p->sectors = p->sign + padded;
+    p->period = p->sectors + padded;
+    p->twist = p->period + padded;
+    p->inv_frequency = p->twist + padded;
+    p->inv_decay = p->inv_frequency + padded;
+    p->cull_radius2 = p->inv_decay + padded;
+  }
+  memset(p->block, 0, sizeof(double) * padded * num_arrays);
+
+  /* the first pass takes the knots that go in front */
+  for (pass = 0, kk = 0; pass < 2; ++pass)
+  {
+    for (ii = 0; ii < num_knots; ++ii)
+    {
+      const knot *k = &knots[ii];
+      int in_front = 1;
+
+      if (style == flow)
+        in_front = (k->flowsign > 0);
+      else if (style == spin)
+        in_front = (k->amplitude != 0);
+      if (in_front != (pass == 0))
+        continue;
+
+      p->x[kk] = k->x;
+      p->y[kk] = k->y;
+      switch (style)
+      {
+        case flow:  p->sign[kk] = k->flowsign;       break;
+        case wave:  p->sign[kk] = k->wavesign;       break;
+        case leaf:  p->sign[kk] = k->leafsign * 75;  break;
+        case rays:  p->sign[kk] = k->rayssign * 75;  break;
+        case spin:
+          p->sign[kk] = k->spinsign;
+          p->sectors[kk] = k->sectors;
+          p->period[kk] = 1.0 / k->sectors;
+          p->twist[kk] = k->amplitude * k->sectors;
+          p->inv_frequency[kk] = 1.0 / k->frequency;
+          p->inv_decay[kk] = 1.0 / k->decay;
+          p->cull_radius2[kk] = cull_radius2(k);
+          break;
+      }
+      ++kk;
+    }
+
+    if (pass == 0)
+    {
+      p->num_positive = (style == flow) ? kk : 0;
+      p->num_twisted = (style == spin) ? kk : 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Returns the square of the distance from a spin knot past which its
+ * twist, sectors * amplitude * sectors * sin(r/frequency) *
+ * exp(-r/decay), times 256, is at most SPIN_CULL, or HUGE_VAL if
+ * the decay isn't positive.
+ */
+static double cull_radius2(const knot *k)
+{
+  double most = 256 * fabs(k->amplitude) * k->sectors * k->sectors;
+  double r;
+
+  /* a twist that doesn't fade never dies away; never cull it */
+  if (!(k->decay > 0))
+    return HUGE_VAL;
+
+  if (most <= SPIN_CULL)
+    return 0;
+
+  r = k->decay * log(most / SPIN_CULL);
+  return r * r;
+}
+
+/**
+ * Returns the term of a knot at (-dx, -dy) from the pixel, with sign75
+ * the style's sign times 75, exactly as get_leaf_value computes it.
+ */
+static int band_term(double dx, double dy, double sign75, int discrete)
+{
+  double big = fmax(fabs(dx), fabs(dy));
+  double small = fmin(fabs(dx), fabs(dy));
+  double a;
+
+  if (big == 0)
+    a = 0.0;
+  else
+    a = sign75 * (small/big) * (small/big);
+
+  return ((int) a / discrete) * discrete;
+}
@@ -0,0 +1,424 @@
+/**
+ * \file fluere_kernels_impl.h
+ *
+ * \brief The vector kernels for each style, compiled once per
+ * instruction set.
+ *
+ * Like vector_math_impl.h (which must be included first), this has no
+ * include guard and is included once per instruction set.  Each kernel
+ * computes VM_WIDTH pixels at a time: the pixel values stay in a
+ * register while the loop runs over the knots of the style's knot_pack,
+ * whose fields are broadcast to every lane.  Wave does its arithmetic
+ * in the same order as get_wave_value, so its differences from it come
+ * from the vector math functions.  The others don't: flow takes one log
+ * per pixel, spin reorders its knots and multiplies by reciprocals of
+ * the frequency and decay instead of dividing, and leaf and rays
+ * estimate their terms in float lanes (flow-check holds spin, leaf and
+ * rays to the references exactly all the same).
+ *
+ * \author Jonathan Cross
+ **/
+
+/** x coordinates of the VM_WIDTH pixels x, x+step, ... */
+static inline VDOUBLE VM(span_x)(int x, int step)
+{
+  VDOUBLE v;
+  int ii;
+  for (ii = 0; ii < VM_WIDTH; ++ii)
+    v[ii] = x + step * ii;
+  return v;
+}
+
+/** stores up to VM_WIDTH pixel values at out[0], out[step], ... */
+static inline void VM(store_span)(unsigned char *out, int step, int count,
+                                  VDOUBLE val)
+{
+  int ii;
+  for (ii = 0; ii < VM_WIDTH && ii < count; ++ii)
+    out[step * ii] = quantize_value(val[ii]);
+}
+
+/**
+ * takes the exponent out of each lane of a running product, adding it
+ * to expo and leaving the product in [1, 2)
+ */
+static inline VDOUBLE VM(renormalize)(VDOUBLE prod, VLONG *expo)
+{
+  VLONG bits = (VLONG) prod;
+  *expo += ((bits >> 52) & 0x7ff) - 1023;
+  return (VDOUBLE) ((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+}
+
+/**
+ * see get_flow_value.  The sum of +/-log(r^2) is the log of the
+ * product of the r^2 of the positive knots over the product of the
+ * r^2 of the negative ones, so only one log per pixel is needed.  Each
+ * product is renormalized every 4 knots; an r^2 is at least about
+ * 2^-100 and at most 2^60, so it can neither overflow nor underflow
+ * in between.  A pixel right on a knot gives 0, like the scalar code.
+ */
+static void VM(flow_span)(const fluere_drawing *s,
+                          int row, int x0, int step, int count,
+                          unsigned char *out)
+{
+  const double ln2_hi = 6.93147180369123816490e-01;
+  const double ln2_lo = 1.90821492927058770002e-10;
+  const knot_pack *p = &s->packs[flow];
+  double scale = 100 / s->num_knots;
+  int ii;
+  int kk;
+
+  for (ii = 0; ii < count; ii += VM_WIDTH)
+  {
+    VDOUBLE x = VM(span_x)(x0 + step * ii, step);
+    VDOUBLE pos = VM(vm_splat)(1.0);
+    VDOUBLE neg = VM(vm_splat)(1.0);
+    VLONG pos_expo = VM(vm_splatl)(0);
+    VLONG neg_expo = VM(vm_splatl)(0);
+    VLONG on_knot = VM(vm_splatl)(0);
+    VDOUBLE expo;
+    VDOUBLE val;
+
+    for (kk = 0; kk < p->num_positive; ++kk)
+    {
+      VDOUBLE dx = x - p->x[kk];
+      double dy = row - p->y[kk];
+      VDOUBLE r2 = dx*dx + dy*dy;
+
+      on_knot |= (r2 == 0.0);
+      pos *= r2;
+      if ((kk & 3) == 3)
+        pos = VM(renormalize)(pos, &pos_expo);
+    }
+
+    for (; kk < p->count; ++kk)
+    {
+      VDOUBLE dx = x - p->x[kk];
+      double dy = row - p->y[kk];
+      VDOUBLE r2 = dx*dx + dy*dy;
+
+      on_knot |= (r2 == 0.0);
+      neg *= r2;
+      if (((kk - p->num_positive) & 3) == 3)
+        neg = VM(renormalize)(neg, &neg_expo);
+    }
+
+    pos = VM(renormalize)(pos, &pos_expo);
+    neg = VM(renormalize)(neg, &neg_expo);
+
+    expo = VM(vm_long2double)(pos_expo - neg_expo);
+    val = (VM(vm_log)(pos / neg) + expo * ln2_lo) + expo * ln2_hi;
+    val *= scale;
+    val = VM(vm_select)(on_knot, VM(vm_splat)(NAN), val);
+
+    VM(store_span)(out + step * ii, step, count - ii, val);
+  }
+}
+
+/** see get_wave_value */
+static void VM(wave_span)(const fluere_drawing *s,
+                          int row, int x0, int step, int count,
+                          unsigned char *out)
+{
+  const knot_pack *p = &s->packs[wave];
+  double scale = 100 / s->num_knots;
+  int ii;
+  int kk;
+
+  for (ii = 0; ii < count; ii += VM_WIDTH)
+  {
+    VDOUBLE x = VM(span_x)(x0 + step * ii, step);
+    VDOUBLE val = VM(vm_splat)(0.0);
+
+    for (kk = 0; kk < p->count; ++kk)
+    {
+      VDOUBLE dx = x - p->x[kk];
+      double dy = row - p->y[kk];
+
+      val += p->sign[kk] * VM(vm_sin)(1.5 * VM(vm_log)(dx*dx + dy*dy));
+    }
+    val *= scale;
+
+    VM(store_span)(out + step * ii, step, count - ii, val);
+  }
+}
+
+/**
+ * the spin values of the VM_WIDTH pixels at x on row; see
+ * get_spin_value.  The twisted knots are first in the pack, so the
+ * twist is only computed for them, with reciprocals in place of the
+ * divisions.
+ */
+static inline VDOUBLE VM(spin_block)(const knot_pack *p, VDOUBLE x, int row)
+{
+  VDOUBLE val = VM(vm_splat)(0.0);
+  int kk;
+
+  for (kk = 0; kk < p->num_twisted; ++kk)
+  {
+    VDOUBLE dx = x - p->x[kk];
+    VDOUBLE dy = VM(vm_splat)(row - p->y[kk]);
+    VDOUBLE r = VM(vm_sqrt)(dx*dx + dy*dy);
+
+    /* atan2(0, 0) is 0, as get_spin_value wants */
+    VDOUBLE a = VM(vm_atan2)(dy, dx);
+
+    /* wavy! */
+    a += p->twist[kk] * VM(vm_sin)(r * p->inv_frequency[kk]) *
+         VM(vm_exp)(-r * p->inv_decay[kk]);
+
+    a = p->sectors[kk] * VM(vm_fmod)(a, VM(vm_splat)(p->period[kk]));
+    val += p->sign[kk] * a;
+  }
+
+  for (; kk < p->count; ++kk)
+  {
+    VDOUBLE dx = x - p->x[kk];
+    VDOUBLE dy = VM(vm_splat)(row - p->y[kk]);
+    VDOUBLE a = VM(vm_atan2)(dy, dx);
+
+    a = p->sectors[kk] * VM(vm_fmod)(a, VM(vm_splat)(p->period[kk]));
+    val += p->sign[kk] * a;
+  }
+
+  return val;
+}
+
+/**
+ * whether every pixel from x_first to x_last of row is at least
+ * sqrt(cull_radius2) from twisted knot kk
+ */
+static inline int VM(spin_far)(const knot_pack *p, int kk, int row,
+                               double x_first, double x_last)
+{
+  double dy = row - p->y[kk];
+  double gap = (p->x[kk] < x_first) ? x_first - p->x[kk] :
+               (p->x[kk] > x_last) ? p->x[kk] - x_last : 0;
+
+  return gap*gap + dy*dy >= p->cull_radius2[kk];
+}
+
+/**
+ * see get_spin_value.  A knot's twist dies away exponentially, so for
+ * the knots that a block of pixels is far from, it changes the value by
+ * less than SPIN_CULL, and is left out.  That can only change a pixel
+ * if its value (times 256) is that close to a whole number, or if the
+ * angle to one of those knots is that close to the edge of a sector,
+ * where fmod wraps around; if any pixel of the block is, the block is
+ * done again with every twist.  So the pixels are the same as with
+ * spin_block alone.
+ */
+static void VM(spin_span)(const fluere_drawing *s,
+                          int row, int x0, int step, int count,
+                          unsigned char *out)
+{
+  const knot_pack *p = &s->packs[spin];
+  int ii;
+  int kk;
+
+  for (ii = 0; ii < count; ii += VM_WIDTH)
+  {
+    VDOUBLE x = VM(span_x)(x0 + step * ii, step);
+    int last = (count - ii < VM_WIDTH) ? count - ii - 1 : VM_WIDTH - 1;
+    double x_first = x0 + step * ii;
+    double x_last = x_first + step * last;
+    VDOUBLE val = VM(vm_splat)(0.0);
+    VLONG close = VM(vm_splatl)(0);
+    int num_far = 0;
+
+    for (kk = 0; kk < p->num_twisted; ++kk)
+      num_far += VM(spin_far)(p, kk, row, x_first, x_last);
+
+    if (num_far == 0)
+    {
+      VM(store_span)(out + step * ii, step, count - ii,
+                     256 * VM(spin_block)(p, x, row));
+      continue;
+    }
+
+    for (kk = 0; kk < p->num_twisted; ++kk)
+    {
+      VDOUBLE dx = x - p->x[kk];
+      VDOUBLE dy = VM(vm_splat)(row - p->y[kk]);
+      VDOUBLE a = VM(vm_atan2)(dy, dx);
+
+      if (VM(spin_far)(p, kk, row, x_first, x_last))
+      {
+        VDOUBLE edge;
+
+        a = p->sectors[kk] * VM(vm_fmod)(a, VM(vm_splat)(p->period[kk]));
+        edge = 256 * VM(vm_abs)(a);
+        close |= (edge <= SPIN_CULL + SPIN_SLACK) |
+                 (edge >= 256 - SPIN_CULL - SPIN_SLACK);
+      }
+      else
+      {
+        VDOUBLE r = VM(vm_sqrt)(dx*dx + dy*dy);
+
+        a += p->twist[kk] * VM(vm_sin)(r * p->inv_frequency[kk]) *
+             VM(vm_exp)(-r * p->inv_decay[kk]);
+        a = p->sectors[kk] * VM(vm_fmod)(a, VM(vm_splat)(p->period[kk]));
+      }
+      val += p->sign[kk] * a;
+    }
+
+    for (; kk < p->count; ++kk)
+    {
+      VDOUBLE dx = x - p->x[kk];
+      VDOUBLE dy = VM(vm_splat)(row - p->y[kk]);
+      VDOUBLE a = VM(vm_atan2)(dy, dx);
+
+      a = p->sectors[kk] * VM(vm_fmod)(a, VM(vm_splat)(p->period[kk]));
+      val += p->sign[kk] * a;
+    }
+
+    val *= 256;
+    close |= VM(vm_abs)(val - VM(vm_round)(val))
+             <= num_far * SPIN_CULL + SPIN_SLACK;
+    if (VM(vm_any)(close))
+      val = 256 * VM(spin_block)(p, x, row);
+
+    VM(store_span)(out + step * ii, step, count - ii, val);
+  }
+}
+
+/** twice as many floats as there are doubles in a VDOUBLE */
+typedef float VM(vfloat) __attribute__((vector_size(8 * VM_WIDTH)));
+
+/** as many ints as there are floats in a vfloat */
+typedef int VM(vint) __attribute__((vector_size(8 * VM_WIDTH)));
+
+/** half a vfloat */
+typedef float VM(vhalf) __attribute__((vector_size(4 * VM_WIDTH)));
+
+/** the lanes of lo and then those of hi, as floats */
+static inline VM(vfloat) VM(to_floats)(VDOUBLE lo, VDOUBLE hi)
+{
+  VM(vhalf) flo = __builtin_convertvector(lo, VM(vhalf));
+  VM(vhalf) fhi = __builtin_convertvector(hi, VM(vhalf));
+#if VM_WIDTH == 2
+  return __builtin_shufflevector(flo, fhi, 0, 1, 2, 3);
+#elif VM_WIDTH == 4
+  return __builtin_shufflevector(flo, fhi, 0, 1, 2, 3, 4, 5, 6, 7);
+#else
+  return __builtin_shufflevector(flo, fhi, 0, 1, 2, 3, 4, 5, 6, 7,
+                                 8, 9, 10, 11, 12, 13, 14, 15);
+#endif
+}
+
+/** all lanes set to a */
+static inline VM(vfloat) VM(splat_floats)(float a)
+{
+  VM(vfloat) v;
+  int ii;
+  for (ii = 0; ii < 2 * VM_WIDTH; ++ii)
+    v[ii] = a;
+  return v;
+}
+
+/** lanes of a where mask is set, lanes of b elsewhere */
+static inline VM(vfloat) VM(select_floats)(VM(vint) mask,
+                                           VM(vfloat) a, VM(vfloat) b)
+{
+  return (VM(vfloat)) (((VM(vint)) a & mask) | ((VM(vint)) b & ~mask));
+}
+
+/**
+ * see get_leaf_value and get_rays_value, which this matches bit for
+ * bit, 2*VM_WIDTH pixels at a time.  Each knot's term there is
+ * (q / discrete) * discrete with its sign, where q = (int) (75
+ * (small/big)^2) is at most 75; here no division is done.  In float
+ * lanes, 75 small^2 is multiplied by a reciprocal of big^2 from three
+ * Newton steps, which comes within LEAF_GUARD of 75 (small/big)^2, and
+ * q / discrete is an integer multiply and shift.  The few lanes whose
+ * estimate is that near a whole number, or whose big^2 is outside
+ * LEAF_BIG2_MIN .. LEAF_BIG2_MAX, get their term from band_term.
+ */
+static void VM(band_span)(const knot_pack *p, int discrete,
+                          int row, int x0, int step, int count,
+                          unsigned char *out)
+{
+  /* (q * spread) >> 16 is q / discrete for q up to 75 */
+  int spread = (65536 + discrete - 1) / discrete;
+  int ii;
+  int jj;
+  int kk;
+
+  for (ii = 0; ii < count; ii += 2 * VM_WIDTH)
+  {
+    VDOUBLE x_lo = VM(span_x)(x0 + step * ii, step);
+    VDOUBLE x_hi = x_lo + step * VM_WIDTH;
+    VM(vint) val = {0};
+
+    for (kk = 0; kk < p->count; ++kk)
+    {
+      VM(vfloat) dx = VM(to_floats)(x_lo - p->x[kk], x_hi - p->x[kk]);
+      VM(vfloat) adx = (VM(vfloat)) ((VM(vint)) dx & 0x7fffffff);
+      VM(vfloat) ady = VM(splat_floats)(fabs(row - p->y[kk]));
+      VM(vint) dx_bigger = adx > ady;
+      VM(vfloat) big = VM(select_floats)(dx_bigger, adx, ady);
+      VM(vfloat) small = VM(select_floats)(dx_bigger, ady, adx);
+      VM(vfloat) big2 = big * big;
+      VM(vint) odd = ~((big2 >= LEAF_BIG2_MIN) & (big2 <= LEAF_BIG2_MAX));
+      VM(vfloat) recip;
+      VM(vfloat) a;
+      VM(vfloat) miss;
+      VM(vint) q;
+      VM(vint) near;
+      VM(vint) term;
+      int sign = (p->sign[kk] > 0) ? discrete : -discrete;
+
+      /* a guess at 1/big2 from its bits, within 6%, then Newton steps */
+      big2 = VM(select_floats)(odd, VM(splat_floats)(1), big2);
+      recip = (VM(vfloat)) (0x7ef311c3 - (VM(vint)) big2);
+      recip = recip * (2 - big2 * recip);
+      recip = recip * (2 - big2 * recip);
+      recip = recip * (2 - big2 * recip);
+      a = 75 * small * small * recip;
+
+      q = __builtin_convertvector(a + 0.5f, VM(vint));
+      miss = a - __builtin_convertvector(q, VM(vfloat));
+      near = odd | ((q > 0) & (miss >= -LEAF_GUARD) & (miss <= LEAF_GUARD));
+      q += (miss < 0);
+      term = ((q * spread) >> 16) * sign;
+
+      if (VM(vm_any)((VLONG) near))
+      {
+        for (jj = 0; jj < 2 * VM_WIDTH; ++jj)
+          if (near[jj])
+            term[jj] = band_term(x0 + step * (ii + jj) - p->x[kk],
+                                 row - p->y[kk], p->sign[kk], discrete);
+      }
+      val += term;
+    }
+
+    for (jj = 0; jj < 2 * VM_WIDTH && jj < count - ii; ++jj)
+      out[step * (ii + jj)] = val[jj] % 256;
+  }
+}
+
+/** see get_leaf_value */
+static void VM(leaf_span)(const fluere_drawing *s,
+                          int row, int x0, int step, int count,
+                          unsigned char *out)
+{
+  VM(band_span)(&s->packs[leaf], s->leafdiscrete, row, x0, step, count, out);
+}
+
+/** see get_rays_value */
+static void VM(rays_span)(const fluere_drawing *s,
+                          int row, int x0, int step, int count,
+                          unsigned char *out)
+{
+  VM(band_span)(&s->packs[rays], s->raysdiscrete, row, x0, step, count, out);
+}
+
+/** the kernels, in the order of fluere_style */
+static const span_kernel VM(span_kernels)[5] =
+{
+  VM(flow_span),
+  VM(wave_span),
+  VM(spin_span),
+  VM(leaf_span),
+  VM(rays_span)
+};
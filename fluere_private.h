@@ -0,0 +1,291 @@
+/**  
+ * \file fluere_private.h  
+ *
+ * \brief The data structures behind a fluere drawing, shared by the
+ * files that compute the pixel values.
+ *  
+ * \author Jonathan Cross
+ **/ 
+
+#ifndef FLUERE_PRIVATE_H
+#define FLUERE_PRIVATE_H
+
+#include "fluere_drawing.h"
+
+
+/** holds an integer point */
+struct point_struct
+{
+  int x;  /**<   x value */
+  int y;  /**<   y value */
+};
+typedef struct point_struct point;
+
+/** 
+ * holds data for one "knot"
+ *
+ * Knots control the appearance of a fluere drawing.  Essentially,
+ * the value (color) of each point in the drawing is some function
+ * related to the distance or angle to each of the knots.
+ */
+struct knot_struct
+{
+  /*@{*/
+  /** location of the point */
+  double x;
+  double y;
+  /*@}*/
+  
+  /*@{*/
+  /** ---- used for "flow" ---- */
+  double flowsign;     /**< +/-1; is the knot a source or sink for flow? */
+  /*@}*/
+  
+  /*@{*/
+  /** ---- used for "spin" ---- */
+  double spinsign;   /**< +/-1; clockwise or counterclockwise? */
+  double sectors;    /**< n/(2 pi), where n is the number of "spokes" going to the point */
+  double amplitude;   /*< if the spins are "twisted" then these control */
+  double frequency;   /*< the size and shape of the twists.*/
+  double decay;
+  /*@}*/
+  
+  /*@{*/
+  /** ---- used for "wave" ---- */
+  double wavesign;
+  /*@}*/
+  
+  /*@{*/
+  /** ---- used for "leaf" ---- */
+  int leafsign;
+  /*@}*/
+  
+  /*@{*/
+  /** ---- used for "rays" ---- */
+  int rayssign;
+  /*@}*/
+  
+};
+typedef struct knot_struct knot;
+
+
+/**
+ * The fields of the knots that one style's vector kernel reads, as
+ * separate arrays, so the kernels don't drag the rest of each knot
+ * through the cache.  Each array is aligned to 64 bytes and padded to
+ * a multiple of 8 knots.
+ *
+ * For flow, the knots with flowsign +1 come first, so the kernel can
+ * multiply their distances together separately from the others.  For
+ * spin, the knots with amplitude != 0 come first, so the kernel only
+ * computes the twist for knots 0 .. num_twisted-1, and then only for
+ * the pixels near enough to them.
+ */
+struct knot_pack_struct
+{
+  int count;              /**< number of knots */
+  int num_positive;       /**< flow: knots with flowsign +1 */
+  int num_twisted;        /**< spin: knots with amplitude != 0 */
+  double *x;              /**< location of the knot */
+  double *y;
+  double *sign;           /**< the style's sign; times 75 for leaf and rays */
+  double *sectors;        /**< spin: sectors */
+  double *period;         /**< spin: 1/sectors */
+  double *twist;          /**< spin: amplitude * sectors */
+  double *inv_frequency;  /**< spin: 1/frequency */
+  double *inv_decay;      /**< spin: 1/decay */
+  double *cull_radius2;   /**< spin: squared distance past which the
+                               twist is too small to matter (see
+                               spin_span) */
+  double *block;          /**< the allocation holding all of the arrays */
+};
+typedef struct knot_pack_struct knot_pack;
+
+/**
+ * lets a render running on another thread be watched and stopped; see
+ * fill_pixels_progressively
+ */
+struct render_state_struct
+{
+  int cancelled;          /**< set to make the render stop */
+  int work_done;          /**< work done so far ... */
+  int total_work;         /**< ... out of this much */
+};
+typedef struct render_state_struct render_state;
+
+/** precomputed per-knot terms for table_kernels; see fluere_tables.c */
+typedef struct style_tables_struct style_tables;
+
+/** this holds the parameters to make a fluere drawing */
+struct fluere_drawing_struct
+{
+  /** we can show up to 2 styles at once */
+  int style1;    
+  int style2;
+
+  /** When drawing leaves or rays, should it be continuous or discrete?
+   * If these values are 1, then this will be continuous; larger values
+   * give increasingly larger discrete angle sections.*/
+  int leafdiscrete;  
+  int raysdiscrete;
+
+  int num_knots; /**< number of knots */
+  knot *knots;   /**< the knot data */
+
+  int width;     /**< width of the drawing */
+  int height;    /**< height of the drawing */
+
+  unsigned long long seed;  /**< what the knots were chosen from */
+
+  int kernels;   /**< a fluere_kernels; how to compute the pixel values */
+
+  knot_pack packs[5];  /**< the knots laid out for each style's vector kernel */
+
+  style_tables *tables;  /**< for table_kernels; NULL until they are chosen */
+};
+typedef struct fluere_drawing_struct fluere_drawing;
+
+/** 
+ * Turns a value into a pixel value the same way (int) val % 256 does
+ * on x86 processors: values that don't fit in an int (including
+ * infinities and NaNs, which happen on top of a knot) give 0.
+ */
+static inline unsigned char quantize_value(double val)
+{
+  if (!(val > -2147483649.0 && val < 2147483648.0))
+    return 0;
+  return (int) val % 256;
+}
+
+/**
+ * Stores the low 32 bits of v at p, little end first, as the spec,
+ * cache, codec, animation and stream formats keep their numbers.
+ */
+static inline void put_u32(unsigned char *p, unsigned long v)
+{
+  int ii;
+  for (ii = 0; ii < 4; ++ii)
+    p[ii] = (v >> (8 * ii)) & 0xff;
+}
+
+/**
+ * Reads what put_u32 stored.
+ */
+static inline unsigned long get_u32(const unsigned char *p)
+{
+  return (unsigned long) p[0] | ((unsigned long) p[1] << 8) |
+         ((unsigned long) p[2] << 16) | ((unsigned long) p[3] << 24);
+}
+
+/**
+ * Fills in s->packs for style1 and style2 from s->knots.  The packs of
+ * the other styles are left empty.  Returns 0, with every pack empty,
+ * if there isn't the memory for them.
+ */
+int init_knot_packs(fluere_drawing *s);
+
+/**
+ * Frees the memory of s->packs.
+ */
+void delete_knot_packs(fluere_drawing *s);
+
+/**
+ * Fills out[0], out[step], ..., out[step*(count-1)] with the pixel
+ * values at (x0, row), (x0+step, row), ... for one style, using the
+ * vector kernels for the best instruction set the processor has.  The
+ * step is even (usually 2), since the two styles are drawn in a
+ * checkerboard.
+ */
+void fill_style_span(const fluere_drawing *s,
+                     int style,
+                     int row,
+                     int x0,
+                     int step,
+                     int count,
+                     unsigned char *out);
+
+
+/**
+ * Returns the value of one flow pixel, computed with libm; the
+ * reference that flow-check holds the vector kernels to.
+ */
+unsigned char get_flow_value(fluere_drawing_ptr s, point where);
+
+/**
+ * Returns the value of one wave pixel, computed with libm; the
+ * reference that flow-check holds the vector wave kernel to.
+ */
+unsigned char get_wave_value(fluere_drawing_ptr s, point where);
+
+/**
+ * Returns the value of one spin pixel, computed with libm; flow-check
+ * holds the vector kernel, with its far twists culled, to it exactly.
+ */
+unsigned char get_spin_value(fluere_drawing_ptr s, point where);
+
+/**
+ * Returns the value of one leaf or rays pixel, computed with libm;
+ * flow-check holds the vector kernels to them exactly.
+ */
+unsigned char get_leaf_value(fluere_drawing_ptr s, point where);
+unsigned char get_rays_value(fluere_drawing_ptr s, point where);
+
+/**
+ * Fills out[0] .. out[col1-col0-1] with the pixels col0 .. col1-1 of
+ * one row, using the drawing's kernels.
+ */
+void fill_row(fluere_drawing *s, int row, int col0, int col1,
+              unsigned char *out);
+
+/**
+ * Fills out[0], out[step], ..., out[step*(count-1)] with the pixel
+ * values at (x0, row), (x0+step, row), ... using the drawing's
+ * kernels.  The step must be even, so the pixels all have the same
+ * style.
+ */
+void fill_span(fluere_drawing *s, int row, int x0, int step, int count,
+               unsigned char *out);
+
+/**
+ * Does the work of fill_pixels_progressive.  If state isn't NULL, it
+ * is checked before each band of rows and the render stops soon after
+ * state->cancelled is set, leaving the data part done; the work done is
+ * added to state->work_done as it goes.  Returns 1 if the drawing was
+ * finished, 0 if it was cancelled or there isn't the memory to start.
+ */
+int fill_pixels_progressively(fluere_drawing *s,
+                              unsigned char *data,
+                              int nthreads,
+                              fill_progress_function progress,
+                              void *arg,
+                              render_state *state);
+
+/**
+ * Returns the tables for a width x height drawing of style1 and
+ * style2, making any that are missing, or NULL if there isn't enough
+ * memory.  The tables are shared; give them back with
+ * release_style_tables.  This runs jobs on the shared thread pool, so
+ * it must not be called from inside one.
+ */
+style_tables* acquire_style_tables(int width, int height,
+                                   int style1, int style2);
+
+/**
+ * Gives back tables from acquire_style_tables.
+ */
+void release_style_tables(style_tables *t);
+
+/**
+ * Same as fill_style_span, but reads the per-knot terms from s->tables,
+ * which must not be NULL.
+ */
+void fill_table_span(const fluere_drawing *s,
+                     int style,
+                     int row,
+                     int x0,
+                     int step,
+                     int count,
+                     unsigned char *out);
+
+
+#endif
@@ -0,0 +1,251 @@
+/**
+ * \file fluere_progressive.c
+ *
+ * \brief Fills a drawing in passes of increasing density, so a partial
+ * image can be shown long before the whole drawing is done.
+ *
+ * Pass 0 computes one pixel in each 4x4 block, pass 1 one pixel in each
+ * 2x2 block, and pass 2 the rest; no pixel is computed twice.  The two
+ * styles are drawn in a checkerboard, so the sample in each block
+ * alternates between them: the sample of 4x4 block (i, j) is at
+ * (4i + ((i + j) & 1), 4j), and the 2x2 blocks inside it use the same
+ * offset.  After passes 0 and 1, every pixel not computed yet gets the
+ * value of the nearest sample of its own style, from its own block or
+ * the one beside it.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+
+#include "fluere_private.h"
+#include "thread_pool.h"
+
+/** number of passes fill_pixels_progressive makes */
+#define PROGRESSIVE_PASSES 3
+
+/** rows in each tile; a multiple of 8, so a tile holds its samples */
+#define PROGRESSIVE_BAND 8
+
+/** the work of a tile in each pass, in 16ths of the pixels */
+static const int pass_work[PROGRESSIVE_PASSES] = { 1, 3, 12 };
+
+
+/** what fill_band needs to know about the pass */
+struct progressive_job_struct
+{
+  fluere_drawing *s;      /**< the drawing */
+  unsigned char *data;    /**< the image data, width x height */
+  int pass;               /**< which pass this is */
+  int *sources[8];        /**< for each row mod 8, the x of the sample each
+                               pixel copies, or -1 to leave it alone */
+  render_state *state;    /**< for stopping and watching it, or NULL */
+};
+typedef struct progressive_job_struct progressive_job;
+
+/** private declarations */
+
+static int get_sample_pass(int x, int y);
+static int find_source(int x, int y, int step, int width);
+static void fill_band(void *arg, int tile);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * same as fill_pixels_parallel, but in passes of increasing density,
+ * calling progress after each one.
+ */
+void fill_pixels_progressive(fluere_drawing_ptr s,
+                             unsigned char* data,
+                             int nthreads,
+                             fill_progress_function progress,
+                             void *arg)
+{
+  fill_pixels_progressively(s, data, nthreads, progress, arg, NULL);
+}
+
+/*@}*/
+
+/** @name Private Interface */
+/*@{*/
+
+/**
+ * fill_pixels_progressive, checking state (if not NULL) before each
+ * tile to see if it should stop, and adding the work done to it.
+ */
+int fill_pixels_progressively(fluere_drawing *s,
+                              unsigned char *data,
+                              int nthreads,
+                              fill_progress_function progress,
+                              void *arg,
+                              render_state *state)
+{
+  progressive_job job;
+  int num_bands = (s->height + PROGRESSIVE_BAND - 1) / PROGRESSIVE_BAND;
+  int *block;
+  int pass;
+  int ii;
+  int x;
+
+  block = malloc(sizeof(int) * 8 * s->width);
+  if (!block)
+    return 0;
+  for (ii = 0; ii < 8; ++ii)
+    job.sources[ii] = block + ii * s->width;
+
+  job.s = s;
+  job.data = data;
+  job.state = state;
+
+  if (state)
+    __atomic_store_n(&state->total_work, 16 * num_bands, __ATOMIC_RELEASE);
+
+  for (pass = 0; pass < PROGRESSIVE_PASSES; ++pass)
+  {
+    job.pass = pass;
+
+    if (pass < PROGRESSIVE_PASSES - 1)
+    {
+      int step = 4 >> pass;
+
+      for (ii = 0; ii < 8; ++ii)
+      {
+        for (x = 0; x < s->width; ++x)
+        {
+          job.sources[ii][x] = (get_sample_pass(x, ii) <= pass)
+                               ? -1 : find_source(x, ii, step, s->width);
+        }
+      }
+    }
+
+    run_tiles(get_shared_thread_pool(), num_bands, nthreads, fill_band, &job);
+
+    if (state && __atomic_load_n(&state->cancelled, __ATOMIC_ACQUIRE))
+      break;
+
+    if (progress)
+      progress(arg, pass, PROGRESSIVE_PASSES);
+  }
+
+  free(block);
+
+  return pass == PROGRESSIVE_PASSES;
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Returns the pass that computes pixel (x, y).  This only depends on
+ * x and y mod 8.
+ */
+static int get_sample_pass(int x, int y)
+{
+  int offset = ((x >> 2) + (y >> 2)) & 1;
+
+  if ((y & 3) == 0 && (x & 3) == offset)
+    return 0;
+  if ((y & 1) == 0 && (x & 1) == offset)
+    return 1;
+  return 2;
+}
+
+/**
+ * Returns the x of the sample that pixel (x, y) copies after the pass
+ * with blocks of step x step pixels; the sample is in row y & ~(step-1).
+ * The sample of the pixel's own block is used if it has the pixel's
+ * style, and otherwise the one of the nearer block beside it.  Returns
+ * -1 if there's no sample to copy.
+ */
+static int find_source(int x, int y, int step, int width)
+{
+  int sy = y & ~(step - 1);
+  int bx = x & ~(step - 1);
+  int near = (x - bx < step / 2) ? bx - step : bx + step;
+  int far = 2 * bx - near;
+  int blocks[3];
+  int ii;
+
+  blocks[0] = bx;
+  blocks[1] = near;
+  blocks[2] = far;
+
+  for (ii = 0; ii < 3; ++ii)
+  {
+    int sx = blocks[ii] + (((blocks[ii] >> 2) + (sy >> 2)) & 1);
+
+    if (blocks[ii] >= 0 && sx < width && ((sx + sy) & 1) == ((x + y) & 1))
+      return sx;
+  }
+
+  /* a drawing only a pixel or two wide; any sample will do */
+  ii = bx + (((bx >> 2) + (sy >> 2)) & 1);
+  return (ii < width) ? ii : -1;
+}
+
+/**
+ * Computes the samples of one pass in a band of rows, then copies them
+ * to the pixels that don't have a value yet.
+ */
+static void fill_band(void *arg, int tile)
+{
+  progressive_job *job = arg;
+  fluere_drawing *s = job->s;
+  int width = s->width;
+  int row0 = tile * PROGRESSIVE_BAND;
+  int row1 = (row0 + PROGRESSIVE_BAND < s->height) ? row0 + PROGRESSIVE_BAND
+                                                    : s->height;
+  int row;
+  int r;
+  int x;
+
+  if (job->state && __atomic_load_n(&job->state->cancelled, __ATOMIC_ACQUIRE))
+    return;
+
+  for (row = row0; row < row1; ++row)
+  {
+    unsigned char *out = job->data + row * width;
+
+    /* the odd rows are all in the last pass */
+    if (job->pass == PROGRESSIVE_PASSES - 1 && (row & 1))
+    {
+      fill_row(s, row, 0, width, out);
+      continue;
+    }
+
+    for (r = 0; r < 8 && r < width; ++r)
+    {
+      if (get_sample_pass(r, row) == job->pass)
+        fill_span(s, row, r, 8, (width - r + 7) / 8, out + r);
+    }
+  }
+
+  if (job->pass < PROGRESSIVE_PASSES - 1)
+  {
+    for (row = row0; row < row1; ++row)
+    {
+      int step = 4 >> job->pass;
+      const int *source = job->sources[row & 7];
+      const unsigned char *samples = job->data + (row & ~(step - 1)) * width;
+      unsigned char *out = job->data + row * width;
+
+      for (x = 0; x < width; ++x)
+      {
+        if (source[x] >= 0)
+          out[x] = samples[source[x]];
+      }
+    }
+  }
+
+  if (job->state)
+  {
+    __atomic_fetch_add(&job->state->work_done, pass_work[job->pass],
+                       __ATOMIC_RELEASE);
+  }
+}
+
+/*@}*/
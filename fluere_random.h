@@ -0,0 +1,74 @@
+/**
+ * \file fluere_random.h
+ *
+ * \brief A small random number generator whose state belongs to the
+ * caller, so drawings and color tables can be made on any thread and
+ * made again from their seed.
+ *
+ * This is splitmix64: the state is a counter that goes up by a fixed
+ * odd number for each draw, and each draw is a mix of the counter.
+ * There's no lock and no shared state, and a 64-bit seed picks the
+ * whole stream.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_RANDOM_H
+#define FLUERE_RANDOM_H
+
+
+/** the state of a stream of random numbers */
+struct fluere_random_struct
+{
+  unsigned long long counter;  /**< goes up by one step per draw */
+};
+typedef struct fluere_random_struct fluere_random;
+
+
+/**
+ * Starts a stream of random numbers from seed
+ */
+static inline void init_fluere_random(fluere_random *r,
+                                      unsigned long long seed)
+{
+  r->counter = seed;
+}
+
+/**
+ * Returns the next 64 random bits
+ */
+static inline unsigned long long next_random(fluere_random *r)
+{
+  unsigned long long z = (r->counter += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * Returns a random number uniformly in [0, 1)
+ */
+static inline double random_double(fluere_random *r)
+{
+  return (next_random(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Returns a random integer in 0 .. n-1, for n > 0
+ */
+static inline int random_below(fluere_random *r, int n)
+{
+  return (int) (((next_random(r) >> 32) * (unsigned long long) n) >> 32);
+}
+
+/**
+ * Returns 0 or 1 with probability 1/2
+ */
+static inline int random_coin(fluere_random *r)
+{
+  return (int) (next_random(r) >> 63);
+}
+
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * \file fluere_render.c
+ *
+ * \brief Runs fill_pixels_progressively on a thread of its own.
+ *
+ * The render thread is the caller of run_tiles, so the tiles are still
+ * spread over the shared pool; renders started at the same time take
+ * turns with the pool.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "fluere_render.h"
+#include "fluere_private.h"
+
+
+/** a render running on its own thread */
+struct fluere_render_struct
+{
+  fluere_drawing_ptr s;   /**< the drawing */
+  unsigned char *data;    /**< where it goes */
+  int nthreads;           /**< threads to fill it with */
+
+  render_state state;     /**< for cancelling it and watching progress */
+  int passes;             /**< passes done */
+  int finished;           /**< was the whole drawing filled? */
+  int done;               /**< has the thread finished? */
+
+  pthread_t thread;       /**< the render thread */
+  int has_thread;         /**< was the render thread started? */
+  pthread_mutex_t lock;   /**< protects done, for the condition */
+  pthread_cond_t stopped; /**< signalled when done is set */
+};
+
+/** private declarations */
+
+static void* render_main(void *arg);
+static void count_pass(void *arg, int pass, int num_passes);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Starts a render thread
+ */
+fluere_render_ptr start_fluere_render(fluere_drawing_ptr s,
+                                      unsigned char* data,
+                                      int nthreads)
+{
+  fluere_render_ptr r;
+
+  r = calloc(1, sizeof(struct fluere_render_struct));
+  if (!r)
+    return NULL;
+
+  r->s = s;
+  r->data = data;
+  r->nthreads = nthreads;
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->stopped, NULL);
+
+  if (pthread_create(&r->thread, NULL, render_main, r) == 0)
+    r->has_thread = 1;
+  else
+  {
+    /* no thread to be had; do it on this one */
+    render_main(r);
+  }
+
+  return r;
+}
+
+/**
+ * Checks if the render thread has finished
+ */
+int is_fluere_render_done(fluere_render_ptr r)
+{
+  return __atomic_load_n(&r->done, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Waits for the render thread to finish
+ */
+int wait_for_fluere_render(fluere_render_ptr r)
+{
+  pthread_mutex_lock(&r->lock);
+  while (!r->done)
+    pthread_cond_wait(&r->stopped, &r->lock);
+  pthread_mutex_unlock(&r->lock);
+
+  return r->finished;
+}
+
+/**
+ * Returns the fraction of the work that's done
+ */
+double get_fluere_render_progress(fluere_render_ptr r)
+{
+  int total = __atomic_load_n(&r->state.total_work, __ATOMIC_ACQUIRE);
+  int done = __atomic_load_n(&r->state.work_done, __ATOMIC_ACQUIRE);
+
+  if (is_fluere_render_done(r) && r->finished)
+    return 1.0;
+  if (total == 0)
+    return 0.0;
+  return (double) done / total;
+}
+
+/**
+ * Returns the number of passes that are done
+ */
+int get_fluere_render_passes(fluere_render_ptr r)
+{
+  return __atomic_load_n(&r->passes, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Tells the render to stop
+ */
+void cancel_fluere_render(fluere_render_ptr r)
+{
+  __atomic_store_n(&r->state.cancelled, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Stops the render and frees it
+ */
+void delete_fluere_render(fluere_render_ptr r)
+{
+  if (!r)
+    return;
+
+  cancel_fluere_render(r);
+  wait_for_fluere_render(r);
+  if (r->has_thread)
+    pthread_join(r->thread, NULL);
+
+  pthread_cond_destroy(&r->stopped);
+  pthread_mutex_destroy(&r->lock);
+  free(r);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * The render thread
+ */
+static void* render_main(void *arg)
+{
+  fluere_render_ptr r = arg;
+  int finished;
+
+  finished = fill_pixels_progressively(r->s, r->data, r->nthreads,
+                                       count_pass, r, &r->state);
+
+  pthread_mutex_lock(&r->lock);
+  r->finished = finished;
+  __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&r->stopped);
+  pthread_mutex_unlock(&r->lock);
+
+  return NULL;
+}
+
+/**
+ * Counts the passes as they finish
+ */
+static void count_pass(void *arg, int pass, int num_passes)
+{
+  fluere_render_ptr r = arg;
+
+  (void) num_passes;
+  __atomic_store_n(&r->passes, pass + 1, __ATOMIC_RELEASE);
+}
+
+/*@}*/
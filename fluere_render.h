@@ -0,0 +1,66 @@
+/**
+ * \file fluere_render.h
+ *
+ * \brief Fills a drawing on a thread of its own, so the caller can
+ * keep animating while it is computed.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_RENDER_H
+#define FLUERE_RENDER_H
+
+#include "fluere_drawing.h"
+
+
+typedef struct fluere_render_struct *fluere_render_ptr;
+
+
+/**
+ * Starts filling data (width x height bytes) with the drawing s, the
+ * same way fill_pixels_progressive does with nthreads threads, and
+ * returns right away.  Neither s nor data may be touched (except to
+ * read data) or freed until the render is deleted.
+ */
+fluere_render_ptr start_fluere_render(fluere_drawing_ptr s,
+                                      unsigned char* data,
+                                      int nthreads);
+
+/**
+ * Returns 1 if the render has finished or stopped after being
+ * cancelled, without waiting.
+ */
+int is_fluere_render_done(fluere_render_ptr r);
+
+/**
+ * Waits for the render to finish or stop.  Returns 1 if the whole
+ * drawing was filled, 0 if it was cancelled.
+ */
+int wait_for_fluere_render(fluere_render_ptr r);
+
+/**
+ * Returns how much of the render is done, from 0 to 1.
+ */
+double get_fluere_render_progress(fluere_render_ptr r);
+
+/**
+ * Returns the number of passes of fill_pixels_progressive that are
+ * done.  Once it is at least 1, data holds a whole (blocky) image that
+ * can be shown while the rest is computed.
+ */
+int get_fluere_render_passes(fluere_render_ptr r);
+
+/**
+ * Asks the render to stop.  It stops after the tiles being worked on,
+ * and data is left part done.
+ */
+void cancel_fluere_render(fluere_render_ptr r);
+
+/**
+ * Cancels the render if it is still going, waits for it to stop, and
+ * frees it.
+ */
+void delete_fluere_render(fluere_render_ptr r);
+
+
+#endif
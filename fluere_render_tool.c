@@ -0,0 +1,951 @@
+/**
+ * \file fluere_render_tool.c
+ *
+ * \brief fluere-render: makes a fluere drawing from the command line and
+ * writes it as an image file, timing each step.
+ *
+ * The drawing is filled on every core, and the time taken to make it
+ * (init), fill it (render), make its color table (colortable) and
+ * write it (encode) is printed on stderr, so the tool doubles as a
+ * benchmark.  With --repeat, all of it is done that many times and the
+ * fastest and mean times are printed.  Everything chosen at random
+ * comes from the seed, which is printed too, so any drawing can be made
+ * again.
+ *
+ * With --batch, it makes a drawing for each seed or spec in a list
+ * instead, through the pipeline in fluere_batch.h, and prints how fast
+ * each stage of the pipeline went.  A drawing made from a seed in a
+ * batch is the same as one made from the seed on its own.
+ *
+ * With --cache, drawings are looked for in the cache in fluere_cache.h
+ * before they're rendered, and kept there after, so drawing the same
+ * seed or spec again (say, in another format) skips the render.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "fluere_drawing.h"
+#include "fluere_batch.h"
+#include "fluere_cache.h"
+#include "fluere_spec.h"
+#include "fluere_codec.h"
+#include "fluere_export.h"
+#include "fluere_gif.h"
+#include "fluere_video.h"
+#include "fluere_anim.h"
+#include "palettes.h"
+#include "thread_pool.h"
+
+#ifndef DEFAULT_PALETTE_FILE
+#define DEFAULT_PALETTE_FILE "palettes.txt"
+#endif
+
+/** the cache's budget, in megabytes, unless --cache-size says */
+#define DEFAULT_CACHE_SIZE 1024
+
+#ifdef HAVE_ZLIB
+#define DEFAULT_LEVEL 6
+#else
+#define DEFAULT_LEVEL 0
+#endif
+
+/** the steps that are timed */
+enum
+{
+  init_phase,
+  render_phase,
+  colortable_phase,
+  encode_phase,
+  num_phases
+};
+
+/** what was asked for on the command line */
+struct options_struct
+{
+  fluere_batch_settings b;    /**< the drawing, and how to write it */
+  int size_given;             /**< whether b's size was asked for */
+  unsigned long long seed;    /**< where everything random comes from */
+  const char *palette;        /**< name or number, or NULL to choose */
+  const char *palette_file;   /**< where the palettes are */
+  const char *output;         /**< the file (or directory) to write */
+  int nthreads;               /**< threads, or 0 for one per processor */
+  const char *spec;           /**< spec to draw, or NULL */
+  const char *save_spec;      /**< where to save the spec, or NULL */
+  int repeat;                 /**< times to do it all */
+  int fps;                    /**< frame rate of a video */
+  int quiet;                  /**< don't print the times */
+  const char *batch;          /**< the list of seeds and specs, or NULL */
+  const char *sheet;          /**< where to write the contact sheet */
+  const char *cache;          /**< the cache's directory, or NULL */
+  long long cache_size;       /**< its budget, in megabytes */
+};
+typedef struct options_struct options;
+
+static const char *style_names[5] = { "flow", "wave", "spin", "leaf", "rays" };
+
+static const char *phase_names[num_phases] =
+  { "init", "render", "colortable", "encode" };
+
+/** private declarations */
+
+static void usage(FILE *f);
+static int parse_options(int argc, char **argv, options *o);
+static int find_style(const char *name);
+static int needs_colors(options *o);
+static int load_palettes(options *o);
+static fluere_drawing_ptr make_drawing(options *o, fluere_choices *c);
+static int write_image(options *o, const unsigned char *data,
+                       int width, int height, const unsigned char *ctable);
+static int run_batch(options *o);
+static char **read_sources(const char *name, int *num_sources);
+static double get_time(void);
+
+
+int main(int argc, char **argv)
+{
+  options o;
+  double times[num_phases];
+  double best[num_phases];
+  double total[num_phases];
+  unsigned char ctable[256 * 3 * 2];
+  int run;
+  int ii;
+
+  if (!parse_options(argc, argv, &o))
+    return 2;
+
+  if (o.cache)
+  {
+    o.b.cache = open_fluere_cache(o.cache, o.cache_size << 20);
+    if (!o.b.cache)
+    {
+      fprintf(stderr, "fluere-render: can't make %s\n", o.cache);
+      return 1;
+    }
+  }
+
+  if (o.batch)
+  {
+    int status = run_batch(&o);
+
+    close_fluere_cache(o.b.cache);
+    return status;
+  }
+
+  for (ii = 0; ii < num_phases; ++ii)
+  {
+    best[ii] = -1;
+    total[ii] = 0;
+  }
+
+  /* start the threads before the clock does */
+  get_shared_thread_pool();
+
+  for (run = 0; run < o.repeat; ++run)
+  {
+    fluere_drawing_ptr s;
+    fluere_choices c;
+    fluere_image_ptr img;
+    const unsigned char *data;
+    int width;
+    int height;
+    double t0;
+    double t1;
+    int ok;
+
+    t0 = get_time();
+
+    if (needs_colors(&o) && !load_palettes(&o))
+      return 1;
+
+    s = make_drawing(&o, &c);
+    if (!s)
+      return 1;
+    get_fluere_drawing_size(s, &width, &height);
+
+    t1 = get_time();
+    times[init_phase] = t1 - t0;
+    t0 = t1;
+
+    img = get_fluere_image(o.b.cache, s, o.nthreads);
+    if (!img)
+    {
+      fprintf(stderr, "fluere-render: out of memory\n");
+      return 1;
+    }
+    data = get_fluere_image_data(img);
+
+    t1 = get_time();
+    times[render_phase] = t1 - t0;
+    t0 = t1;
+
+    if (o.b.palettes)
+    {
+      get_colortable_seeded(get_palette(o.b.palettes, c.palette), ctable,
+                            o.b.randomize, o.b.stripes, c.ctable_seed);
+    }
+
+    t1 = get_time();
+    times[colortable_phase] = t1 - t0;
+    t0 = t1;
+
+    ok = write_image(&o, data, width, height,
+                     o.b.palettes ? ctable : NULL);
+
+    t1 = get_time();
+    times[encode_phase] = t1 - t0;
+
+    if (!ok)
+    {
+      fprintf(stderr, "fluere-render: can't write %s\n", o.output);
+      return 1;
+    }
+
+    if (o.save_spec && run == 0)
+    {
+      FILE *f = fopen(o.save_spec, "w");
+
+      if (!f || !save_fluere_spec_text(s, f))
+      {
+        fprintf(stderr, "fluere-render: can't write %s\n", o.save_spec);
+        return 1;
+      }
+      fclose(f);
+    }
+
+    if (!o.quiet && run == 0)
+    {
+      fprintf(stderr, "fluere-render: %dx%d", width, height);
+      if (o.spec)
+        fprintf(stderr, ", from %s", o.spec);
+      else
+      {
+        fprintf(stderr, ", %s/%s, seed 0x%llx", style_names[c.style1],
+                style_names[c.style2], o.seed);
+      }
+      if (o.b.palettes)
+      {
+        fprintf(stderr, ", palette %s",
+                get_name(get_palette(o.b.palettes, c.palette)));
+      }
+      fprintf(stderr, ", %d threads\n",
+              (o.nthreads > 0) ? o.nthreads : get_number_of_processors());
+    }
+
+    for (ii = 0; ii < num_phases; ++ii)
+    {
+      if (best[ii] < 0 || times[ii] < best[ii])
+        best[ii] = times[ii];
+      total[ii] += times[ii];
+    }
+
+    release_fluere_image(img);
+    delete_fluere_drawing(s);
+    if (o.b.palettes)
+    {
+      delete_palette_list(o.b.palettes);
+      o.b.palettes = NULL;
+    }
+  }
+
+  if (!o.quiet)
+  {
+    double sum_best = 0;
+    double sum_mean = 0;
+
+    if (o.repeat > 1)
+      fprintf(stderr, "  %-12s %10s %10s\n", "ms", "fastest", "mean");
+    for (ii = 0; ii < num_phases; ++ii)
+    {
+      fprintf(stderr, "  %-12s %10.2f", phase_names[ii], 1000 * best[ii]);
+      if (o.repeat > 1)
+        fprintf(stderr, " %10.2f", 1000 * total[ii] / o.repeat);
+      fprintf(stderr, "\n");
+      sum_best += best[ii];
+      sum_mean += total[ii] / o.repeat;
+    }
+    fprintf(stderr, "  %-12s %10.2f", "total", 1000 * sum_best);
+    if (o.repeat > 1)
+      fprintf(stderr, " %10.2f", 1000 * sum_mean);
+    fprintf(stderr, "\n");
+  }
+
+  close_fluere_cache(o.b.cache);
+  return 0;
+}
+
+/**
+ * Prints how to use the tool.
+ */
+static void usage(FILE *f)
+{
+  fprintf(f,
+"usage: fluere-render [options] -o FILE\n"
+"       fluere-render [options] --batch LIST -o DIRECTORY\n"
+"\n"
+"  -o, --output FILE       where to write the image (- for stdout)\n"
+"  -f, --format FORMAT     png, ppm, pgm (the indices), flpx (see\n"
+"                          fluere_codec.h), gif (animated), y4m or\n"
+"                          yuv (video, to pipe to an encoder), or\n"
+"                          fluere (an animation, as the screen saver\n"
+"                          shows it); by default from FILE's\n"
+"                          extension, or png\n"
+"  -s, --size WxH          size of the drawing (default 1920x1080)\n"
+"  -k, --knots N           number of knots (default 4)\n"
+"  -y, --styles A,B        two of flow, wave, spin, leaf and rays\n"
+"                          (default chosen from the seed)\n"
+"  -e, --seed N            seed for everything chosen at random\n"
+"                          (default from the clock)\n"
+"  -p, --palette NAME      palette name or number (default chosen\n"
+"                          from the seed)\n"
+"  -P, --palette-file F    palette file (default %s)\n"
+"  -r, --randomize         pick the palette's colors at random\n"
+"  -S, --stripes           put black between the colors\n"
+"      --rgb               write a PNG as 24-bit color, not indexed\n"
+"  -z, --level N           PNG compression, 0 (none) to 9 (default %d)\n"
+"      --frames N          frames of a GIF or video (default 128)\n"
+"      --step N            how far its colors move each frame\n"
+"                          (default 2)\n"
+"      --delay N           hundredths of a second each GIF frame is\n"
+"                          shown (default 3)\n"
+"      --fps N             frames a second of a video (default 30)\n"
+"  -j, --threads N         threads to use (default one per processor)\n"
+"      --kernels K         exact, vector (default) or table\n"
+"      --spec FILE         draw a saved spec (text or binary); with\n"
+"                          --size, scaled to that size\n"
+"      --save-spec FILE    save the drawing's text spec\n"
+"      --cache DIR         look for the drawing in a cache of them in\n"
+"                          DIR before rendering it, and keep it there\n"
+"      --cache-size MB     how big the cache may grow (default %d)\n"
+"  -n, --repeat N          do it all N times, and time the fastest\n"
+"  -q, --quiet             don't print the times\n"
+"  -h, --help              print this\n"
+"\n"
+"batches:\n"
+"  -b, --batch LIST        make a drawing for each line of LIST (- for\n"
+"                          stdin): a seed, or the name of a spec file;\n"
+"                          they're written to the directory given by\n"
+"                          --output, named after their seed or spec,\n"
+"                          all at the same size\n"
+"      --queue N           drawings waiting between stages (default 4)\n"
+"      --contact-sheet F   also write a PNG (or .ppm) of thumbnails\n"
+"      --thumb-width N     width of each thumbnail (default 192)\n"
+"      --columns N         thumbnails across (default 10)\n",
+          DEFAULT_PALETTE_FILE, DEFAULT_LEVEL, DEFAULT_CACHE_SIZE);
+}
+
+/**
+ * Fills in o from the command line.  Returns 0 (after saying why) if
+ * it doesn't make sense.
+ */
+static int parse_options(int argc, char **argv, options *o)
+{
+  static const struct option long_options[] =
+  {
+    { "output",        required_argument, NULL, 'o' },
+    { "format",        required_argument, NULL, 'f' },
+    { "size",          required_argument, NULL, 's' },
+    { "knots",         required_argument, NULL, 'k' },
+    { "styles",        required_argument, NULL, 'y' },
+    { "seed",          required_argument, NULL, 'e' },
+    { "palette",       required_argument, NULL, 'p' },
+    { "palette-file",  required_argument, NULL, 'P' },
+    { "randomize",     no_argument,       NULL, 'r' },
+    { "stripes",       no_argument,       NULL, 'S' },
+    { "rgb",           no_argument,       NULL, 'R' },
+    { "level",         required_argument, NULL, 'z' },
+    { "threads",       required_argument, NULL, 'j' },
+    { "kernels",       required_argument, NULL, 'K' },
+    { "spec",          required_argument, NULL, 'D' },
+    { "save-spec",     required_argument, NULL, 'V' },
+    { "repeat",        required_argument, NULL, 'n' },
+    { "quiet",         no_argument,       NULL, 'q' },
+    { "help",          no_argument,       NULL, 'h' },
+    { "batch",         required_argument, NULL, 'b' },
+    { "queue",         required_argument, NULL, 'Q' },
+    { "contact-sheet", required_argument, NULL, 'C' },
+    { "thumb-width",   required_argument, NULL, 'T' },
+    { "columns",       required_argument, NULL, 'L' },
+    { "frames",        required_argument, NULL, 'F' },
+    { "step",          required_argument, NULL, 'X' },
+    { "delay",         required_argument, NULL, 'W' },
+    { "fps",           required_argument, NULL, 'Y' },
+    { "cache",         required_argument, NULL, 'A' },
+    { "cache-size",    required_argument, NULL, 'M' },
+    { NULL, 0, NULL, 0 }
+  };
+  int format_given = 0;
+  char name1[8];
+  char name2[8];
+  int c;
+
+  memset(o, 0, sizeof(*o));
+  init_fluere_batch_settings(&o->b);
+  o->b.level = DEFAULT_LEVEL;
+  o->b.thumb_width = 192;
+  o->seed = (unsigned long long) time(NULL) * 0x9e3779b97f4a7c15ULL
+            ^ (unsigned long long) getpid();
+  o->palette_file = DEFAULT_PALETTE_FILE;
+  o->repeat = 1;
+  o->fps = 30;
+  o->cache_size = DEFAULT_CACHE_SIZE;
+
+  while ((c = getopt_long(argc, argv, "o:f:s:k:y:e:p:P:rSz:j:n:qhb:",
+                          long_options, NULL)) != -1)
+  {
+    switch (c)
+    {
+      case 'o':
+        o->output = optarg;
+        break;
+      case 'f':
+        format_given = 1;
+        if (strcmp(optarg, "png") == 0)
+          o->b.output = png_output;
+        else if (strcmp(optarg, "ppm") == 0)
+          o->b.output = ppm_output;
+        else if (strcmp(optarg, "pgm") == 0)
+          o->b.output = pgm_output;
+        else if (strcmp(optarg, "flpx") == 0)
+          o->b.output = flpx_output;
+        else if (strcmp(optarg, "gif") == 0)
+          o->b.output = gif_output;
+        else if (strcmp(optarg, "y4m") == 0)
+          o->b.output = y4m_output;
+        else if (strcmp(optarg, "yuv") == 0)
+          o->b.output = yuv_output;
+        else if (strcmp(optarg, "fluere") == 0)
+          o->b.output = anim_output;
+        else
+        {
+          fprintf(stderr, "fluere-render: unknown format %s\n", optarg);
+          return 0;
+        }
+        break;
+      case 's':
+        if (sscanf(optarg, "%dx%d", &o->b.width, &o->b.height) != 2 ||
+            o->b.width <= 0 || o->b.height <= 0)
+        {
+          fprintf(stderr, "fluere-render: bad size %s\n", optarg);
+          return 0;
+        }
+        o->size_given = 1;
+        break;
+      case 'k':
+        o->b.num_knots = atoi(optarg);
+        if (o->b.num_knots < 1 || o->b.num_knots > 50)
+        {
+          fprintf(stderr, "fluere-render: knots must be 1 to 50\n");
+          return 0;
+        }
+        break;
+      case 'y':
+        if (sscanf(optarg, "%7[a-z],%7[a-z]", name1, name2) != 2 ||
+            (o->b.style1 = find_style(name1)) < 0 ||
+            (o->b.style2 = find_style(name2)) < 0)
+        {
+          fprintf(stderr, "fluere-render: bad styles %s\n", optarg);
+          return 0;
+        }
+        break;
+      case 'e':
+        o->seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'p':
+        o->palette = optarg;
+        break;
+      case 'P':
+        o->palette_file = optarg;
+        break;
+      case 'r':
+        o->b.randomize = 1;
+        break;
+      case 'S':
+        o->b.stripes = 1;
+        break;
+      case 'R':
+        o->b.rgb = 1;
+        break;
+      case 'z':
+        o->b.level = atoi(optarg);
+        if (o->b.level < 0 || o->b.level > 9)
+        {
+          fprintf(stderr, "fluere-render: level must be 0 to 9\n");
+          return 0;
+        }
+        break;
+      case 'j':
+        o->nthreads = atoi(optarg);
+        break;
+      case 'K':
+        if (strcmp(optarg, "exact") == 0)
+          o->b.kernels = exact_kernels;
+        else if (strcmp(optarg, "vector") == 0)
+          o->b.kernels = vector_kernels;
+        else if (strcmp(optarg, "table") == 0)
+          o->b.kernels = table_kernels;
+        else
+        {
+          fprintf(stderr, "fluere-render: unknown kernels %s\n", optarg);
+          return 0;
+        }
+        break;
+      case 'D':
+        o->spec = optarg;
+        break;
+      case 'V':
+        o->save_spec = optarg;
+        break;
+      case 'n':
+        o->repeat = atoi(optarg);
+        if (o->repeat < 1)
+          o->repeat = 1;
+        break;
+      case 'q':
+        o->quiet = 1;
+        break;
+      case 'h':
+        usage(stdout);
+        exit(0);
+      case 'b':
+        o->batch = optarg;
+        break;
+      case 'Q':
+        o->b.queue_length = atoi(optarg);
+        if (o->b.queue_length < 1)
+          o->b.queue_length = 1;
+        break;
+      case 'C':
+        o->sheet = optarg;
+        break;
+      case 'T':
+        o->b.thumb_width = atoi(optarg);
+        if (o->b.thumb_width < 1)
+        {
+          fprintf(stderr, "fluere-render: bad thumbnail width\n");
+          return 0;
+        }
+        break;
+      case 'L':
+        o->b.columns = atoi(optarg);
+        break;
+      case 'F':
+        o->b.frames = atoi(optarg);
+        if (o->b.frames < 1)
+          o->b.frames = 1;
+        break;
+      case 'X':
+        o->b.frame_step = atoi(optarg);
+        break;
+      case 'W':
+        o->b.gif_delay = atoi(optarg);
+        if (o->b.gif_delay < 0 || o->b.gif_delay > 65535)
+        {
+          fprintf(stderr, "fluere-render: delay must be 0 to 65535\n");
+          return 0;
+        }
+        break;
+      case 'Y':
+        o->fps = atoi(optarg);
+        if (o->fps < 1)
+        {
+          fprintf(stderr, "fluere-render: fps must be at least 1\n");
+          return 0;
+        }
+        break;
+      case 'A':
+        o->cache = optarg;
+        break;
+      case 'M':
+        o->cache_size = atoll(optarg);
+        if (o->cache_size < 1)
+        {
+          fprintf(stderr, "fluere-render: cache size must be at least 1\n");
+          return 0;
+        }
+        break;
+      default:
+        usage(stderr);
+        return 0;
+    }
+  }
+
+  if (!o->output || optind < argc)
+  {
+    usage(stderr);
+    return 0;
+  }
+
+  if (!format_given && !o->batch)
+  {
+    const char *dot = strrchr(o->output, '.');
+
+    if (dot && strcasecmp(dot, ".ppm") == 0)
+      o->b.output = ppm_output;
+    else if (dot && strcasecmp(dot, ".pgm") == 0)
+      o->b.output = pgm_output;
+    else if (dot && strcasecmp(dot, ".flpx") == 0)
+      o->b.output = flpx_output;
+    else if (dot && strcasecmp(dot, ".gif") == 0)
+      o->b.output = gif_output;
+    else if (dot && strcasecmp(dot, ".y4m") == 0)
+      o->b.output = y4m_output;
+    else if (dot && strcasecmp(dot, ".yuv") == 0)
+      o->b.output = yuv_output;
+    else if (dot && strcasecmp(dot, ".fluere") == 0)
+      o->b.output = anim_output;
+    else
+      o->b.output = png_output;
+  }
+
+  return 1;
+}
+
+/**
+ * Returns the style called name, or -1 if there's no such style.
+ */
+static int find_style(const char *name)
+{
+  int ii;
+
+  for (ii = 0; ii < 5; ++ii)
+  {
+    if (strcmp(name, style_names[ii]) == 0)
+      return ii;
+  }
+
+  return -1;
+}
+
+/**
+ * Returns whether the drawings need colors, and so palettes.
+ */
+static int needs_colors(options *o)
+{
+  return o->b.output == png_output || o->b.output == ppm_output ||
+         o->b.output == gif_output || o->b.output == y4m_output ||
+         o->b.output == yuv_output || o->b.output == anim_output ||
+         (o->batch && o->sheet);
+}
+
+/**
+ * Reads the palettes into o->b, and finds the one asked for.  Returns
+ * 0 (after saying why) if it can't.
+ */
+static int load_palettes(options *o)
+{
+  FILE *f = fopen(o->palette_file, "r");
+  int n;
+  char *end;
+  long idx;
+  int ii;
+
+  if (!f)
+  {
+    fprintf(stderr, "fluere-render: can't read %s\n", o->palette_file);
+    return 0;
+  }
+  o->b.palettes = init_palette_list(f);
+  fclose(f);
+
+  n = get_number_of_palettes(o->b.palettes);
+  if (n <= 0)
+  {
+    fprintf(stderr, "fluere-render: no palettes in %s\n", o->palette_file);
+    return 0;
+  }
+
+  o->b.palette = -1;
+  if (!o->palette)
+    return 1;
+
+  idx = strtol(o->palette, &end, 10);
+  if (*end == '\0' && idx >= 0 && idx < n)
+    o->b.palette = (int) idx;
+
+  for (ii = 0; ii < n && o->b.palette < 0; ++ii)
+  {
+    if (strcasecmp(o->palette, get_name(get_palette(o->b.palettes, ii))) == 0)
+      o->b.palette = ii;
+  }
+
+  if (o->b.palette < 0)
+  {
+    fprintf(stderr, "fluere-render: no palette %s in %s\n", o->palette,
+            o->palette_file);
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Makes the drawing: from the spec if there is one, and otherwise
+ * from the seed, and makes the choices that its seed gives it.
+ * Returns NULL (after saying why) if it can't.
+ */
+static fluere_drawing_ptr make_drawing(options *o, fluere_choices *c)
+{
+  int num_palettes = o->b.palettes ? get_number_of_palettes(o->b.palettes)
+                                   : 0;
+  fluere_drawing_ptr s;
+  FILE *f;
+
+  if (!o->spec)
+  {
+    get_fluere_choices(&o->b, o->seed, num_palettes, c);
+    s = init_fluere_drawing_seeded(o->b.width, o->b.height, o->b.num_knots,
+                                   (fluere_style) c->style1,
+                                   (fluere_style) c->style2, o->seed);
+    if (!s)
+    {
+      fprintf(stderr, "fluere-render: out of memory\n");
+      return NULL;
+    }
+    set_fluere_kernels(s, o->b.kernels);
+    return s;
+  }
+
+  f = fopen(o->spec, "rb");
+  if (!f)
+  {
+    fprintf(stderr, "fluere-render: can't read %s\n", o->spec);
+    return NULL;
+  }
+
+  s = load_fluere_spec_text(f, o->size_given ? o->b.width : 0,
+                            o->size_given ? o->b.height : 0);
+  if (!s)
+  {
+    rewind(f);
+    s = load_fluere_spec(f, o->size_given ? o->b.width : 0,
+                         o->size_given ? o->b.height : 0);
+  }
+  fclose(f);
+
+  if (!s)
+  {
+    fprintf(stderr, "fluere-render: %s isn't a good spec\n", o->spec);
+    return NULL;
+  }
+
+  get_fluere_choices(&o->b, get_fluere_drawing_seed(s), num_palettes, c);
+  set_fluere_kernels(s, o->b.kernels);
+
+  return s;
+}
+
+/**
+ * Writes the image in the format asked for.  Returns 1 if it was
+ * written.
+ */
+static int write_image(options *o, const unsigned char *data,
+                       int width, int height, const unsigned char *ctable)
+{
+  int to_stdout = (strcmp(o->output, "-") == 0);
+  FILE *f = to_stdout ? stdout : fopen(o->output, "wb");
+  int ok;
+
+  if (!f)
+    return 0;
+
+  switch (o->b.output)
+  {
+    case png_output:
+      ok = write_fluere_png(f, data, width, height, ctable, o->b.rgb,
+                            o->b.level, o->nthreads);
+      break;
+    case flpx_output:
+    {
+      size_t bound = get_fluere_codec_bound(width, height);
+      unsigned char *out = malloc(bound);
+      size_t size = 0;
+
+      if (out)
+        size = encode_fluere_pixels(data, width, height, o->nthreads, out,
+                                    bound);
+      ok = (size > 0 && fwrite(out, 1, size, f) == size);
+      free(out);
+      break;
+    }
+    case ppm_output:
+      ok = write_fluere_pnm(f, data, width, height, ctable);
+      break;
+    case gif_output:
+      ok = write_fluere_gif(f, data, width, height, ctable, o->b.frames,
+                            o->b.frame_step, o->b.gif_delay);
+      break;
+    case y4m_output:
+    case yuv_output:
+      ok = write_fluere_video(f, data, width, height, ctable, o->b.frames,
+                              o->b.frame_step, o->fps,
+                              o->b.output == yuv_output, o->nthreads);
+      break;
+    case anim_output:
+    {
+      fluere_anim_segment segments[FLUERE_VIEW_SEGMENTS];
+      int n = fluere_view_timeline(0, segments);
+
+      ok = save_fluere_anim(f, data, width, height, ctable, 1, segments, n,
+                            FLUERE_VIEW_FPS, 1, o->nthreads);
+      break;
+    }
+    default:
+      ok = write_fluere_pnm(f, data, width, height, NULL);
+      break;
+  }
+
+  if (to_stdout)
+    ok = (fflush(f) == 0) && ok;
+  else
+    ok = (fclose(f) == 0) && ok;
+
+  return ok;
+}
+
+/**
+ * Makes the drawings of a batch, and its contact sheet.  Returns the
+ * tool's exit status.
+ */
+static int run_batch(options *o)
+{
+  fluere_batch_result_ptr r;
+  char **sources;
+  int num_sources;
+  int status = 0;
+  int ii;
+
+  if (o->b.output == y4m_output || o->b.output == yuv_output)
+  {
+    fprintf(stderr, "fluere-render: video can't be made in a batch\n");
+    return 2;
+  }
+
+  sources = read_sources(o->batch, &num_sources);
+  if (!sources)
+  {
+    fprintf(stderr, "fluere-render: can't read %s\n", o->batch);
+    return 1;
+  }
+
+  if (needs_colors(o) && !load_palettes(o))
+    return 1;
+
+  if (mkdir(o->output, 0777) != 0 && errno != EEXIST)
+  {
+    fprintf(stderr, "fluere-render: can't make %s\n", o->output);
+    return 1;
+  }
+
+  o->b.directory = o->output;
+  o->b.render_threads = o->nthreads;
+  o->b.encode_threads = o->nthreads;
+  if (!o->sheet)
+    o->b.thumb_width = 0;
+
+  r = run_fluere_batch(&o->b, sources, num_sources);
+  if (!r)
+  {
+    fprintf(stderr, "fluere-render: out of memory\n");
+    return 1;
+  }
+
+  if (!o->quiet)
+    print_fluere_batch_report(r, stderr);
+  if (get_fluere_batch_failures(r) > 0)
+    status = 1;
+
+  if (o->sheet && num_sources > 0)
+  {
+    const char *dot = strrchr(o->sheet, '.');
+    FILE *f = fopen(o->sheet, "wb");
+    int ok;
+
+    ok = f && write_fluere_contact_sheet(r, f,
+                                         dot && strcasecmp(dot, ".ppm") == 0,
+                                         o->b.level);
+    if (!f || fclose(f) != 0 || !ok)
+    {
+      fprintf(stderr, "fluere-render: can't write %s\n", o->sheet);
+      status = 1;
+    }
+  }
+
+  delete_fluere_batch_result(r);
+  if (o->b.palettes)
+    delete_palette_list(o->b.palettes);
+  for (ii = 0; ii < num_sources; ++ii)
+    free(sources[ii]);
+  free(sources);
+
+  return status;
+}
+
+/**
+ * Reads the lines of a file ("-" for stdin), without blank lines,
+ * lines starting with '#', or the space around them.  Returns NULL if
+ * it can't be read.
+ */
+static char **read_sources(const char *name, int *num_sources)
+{
+  FILE *f = (strcmp(name, "-") == 0) ? stdin : fopen(name, "r");
+  char **sources = NULL;
+  char *line = NULL;
+  size_t line_size = 0;
+  int capacity = 0;
+  int n = 0;
+
+  if (!f)
+    return NULL;
+
+  while (getline(&line, &line_size, f) != -1)
+  {
+    char *start = line;
+    char *end = line + strlen(line);
+
+    while (isspace((unsigned char) *start))
+      start++;
+    while (end > start && isspace((unsigned char) end[-1]))
+      end--;
+    *end = '\0';
+
+    if (*start == '\0' || *start == '#')
+      continue;
+
+    if (n == capacity)
+    {
+      capacity = capacity ? 2 * capacity : 64;
+      sources = realloc(sources, sizeof(char *) * capacity);
+    }
+    sources[n++] = strdup(start);
+  }
+
+  free(line);
+  if (f != stdin)
+    fclose(f);
+
+  *num_sources = n;
+  return sources ? sources : malloc(sizeof(char *));
+}
+
+/**
+ * Returns the time in seconds on a clock that only goes forward.
+ */
+static double get_time(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
@@ -0,0 +1,562 @@
+/**
+ * \file fluere_spec.c
+ *
+ * \brief Saving and loading fluere drawing specs.
+ *
+ * The binary spec is little endian:
+ *
+ \verbatim
+   offset  size
+        0     4   "FLSP"
+        4     1   version
+        5     1   style1
+        6     1   style2
+        7     1   leafdiscrete
+        8     1   raysdiscrete
+        9     3   zero
+       12     4   width
+       16     4   height
+       20     4   number of knots, at least 1
+       24     8   seed
+       32  42*n   the knots
+   32+42n     4   FNV-1a hash of everything before it
+ \endverbatim
+ *
+ * and each knot is x, y, frequency, decay and amplitude as IEEE
+ * doubles, then the number of spokes, then a byte whose bits 0-4 are
+ * set when flowsign, spinsign, leafsign, rayssign and wavesign are -1.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fluere_spec.h"
+#include "fluere_private.h"
+
+/** bytes before the knots */
+#define SPEC_HEADER_SIZE 32
+
+/** bytes per knot */
+#define SPEC_KNOT_SIZE 42
+
+/** bytes after the knots */
+#define SPEC_TRAILER_SIZE 4
+
+/** more knots than this is taken for a damaged spec */
+#define SPEC_MAX_KNOTS 100000
+
+/**
+ * how far past the edges, in widths or heights of the saved drawing, a
+ * knot may be; define_knots keeps them within a twentieth
+ */
+#define SPEC_KNOT_REACH 1.0
+
+/** the names of the styles in the text spec, in the order of fluere_style */
+static const char *style_names[5] = { "flow", "wave", "spin", "leaf", "rays" };
+
+/** number of signs in each knot */
+#define SPEC_SIGNS 5
+
+
+/** private declarations */
+
+static void put_u64(unsigned char *p, unsigned long long v);
+static void put_double(unsigned char *p, double d);
+static unsigned long long get_u64(const unsigned char *p);
+static double get_double(const unsigned char *p);
+static unsigned long hash_bytes(const unsigned char *p, size_t n);
+
+static int get_sign_bits(const knot *k);
+static void set_sign_bits(knot *k, int bits);
+static int get_spokes(const knot *k);
+static int is_good_knot(const knot *k, int spokes,
+                        double saved_width, double saved_height);
+static int get_style(const char *name);
+static fluere_drawing_ptr make_drawing(int saved_width, int saved_height,
+                                       int width, int height,
+                                       int style1, int style2,
+                                       int leafdiscrete, int raysdiscrete,
+                                       unsigned long long seed,
+                                       const knot *knots, int num_knots);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Writes the binary spec
+ */
+size_t encode_fluere_spec(fluere_drawing_ptr s,
+                          unsigned char *buf,
+                          size_t size)
+{
+  size_t needed = SPEC_HEADER_SIZE + SPEC_KNOT_SIZE * (size_t) s->num_knots
+                  + SPEC_TRAILER_SIZE;
+  unsigned char *p;
+  int ii;
+
+  if (!buf || size < needed)
+    return needed;
+
+  memset(buf, 0, SPEC_HEADER_SIZE);
+  memcpy(buf, "FLSP", 4);
+  buf[4] = FLUERE_SPEC_VERSION;
+  buf[5] = s->style1;
+  buf[6] = s->style2;
+  buf[7] = s->leafdiscrete;
+  buf[8] = s->raysdiscrete;
+  put_u32(buf + 12, s->width);
+  put_u32(buf + 16, s->height);
+  put_u32(buf + 20, s->num_knots);
+  put_u64(buf + 24, s->seed);
+
+  p = buf + SPEC_HEADER_SIZE;
+  for (ii = 0; ii < s->num_knots; ++ii, p += SPEC_KNOT_SIZE)
+  {
+    knot k = s->knots[ii];
+
+    put_double(p, k.x);
+    put_double(p + 8, k.y);
+    put_double(p + 16, k.frequency);
+    put_double(p + 24, k.decay);
+    put_double(p + 32, k.amplitude);
+    p[40] = get_spokes(&k);
+    p[41] = get_sign_bits(&k);
+  }
+
+  put_u32(p, hash_bytes(buf, p - buf));
+
+  return needed;
+}
+
+/**
+ * Reads a binary spec
+ */
+fluere_drawing_ptr decode_fluere_spec(const unsigned char *buf,
+                                      size_t size,
+                                      int width,
+                                      int height)
+{
+  fluere_drawing_ptr s;
+  const unsigned char *p;
+  unsigned long num_knots;
+  knot *knots;
+  int ii;
+
+  if (size < SPEC_HEADER_SIZE + SPEC_TRAILER_SIZE ||
+      memcmp(buf, "FLSP", 4) != 0 || buf[4] != FLUERE_SPEC_VERSION)
+    return NULL;
+
+  num_knots = get_u32(buf + 20);
+  if (num_knots < 1 || num_knots > SPEC_MAX_KNOTS ||
+      size != SPEC_HEADER_SIZE + SPEC_KNOT_SIZE * num_knots
+              + SPEC_TRAILER_SIZE)
+    return NULL;
+
+  p = buf + SPEC_HEADER_SIZE + SPEC_KNOT_SIZE * num_knots;
+  if (get_u32(p) != hash_bytes(buf, p - buf))
+    return NULL;
+
+  knots = malloc(sizeof(knot) * num_knots);
+  if (!knots)
+    return NULL;
+
+  p = buf + SPEC_HEADER_SIZE;
+  for (ii = 0; ii < (int) num_knots; ++ii, p += SPEC_KNOT_SIZE)
+  {
+    knot *k = &knots[ii];
+
+    k->x = get_double(p);
+    k->y = get_double(p + 8);
+    k->frequency = get_double(p + 16);
+    k->decay = get_double(p + 24);
+    k->amplitude = get_double(p + 32);
+    k->sectors = p[40] / (2 * M_PI);
+    set_sign_bits(k, p[41]);
+
+    if (!is_good_knot(k, p[40], get_u32(buf + 12), get_u32(buf + 16)))
+    {
+      free(knots);
+      return NULL;
+    }
+  }
+
+  s = make_drawing(get_u32(buf + 12), get_u32(buf + 16), width, height,
+                   buf[5], buf[6], buf[7], buf[8], get_u64(buf + 24),
+                   knots, num_knots);
+  free(knots);
+
+  return s;
+}
+
+/**
+ * Writes the binary spec to a file
+ */
+int save_fluere_spec(fluere_drawing_ptr s, FILE *f)
+{
+  size_t size = encode_fluere_spec(s, NULL, 0);
+  unsigned char *buf = malloc(size);
+  int written;
+
+  if (!buf)
+    return 0;
+
+  encode_fluere_spec(s, buf, size);
+  written = (fwrite(buf, 1, size, f) == size);
+  free(buf);
+
+  return written;
+}
+
+/**
+ * Reads a binary spec from a file
+ */
+fluere_drawing_ptr load_fluere_spec(FILE *f, int width, int height)
+{
+  unsigned char header[SPEC_HEADER_SIZE];
+  unsigned char *buf;
+  unsigned long num_knots;
+  size_t size;
+  fluere_drawing_ptr s = NULL;
+
+  if (fread(header, 1, SPEC_HEADER_SIZE, f) != SPEC_HEADER_SIZE)
+    return NULL;
+
+  num_knots = get_u32(header + 20);
+  if (num_knots < 1 || num_knots > SPEC_MAX_KNOTS)
+    return NULL;
+
+  size = SPEC_HEADER_SIZE + SPEC_KNOT_SIZE * num_knots + SPEC_TRAILER_SIZE;
+  buf = malloc(size);
+  if (!buf)
+    return NULL;
+
+  memcpy(buf, header, SPEC_HEADER_SIZE);
+  if (fread(buf + SPEC_HEADER_SIZE, 1, size - SPEC_HEADER_SIZE, f)
+      == size - SPEC_HEADER_SIZE)
+    s = decode_fluere_spec(buf, size, width, height);
+
+  free(buf);
+  return s;
+}
+
+/**
+ * Writes the text spec, which looks like
+ *
+ \verbatim
+   fluere-spec 1
+   size 1920 1080
+   styles wave leaf
+   discrete 4 1
+   seed 0x2545f4914f6cdd1d
+   knots 2
+   960.5 540.25 +-+-- 3 4.5 32.75 0
+   ...
+ \endverbatim
+ *
+ * with a line for each knot giving x, y, the signs of flow, spin,
+ * leaf, rays and wave, the number of spokes, frequency, decay and
+ * amplitude.  The doubles are written with 17 digits, which is enough
+ * to read them back exactly.
+ */
+int save_fluere_spec_text(fluere_drawing_ptr s, FILE *f)
+{
+  int ii;
+  int jj;
+
+  fprintf(f, "fluere-spec %d\n", FLUERE_SPEC_VERSION);
+  fprintf(f, "size %d %d\n", s->width, s->height);
+  fprintf(f, "styles %s %s\n", style_names[s->style1],
+          style_names[s->style2]);
+  fprintf(f, "discrete %d %d\n", s->leafdiscrete, s->raysdiscrete);
+  fprintf(f, "seed 0x%016llx\n", s->seed);
+  fprintf(f, "knots %d\n", s->num_knots);
+
+  for (ii = 0; ii < s->num_knots; ++ii)
+  {
+    knot k = s->knots[ii];
+    int bits = get_sign_bits(&k);
+    char letters[SPEC_SIGNS + 1];
+
+    for (jj = 0; jj < SPEC_SIGNS; ++jj)
+      letters[jj] = (bits & (1 << jj)) ? '-' : '+';
+    letters[SPEC_SIGNS] = '\0';
+
+    fprintf(f, "%.17g %.17g %s %d %.17g %.17g %.17g\n",
+            k.x, k.y, letters, get_spokes(&k),
+            k.frequency, k.decay, k.amplitude);
+  }
+
+  return !ferror(f);
+}
+
+/**
+ * Reads a text spec
+ */
+fluere_drawing_ptr load_fluere_spec_text(FILE *f, int width, int height)
+{
+  fluere_drawing_ptr s;
+  char name1[8];
+  char name2[8];
+  int version;
+  int saved_width;
+  int saved_height;
+  int style1;
+  int style2;
+  int leafdiscrete;
+  int raysdiscrete;
+  unsigned long long seed;
+  int num_knots;
+  knot *knots;
+  int ii;
+  int jj;
+
+  if (fscanf(f, " fluere-spec %d", &version) != 1 ||
+      version != FLUERE_SPEC_VERSION ||
+      fscanf(f, " size %d %d", &saved_width, &saved_height) != 2 ||
+      fscanf(f, " styles %7s %7s", name1, name2) != 2 ||
+      fscanf(f, " discrete %d %d", &leafdiscrete, &raysdiscrete) != 2 ||
+      fscanf(f, " seed %llx", &seed) != 1 ||
+      fscanf(f, " knots %d", &num_knots) != 1)
+    return NULL;
+
+  style1 = get_style(name1);
+  style2 = get_style(name2);
+  if (num_knots < 1 || num_knots > SPEC_MAX_KNOTS)
+    return NULL;
+
+  knots = malloc(sizeof(knot) * num_knots);
+  if (!knots)
+    return NULL;
+
+  for (ii = 0; ii < num_knots; ++ii)
+  {
+    knot *k = &knots[ii];
+    char letters[SPEC_SIGNS + 1];
+    int bits = 0;
+    int spokes;
+
+    if (fscanf(f, "%lf %lf %5s %d %lf %lf %lf", &k->x, &k->y, letters,
+               &spokes, &k->frequency, &k->decay, &k->amplitude) != 7 ||
+        strlen(letters) != SPEC_SIGNS)
+      break;
+
+    k->sectors = spokes / (2 * M_PI);
+    for (jj = 0; jj < SPEC_SIGNS; ++jj)
+    {
+      if (letters[jj] == '-')
+        bits |= 1 << jj;
+    }
+    set_sign_bits(k, bits);
+
+    if (!is_good_knot(k, spokes, saved_width, saved_height))
+      break;
+  }
+
+  s = NULL;
+  if (ii == num_knots)
+    s = make_drawing(saved_width, saved_height, width, height,
+                     style1, style2, leafdiscrete, raysdiscrete, seed,
+                     knots, num_knots);
+  free(knots);
+
+  return s;
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * stores v at p, little end first
+ */
+static void put_u64(unsigned char *p, unsigned long long v)
+{
+  int ii;
+  for (ii = 0; ii < 8; ++ii)
+    p[ii] = (v >> (8 * ii)) & 0xff;
+}
+
+/**
+ * stores the bits of d at p, little end first
+ */
+static void put_double(unsigned char *p, double d)
+{
+  unsigned long long v;
+  memcpy(&v, &d, sizeof(v));
+  put_u64(p, v);
+}
+
+/**
+ * reads what put_u64 stored
+ */
+static unsigned long long get_u64(const unsigned char *p)
+{
+  return (unsigned long long) get_u32(p) |
+         ((unsigned long long) get_u32(p + 4) << 32);
+}
+
+/**
+ * reads what put_double stored
+ */
+static double get_double(const unsigned char *p)
+{
+  unsigned long long v = get_u64(p);
+  double d;
+  memcpy(&d, &v, sizeof(d));
+  return d;
+}
+
+/**
+ * the 32-bit FNV-1a hash of n bytes
+ */
+static unsigned long hash_bytes(const unsigned char *p, size_t n)
+{
+  unsigned long h = 2166136261UL;
+  size_t ii;
+
+  for (ii = 0; ii < n; ++ii)
+    h = ((h ^ p[ii]) * 16777619UL) & 0xffffffffUL;
+
+  return h;
+}
+
+/**
+ * the signs of k as bits 0-4, set where flowsign, spinsign, leafsign,
+ * rayssign and wavesign are negative
+ */
+static int get_sign_bits(const knot *k)
+{
+  return (k->flowsign < 0) | (k->spinsign < 0) << 1 |
+         (k->leafsign < 0) << 2 | (k->rayssign < 0) << 3 |
+         (k->wavesign < 0) << 4;
+}
+
+/**
+ * sets the signs of k from the bits made by get_sign_bits
+ */
+static void set_sign_bits(knot *k, int bits)
+{
+  k->flowsign = (bits & 1) ? -1.0 : 1.0;
+  k->spinsign = (bits & 2) ? -1.0 : 1.0;
+  k->leafsign = (bits & 4) ? -1 : 1;
+  k->rayssign = (bits & 8) ? -1 : 1;
+  k->wavesign = (bits & 16) ? -1.0 : 1.0;
+}
+
+/**
+ * the number of spokes that k->sectors was made from
+ */
+static int get_spokes(const knot *k)
+{
+  return (int) floor(k->sectors * 2 * M_PI + 0.5);
+}
+
+/**
+ * checks that a knot read from a spec can be drawn: its twist must
+ * fade and turn the way define_knots makes them (the spin kernels cull
+ * by the decay, and flow_span's bound on r^2 needs the knots near the
+ * drawing), and it must be within SPEC_KNOT_REACH of the saved size
+ */
+static int is_good_knot(const knot *k, int spokes,
+                        double saved_width, double saved_height)
+{
+  return spokes >= 1 && spokes <= 255 &&
+         saved_width > 0 && saved_height > 0 &&
+         k->x >= -SPEC_KNOT_REACH * saved_width &&
+         k->x <= (1 + SPEC_KNOT_REACH) * saved_width &&
+         k->y >= -SPEC_KNOT_REACH * saved_height &&
+         k->y <= (1 + SPEC_KNOT_REACH) * saved_height &&
+         isfinite(k->amplitude) &&
+         isfinite(k->frequency) && k->frequency > 0 &&
+         isfinite(k->decay) && k->decay > 0;
+}
+
+/**
+ * the fluere_style with the given name, or -1
+ */
+static int get_style(const char *name)
+{
+  int style;
+
+  for (style = flow; style <= rays; ++style)
+  {
+    if (strcmp(name, style_names[style]) == 0)
+      return style;
+  }
+  return -1;
+}
+
+/**
+ * Makes a drawing with the given knots, scaled from the size they were
+ * saved at to width x height (if those are > 0).  The positions are
+ * scaled in each direction, and the frequency and decay of the spin
+ * twists by the geometric mean, so the drawing looks the same but for
+ * flow and wave: their values depend on the log of the distance to each
+ * knot, so their colors shift a little at other sizes.  Returns NULL if
+ * the numbers don't make a drawing.
+ */
+static fluere_drawing_ptr make_drawing(int saved_width, int saved_height,
+                                       int width, int height,
+                                       int style1, int style2,
+                                       int leafdiscrete, int raysdiscrete,
+                                       unsigned long long seed,
+                                       const knot *knots, int num_knots)
+{
+  fluere_drawing_ptr s;
+  double sx = 1.0;
+  double sy = 1.0;
+  int ii;
+
+  if (saved_width <= 0 || saved_height <= 0 || num_knots < 1 ||
+      style1 < flow || style1 > rays || style2 < flow || style2 > rays ||
+      leafdiscrete < 1 || leafdiscrete > 255 ||
+      raysdiscrete < 1 || raysdiscrete > 255)
+    return NULL;
+
+  if (width <= 0 || height <= 0)
+  {
+    width = saved_width;
+    height = saved_height;
+  }
+  else
+  {
+    sx = (double) width / saved_width;
+    sy = (double) height / saved_height;
+  }
+
+  s = init_fluere_drawing_seeded(width, height, num_knots,
+                                 style1, style2, seed);
+  if (!s)
+    return NULL;
+
+  s->leafdiscrete = leafdiscrete;
+  s->raysdiscrete = raysdiscrete;
+
+  for (ii = 0; ii < num_knots; ++ii)
+  {
+    s->knots[ii] = knots[ii];
+    if (sx != 1.0 || sy != 1.0)
+    {
+      s->knots[ii].x *= sx;
+      s->knots[ii].y *= sy;
+      s->knots[ii].frequency *= sqrt(sx * sy);
+      s->knots[ii].decay *= sqrt(sx * sy);
+    }
+  }
+
+  delete_knot_packs(s);
+  if (!init_knot_packs(s))
+  {
+    delete_fluere_drawing(s);
+    return NULL;
+  }
+
+  return s;
+}
+
+/*@}*/
@@ -0,0 +1,70 @@
+/**
+ * \file fluere_spec.h
+ *
+ * \brief Saving and loading the spec of a fluere drawing: its styles,
+ * discreteness and knots, which is all it takes to draw it again, at
+ * the same size or any other.
+ *
+ * The binary spec is 36 bytes plus 42 per knot; the text spec holds
+ * the same things in a form that can be read and edited by hand.  Both
+ * keep every double bit for bit, so a drawing loaded at the size it
+ * was saved at gives exactly the same pixels.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_SPEC_H
+#define FLUERE_SPEC_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "fluere_drawing.h"
+
+/** the version of the spec formats written by this code */
+#define FLUERE_SPEC_VERSION 1
+
+
+/**
+ * Writes the binary spec of s into buf, if it fits in size bytes.
+ * Returns the size of the spec either way, so calling it with size 0
+ * says how big buf needs to be.
+ */
+size_t encode_fluere_spec(fluere_drawing_ptr s,
+                          unsigned char *buf,
+                          size_t size);
+
+/**
+ * Makes a drawing from the size bytes of a binary spec.  If width and
+ * height are > 0, the knots are scaled to a drawing of that size;
+ * otherwise the drawing has the size it was saved at.  Returns NULL if
+ * the spec is damaged or from a newer version.
+ */
+fluere_drawing_ptr decode_fluere_spec(const unsigned char *buf,
+                                      size_t size,
+                                      int width,
+                                      int height);
+
+/**
+ * Writes the binary spec of s to f.  Returns 1 if it was written.
+ */
+int save_fluere_spec(fluere_drawing_ptr s, FILE *f);
+
+/**
+ * Reads a binary spec from f, like decode_fluere_spec.  Returns NULL if
+ * there's no good spec there.
+ */
+fluere_drawing_ptr load_fluere_spec(FILE *f, int width, int height);
+
+/**
+ * Writes the text spec of s to f.  Returns 1 if it was written.
+ */
+int save_fluere_spec_text(fluere_drawing_ptr s, FILE *f);
+
+/**
+ * Reads a text spec from f, like load_fluere_spec.
+ */
+fluere_drawing_ptr load_fluere_spec_text(FILE *f, int width, int height);
+
+
+#endif
@@ -0,0 +1,814 @@
+/**
+ * \file fluere_stream.c
+ *
+ * \brief The fluere streaming protocol, over TCP or Unix sockets.
+ *
+ * When a client connects, the server sends
+ *
+ \verbatim
+   offset  size
+        0     4   "FLST"
+        4     1   version
+        5     3   zero
+ \endverbatim
+ *
+ * and after that, messages, each of which is
+ *
+ \verbatim
+   offset  size
+        0     1   type
+        1     3   zero
+        4     4   size of the rest, n
+        8     n   the rest
+ \endverbatim
+ *
+ * with the numbers little endian.  The types are
+ *
+ \verbatim
+   'D'   a new drawing: its pixels, as fluere_codec.h compresses them
+   'C'   new colors: 256 colors of 3 bytes
+   'F'   a frame:
+           offset  size
+                0     4   frame number
+                4     1   how far the colors are turned
+                5     1   zero
+                6     2   fade, out of 256
+                8     3   fade color
+               11     1   zero
+ \endverbatim
+ *
+ * and a client skips messages of any other type, so new ones can be
+ * added without changing the version.
+ *
+ * The server writes to each client with a blocking send, which gives
+ * up after STREAM_SEND_TIMEOUT seconds; a client that can't keep up for
+ * that long is dropped rather than holding up the rest.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "fluere_stream.h"
+#include "fluere_codec.h"
+#include "fluere_private.h"
+#include "colortable_transform.h"
+
+/* where there's no MSG_NOSIGNAL (macOS), SO_NOSIGPIPE does its job */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/** the version of the protocol */
+#define STREAM_VERSION 1
+
+/** bytes in the greeting, and in the start of a message */
+#define STREAM_GREETING_SIZE 8
+#define STREAM_HEADER_SIZE 8
+
+/** bytes in the rest of a colors message, and of a frame message */
+#define STREAM_COLORS_SIZE (256 * 3)
+#define STREAM_FRAME_SIZE 12
+
+/** the biggest message a client takes */
+#define STREAM_MAX_MESSAGE (1UL << 30)
+
+/** seconds a client has to take what it's sent */
+#define STREAM_SEND_TIMEOUT 5
+
+/** bytes a client reads of a drawing at a time */
+#define STREAM_CHUNK (64 * 1024)
+
+
+/** a server */
+struct fluere_stream_server_struct
+{
+  int listener;                 /**< the socket clients connect to */
+  char *unix_path;              /**< its name, if it's a Unix socket */
+  int *clients;                 /**< the clients' sockets */
+  int num_clients;
+  int max_clients;              /**< room in clients */
+  unsigned char *drawing;       /**< the latest drawing message, or NULL */
+  size_t drawing_size;
+  unsigned char colors[STREAM_HEADER_SIZE + STREAM_COLORS_SIZE];
+                                /**< the latest colors message */
+  int have_colors;              /**< whether there is one */
+  unsigned long long bytes_sent;
+};
+typedef struct fluere_stream_server_struct fluere_stream_server;
+
+/** a client */
+struct fluere_stream_client_struct
+{
+  int fd;                                   /**< the socket */
+  fluere_decoder_ptr drawing;               /**< the latest whole drawing,
+                                                 or NULL */
+  unsigned char ctable[STREAM_COLORS_SIZE]; /**< the latest colors */
+  int have_colors;                          /**< whether they've come */
+  int frame;                                /**< the latest frame */
+  int offset;
+  int fade;
+  unsigned char fade_color[3];
+  unsigned long long bytes_received;
+};
+typedef struct fluere_stream_client_struct fluere_stream_client;
+
+/** private declarations */
+
+static int open_socket(const char *address, int server, char **unix_path);
+static int open_unix_socket(const char *path, int server);
+static void set_up_client(int fd);
+static int greet_client(fluere_stream_server *s, int fd);
+static void send_to_all(fluere_stream_server *s,
+                        const unsigned char *message,
+                        size_t size);
+static int send_all(int fd, const unsigned char *buf, size_t size);
+static int receive_all(fluere_stream_client *c, unsigned char *buf,
+                       size_t size);
+static int read_drawing(fluere_stream_client *c, size_t size);
+static void put_header(unsigned char *p, int type, unsigned long size);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Opens the listening socket, and makes it not block, so new clients
+ * can be looked for between frames.
+ */
+fluere_stream_server_ptr open_fluere_stream_server(const char *address)
+{
+  fluere_stream_server *s = calloc(1, sizeof(fluere_stream_server));
+
+  if (!s)
+    return NULL;
+
+  s->listener = open_socket(address, 1, &s->unix_path);
+  if (s->listener < 0)
+  {
+    free(s);
+    return NULL;
+  }
+  fcntl(s->listener, F_SETFL, fcntl(s->listener, F_GETFL) | O_NONBLOCK);
+
+  return s;
+}
+
+/**
+ * Compresses the drawing into a message once, for every client now and
+ * later.
+ */
+int send_fluere_stream_drawing(fluere_stream_server_ptr s,
+                               const unsigned char *data,
+                               int width,
+                               int height,
+                               int nthreads)
+{
+  size_t bound = get_fluere_codec_bound(width, height);
+  unsigned char *message = malloc(STREAM_HEADER_SIZE + bound);
+  size_t size;
+
+  if (!message)
+    return 0;
+
+  size = encode_fluere_pixels(data, width, height, nthreads,
+                              message + STREAM_HEADER_SIZE, bound);
+  if (size == 0)
+  {
+    free(message);
+    return 0;
+  }
+  put_header(message, 'D', size);
+
+  free(s->drawing);
+  s->drawing = message;
+  s->drawing_size = STREAM_HEADER_SIZE + size;
+
+  accept_fluere_stream_clients(s);
+  send_to_all(s, s->drawing, s->drawing_size);
+
+  return 1;
+}
+
+/**
+ * Keeps the colors as a message, and sends it.
+ */
+void send_fluere_stream_colors(fluere_stream_server_ptr s,
+                               const unsigned char *ctable)
+{
+  put_header(s->colors, 'C', STREAM_COLORS_SIZE);
+  memcpy(s->colors + STREAM_HEADER_SIZE, ctable, STREAM_COLORS_SIZE);
+  s->have_colors = 1;
+
+  accept_fluere_stream_clients(s);
+  send_to_all(s, s->colors, sizeof(s->colors));
+}
+
+/**
+ * Sends the frame.
+ */
+void send_fluere_stream_frame(fluere_stream_server_ptr s,
+                              int frame,
+                              int offset,
+                              int fade,
+                              const unsigned char *fade_color)
+{
+  unsigned char message[STREAM_HEADER_SIZE + STREAM_FRAME_SIZE];
+  unsigned char *p = message + STREAM_HEADER_SIZE;
+
+  fade = (fade < 0) ? 0 : (fade > 256) ? 256 : fade;
+
+  put_header(message, 'F', STREAM_FRAME_SIZE);
+  put_u32(p, (unsigned long) frame);
+  p[4] = offset & 255;
+  p[5] = 0;
+  p[6] = fade & 0xff;
+  p[7] = fade >> 8;
+  if (fade_color)
+    memcpy(p + 8, fade_color, 3);
+  else
+    memset(p + 8, 0, 3);
+  p[11] = 0;
+
+  accept_fluere_stream_clients(s);
+  send_to_all(s, message, sizeof(message));
+}
+
+/**
+ * Accepts until there's nobody waiting.
+ */
+void accept_fluere_stream_clients(fluere_stream_server_ptr s)
+{
+  for (;;)
+  {
+    int fd = accept(s->listener, NULL, NULL);
+
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+
+    set_up_client(fd);
+
+    if (s->num_clients == s->max_clients)
+    {
+      int max = s->max_clients ? 2 * s->max_clients : 8;
+      int *clients = realloc(s->clients, max * sizeof(int));
+
+      if (!clients)
+      {
+        close(fd);
+        continue;
+      }
+      s->clients = clients;
+      s->max_clients = max;
+    }
+
+    if (greet_client(s, fd))
+      s->clients[s->num_clients++] = fd;
+    else
+      close(fd);
+  }
+}
+
+/**
+ * Returns the number of clients.
+ */
+int get_fluere_stream_clients(fluere_stream_server_ptr s)
+{
+  return s->num_clients;
+}
+
+/**
+ * Returns the bytes sent.
+ */
+unsigned long long get_fluere_stream_bytes_sent(fluere_stream_server_ptr s)
+{
+  return s->bytes_sent;
+}
+
+/**
+ * Closes every socket, and removes a Unix socket's name.
+ */
+void close_fluere_stream_server(fluere_stream_server_ptr s)
+{
+  int ii;
+
+  if (!s)
+    return;
+
+  for (ii = 0; ii < s->num_clients; ++ii)
+    close(s->clients[ii]);
+  close(s->listener);
+  if (s->unix_path)
+  {
+    unlink(s->unix_path);
+    free(s->unix_path);
+  }
+
+  free(s->clients);
+  free(s->drawing);
+  free(s);
+}
+
+/**
+ * Connects, and checks the greeting.
+ */
+fluere_stream_client_ptr connect_fluere_stream(const char *address)
+{
+  fluere_stream_client *c = calloc(1, sizeof(fluere_stream_client));
+  unsigned char greeting[STREAM_GREETING_SIZE];
+
+  if (!c)
+    return NULL;
+
+  c->fd = open_socket(address, 0, NULL);
+  if (c->fd < 0)
+  {
+    free(c);
+    return NULL;
+  }
+
+  if (!receive_all(c, greeting, STREAM_GREETING_SIZE) ||
+      memcmp(greeting, "FLST", 4) != 0 || greeting[4] != STREAM_VERSION)
+  {
+    close_fluere_stream(c);
+    return NULL;
+  }
+
+  return c;
+}
+
+/**
+ * Reads messages until a frame comes.  Frames that come before there
+ * is a drawing and colors to show them with are passed over.
+ */
+int read_fluere_stream_frame(fluere_stream_client_ptr c)
+{
+  for (;;)
+  {
+    unsigned char header[STREAM_HEADER_SIZE];
+    unsigned char frame[STREAM_FRAME_SIZE];
+    unsigned long size;
+
+    if (!receive_all(c, header, STREAM_HEADER_SIZE))
+      return 0;
+    size = get_u32(header + 4);
+    if (size > STREAM_MAX_MESSAGE)
+      return 0;
+
+    if (header[0] == 'D')
+    {
+      if (!read_drawing(c, size))
+        return 0;
+    }
+    else if (header[0] == 'C')
+    {
+      if (size != STREAM_COLORS_SIZE ||
+          !receive_all(c, c->ctable, STREAM_COLORS_SIZE))
+        return 0;
+      c->have_colors = 1;
+    }
+    else if (header[0] == 'F')
+    {
+      if (size != STREAM_FRAME_SIZE ||
+          !receive_all(c, frame, STREAM_FRAME_SIZE) ||
+          frame[6] + 256 * frame[7] > 256)
+        return 0;
+
+      c->frame = (int) get_u32(frame);
+      c->offset = frame[4];
+      c->fade = frame[6] + 256 * frame[7];
+      memcpy(c->fade_color, frame + 8, 3);
+
+      if (c->drawing && c->have_colors)
+        return 1;
+    }
+    else
+    {
+      unsigned char skip[256];
+
+      while (size > 0)
+      {
+        size_t n = (size < sizeof(skip)) ? size : sizeof(skip);
+
+        if (!receive_all(c, skip, n))
+          return 0;
+        size -= n;
+      }
+    }
+  }
+}
+
+/**
+ * Returns the frame number.
+ */
+int get_fluere_stream_frame(fluere_stream_client_ptr c)
+{
+  return c->frame;
+}
+
+/**
+ * Gets the size from the decoder.
+ */
+void get_fluere_stream_size(fluere_stream_client_ptr c,
+                            int *width,
+                            int *height)
+{
+  *width = 0;
+  *height = 0;
+  if (c->drawing)
+    get_fluere_decoder_data(c->drawing, width, height);
+}
+
+/**
+ * Returns the decoder's pixels.
+ */
+const unsigned char* get_fluere_stream_pixels(fluere_stream_client_ptr c)
+{
+  int width;
+  int height;
+
+  return c->drawing ? get_fluere_decoder_data(c->drawing, &width, &height)
+                    : NULL;
+}
+
+/**
+ * Turns and fades the colors.
+ */
+void get_fluere_stream_colors(fluere_stream_client_ptr c,
+                              unsigned char *colors)
+{
+  colortable_transform t;
+  int ii;
+
+  for (ii = 0; ii < 256; ++ii)
+    memcpy(colors + 3 * ii, c->ctable + 3 * ((ii + c->offset) & 255), 3);
+
+  init_colortable_transform(&t);
+  set_colortable_fade(&t, c->fade / 256.0, c->fade_color);
+  transform_colortable(&t, colors, 256, colors);
+}
+
+/**
+ * Makes the frame's colors into a table of pixels, and looks the
+ * pixels up in it.
+ */
+void render_fluere_stream_frame(fluere_stream_client_ptr c,
+                                fluere_pixel_format format,
+                                void *out,
+                                int stride,
+                                int nthreads)
+{
+  unsigned char colors[STREAM_COLORS_SIZE];
+  fluere_pixel_table t;
+  int width;
+  int height;
+  const unsigned char *data;
+
+  if (!c->drawing)
+    return;
+  data = get_fluere_decoder_data(c->drawing, &width, &height);
+
+  get_fluere_stream_colors(c, colors);
+  init_fluere_pixel_table(&t, colors, 0, format);
+  expand_fluere_pixels(data, width, height, &t, out, stride, nthreads);
+}
+
+/**
+ * Returns the bytes received.
+ */
+unsigned long long get_fluere_stream_bytes_received(
+    fluere_stream_client_ptr c)
+{
+  return c->bytes_received;
+}
+
+/**
+ * Closes the socket, and frees the drawing.
+ */
+void close_fluere_stream(fluere_stream_client_ptr c)
+{
+  if (!c)
+    return;
+
+  close(c->fd);
+  if (c->drawing)
+    delete_fluere_decoder(c->drawing);
+  free(c);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Opens a socket to address, listening on it if server is set, and
+ * connecting to it if not.  The name of a Unix socket a server listens
+ * on is put in *unix_path, for it to be removed later.  Returns the
+ * socket, or -1.
+ */
+static int open_socket(const char *address, int server, char **unix_path)
+{
+  const char *colon = strrchr(address, ':');
+  struct addrinfo hints;
+  struct addrinfo *list;
+  struct addrinfo *ai;
+  char *host;
+  int fd = -1;
+
+  if (strncmp(address, "unix:", 5) == 0)
+  {
+    fd = open_unix_socket(address + 5, server);
+    if (fd >= 0 && server)
+      *unix_path = strdup(address + 5);
+    return fd;
+  }
+
+  if (!colon || !colon[1])
+    return -1;
+
+  host = malloc(colon - address + 1);
+  if (!host)
+    return -1;
+  memcpy(host, address, colon - address);
+  host[colon - address] = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = server ? AI_PASSIVE : 0;
+
+  if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &list) != 0)
+  {
+    free(host);
+    return -1;
+  }
+  free(host);
+
+  for (ai = list; ai && fd < 0; ai = ai->ai_next)
+  {
+    int one = 1;
+
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (server)
+    {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 16) != 0)
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+    else
+    {
+      if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+      {
+        close(fd);
+        fd = -1;
+      }
+      else
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+  }
+
+  freeaddrinfo(list);
+  return fd;
+}
+
+/**
+ * Opens a Unix socket at path.  A server removes a socket left at path
+ * by one before it (but nothing else that's there).  Returns the
+ * socket, or -1.
+ */
+static int open_unix_socket(const char *path, int server)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd;
+  int ok;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  if (server)
+  {
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(path);
+    ok = (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0 &&
+          listen(fd, 16) == 0);
+  }
+  else
+    ok = (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0);
+
+  if (!ok)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+ * Makes a client's socket block (an accepted socket takes after the
+ * listener on some systems), with a time limit, and sends each frame
+ * as soon as it's written.
+ */
+static void set_up_client(int fd)
+{
+  struct timeval timeout;
+  int one = 1;
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+  timeout.tv_sec = STREAM_SEND_TIMEOUT;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  /* fails on a Unix socket, which doesn't wait anyway */
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+/**
+ * Sends a new client the greeting, and the latest drawing and colors.
+ * Returns 1 if it took them.
+ */
+static int greet_client(fluere_stream_server *s, int fd)
+{
+  unsigned char greeting[STREAM_GREETING_SIZE];
+
+  memcpy(greeting, "FLST", 4);
+  greeting[4] = STREAM_VERSION;
+  memset(greeting + 5, 0, 3);
+
+  if (!send_all(fd, greeting, sizeof(greeting)))
+    return 0;
+  s->bytes_sent += sizeof(greeting);
+
+  if (s->drawing)
+  {
+    if (!send_all(fd, s->drawing, s->drawing_size))
+      return 0;
+    s->bytes_sent += s->drawing_size;
+  }
+
+  if (s->have_colors)
+  {
+    if (!send_all(fd, s->colors, sizeof(s->colors)))
+      return 0;
+    s->bytes_sent += sizeof(s->colors);
+  }
+
+  return 1;
+}
+
+/**
+ * Sends a message to every client, dropping the ones it can't be sent
+ * to.
+ */
+static void send_to_all(fluere_stream_server *s,
+                        const unsigned char *message,
+                        size_t size)
+{
+  int ii = 0;
+
+  while (ii < s->num_clients)
+  {
+    if (send_all(s->clients[ii], message, size))
+    {
+      s->bytes_sent += size;
+      ii++;
+    }
+    else
+    {
+      close(s->clients[ii]);
+      s->clients[ii] = s->clients[--s->num_clients];
+    }
+  }
+}
+
+/**
+ * Sends all size bytes of buf.  Returns 1 if they were sent.
+ */
+static int send_all(int fd, const unsigned char *buf, size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 0;
+    buf += n;
+    size -= n;
+  }
+
+  return 1;
+}
+
+/**
+ * Reads size bytes into buf.  Returns 1 if they all came.
+ */
+static int receive_all(fluere_stream_client *c, unsigned char *buf,
+                       size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t n = recv(c->fd, buf, size, 0);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 0;
+    c->bytes_received += n;
+    buf += n;
+    size -= n;
+  }
+
+  return 1;
+}
+
+/**
+ * Reads the size bytes of a drawing into a new decoder, decoding the
+ * bands as they come, and makes it the drawing if it's all there.
+ * Returns 1 if it was good.
+ */
+static int read_drawing(fluere_stream_client *c, size_t size)
+{
+  fluere_decoder_ptr d = init_fluere_decoder();
+  unsigned char *chunk = malloc(STREAM_CHUNK);
+  int rows = 0;
+  int width = 0;
+  int height = 0;
+
+  while (d && chunk && size > 0 && rows >= 0)
+  {
+    size_t n = (size < STREAM_CHUNK) ? size : STREAM_CHUNK;
+
+    if (!receive_all(c, chunk, n))
+      rows = -1;
+    else
+      rows = feed_fluere_decoder(d, chunk, n);
+    size -= n;
+  }
+  free(chunk);
+
+  if (!d || size > 0 || rows < 0 ||
+      !get_fluere_decoder_data(d, &width, &height) || rows < height)
+  {
+    if (d)
+      delete_fluere_decoder(d);
+    return 0;
+  }
+
+  if (c->drawing)
+    delete_fluere_decoder(c->drawing);
+  c->drawing = d;
+
+  return 1;
+}
+
+/**
+ * Writes the start of a message of the given type, with size more
+ * bytes.
+ */
+static void put_header(unsigned char *p, int type, unsigned long size)
+{
+  p[0] = type;
+  memset(p + 1, 0, 3);
+  put_u32(p + 4, size);
+}
+
+/*@}*/
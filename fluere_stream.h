@@ -0,0 +1,153 @@
+/**
+ * \file fluere_stream.h
+ *
+ * \brief Streaming fluere animations to displays over TCP or Unix
+ * sockets.
+ *
+ * Every frame of a fluere animation is the same pixels with the colors
+ * turned and faded, so sending frames as pixels wastes nearly all of
+ * what is sent.  Instead, the server sends each drawing's pixels once,
+ * compressed, its color table once, and then just how far the colors
+ * are turned and how faded they are for each frame: a few hundred
+ * bytes a second.  Each client makes the frames itself, with one
+ * lookup for each pixel (see fluere_expand.h).
+ *
+ * An address is either "unix:PATH", for a Unix socket, or "HOST:PORT"
+ * (HOST may be empty, for a server, to listen on every interface).
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_STREAM_H
+#define FLUERE_STREAM_H
+
+#include "fluere_expand.h"
+
+/** a server, sending to any number of clients */
+typedef struct fluere_stream_server_struct *fluere_stream_server_ptr;
+
+/** a client, making the frames a server sends it */
+typedef struct fluere_stream_client_struct *fluere_stream_client_ptr;
+
+
+/**
+ * Starts listening for clients at address.  Returns NULL if it can't.
+ */
+fluere_stream_server_ptr open_fluere_stream_server(const char *address);
+
+/**
+ * Sends the width x height pixels of a new drawing, which are
+ * compressed on nthreads threads, to every client.  Clients that
+ * connect later are sent the latest drawing when they do.  Returns 1 if
+ * the pixels could be compressed.
+ */
+int send_fluere_stream_drawing(fluere_stream_server_ptr s,
+                               const unsigned char *data,
+                               int width,
+                               int height,
+                               int nthreads);
+
+/**
+ * Sends new colors: the 256 colors of ctable (a color table made by
+ * get_colortable; only its first 768 bytes are used).  Like the
+ * drawing, the latest ones are sent to clients that connect later.
+ */
+void send_fluere_stream_colors(fluere_stream_server_ptr s,
+                               const unsigned char *ctable);
+
+/**
+ * Sends a frame, numbered frame, which shows pixel value v in color
+ * (v + offset) % 256, with fade (out of 256) of each color left, and
+ * the rest of it fade_color (NULL for black).  New clients are let in
+ * first.
+ */
+void send_fluere_stream_frame(fluere_stream_server_ptr s,
+                              int frame,
+                              int offset,
+                              int fade,
+                              const unsigned char *fade_color);
+
+/**
+ * Lets in any clients that are waiting to connect, sending them the
+ * latest drawing and colors.  A client that isn't taking what it's
+ * sent, or has gone, is dropped.
+ */
+void accept_fluere_stream_clients(fluere_stream_server_ptr s);
+
+/**
+ * Returns the number of clients connected.
+ */
+int get_fluere_stream_clients(fluere_stream_server_ptr s);
+
+/**
+ * Returns the number of bytes sent to all the clients so far.
+ */
+unsigned long long get_fluere_stream_bytes_sent(fluere_stream_server_ptr s);
+
+/**
+ * Disconnects the clients and stops listening.
+ */
+void close_fluere_stream_server(fluere_stream_server_ptr s);
+
+/**
+ * Connects to the server at address.  Returns NULL if it can't, or
+ * the server doesn't speak the protocol.
+ */
+fluere_stream_client_ptr connect_fluere_stream(const char *address);
+
+/**
+ * Waits for the next frame, taking in any new drawing and colors that
+ * come before it; a new drawing is decompressed as it comes in.
+ * Returns 1 when there is a frame, or 0 if the server has gone or sent
+ * something bad.
+ */
+int read_fluere_stream_frame(fluere_stream_client_ptr c);
+
+/**
+ * Returns the number of the latest frame, as the server numbered it.
+ */
+int get_fluere_stream_frame(fluere_stream_client_ptr c);
+
+/**
+ * Gets the size of the drawing.
+ */
+void get_fluere_stream_size(fluere_stream_client_ptr c,
+                            int *width,
+                            int *height);
+
+/**
+ * Returns the pixels of the drawing.  They belong to the client, and
+ * change when a new drawing comes.
+ */
+const unsigned char* get_fluere_stream_pixels(fluere_stream_client_ptr c);
+
+/**
+ * Makes the 256 colors of the latest frame into colors: the pixels of
+ * the frame are the drawing's pixels looked up in them.
+ */
+void get_fluere_stream_colors(fluere_stream_client_ptr c,
+                              unsigned char *colors);
+
+/**
+ * Makes the latest frame as packed pixels, into rows of stride bytes
+ * at out, on nthreads threads (see expand_fluere_pixels).
+ */
+void render_fluere_stream_frame(fluere_stream_client_ptr c,
+                                fluere_pixel_format format,
+                                void *out,
+                                int stride,
+                                int nthreads);
+
+/**
+ * Returns the number of bytes received so far.
+ */
+unsigned long long get_fluere_stream_bytes_received(
+    fluere_stream_client_ptr c);
+
+/**
+ * Disconnects and frees the client.
+ */
+void close_fluere_stream(fluere_stream_client_ptr c);
+
+
+#endif
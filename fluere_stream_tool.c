@@ -0,0 +1,736 @@
+/**
+ * \file fluere_stream_tool.c
+ *
+ * \brief fluere-stream: serves fluere animations to displays over the
+ * network, shows them, and tries the two out together.
+ *
+ * "serve" makes a drawing from each seed in turn and plays it as the
+ * screen saver does, at 30 frames a second, to every client that
+ * connects.  "show" is a display with no screen: it makes every frame
+ * it's sent and prints how fast they come and how much they cost.
+ * "loopback" does both at once over a Unix socket, as fast as it can,
+ * with each client checking every frame against the same animation
+ * played from a .fluere file, and prints how much was sent against
+ * what sending the pixels would take.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "fluere_stream.h"
+#include "fluere_anim.h"
+#include "fluere_batch.h"
+#include "fluere_drawing.h"
+#include "palettes.h"
+#include "thread_pool.h"
+
+#ifndef DEFAULT_PALETTE_FILE
+#define DEFAULT_PALETTE_FILE "palettes.txt"
+#endif
+
+/** the ways the tool can run */
+enum
+{
+  serve_mode,
+  show_mode,
+  loopback_mode
+};
+
+/** what was asked for on the command line */
+struct stream_options_struct
+{
+  int mode;                   /**< serve, show or loopback */
+  const char *address;        /**< where to serve or connect */
+  int width;                  /**< size of the drawings served */
+  int height;
+  unsigned long long seed;    /**< seed of the first drawing */
+  const char *palette_file;   /**< where the palettes are */
+  int drawings;               /**< drawings to play, or 0 for no end */
+  int clients;                /**< clients in a loopback */
+  int frames;                 /**< frames to show, or 0 for no end */
+  int nthreads;               /**< threads, or 0 for one per processor */
+  int quiet;                  /**< don't print how it's going */
+};
+typedef struct stream_options_struct stream_options;
+
+/** a drawing to serve */
+struct stream_drawing_struct
+{
+  unsigned char *data;                /**< its pixels */
+  unsigned char ctable[256 * 3 * 2];  /**< its colors */
+  fluere_anim_ptr anim;               /**< for a loopback, what the
+                                           frames should be */
+};
+typedef struct stream_drawing_struct stream_drawing;
+
+/** a client of a loopback */
+struct loopback_client_struct
+{
+  const stream_options *o;
+  const char *address;
+  stream_drawing *drawings;
+  int frames_per_drawing;
+  int frames;                 /**< frames that came */
+  int wrong;                  /**< and weren't what they should be */
+  int failed;                 /**< set if it couldn't connect */
+};
+typedef struct loopback_client_struct loopback_client;
+
+static const char *mode_names[3] = { "serve", "show", "loopback" };
+
+/** private declarations */
+
+static void usage(FILE *f);
+static int parse_options(int argc, char **argv, stream_options *o);
+static palette_list_ptr load_palettes(const stream_options *o);
+static int make_drawing(const stream_options *o, palette_list_ptr palettes,
+                        unsigned long long seed, stream_drawing *d);
+static int play_drawing(fluere_stream_server_ptr s, stream_drawing *d,
+                        const stream_options *o, int first_frame,
+                        double fps);
+static int serve(stream_options *o);
+static int show(stream_options *o);
+static int loopback(stream_options *o);
+static void *loopback_main(void *arg);
+static double get_time(void);
+static void sleep_until(double t);
+
+
+int main(int argc, char **argv)
+{
+  stream_options o;
+
+  if (!parse_options(argc, argv, &o))
+    return 2;
+
+  switch (o.mode)
+  {
+    case serve_mode:
+      return serve(&o);
+    case show_mode:
+      return show(&o);
+    default:
+      return loopback(&o);
+  }
+}
+
+/**
+ * Prints how to use the tool.
+ */
+static void usage(FILE *f)
+{
+  fprintf(f,
+"usage: fluere-stream serve ADDRESS [options]\n"
+"       fluere-stream show ADDRESS [options]\n"
+"       fluere-stream loopback [options]\n"
+"\n"
+"  ADDRESS is unix:PATH, or HOST:PORT (:PORT to serve on every\n"
+"  interface)\n"
+"\n"
+"  -s, --size WxH          size of the drawings served (default\n"
+"                          1920x1080, or 1280x720 in a loopback)\n"
+"  -e, --seed N            seed of the first drawing; each one after\n"
+"                          has the next (default from the clock)\n"
+"  -P, --palette-file F    palette file (default %s)\n"
+"  -d, --drawings N        drawings to serve (default no end, or 2 in\n"
+"                          a loopback)\n"
+"  -c, --clients N         clients in a loopback (default 2)\n"
+"  -F, --frames N          frames to show before stopping (default\n"
+"                          no end)\n"
+"  -j, --threads N         threads to use (default one per processor)\n"
+"  -q, --quiet             don't print how it's going\n"
+"  -h, --help              print this\n",
+          DEFAULT_PALETTE_FILE);
+}
+
+/**
+ * Fills in o from the command line.  Returns 0 (after saying why) if
+ * it doesn't make sense.
+ */
+static int parse_options(int argc, char **argv, stream_options *o)
+{
+  static const struct option long_options[] =
+  {
+    { "size",          required_argument, NULL, 's' },
+    { "seed",          required_argument, NULL, 'e' },
+    { "palette-file",  required_argument, NULL, 'P' },
+    { "drawings",      required_argument, NULL, 'd' },
+    { "clients",       required_argument, NULL, 'c' },
+    { "frames",        required_argument, NULL, 'F' },
+    { "threads",       required_argument, NULL, 'j' },
+    { "quiet",         no_argument,       NULL, 'q' },
+    { "help",          no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  int size_given = 0;
+  int drawings_given = 0;
+  int c;
+
+  memset(o, 0, sizeof(*o));
+  o->seed = (unsigned long long) time(NULL) * 0x9e3779b97f4a7c15ULL
+            ^ (unsigned long long) getpid();
+  o->palette_file = DEFAULT_PALETTE_FILE;
+  o->clients = 2;
+
+  while ((c = getopt_long(argc, argv, "s:e:P:d:c:F:j:qh", long_options,
+                          NULL)) != -1)
+  {
+    switch (c)
+    {
+      case 's':
+        if (sscanf(optarg, "%dx%d", &o->width, &o->height) != 2 ||
+            o->width <= 0 || o->height <= 0)
+        {
+          fprintf(stderr, "fluere-stream: bad size %s\n", optarg);
+          return 0;
+        }
+        size_given = 1;
+        break;
+      case 'e':
+        o->seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'P':
+        o->palette_file = optarg;
+        break;
+      case 'd':
+        o->drawings = atoi(optarg);
+        drawings_given = 1;
+        break;
+      case 'c':
+        o->clients = atoi(optarg);
+        break;
+      case 'F':
+        o->frames = atoi(optarg);
+        break;
+      case 'j':
+        o->nthreads = atoi(optarg);
+        break;
+      case 'q':
+        o->quiet = 1;
+        break;
+      case 'h':
+        usage(stdout);
+        exit(0);
+      default:
+        usage(stderr);
+        return 0;
+    }
+  }
+
+  if (optind >= argc)
+  {
+    usage(stderr);
+    return 0;
+  }
+
+  for (o->mode = 0; o->mode < 3; ++o->mode)
+  {
+    if (strcmp(argv[optind], mode_names[o->mode]) == 0)
+      break;
+  }
+  if (o->mode == 3)
+  {
+    fprintf(stderr, "fluere-stream: no mode %s\n", argv[optind]);
+    return 0;
+  }
+
+  if (o->mode != loopback_mode)
+  {
+    if (optind + 1 >= argc)
+    {
+      fprintf(stderr, "fluere-stream: %s needs an address\n",
+              mode_names[o->mode]);
+      return 0;
+    }
+    o->address = argv[optind + 1];
+  }
+
+  if (!size_given)
+  {
+    o->width = (o->mode == loopback_mode) ? 1280 : 1920;
+    o->height = (o->mode == loopback_mode) ? 720 : 1080;
+  }
+  if (!drawings_given && o->mode == loopback_mode)
+    o->drawings = 2;
+
+  if (o->drawings < 0 || o->frames < 0 ||
+      (o->mode == loopback_mode && (o->drawings < 1 || o->clients < 1)))
+  {
+    fprintf(stderr, "fluere-stream: nothing to do\n");
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Reads the palettes.  Returns NULL (after saying why) if there are
+ * none.
+ */
+static palette_list_ptr load_palettes(const stream_options *o)
+{
+  FILE *f = fopen(o->palette_file, "r");
+  palette_list_ptr palettes;
+
+  if (!f)
+  {
+    fprintf(stderr, "fluere-stream: can't read %s\n", o->palette_file);
+    return NULL;
+  }
+  palettes = init_palette_list(f);
+  fclose(f);
+
+  if (get_number_of_palettes(palettes) <= 0)
+  {
+    fprintf(stderr, "fluere-stream: no palettes in %s\n", o->palette_file);
+    delete_palette_list(palettes);
+    return NULL;
+  }
+
+  return palettes;
+}
+
+/**
+ * Makes the drawing and colors for seed, as fluere-render would with
+ * its defaults.  Returns 1 if it could.
+ */
+static int make_drawing(const stream_options *o, palette_list_ptr palettes,
+                        unsigned long long seed, stream_drawing *d)
+{
+  fluere_batch_settings b;
+  fluere_choices c;
+  fluere_drawing_ptr s;
+
+  init_fluere_batch_settings(&b);
+  get_fluere_choices(&b, seed, get_number_of_palettes(palettes), &c);
+
+  d->anim = NULL;
+  d->data = malloc((size_t) o->width * o->height);
+  if (!d->data)
+    return 0;
+
+  s = init_fluere_drawing_seeded(o->width, o->height, b.num_knots,
+                                 (fluere_style) c.style1,
+                                 (fluere_style) c.style2, seed);
+  if (!s)
+  {
+    free(d->data);
+    d->data = NULL;
+    return 0;
+  }
+  set_fluere_kernels(s, b.kernels);
+  fill_pixels_parallel(s, d->data, o->nthreads);
+  delete_fluere_drawing(s);
+
+  get_colortable_seeded(get_palette(palettes, c.palette), d->ctable,
+                        b.randomize, b.stripes, c.ctable_seed);
+
+  return 1;
+}
+
+/**
+ * Sends a drawing and its colors, and then its frames as the screen
+ * saver shows them, numbered from first_frame, at fps frames a second
+ * (or as fast as they go, if fps is 0).  Returns the number of frames.
+ */
+static int play_drawing(fluere_stream_server_ptr s, stream_drawing *d,
+                        const stream_options *o, int first_frame,
+                        double fps)
+{
+  fluere_anim_segment segments[FLUERE_VIEW_SEGMENTS];
+  int num_segments = fluere_view_timeline(0, segments);
+  double start;
+  int frame = 0;
+  int ii;
+  int k;
+
+  send_fluere_stream_drawing(s, d->data, o->width, o->height, o->nthreads);
+  send_fluere_stream_colors(s, d->ctable);
+
+  start = get_time();
+  for (ii = 0; ii < num_segments; ++ii)
+  {
+    for (k = 0; k < segments[ii].num_frames; ++k)
+    {
+      int offset;
+      int fade;
+
+      if (fps > 0)
+        sleep_until(start + frame / fps);
+
+      get_fluere_segment_frame(segments + ii, k, &offset, &fade);
+      send_fluere_stream_frame(s, first_frame + frame, offset, fade,
+                               segments[ii].fade_color);
+      frame++;
+    }
+  }
+
+  return frame;
+}
+
+/**
+ * Serves drawings until there are no more to serve.
+ */
+static int serve(stream_options *o)
+{
+  palette_list_ptr palettes = load_palettes(o);
+  fluere_stream_server_ptr s;
+  int frame = 0;
+  int ii;
+
+  if (!palettes)
+    return 1;
+
+  s = open_fluere_stream_server(o->address);
+  if (!s)
+  {
+    fprintf(stderr, "fluere-stream: can't serve at %s\n", o->address);
+    return 1;
+  }
+
+  for (ii = 0; o->drawings == 0 || ii < o->drawings; ++ii)
+  {
+    stream_drawing d;
+    unsigned long long sent = get_fluere_stream_bytes_sent(s);
+    double start = get_time();
+    int frames;
+
+    if (!make_drawing(o, palettes, o->seed + ii, &d))
+    {
+      fprintf(stderr, "fluere-stream: out of memory\n");
+      return 1;
+    }
+
+    frames = play_drawing(s, &d, o, frame, FLUERE_VIEW_FPS);
+    frame += frames;
+    free(d.data);
+
+    if (!o->quiet)
+    {
+      fprintf(stderr, "fluere-stream: seed 0x%llx, %d frames to %d "
+              "clients, %.1f KB/s\n", o->seed + ii, frames,
+              get_fluere_stream_clients(s),
+              (get_fluere_stream_bytes_sent(s) - sent) / 1024.0
+              / (get_time() - start));
+    }
+  }
+
+  close_fluere_stream_server(s);
+  delete_palette_list(palettes);
+  return 0;
+}
+
+/**
+ * Makes every frame it's sent, as a display would, and prints how it
+ * goes once a second.
+ */
+static int show(stream_options *o)
+{
+  fluere_stream_client_ptr c = connect_fluere_stream(o->address);
+  unsigned char *pixels = NULL;
+  size_t pixels_size = 0;
+  unsigned long long received = 0;
+  double last = get_time();
+  double expanding = 0;
+  int frames = 0;
+  int shown = 0;
+
+  if (!c)
+  {
+    fprintf(stderr, "fluere-stream: can't connect to %s\n", o->address);
+    return 1;
+  }
+
+  while ((o->frames == 0 || shown < o->frames) &&
+         read_fluere_stream_frame(c))
+  {
+    int width;
+    int height;
+    double t0;
+    double now;
+
+    get_fluere_stream_size(c, &width, &height);
+    if ((size_t) width * height * 4 > pixels_size)
+    {
+      free(pixels);
+      pixels_size = (size_t) width * height * 4;
+      pixels = malloc(pixels_size);
+      if (!pixels)
+      {
+        fprintf(stderr, "fluere-stream: out of memory\n");
+        return 1;
+      }
+    }
+
+    t0 = get_time();
+    render_fluere_stream_frame(c, bgra8888_pixels, pixels, width * 4,
+                               o->nthreads);
+    now = get_time();
+    expanding += now - t0;
+    frames++;
+    shown++;
+
+    if (now - last >= 1 && !o->quiet)
+    {
+      unsigned long long bytes = get_fluere_stream_bytes_received(c);
+
+      fprintf(stderr, "fluere-stream: frame %d, %dx%d, %.1f frames/s, "
+              "%.1f KB/s, %.2f ms a frame to make\n",
+              get_fluere_stream_frame(c), width, height,
+              frames / (now - last), (bytes - received) / 1024.0
+              / (now - last), 1000 * expanding / frames);
+      received = bytes;
+      last = now;
+      expanding = 0;
+      frames = 0;
+    }
+  }
+
+  free(pixels);
+  close_fluere_stream(c);
+  return 0;
+}
+
+/**
+ * Serves the drawings over a Unix socket to clients on threads of their
+ * own, and prints what it took.  Returns 1 if any frame wasn't what it
+ * should have been.
+ */
+static int loopback(stream_options *o)
+{
+  palette_list_ptr palettes = load_palettes(o);
+  fluere_anim_segment segments[FLUERE_VIEW_SEGMENTS];
+  int num_segments = fluere_view_timeline(0, segments);
+  stream_drawing *drawings;
+  loopback_client *clients;
+  pthread_t *threads;
+  fluere_stream_server_ptr s;
+  char address[64];
+  int frames_per_drawing = 0;
+  int total_frames = 0;
+  int wrong = 0;
+  int late;
+  double start;
+  double seconds;
+  double per_client;
+  int ii;
+
+  if (!palettes)
+    return 1;
+
+  for (ii = 0; ii < num_segments; ++ii)
+    frames_per_drawing += segments[ii].num_frames;
+
+  drawings = calloc(o->drawings, sizeof(stream_drawing));
+  clients = calloc(o->clients, sizeof(loopback_client));
+  threads = calloc(o->clients, sizeof(pthread_t));
+  if (!drawings || !clients || !threads)
+  {
+    fprintf(stderr, "fluere-stream: out of memory\n");
+    return 1;
+  }
+
+  /* what the frames should be comes from a .fluere file of each
+     drawing, so the stream is checked against the other way of playing
+     an animation */
+  for (ii = 0; ii < o->drawings; ++ii)
+  {
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *f;
+
+    if (!make_drawing(o, palettes, o->seed + ii, drawings + ii))
+    {
+      fprintf(stderr, "fluere-stream: out of memory\n");
+      return 1;
+    }
+
+    f = open_memstream(&buf, &size);
+    if (f)
+    {
+      save_fluere_anim(f, drawings[ii].data, o->width, o->height,
+                       drawings[ii].ctable, 1, segments, num_segments,
+                       FLUERE_VIEW_FPS, 1, o->nthreads);
+      fclose(f);
+      f = fmemopen(buf, size, "rb");
+    }
+    if (f)
+    {
+      drawings[ii].anim = load_fluere_anim(f, o->nthreads);
+      fclose(f);
+    }
+    free(buf);
+
+    if (!drawings[ii].anim)
+    {
+      fprintf(stderr, "fluere-stream: can't make the .fluere of seed "
+              "0x%llx\n", o->seed + ii);
+      return 1;
+    }
+  }
+
+  snprintf(address, sizeof(address), "unix:/tmp/fluere-stream-%d.sock",
+           (int) getpid());
+  s = open_fluere_stream_server(address);
+  if (!s)
+  {
+    fprintf(stderr, "fluere-stream: can't serve at %s\n", address);
+    return 1;
+  }
+
+  for (ii = 0; ii < o->clients; ++ii)
+  {
+    clients[ii].o = o;
+    clients[ii].address = address;
+    clients[ii].drawings = drawings;
+    clients[ii].frames_per_drawing = frames_per_drawing;
+    if (pthread_create(threads + ii, NULL, loopback_main, clients + ii) != 0)
+    {
+      fprintf(stderr, "fluere-stream: can't start a client\n");
+      return 1;
+    }
+  }
+
+  /* give the clients a few seconds to connect */
+  start = get_time();
+  late = 0;
+  while (get_fluere_stream_clients(s) < o->clients && !late)
+  {
+    accept_fluere_stream_clients(s);
+    sleep_until(get_time() + 0.001);
+    late = (get_time() - start > 5);
+  }
+
+  start = get_time();
+  for (ii = 0; ii < o->drawings; ++ii)
+    total_frames += play_drawing(s, drawings + ii, o, total_frames, 0);
+  seconds = get_time() - start;
+  per_client = (double) get_fluere_stream_bytes_sent(s) / o->clients;
+  close_fluere_stream_server(s);
+
+  for (ii = 0; ii < o->clients; ++ii)
+  {
+    pthread_join(threads[ii], NULL);
+    if (clients[ii].failed || clients[ii].frames != total_frames)
+    {
+      fprintf(stderr, "fluere-stream: client %d got %d of %d frames\n", ii,
+              clients[ii].frames, total_frames);
+      wrong++;
+    }
+    wrong += clients[ii].wrong;
+  }
+
+  if (!o->quiet)
+  {
+    double screen_seconds = (double) total_frames / FLUERE_VIEW_FPS;
+    double pixels_rate = (double) o->width * o->height * 3
+                         * FLUERE_VIEW_FPS;
+
+    fprintf(stderr, "fluere-stream: %d drawings of %dx%d, %d frames, to "
+            "%d clients in %.2f s\n", o->drawings, o->width, o->height,
+            total_frames, o->clients, seconds);
+    fprintf(stderr, "  sent %.0f bytes to each client, %.1f KB/s at %d "
+            "frames a second;\n  as RGB pixels that would be %.1f Mbit/s\n",
+            per_client, per_client / 1024 / screen_seconds,
+            FLUERE_VIEW_FPS, pixels_rate * 8 / 1e6);
+    if (!wrong)
+    {
+      fprintf(stderr, "  every frame was the same as the .fluere "
+              "player's\n");
+    }
+  }
+  if (wrong)
+    fprintf(stderr, "fluere-stream: %d frames went wrong\n", wrong);
+
+  for (ii = 0; ii < o->drawings; ++ii)
+  {
+    free(drawings[ii].data);
+    delete_fluere_anim(drawings[ii].anim);
+  }
+  free(drawings);
+  free(clients);
+  free(threads);
+  delete_palette_list(palettes);
+
+  return wrong ? 1 : 0;
+}
+
+/**
+ * A loopback client: makes every frame, and checks it against the
+ * drawing's animation, until the server stops.
+ */
+static void *loopback_main(void *arg)
+{
+  loopback_client *l = arg;
+  fluere_stream_client_ptr c = connect_fluere_stream(l->address);
+  size_t size = (size_t) l->o->width * l->o->height * 4;
+  unsigned char *pixels = malloc(size);
+  unsigned char *expected = malloc(size);
+
+  if (!c || !pixels || !expected)
+    l->failed = 1;
+
+  while (!l->failed && read_fluere_stream_frame(c))
+  {
+    int frame = get_fluere_stream_frame(c);
+    stream_drawing *d;
+
+    /* the frames come in order, and the clients are let in before the
+       first one, so none are missed */
+    if (frame != l->frames || frame / l->frames_per_drawing
+                              >= l->o->drawings)
+    {
+      l->wrong++;
+      l->frames++;
+      continue;
+    }
+    d = l->drawings + frame / l->frames_per_drawing;
+
+    render_fluere_stream_frame(c, bgra8888_pixels, pixels,
+                               l->o->width * 4, 1);
+    render_fluere_anim_frame(d->anim, frame % l->frames_per_drawing,
+                             bgra8888_pixels, expected, l->o->width * 4, 1);
+    if (memcmp(pixels, expected, size) != 0)
+      l->wrong++;
+    l->frames++;
+  }
+
+  close_fluere_stream(c);
+  free(pixels);
+  free(expected);
+  return NULL;
+}
+
+/**
+ * Returns the time in seconds, from some fixed point.
+ */
+static double get_time(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/**
+ * Sleeps until get_time() reaches t.
+ */
+static void sleep_until(double t)
+{
+  double wait = t - get_time();
+  struct timespec ts;
+
+  if (wait <= 0)
+    return;
+
+  ts.tv_sec = (time_t) wait;
+  ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1e9);
+  nanosleep(&ts, NULL);
+}
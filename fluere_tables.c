@@ -0,0 +1,672 @@
+/**
+ * \file fluere_tables.c
+ *
+ * \brief Table kernels: each style's per-knot term, precomputed once
+ * on a grid of offsets from a knot and added up for each knot by
+ * reading the table at the pixel's offset.
+ *
+ * The knots are snapped to a 1/TABLE_SUBPIXELS pixel grid, so the offset
+ * from any pixel to any knot is on that grid too.  Every term depends
+ * only on |dx| and |dy| (spin's angle can be rebuilt from the angle in
+ * the first quadrant), so one quadrant of offsets is enough.  The
+ * tables cover offsets up to 1.1 times the drawing's size, which holds
+ * every knot define_knots makes; terms for knots further away are
+ * computed directly.
+ *
+ * The tables depend only on the resolution, so they are kept in a cache
+ * and shared by all drawings of the same size.  A screensaver that
+ * cycles through drawings pays for them once.  Each float table takes
+ * about 4 * (2.2 * width) * (2.2 * height) bytes: 40 MB at 1920x1080.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "fluere_private.h"
+#include "thread_pool.h"
+#include "vector_math.h"
+
+/** the knots are snapped to multiples of 1/TABLE_SUBPIXELS pixels */
+#define TABLE_SUBPIXELS 2
+
+/** pixels done at a time by the span functions */
+#define TABLE_CHUNK 256
+
+/** rows of a table made by each tile while building it */
+#define TABLE_BUILD_ROWS 16
+
+
+/** which tables a style needs */
+enum
+{
+  flow_table = 1,
+  wave_table = 2,
+  spin_tables = 4,
+  leaf_table = 8
+};
+
+/**
+ * The tables for one resolution.  Entry [ady * nx + adx] is for the
+ * offset (adx, ady) / TABLE_SUBPIXELS.  The tables are made when a
+ * drawing first needs them and kept until the cache is cleared.
+ */
+struct style_tables_struct
+{
+  int width;                /**< resolution the tables are for */
+  int height;
+  int refs;                 /**< drawings using the tables */
+  int nx;                   /**< entries in each row */
+  int ny;                   /**< rows */
+  float *flow_log;          /**< log(r^2) */
+  float *wave_sin;          /**< sin(1.5 log(r^2)) */
+  float *spin_angle;        /**< atan2(dy, dx), between 0 and pi/2 */
+  float *spin_radius;       /**< r */
+  unsigned char *leaf_q;    /**< (int) (75 (small/big)^2) */
+  style_tables *next;       /**< next entry of the cache */
+};
+
+/** what build_rows needs to know */
+struct table_job_struct
+{
+  style_tables *t;          /**< the tables being made */
+  int which;                /**< which of them */
+  int failed;               /**< set if a tile ran out of memory */
+};
+typedef struct table_job_struct table_job;
+
+
+/** the cached tables, and the lock for them */
+static style_tables *cache = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** private declarations */
+
+static int get_needed_tables(int style);
+static int build_tables(style_tables *t, int which);
+static void drop_tables(style_tables *t, int which);
+static void build_rows(void *arg, int tile);
+static void free_tables(style_tables *t);
+static double get_direct_term(const fluere_drawing *s, int style, int kk,
+                              double dx, double dy);
+static void add_flow_terms(const fluere_drawing *s, int style, int row,
+                           int x0, int step, int count, double *acc);
+static void add_spin_terms(const fluere_drawing *s, int row,
+                           int x0, int step, int count, double *acc);
+static void add_leaf_terms(const fluere_drawing *s, int style, int row,
+                           int x0, int step, int count, int *acc);
+
+
+/** @name Private Interface */
+/*@{*/
+
+/**
+ * Finds (or makes) the tables for a width x height drawing of style1
+ * and style2.  Tables left over from drawings of other sizes that are
+ * no longer used are freed first.
+ */
+style_tables* acquire_style_tables(int width, int height,
+                                   int style1, int style2)
+{
+  int which = get_needed_tables(style1) | get_needed_tables(style2);
+  style_tables **link;
+  style_tables *t = NULL;
+
+  pthread_mutex_lock(&cache_lock);
+
+  link = &cache;
+  while (*link)
+  {
+    style_tables *entry = *link;
+
+    if (entry->width == width && entry->height == height)
+    {
+      t = entry;
+      link = &entry->next;
+    }
+    else if (entry->refs == 0)
+    {
+      *link = entry->next;
+      free_tables(entry);
+    }
+    else
+      link = &entry->next;
+  }
+
+  if (!t)
+  {
+    t = calloc(1, sizeof(style_tables));
+    if (t)
+    {
+      t->width = width;
+      t->height = height;
+      t->nx = (int) (TABLE_SUBPIXELS * 1.1 * width) + 2;
+      t->ny = (int) (TABLE_SUBPIXELS * 1.1 * height) + 2;
+      t->next = cache;
+      cache = t;
+    }
+  }
+
+  if (t && build_tables(t, which))
+    ++t->refs;
+  else
+    t = NULL;
+
+  pthread_mutex_unlock(&cache_lock);
+
+  return t;
+}
+
+/**
+ * Lets go of tables from acquire_style_tables.  They stay in the cache
+ * for the next drawing of the same size.
+ */
+void release_style_tables(style_tables *t)
+{
+  if (!t)
+    return;
+
+  pthread_mutex_lock(&cache_lock);
+  --t->refs;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Fills every step'th pixel of a span with one style from the tables;
+ * see fill_style_span.
+ */
+void fill_table_span(const fluere_drawing *s,
+                     int style,
+                     int row,
+                     int x0,
+                     int step,
+                     int count,
+                     unsigned char *out)
+{
+  double acc[TABLE_CHUNK];
+  int iacc[TABLE_CHUNK];
+  double scale = 100 / s->num_knots;
+  int done;
+  int ii;
+
+  for (done = 0; done < count; done += TABLE_CHUNK)
+  {
+    int n = (count - done < TABLE_CHUNK) ? count - done : TABLE_CHUNK;
+    int x = x0 + step * done;
+    unsigned char *o = out + step * done;
+
+    switch (style)
+    {
+      case flow:
+      case wave:
+        memset(acc, 0, sizeof(double) * n);
+        add_flow_terms(s, style, row, x, step, n, acc);
+        for (ii = 0; ii < n; ++ii)
+          o[step * ii] = quantize_value(acc[ii] * scale);
+        break;
+
+      case spin:
+        memset(acc, 0, sizeof(double) * n);
+        add_spin_terms(s, row, x, step, n, acc);
+        for (ii = 0; ii < n; ++ii)
+          o[step * ii] = quantize_value(256 * acc[ii]);
+        break;
+
+      case leaf:
+      case rays:
+        memset(iacc, 0, sizeof(int) * n);
+        add_leaf_terms(s, style, row, x, step, n, iacc);
+        for (ii = 0; ii < n; ++ii)
+          o[step * ii] = iacc[ii] % 256;
+        break;
+
+      default:
+        for (ii = 0; ii < n; ++ii)
+          o[step * ii] = 0;
+    }
+  }
+}
+
+/*@}*/
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Frees the cached tables that no drawing is using
+ */
+void free_fluere_tables(void)
+{
+  style_tables **link;
+
+  pthread_mutex_lock(&cache_lock);
+
+  link = &cache;
+  while (*link)
+  {
+    style_tables *entry = *link;
+
+    if (entry->refs == 0)
+    {
+      *link = entry->next;
+      free_tables(entry);
+    }
+    else
+      link = &entry->next;
+  }
+
+  pthread_mutex_unlock(&cache_lock);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Returns the tables a style reads
+ */
+static int get_needed_tables(int style)
+{
+  switch (style)
+  {
+    case flow:  return flow_table;
+    case wave:  return wave_table;
+    case spin:  return spin_tables;
+    case leaf:
+    case rays:  return leaf_table;
+    default:    return 0;
+  }
+}
+
+/**
+ * Makes the tables in which that t doesn't have yet, using the shared
+ * thread pool.  Returns 0 if there isn't enough memory.
+ */
+static int build_tables(style_tables *t, int which)
+{
+  size_t entries = (size_t) t->nx * t->ny;
+  table_job job;
+
+  if (t->flow_log)
+    which &= ~flow_table;
+  if (t->wave_sin)
+    which &= ~wave_table;
+  if (t->spin_angle)
+    which &= ~spin_tables;
+  if (t->leaf_q)
+    which &= ~leaf_table;
+  if (!which)
+    return 1;
+
+  if (which & flow_table)
+    t->flow_log = malloc(sizeof(float) * entries);
+  if (which & wave_table)
+    t->wave_sin = malloc(sizeof(float) * entries);
+  if (which & spin_tables)
+  {
+    t->spin_angle = malloc(sizeof(float) * entries);
+    t->spin_radius = malloc(sizeof(float) * entries);
+  }
+  if (which & leaf_table)
+    t->leaf_q = malloc(entries);
+
+  if (((which & flow_table) && !t->flow_log) ||
+      ((which & wave_table) && !t->wave_sin) ||
+      ((which & spin_tables) && (!t->spin_angle || !t->spin_radius)) ||
+      ((which & leaf_table) && !t->leaf_q))
+  {
+    drop_tables(t, which);
+    return 0;
+  }
+
+  job.t = t;
+  job.which = which;
+  job.failed = 0;
+  run_tiles(get_shared_thread_pool(),
+            (t->ny + TABLE_BUILD_ROWS - 1) / TABLE_BUILD_ROWS,
+            0,
+            build_rows,
+            &job);
+
+  if (job.failed)
+  {
+    drop_tables(t, which);
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Frees the tables in which, so they're made again next time
+ */
+static void drop_tables(style_tables *t, int which)
+{
+  if (which & flow_table)
+  {
+    free(t->flow_log);
+    t->flow_log = NULL;
+  }
+  if (which & wave_table)
+  {
+    free(t->wave_sin);
+    t->wave_sin = NULL;
+  }
+  if (which & spin_tables)
+  {
+    free(t->spin_angle);
+    free(t->spin_radius);
+    t->spin_angle = NULL;
+    t->spin_radius = NULL;
+  }
+  if (which & leaf_table)
+  {
+    free(t->leaf_q);
+    t->leaf_q = NULL;
+  }
+}
+
+/**
+ * Makes TABLE_BUILD_ROWS rows of the tables for build_tables, or sets
+ * job->failed if there isn't the memory
+ */
+static void build_rows(void *arg, int tile)
+{
+  table_job *job = arg;
+  style_tables *t = job->t;
+  int nx = t->nx;
+  int row0 = tile * TABLE_BUILD_ROWS;
+  int row1 = (row0 + TABLE_BUILD_ROWS < t->ny) ? row0 + TABLE_BUILD_ROWS
+                                                : t->ny;
+  double *dx = malloc(sizeof(double) * nx);
+  double *dy = malloc(sizeof(double) * nx);
+  double *r2 = malloc(sizeof(double) * nx);
+  double *v = malloc(sizeof(double) * nx);
+  int row;
+  int ii;
+
+  if (!dx || !dy || !r2 || !v)
+  {
+    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    free(dx);
+    free(dy);
+    free(r2);
+    free(v);
+    return;
+  }
+
+  for (ii = 0; ii < nx; ++ii)
+    dx[ii] = (double) ii / TABLE_SUBPIXELS;
+
+  for (row = row0; row < row1; ++row)
+  {
+    size_t base = (size_t) row * nx;
+    double y = (double) row / TABLE_SUBPIXELS;
+
+    for (ii = 0; ii < nx; ++ii)
+    {
+      dy[ii] = y;
+      r2[ii] = dx[ii] * dx[ii] + y * y;
+    }
+
+    if (job->which & (flow_table | wave_table))
+    {
+      vector_log(r2, v, nx);
+      if (job->which & flow_table)
+      {
+        for (ii = 0; ii < nx; ++ii)
+          t->flow_log[base + ii] = v[ii];
+      }
+      if (job->which & wave_table)
+      {
+        for (ii = 0; ii < nx; ++ii)
+          v[ii] *= 1.5;
+        vector_sin(v, v, nx);
+        for (ii = 0; ii < nx; ++ii)
+          t->wave_sin[base + ii] = v[ii];
+      }
+    }
+
+    if (job->which & spin_tables)
+    {
+      vector_atan2(dy, dx, v, nx);
+      for (ii = 0; ii < nx; ++ii)
+        t->spin_angle[base + ii] = v[ii];
+      vector_sqrt(r2, v, nx);
+      for (ii = 0; ii < nx; ++ii)
+        t->spin_radius[base + ii] = v[ii];
+    }
+
+    if (job->which & leaf_table)
+    {
+      for (ii = 0; ii < nx; ++ii)
+      {
+        double big = (dx[ii] > y) ? dx[ii] : y;
+        double small = (dx[ii] > y) ? y : dx[ii];
+
+        t->leaf_q[base + ii] =
+          (big == 0) ? 0 : (int) (75 * (small/big) * (small/big));
+      }
+    }
+  }
+
+  free(dx);
+  free(dy);
+  free(r2);
+  free(v);
+}
+
+/**
+ * Frees one entry of the cache
+ */
+static void free_tables(style_tables *t)
+{
+  free(t->flow_log);
+  free(t->wave_sin);
+  free(t->spin_angle);
+  free(t->spin_radius);
+  free(t->leaf_q);
+  free(t);
+}
+
+/**
+ * Computes knot kk's term directly, for offsets outside the tables
+ */
+static double get_direct_term(const fluere_drawing *s, int style, int kk,
+                              double dx, double dy)
+{
+  const knot_pack *p = &s->packs[style];
+  double big;
+  double small;
+  double r;
+  double a;
+
+  switch (style)
+  {
+    case flow:
+      return p->sign[kk] * log(dx*dx + dy*dy);
+
+    case wave:
+      return p->sign[kk] * sin(1.5 * log(dx*dx + dy*dy));
+
+    case spin:
+      r = sqrt(dx*dx + dy*dy);
+      a = atan2(dy, dx);
+      if (kk < p->num_twisted)
+        a += p->twist[kk] * sin(r * p->inv_frequency[kk]) *
+             exp(-r * p->inv_decay[kk]);
+      return p->sign[kk] * (p->sectors[kk] * fmod(a, p->period[kk]));
+
+    default:
+      big = fmax(fabs(dx), fabs(dy));
+      small = fmin(fabs(dx), fabs(dy));
+      a = (big == 0) ? 0.0 : p->sign[kk] * (small/big) * (small/big);
+      return (int) a;
+  }
+}
+
+/**
+ * Adds up the flow or wave terms of all the knots
+ */
+static void add_flow_terms(const fluere_drawing *s, int style, int row,
+                           int x0, int step, int count, double *acc)
+{
+  const style_tables *t = s->tables;
+  const knot_pack *p = &s->packs[style];
+  const float *table = (style == flow) ? t->flow_log : t->wave_sin;
+  int kk;
+  int ii;
+
+  for (kk = 0; kk < p->count; ++kk)
+  {
+    int kx = (int) lround(TABLE_SUBPIXELS * p->x[kk]);
+    int ky = (int) lround(TABLE_SUBPIXELS * p->y[kk]);
+    int ady = abs(TABLE_SUBPIXELS * row - ky);
+    int c0 = TABLE_SUBPIXELS * x0 - kx;
+    int c1 = c0 + step * TABLE_SUBPIXELS * (count - 1);
+    double sign = p->sign[kk];
+
+    if (ady < t->ny && abs(c0) < t->nx && abs(c1) < t->nx)
+    {
+      const float *trow = table + (size_t) ady * t->nx;
+      for (ii = 0; ii < count; ++ii)
+        acc[ii] += sign * trow[abs(c0 + step * TABLE_SUBPIXELS * ii)];
+    }
+    else
+    {
+      double dy = (double) (TABLE_SUBPIXELS * row - ky) / TABLE_SUBPIXELS;
+      for (ii = 0; ii < count; ++ii)
+      {
+        double dx = (double) (c0 + step * TABLE_SUBPIXELS * ii) /
+                    TABLE_SUBPIXELS;
+        acc[ii] += get_direct_term(s, style, kk, dx, dy);
+      }
+    }
+  }
+}
+
+/**
+ * Adds up the spin terms of all the knots.  The angle comes from the
+ * table; the twist and the fmod are done with the vector math
+ * functions, a knot at a time.
+ */
+static void add_spin_terms(const fluere_drawing *s, int row,
+                           int x0, int step, int count, double *acc)
+{
+  const style_tables *t = s->tables;
+  const knot_pack *p = &s->packs[spin];
+  double a[TABLE_CHUNK];
+  double r[TABLE_CHUNK];
+  double w[TABLE_CHUNK];
+  int kk;
+  int ii;
+
+  for (kk = 0; kk < p->count; ++kk)
+  {
+    int kx = (int) lround(TABLE_SUBPIXELS * p->x[kk]);
+    int ky = (int) lround(TABLE_SUBPIXELS * p->y[kk]);
+    int cy = TABLE_SUBPIXELS * row - ky;
+    int c0 = TABLE_SUBPIXELS * x0 - kx;
+    int c1 = c0 + step * TABLE_SUBPIXELS * (count - 1);
+    double scale = p->sign[kk] * p->sectors[kk];
+
+    if (abs(cy) >= t->ny || abs(c0) >= t->nx || abs(c1) >= t->nx)
+    {
+      double dy = (double) cy / TABLE_SUBPIXELS;
+      for (ii = 0; ii < count; ++ii)
+      {
+        double dx = (double) (c0 + step * TABLE_SUBPIXELS * ii) /
+                    TABLE_SUBPIXELS;
+        acc[ii] += get_direct_term(s, spin, kk, dx, dy);
+      }
+      continue;
+    }
+
+    {
+      size_t base = (size_t) abs(cy) * t->nx;
+
+      /* the table has the first quadrant; reflect into the others */
+      for (ii = 0; ii < count; ++ii)
+      {
+        int cx = c0 + step * TABLE_SUBPIXELS * ii;
+        double angle = t->spin_angle[base + abs(cx)];
+
+        if (cx < 0)
+          angle = M_PI - angle;
+        a[ii] = (cy < 0) ? -angle : angle;
+        r[ii] = t->spin_radius[base + abs(cx)];
+      }
+    }
+
+    /* wavy! */
+    if (kk < p->num_twisted)
+    {
+      for (ii = 0; ii < count; ++ii)
+        w[ii] = r[ii] * p->inv_frequency[kk];
+      vector_sin(w, w, count);
+      for (ii = 0; ii < count; ++ii)
+        r[ii] *= -p->inv_decay[kk];
+      vector_exp(r, r, count);
+      for (ii = 0; ii < count; ++ii)
+        a[ii] += p->twist[kk] * w[ii] * r[ii];
+    }
+
+    for (ii = 0; ii < count; ++ii)
+      w[ii] = p->period[kk];
+    vector_fmod(a, w, a, count);
+    for (ii = 0; ii < count; ++ii)
+      acc[ii] += scale * a[ii];
+  }
+}
+
+/**
+ * Adds up the leaf or rays terms of all the knots.  The table has the
+ * term for sign +1 before rounding down to a multiple of discrete,
+ * which is done through a small lookup table.
+ */
+static void add_leaf_terms(const fluere_drawing *s, int style, int row,
+                           int x0, int step, int count, int *acc)
+{
+  const style_tables *t = s->tables;
+  const knot_pack *p = &s->packs[style];
+  int discrete = (style == leaf) ? s->leafdiscrete : s->raysdiscrete;
+  int steps[76];
+  int kk;
+  int ii;
+
+  for (ii = 0; ii <= 75; ++ii)
+    steps[ii] = (ii / discrete) * discrete;
+
+  for (kk = 0; kk < p->count; ++kk)
+  {
+    int kx = (int) lround(TABLE_SUBPIXELS * p->x[kk]);
+    int ky = (int) lround(TABLE_SUBPIXELS * p->y[kk]);
+    int ady = abs(TABLE_SUBPIXELS * row - ky);
+    int c0 = TABLE_SUBPIXELS * x0 - kx;
+    int c1 = c0 + step * TABLE_SUBPIXELS * (count - 1);
+    int sign = (p->sign[kk] > 0) ? 1 : -1;
+
+    if (ady < t->ny && abs(c0) < t->nx && abs(c1) < t->nx)
+    {
+      const unsigned char *trow = t->leaf_q + (size_t) ady * t->nx;
+      for (ii = 0; ii < count; ++ii)
+        acc[ii] += sign * steps[trow[abs(c0 + step * TABLE_SUBPIXELS * ii)]];
+    }
+    else
+    {
+      double dy = (double) (TABLE_SUBPIXELS * row - ky) / TABLE_SUBPIXELS;
+      for (ii = 0; ii < count; ++ii)
+      {
+        double dx = (double) (c0 + step * TABLE_SUBPIXELS * ii) /
+                    TABLE_SUBPIXELS;
+        int a = (int) get_direct_term(s, style, kk, dx, dy);
+        acc[ii] += (a / discrete) * discrete;
+      }
+    }
+  }
+}
+
+/*@}*/
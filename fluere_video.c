@@ -0,0 +1,329 @@
+/**
+ * \file fluere_video.c
+ *
+ * \brief Writing a drawing's colors cycling as Y4M or raw YUV video.
+ *
+ * The colors are converted to Y, and to U and V packed together in one
+ * number, U in the low 16 bits and V in the high ones, so adding up
+ * the four pixels of a 2 x 2 block adds up both at once.  Since the
+ * conversion is linear, averaging U and V this way gives what
+ * converting the pixels' colors and then averaging would.
+ *
+ * The calling thread makes the frames, in bands of VIDEO_BAND rows on
+ * the thread pool, into a ring of VIDEO_BUFFERS frames, and a writer
+ * thread writes them out behind it.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fluere_video.h"
+#include "thread_pool.h"
+
+/** rows of a frame made as one tile; even, so each band has whole
+    rows of U and V */
+#define VIDEO_BAND 32
+
+/** frames that can be made and waiting to be written */
+#define VIDEO_BUFFERS 3
+
+/** how much red and blue count in the brightness, in BT.709 */
+#define KR 0.2126
+#define KB 0.0722
+
+
+/** what make_band needs to know about a frame */
+struct video_frame_struct
+{
+  const unsigned char *data;  /**< the pixels */
+  int width;                  /**< size of the frame */
+  int height;
+  int chroma_width;           /**< size of the U and V planes */
+  int chroma_height;
+  unsigned char y[256];       /**< each pixel value's Y, this frame */
+  unsigned int uv[256];       /**< and its U and V */
+  unsigned char *out;         /**< the Y, U and V planes */
+};
+typedef struct video_frame_struct video_frame;
+
+/** the frames on their way from the maker to the writer */
+struct video_queue_struct
+{
+  FILE *f;                                /**< where they go */
+  int raw;                                /**< leave out the headers */
+  int num_frames;                         /**< frames to write */
+  size_t frame_size;                      /**< bytes in a frame */
+  unsigned char *buffers[VIDEO_BUFFERS];  /**< the frames, round and round */
+  int made;                               /**< frames made */
+  int written;                            /**< frames written */
+  int failed;                             /**< set if a write failed */
+  pthread_mutex_t lock;                   /**< protects made, written
+                                               and failed */
+  pthread_cond_t changed;                 /**< signaled when they do */
+};
+typedef struct video_queue_struct video_queue;
+
+/** private declarations */
+
+static void convert_colors(const unsigned char *ctable,
+                           unsigned char *y,
+                           unsigned int *uv);
+static void make_band(void *arg, int tile);
+static void *writer_main(void *arg);
+static unsigned char clamp_byte(double v);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Writes the video.
+ */
+int write_fluere_video(FILE *f,
+                       const unsigned char *data,
+                       int width,
+                       int height,
+                       const unsigned char *ctable,
+                       int num_frames,
+                       int step,
+                       int fps,
+                       int raw,
+                       int nthreads)
+{
+  unsigned char y[256];
+  unsigned int uv[256];
+  video_frame frame;
+  video_queue q;
+  pthread_t writer;
+  int started;
+  int ok;
+  int ii;
+  int k;
+
+  if (width <= 0 || height <= 0 || num_frames < 1 || fps < 1)
+    return 0;
+
+  convert_colors(ctable, y, uv);
+
+  frame.data = data;
+  frame.width = width;
+  frame.height = height;
+  frame.chroma_width = (width + 1) / 2;
+  frame.chroma_height = (height + 1) / 2;
+
+  memset(&q, 0, sizeof(q));
+  q.f = f;
+  q.raw = raw;
+  q.num_frames = num_frames;
+  q.frame_size = (size_t) width * height
+               + (size_t) 2 * frame.chroma_width * frame.chroma_height;
+  for (ii = 0; ii < VIDEO_BUFFERS; ++ii)
+  {
+    q.buffers[ii] = malloc(q.frame_size);
+    if (!q.buffers[ii])
+    {
+      while (ii-- > 0)
+        free(q.buffers[ii]);
+      return 0;
+    }
+  }
+
+  if (!raw)
+  {
+    /* XCOLORRANGE is understood by ffmpeg, and ignored by the rest */
+    fprintf(f, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg "
+            "XCOLORRANGE=LIMITED\n", width, height, fps);
+  }
+
+  pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.changed, NULL);
+
+  started = (pthread_create(&writer, NULL, writer_main, &q) == 0);
+  if (!started)
+    q.failed = 1;
+
+  for (k = 0; k < num_frames; ++k)
+  {
+    int offset = (int) (((long long) k * step % 256 + 256) % 256);
+    int failed;
+
+    /* wait for the writer to be done with the buffer */
+    pthread_mutex_lock(&q.lock);
+    while (!q.failed && k - q.written >= VIDEO_BUFFERS)
+      pthread_cond_wait(&q.changed, &q.lock);
+    failed = q.failed;
+    pthread_mutex_unlock(&q.lock);
+    if (failed)
+      break;
+
+    for (ii = 0; ii < 256; ++ii)
+    {
+      frame.y[ii] = y[(ii + offset) & 255];
+      frame.uv[ii] = uv[(ii + offset) & 255];
+    }
+    frame.out = q.buffers[k % VIDEO_BUFFERS];
+
+    run_tiles(get_shared_thread_pool(),
+              (height + VIDEO_BAND - 1) / VIDEO_BAND, nthreads, make_band,
+              &frame);
+
+    pthread_mutex_lock(&q.lock);
+    q.made = k + 1;
+    pthread_cond_signal(&q.changed);
+    pthread_mutex_unlock(&q.lock);
+  }
+
+  /* the frames only stop early when a write fails, and then the
+     writer has stopped too */
+  if (started)
+    pthread_join(writer, NULL);
+
+  ok = !q.failed && !ferror(f);
+
+  pthread_cond_destroy(&q.changed);
+  pthread_mutex_destroy(&q.lock);
+  for (ii = 0; ii < VIDEO_BUFFERS; ++ii)
+    free(q.buffers[ii]);
+
+  return ok;
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Converts the 256 colors of ctable to Y, and to U and V packed in
+ * one number.
+ */
+static void convert_colors(const unsigned char *ctable,
+                           unsigned char *y,
+                           unsigned int *uv)
+{
+  int ii;
+
+  for (ii = 0; ii < 256; ++ii)
+  {
+    double r = ctable[3 * ii];
+    double g = ctable[3 * ii + 1];
+    double b = ctable[3 * ii + 2];
+    double luma = KR * r + (1 - KR - KB) * g + KB * b;
+    unsigned char u;
+    unsigned char v;
+
+    y[ii] = clamp_byte(16 + luma * 219 / 255);
+    u = clamp_byte(128 + (b - luma) * 112 / 255 / (1 - KB));
+    v = clamp_byte(128 + (r - luma) * 112 / 255 / (1 - KR));
+    uv[ii] = u | (unsigned int) v << 16;
+  }
+}
+
+/**
+ * Makes one band of rows of a frame: their Y, and the U and V of the
+ * 2 x 2 blocks they make up.  A frame with an odd width or height has
+ * its last pixels counted twice in its last blocks.
+ */
+static void make_band(void *arg, int tile)
+{
+  video_frame *frame = arg;
+  int width = frame->width;
+  int height = frame->height;
+  int cw = frame->chroma_width;
+  size_t chroma_size = (size_t) cw * frame->chroma_height;
+  unsigned char *u_plane = frame->out + (size_t) width * height;
+  unsigned char *v_plane = u_plane + chroma_size;
+  const unsigned char *y = frame->y;
+  const unsigned int *uv = frame->uv;
+  int row0 = tile * VIDEO_BAND;
+  int row1 = (row0 + VIDEO_BAND < height) ? row0 + VIDEO_BAND : height;
+  int row;
+  int x;
+
+  for (row = row0; row < row1; ++row)
+  {
+    const unsigned char *in = frame->data + (size_t) row * width;
+    unsigned char *out = frame->out + (size_t) row * width;
+
+    for (x = 0; x < width; ++x)
+      out[x] = y[in[x]];
+  }
+
+  for (row = row0; row < row1; row += 2)
+  {
+    const unsigned char *a = frame->data + (size_t) row * width;
+    const unsigned char *b = (row + 1 < height) ? a + width : a;
+    unsigned char *u = u_plane + (size_t) (row / 2) * cw;
+    unsigned char *v = v_plane + (size_t) (row / 2) * cw;
+
+    for (x = 0; x < width / 2; ++x)
+    {
+      unsigned int sum = uv[a[2 * x]] + uv[a[2 * x + 1]]
+                       + uv[b[2 * x]] + uv[b[2 * x + 1]];
+
+      u[x] = ((sum & 0xffff) + 2) >> 2;
+      v[x] = ((sum >> 16) + 2) >> 2;
+    }
+
+    if (width & 1)
+    {
+      unsigned int sum = 2 * (uv[a[width - 1]] + uv[b[width - 1]]);
+
+      u[x] = ((sum & 0xffff) + 2) >> 2;
+      v[x] = ((sum >> 16) + 2) >> 2;
+    }
+  }
+}
+
+/**
+ * Writes the frames as they're made, until they're all written or a
+ * write fails.
+ */
+static void *writer_main(void *arg)
+{
+  video_queue *q = arg;
+  int k;
+
+  for (k = 0; k < q->num_frames; ++k)
+  {
+    int ok;
+
+    pthread_mutex_lock(&q->lock);
+    while (!q->failed && q->made <= k)
+      pthread_cond_wait(&q->changed, &q->lock);
+    ok = (q->made > k);
+    pthread_mutex_unlock(&q->lock);
+    if (!ok)
+      break;
+
+    if (!q->raw)
+      fputs("FRAME\n", q->f);
+    ok = (fwrite(q->buffers[k % VIDEO_BUFFERS], 1, q->frame_size, q->f)
+          == q->frame_size);
+
+    pthread_mutex_lock(&q->lock);
+    if (ok)
+      q->written = k + 1;
+    else
+      q->failed = 1;
+    pthread_cond_signal(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    if (!ok)
+      break;
+  }
+
+  return NULL;
+}
+
+/**
+ * Rounds v to the nearest byte, 0 to 255.
+ */
+static unsigned char clamp_byte(double v)
+{
+  return (v <= 0) ? 0 : (v >= 255) ? 255 : (unsigned char) (v + 0.5);
+}
+
+/*@}*/
@@ -0,0 +1,44 @@
+/**
+ * \file fluere_video.h
+ *
+ * \brief Writing a drawing's colors cycling as video: Y4M, or raw
+ * planar YUV, for a video encoder to read from a pipe.
+ *
+ * Every frame is the same pixels through a turned color table, so the
+ * 256 colors are converted to YUV once, and each frame is then made by
+ * looking its pixels up straight into the Y, U and V planes.  The
+ * frames are made on the thread pool while a thread of their own
+ * writes the ones before them.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef FLUERE_VIDEO_H
+#define FLUERE_VIDEO_H
+
+#include <stdio.h>
+
+
+/**
+ * Writes num_frames frames of 4:2:0 YUV (BT.709, limited range, with
+ * U and V averaged over each 2 x 2 block of pixels), as a Y4M stream at
+ * fps frames a second, or with raw set, as just the planes of each
+ * frame one after another.  Frame k shows pixel value v in color
+ * (v + k * step) % 256 of ctable (a color table made by get_colortable;
+ * only its first 768 bytes are used).  The frames are made on nthreads
+ * threads from the shared pool (one per processor if nthreads <= 0).
+ * Returns 1 if it was all written.
+ */
+int write_fluere_video(FILE *f,
+                       const unsigned char *data,
+                       int width,
+                       int height,
+                       const unsigned char *ctable,
+                       int num_frames,
+                       int step,
+                       int fps,
+                       int raw,
+                       int nthreads);
+
+
+#endif
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "palettes.h"
+#include "fluere_random.h"
 
 #define MAX_NAME_LENGTH 20
 
@@ -187,6 +188,29 @@ void get_colortable(
     int randomize, 
     int stripes)
 {
+  unsigned long long seed;
+
+  seed = (unsigned long long) random() << 31;
+  seed ^= (unsigned long long) random();
+
+  get_colortable_seeded(p, ctable, randomize, stripes, seed);
+}
+
+/**
+ * Same as get_colortable, but the random choices come from seed, so
+ * the same seed always gives the same color table.
+ */
+void get_colortable_seeded(
+    palette_ptr p,
+    unsigned char *ctable,
+    int randomize,
+    int stripes,
+    unsigned long long seed)
+{
+  fluere_random r;
+
+  init_fluere_random(&r, seed);
+
   /* first, decide how many bands of color to make */
   int nsteps;
   if (randomize)
@@ -195,12 +219,12 @@ void get_colortable(
     {
       /* pick 3 to 5 colors, so that there will be effectively
        6 to 10 bands of color with stripes. */
-      nsteps = random() % 3 + 3; 
+      nsteps = random_below(&r, 3) + 3; 
     }
     else
     {
       /* between 5 and 10 colors */
-      nsteps = random() % 6 + 5;  
+      nsteps = random_below(&r, 6) + 5;  
     }
   }
   else
@@ -224,7 +248,7 @@ void get_colortable(
     if (stripes && cindx % 2)
       colors[cindx] = black;
     else if (randomize)
-      colors[cindx] = p->colors[random() % p->num_colors];
+      colors[cindx] = p->colors[random_below(&r, p->num_colors)];
     else {
       colors[cindx] = p->colors[ii];
       ++ii;
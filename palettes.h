@@ -27,5 +27,10 @@ void get_colortable( palette_ptr p,
                      unsigned char *ctable, 
                      int randomize, 
                      int stripes);
+void get_colortable_seeded( palette_ptr p,
+                            unsigned char *ctable,
+                            int randomize,
+                            int stripes,
+                            unsigned long long seed );
 
 #endif
@@ -0,0 +1,345 @@
+/**
+ * \file thread_pool.c
+ *
+ * \brief A small persistent pool of worker threads for splitting work
+ * into numbered tiles.
+ *
+ * Each call to run_tiles gives every thread a contiguous range of tiles.
+ * A thread takes tiles from the front of its own range; when its range
+ * is empty it steals the back half of some other thread's range.  Both
+ * ends of a range are packed into one 64 bit word so that taking and
+ * stealing are each a single compare-and-swap.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+
+/** a range of tiles [begin, end), padded to keep it on its own cache line */
+struct tile_range_struct
+{
+  unsigned long long range;  /**< begin in the low 32 bits, end in the high */
+  char pad[56];
+};
+typedef struct tile_range_struct tile_range;
+
+/** one worker thread */
+struct worker_struct
+{
+  thread_pool_ptr pool;  /**< the pool this worker belongs to */
+  int index;             /**< 1 .. num_threads-1; 0 is the caller of run_tiles */
+  pthread_t thread;
+};
+typedef struct worker_struct worker;
+
+/** the pool */
+struct thread_pool_struct
+{
+  int num_threads;       /**< workers + the caller of run_tiles */
+  worker *workers;       /**< num_threads-1 workers */
+  tile_range *ranges;    /**< one range of tiles per thread */
+
+  pthread_mutex_t run_lock;  /**< only one run_tiles at a time */
+
+  pthread_mutex_t lock;      /**< protects everything below */
+  pthread_cond_t start;      /**< signaled when there is new work */
+  pthread_cond_t finish;     /**< signaled when the last worker is done */
+  unsigned int generation;   /**< counts calls to run_tiles */
+  int shutdown;              /**< nonzero when the workers should exit */
+  int participants;          /**< threads working on the current run */
+  int busy;                  /**< workers still working on the current run */
+
+  tile_function f;           /**< the current work */
+  void *arg;
+};
+typedef struct thread_pool_struct thread_pool;
+
+/** private declarations */
+
+static void *worker_main(void *w);
+static void work_on_tiles(thread_pool_ptr p, int me);
+static int steal_tiles(thread_pool_ptr p, int me);
+
+static unsigned long long pack_range(unsigned int begin, unsigned int end)
+{
+  return ((unsigned long long) end << 32) | begin;
+}
+
+/** the pool returned by get_shared_thread_pool */
+static thread_pool_ptr shared_pool = NULL;
+static pthread_once_t shared_pool_once = PTHREAD_ONCE_INIT;
+
+static void make_shared_pool(void)
+{
+  shared_pool = init_thread_pool(0);
+}
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Starts a new pool of threads.  Workers sleep until run_tiles is called.
+ */
+thread_pool_ptr init_thread_pool(int num_threads)
+{
+  int ii;
+  thread_pool_ptr p = malloc(sizeof(thread_pool));
+
+  if (num_threads <= 0)
+    num_threads = get_number_of_processors();
+
+  p->num_threads = num_threads;
+  p->workers = malloc(sizeof(worker) * num_threads);
+  p->ranges = malloc(sizeof(tile_range) * num_threads);
+
+  pthread_mutex_init(&p->run_lock, NULL);
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->start, NULL);
+  pthread_cond_init(&p->finish, NULL);
+  p->generation = 0;
+  p->shutdown = 0;
+  p->participants = 0;
+  p->busy = 0;
+  p->f = NULL;
+  p->arg = NULL;
+
+  for (ii = 0; ii < num_threads; ++ii)
+    p->ranges[ii].range = 0;
+
+  for (ii = 1; ii < num_threads; ++ii)
+  {
+    p->workers[ii].pool = p;
+    p->workers[ii].index = ii;
+    pthread_create(&p->workers[ii].thread, NULL, worker_main, &p->workers[ii]);
+  }
+
+  return p;
+}
+
+/**
+ * Stops the workers and frees the pool.  Must not be called while
+ * run_tiles is running.
+ */
+void delete_thread_pool(thread_pool_ptr p)
+{
+  int ii;
+
+  pthread_mutex_lock(&p->lock);
+  p->shutdown = 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+
+  for (ii = 1; ii < p->num_threads; ++ii)
+    pthread_join(p->workers[ii].thread, NULL);
+
+  pthread_cond_destroy(&p->finish);
+  pthread_cond_destroy(&p->start);
+  pthread_mutex_destroy(&p->lock);
+  pthread_mutex_destroy(&p->run_lock);
+
+  free(p->ranges);
+  free(p->workers);
+  free(p);
+}
+
+/**
+ * Returns the number of threads that can work at once
+ */
+int get_number_of_threads(thread_pool_ptr p)
+{
+  return p->num_threads;
+}
+
+/**
+ * Runs f on every tile and waits for all of them to finish.  The
+ * calling thread works on tiles too.
+ */
+void run_tiles(thread_pool_ptr p,
+               int num_tiles,
+               int num_threads,
+               tile_function f,
+               void *arg)
+{
+  int ii;
+  int participants;
+
+  if (num_tiles <= 0)
+    return;
+
+  participants = p->num_threads;
+  if (num_threads > 0 && num_threads < participants)
+    participants = num_threads;
+  if (num_tiles < participants)
+    participants = num_tiles;
+
+  /* this doesn't touch the pool, so it needn't wait for other runs */
+  if (participants <= 1)
+  {
+    for (ii = 0; ii < num_tiles; ++ii)
+      f(arg, ii);
+    return;
+  }
+
+  pthread_mutex_lock(&p->run_lock);
+
+  /* start everyone off with an equal share of the tiles */
+  for (ii = 0; ii < p->num_threads; ++ii)
+  {
+    unsigned int begin = 0;
+    unsigned int end = 0;
+    if (ii < participants)
+    {
+      begin = (unsigned int) ((long long) num_tiles * ii / participants);
+      end = (unsigned int) ((long long) num_tiles * (ii + 1) / participants);
+    }
+    __atomic_store_n(&p->ranges[ii].range, pack_range(begin, end),
+                     __ATOMIC_RELAXED);
+  }
+
+  pthread_mutex_lock(&p->lock);
+  p->f = f;
+  p->arg = arg;
+  p->participants = participants;
+  p->busy = participants - 1;
+  p->generation++;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+
+  work_on_tiles(p, 0);
+
+  pthread_mutex_lock(&p->lock);
+  while (p->busy > 0)
+    pthread_cond_wait(&p->finish, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+
+  pthread_mutex_unlock(&p->run_lock);
+}
+
+/**
+ * Returns the pool shared by the whole process
+ */
+thread_pool_ptr get_shared_thread_pool(void)
+{
+  pthread_once(&shared_pool_once, make_shared_pool);
+  return shared_pool;
+}
+
+/**
+ * Returns the number of processors that are online
+ */
+int get_number_of_processors(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n < 1) ? 1 : (int) n;
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * The main loop of each worker: wait for a new run, work on it, repeat.
+ */
+static void *worker_main(void *w)
+{
+  worker *self = w;
+  thread_pool_ptr p = self->pool;
+  unsigned int seen = 0;
+
+  pthread_mutex_lock(&p->lock);
+  for (;;)
+  {
+    while (p->generation == seen && !p->shutdown)
+      pthread_cond_wait(&p->start, &p->lock);
+    if (p->shutdown)
+      break;
+    seen = p->generation;
+
+    /* not needed for this run */
+    if (self->index >= p->participants)
+      continue;
+
+    pthread_mutex_unlock(&p->lock);
+    work_on_tiles(p, self->index);
+    pthread_mutex_lock(&p->lock);
+
+    if (--p->busy == 0)
+      pthread_cond_signal(&p->finish);
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  return NULL;
+}
+
+/**
+ * Works through this thread's own tiles, then steals from the others
+ * until there is nothing left anywhere.
+ */
+static void work_on_tiles(thread_pool_ptr p, int me)
+{
+  unsigned long long *mine = &p->ranges[me].range;
+
+  do
+  {
+    unsigned long long r = __atomic_load_n(mine, __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+      unsigned int begin = (unsigned int) r;
+      unsigned int end = (unsigned int) (r >> 32);
+      if (begin >= end)
+        break;
+
+      if (__atomic_compare_exchange_n(mine, &r, pack_range(begin + 1, end),
+                                      0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      {
+        p->f(p->arg, begin);
+        r = __atomic_load_n(mine, __ATOMIC_ACQUIRE);
+      }
+    }
+  } while (steal_tiles(p, me));
+}
+
+/**
+ * Moves the back half of another thread's tiles into this thread's
+ * (empty) range.  Returns 0 if no other thread has any tiles left.
+ */
+static int steal_tiles(thread_pool_ptr p, int me)
+{
+  int ii;
+
+  for (ii = 1; ii < p->participants; ++ii)
+  {
+    int victim = (me + ii) % p->participants;
+    unsigned long long *theirs = &p->ranges[victim].range;
+    unsigned long long r = __atomic_load_n(theirs, __ATOMIC_ACQUIRE);
+
+    for (;;)
+    {
+      unsigned int begin = (unsigned int) r;
+      unsigned int end = (unsigned int) (r >> 32);
+      unsigned int mid = begin + (end - begin) / 2;
+
+      if (begin >= end)
+        break;
+
+      if (__atomic_compare_exchange_n(theirs, &r, pack_range(begin, mid),
+                                      0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      {
+        __atomic_store_n(&p->ranges[me].range, pack_range(mid, end),
+                         __ATOMIC_RELEASE);
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*@}*/
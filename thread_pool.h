@@ -0,0 +1,65 @@
+/**
+ * \file thread_pool.h
+ *
+ * \brief A small persistent pool of worker threads for splitting work
+ * into numbered tiles.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+
+typedef struct thread_pool_struct *thread_pool_ptr;
+
+/** the work to do for one tile; tile is in 0 .. num_tiles-1 */
+typedef void (*tile_function)(void *arg, int tile);
+
+
+/**
+ * Starts a pool that can run num_threads tiles at once.  The thread
+ * calling run_tiles is one of these, so num_threads-1 workers are
+ * started.  If num_threads <= 0, one thread per processor is used.
+ */
+thread_pool_ptr init_thread_pool(int num_threads);
+
+/**
+ * Stops the workers and frees the pool.
+ */
+void delete_thread_pool(thread_pool_ptr p);
+
+/**
+ * Returns the number of threads that can work on tiles at once,
+ * including the caller of run_tiles.
+ */
+int get_number_of_threads(thread_pool_ptr p);
+
+/**
+ * Calls f(arg, tile) once for every tile in 0 .. num_tiles-1, spread
+ * over at most num_threads threads (all of them if num_threads <= 0),
+ * and returns when every tile is done.  Idle threads steal tiles from
+ * busy ones, so tiles may take very different amounts of time.
+ * With one thread (or one tile), the tiles are just run on the calling
+ * thread, without waiting for other calls to finish.
+ */
+void run_tiles(thread_pool_ptr p,
+               int num_tiles,
+               int num_threads,
+               tile_function f,
+               void *arg);
+
+/**
+ * Returns a pool with one thread per processor, shared by the whole
+ * process.  It is created the first time it is asked for and is never
+ * deleted.
+ */
+thread_pool_ptr get_shared_thread_pool(void);
+
+/**
+ * Returns the number of processors that are online.
+ */
+int get_number_of_processors(void);
+
+
+#endif
@@ -0,0 +1,264 @@
+/**
+ * \file vector_math.c
+ *
+ * \brief Array versions of the vector math functions, one set per
+ * instruction set, and the choice between them at run time.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <math.h>
+
+#include "vector_math.h"
+#include "vector_targets.h"
+
+
+/** the array functions for one instruction set */
+struct vector_math_funcs_struct
+{
+  void (*log)(const double *x, double *y, int n);
+  void (*exp)(const double *x, double *y, int n);
+  void (*sin)(const double *x, double *y, int n);
+  void (*sqrt)(const double *x, double *y, int n);
+  void (*atan2)(const double *y, const double *x, double *r, int n);
+  void (*fmod)(const double *x, const double *y, double *r, int n);
+};
+typedef struct vector_math_funcs_struct vector_math_funcs;
+
+
+/**
+ * Makes the array functions for the instruction set just included.
+ * The last partial vector is copied through a padded buffer.
+ */
+#define VM_UNARY_ARRAY(fn)                                              \
+  static void VM(array_##fn)(const double *x, double *y, int n)         \
+  {                                                                     \
+    int ii;                                                             \
+    for (ii = 0; ii + VM_WIDTH <= n; ii += VM_WIDTH)                    \
+      VM(vm_store)(y + ii, VM(vm_##fn)(VM(vm_load)(x + ii)));           \
+    if (ii < n)                                                         \
+    {                                                                   \
+      double tx[VM_WIDTH];                                              \
+      double ty[VM_WIDTH];                                              \
+      int jj;                                                           \
+      for (jj = 0; jj < VM_WIDTH; ++jj)                                 \
+        tx[jj] = (ii + jj < n) ? x[ii + jj] : 1.0;                      \
+      VM(vm_store)(ty, VM(vm_##fn)(VM(vm_load)(tx)));                   \
+      for (jj = 0; ii + jj < n; ++jj)                                   \
+        y[ii + jj] = ty[jj];                                            \
+    }                                                                   \
+  }
+
+#define VM_BINARY_ARRAY(fn)                                             \
+  static void VM(array_##fn)(const double *a, const double *b,          \
+                             double *r, int n)                          \
+  {                                                                     \
+    int ii;                                                             \
+    for (ii = 0; ii + VM_WIDTH <= n; ii += VM_WIDTH)                    \
+      VM(vm_store)(r + ii, VM(vm_##fn)(VM(vm_load)(a + ii),             \
+                                       VM(vm_load)(b + ii)));           \
+    if (ii < n)                                                         \
+    {                                                                   \
+      double ta[VM_WIDTH];                                              \
+      double tb[VM_WIDTH];                                              \
+      double tr[VM_WIDTH];                                              \
+      int jj;                                                           \
+      for (jj = 0; jj < VM_WIDTH; ++jj)                                 \
+      {                                                                 \
+        ta[jj] = (ii + jj < n) ? a[ii + jj] : 1.0;                      \
+        tb[jj] = (ii + jj < n) ? b[ii + jj] : 1.0;                      \
+      }                                                                 \
+      VM(vm_store)(tr, VM(vm_##fn)(VM(vm_load)(ta), VM(vm_load)(tb)));  \
+      for (jj = 0; ii + jj < n; ++jj)                                   \
+        r[ii + jj] = tr[jj];                                            \
+    }                                                                   \
+  }
+
+#define VM_ARRAY_FUNCS                                                  \
+  VM_UNARY_ARRAY(log)                                                   \
+  VM_UNARY_ARRAY(exp)                                                   \
+  VM_UNARY_ARRAY(sin)                                                   \
+  VM_UNARY_ARRAY(sqrt)                                                  \
+  VM_BINARY_ARRAY(atan2)                                                \
+  VM_BINARY_ARRAY(fmod)                                                 \
+  static const vector_math_funcs VM(funcs) =                            \
+  {                                                                     \
+    VM(array_log), VM(array_exp), VM(array_sin),                        \
+    VM(array_sqrt), VM(array_atan2), VM(array_fmod)                     \
+  };
+
+
+/* plain C; on x86-64 the compiler still uses SSE2 for this */
+#define VM_WIDTH 2
+#define VM_SUFFIX generic
+#define VM_ISA 0
+#include "vector_math_impl.h"
+VM_ARRAY_FUNCS
+#undef VM_WIDTH
+#undef VM_SUFFIX
+#undef VM_ISA
+#undef VM_HAVE_FMA
+
+#if VM_X86
+
+BEGIN_TARGET("sse2")
+#define VM_WIDTH 2
+#define VM_SUFFIX sse2
+#define VM_ISA 1
+#include "vector_math_impl.h"
+VM_ARRAY_FUNCS
+#undef VM_WIDTH
+#undef VM_SUFFIX
+#undef VM_ISA
+#undef VM_HAVE_FMA
+END_TARGET
+
+BEGIN_TARGET("avx2,fma")
+#define VM_WIDTH 4
+#define VM_SUFFIX avx2
+#define VM_ISA 2
+#include "vector_math_impl.h"
+VM_ARRAY_FUNCS
+#undef VM_WIDTH
+#undef VM_SUFFIX
+#undef VM_ISA
+#undef VM_HAVE_FMA
+END_TARGET
+
+BEGIN_TARGET("avx512f,avx512dq,avx2,fma")
+#define VM_WIDTH 8
+#define VM_SUFFIX avx512
+#define VM_ISA 3
+#include "vector_math_impl.h"
+VM_ARRAY_FUNCS
+#undef VM_WIDTH
+#undef VM_SUFFIX
+#undef VM_ISA
+#undef VM_HAVE_FMA
+END_TARGET
+
+#endif
+
+
+/** the instruction set in use; -1 until it is first asked for */
+static int current_isa = -1;
+
+/** private declarations */
+
+static const vector_math_funcs* get_funcs(void);
+
+
+/** @name Public Interface */
+/*@{*/
+
+/**
+ * Asks the processor which instruction sets it has.  The compiler's
+ * checks also make sure the operating system saves the wide registers.
+ */
+vector_isa get_best_vector_isa(void)
+{
+#if VM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+    return avx512_isa;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return avx2_isa;
+  if (__builtin_cpu_supports("sse2"))
+    return sse2_isa;
+#endif
+  return generic_isa;
+}
+
+/**
+ * Returns the instruction set in use
+ */
+vector_isa get_vector_isa(void)
+{
+  int isa = __atomic_load_n(&current_isa, __ATOMIC_RELAXED);
+
+  /* drawings filled on several threads at once may all get here; they
+   * all store the same thing */
+  if (isa < 0)
+  {
+    isa = get_best_vector_isa();
+    __atomic_store_n(&current_isa, isa, __ATOMIC_RELAXED);
+  }
+  return (vector_isa) isa;
+}
+
+/**
+ * Picks the instruction set to use
+ */
+void set_vector_isa(vector_isa isa)
+{
+  vector_isa best = get_best_vector_isa();
+  __atomic_store_n(&current_isa, (isa > best) ? best : isa, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns a name for an instruction set
+ */
+const char* get_vector_isa_name(vector_isa isa)
+{
+  switch (isa)
+  {
+    case generic_isa:  return "generic";
+    case sse2_isa:     return "sse2";
+    case avx2_isa:     return "avx2";
+    case avx512_isa:   return "avx512";
+    default:           return "unknown";
+  }
+}
+
+void vector_log(const double *x, double *y, int n)
+{
+  get_funcs()->log(x, y, n);
+}
+
+void vector_exp(const double *x, double *y, int n)
+{
+  get_funcs()->exp(x, y, n);
+}
+
+void vector_sin(const double *x, double *y, int n)
+{
+  get_funcs()->sin(x, y, n);
+}
+
+void vector_sqrt(const double *x, double *y, int n)
+{
+  get_funcs()->sqrt(x, y, n);
+}
+
+void vector_atan2(const double *y, const double *x, double *r, int n)
+{
+  get_funcs()->atan2(y, x, r, n);
+}
+
+void vector_fmod(const double *x, const double *y, double *r, int n)
+{
+  get_funcs()->fmod(x, y, r, n);
+}
+
+/*@}*/
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Returns the array functions for the instruction set in use
+ */
+static const vector_math_funcs* get_funcs(void)
+{
+  switch (get_vector_isa())
+  {
+#if VM_X86
+    case avx512_isa:  return &funcs_avx512;
+    case avx2_isa:    return &funcs_avx2;
+    case sse2_isa:    return &funcs_sse2;
+#endif
+    default:          return &funcs_generic;
+  }
+}
+
+/*@}*/
@@ -0,0 +1,85 @@
+/**
+ * \file vector_math.h
+ *
+ * \brief Vector versions of the libm functions used to draw the styles:
+ * log, sin, exp, sqrt, atan2 and fmod.
+ *
+ * Each function works on whole arrays, using the widest instruction set
+ * the processor has (plain C, SSE2, AVX2 with FMA, or AVX-512).  The
+ * same code is in vector_math_impl.h, which the drawing kernels include
+ * directly so they can call it on values held in registers.
+ *
+ * Errors against correctly rounded results, in units in the last place:
+ *
+ \verbatim
+   vector_log     < 1 ulp      all x
+   vector_exp     < 1 ulp      all x (subnormal results may be off by 1 ulp
+                               more, from the two step scaling)
+   vector_sin     < 1 ulp      |x| < 2^20; libm beyond that
+   vector_sqrt      0 ulp      all x (hardware square root)
+   vector_atan2   < 2 ulp      all x, y; libm for infinities and NaNs
+   vector_fmod      0 ulp      |x/y| < 2^26 with FMA (AVX2, AVX-512, plain C);
+                  < 1 ulp      without FMA (SSE2); libm beyond 2^26,
+                               and for |y| > 2^995 without FMA
+ \endverbatim
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef VECTOR_MATH_H
+#define VECTOR_MATH_H
+
+
+/** instruction sets the vector code is compiled for, slowest first */
+typedef enum
+{
+  generic_isa,   /**< plain C with 2 wide vectors */
+  sse2_isa,      /**< 2 doubles per vector */
+  avx2_isa,      /**< 4 doubles per vector, with FMA */
+  avx512_isa     /**< 8 doubles per vector */
+} vector_isa;
+
+
+/**
+ * Returns the best instruction set this processor (and operating
+ * system) supports.
+ */
+vector_isa get_best_vector_isa(void);
+
+/**
+ * Returns the instruction set in use; get_best_vector_isa unless
+ * set_vector_isa was called.
+ */
+vector_isa get_vector_isa(void);
+
+/**
+ * Picks the instruction set to use, e.g. to compare them.  Asking for
+ * one the processor doesn't support gives the best one it does.
+ */
+void set_vector_isa(vector_isa isa);
+
+/**
+ * Returns a name for an instruction set, like "avx2".
+ */
+const char* get_vector_isa_name(vector_isa isa);
+
+/** y[i] = log(x[i]) for i in 0 .. n-1 */
+void vector_log(const double *x, double *y, int n);
+
+/** y[i] = exp(x[i]) */
+void vector_exp(const double *x, double *y, int n);
+
+/** y[i] = sin(x[i]) */
+void vector_sin(const double *x, double *y, int n);
+
+/** y[i] = sqrt(x[i]) */
+void vector_sqrt(const double *x, double *y, int n);
+
+/** r[i] = atan2(y[i], x[i]) */
+void vector_atan2(const double *y, const double *x, double *r, int n);
+
+/** r[i] = fmod(x[i], y[i]) */
+void vector_fmod(const double *x, const double *y, double *r, int n);
+
+
+#endif
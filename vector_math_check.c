@@ -0,0 +1,433 @@
+/**
+ * \file vector_math_check.c
+ *
+ * \brief vector-math-check: checks the vector math functions against
+ * libm on every instruction set the processor has.
+ *
+ * Arguments are drawn from every binade of the doubles (subnormals
+ * included), plus zeros, infinities, NaNs and the ends of the ranges
+ * the algorithms handle.  Each result is compared with the exact value,
+ * taken from the long double libm functions, and the errors are held
+ * to the bounds documented in vector_math.h.  Where vector_math.h says
+ * a function is exact, or hands an argument to libm, the result must
+ * be the same as libm's bit for bit.  Where long double is no wider
+ * than double, the "exact" values are only libm's, so the bounds are
+ * loosened by LIBM_SLACK.
+ *
+ * Run with "make check".  Exits with status 1 if any bound is broken.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "vector_math.h"
+
+
+/** arguments drawn from each binade of each sign */
+#define PER_BINADE 200
+
+/** the number of arguments handed to the array functions at once; odd,
+    so the padded last vector is checked too */
+#define CHUNK 1001
+
+/** the smallest subnormal */
+#define SMALLEST_DOUBLE 0x1p-1074
+
+/** room for libm's own error when it stands in for the exact values */
+#if LDBL_MANT_DIG > DBL_MANT_DIG
+#define LIBM_SLACK 0.0
+#else
+#define LIBM_SLACK 1.0
+#endif
+
+/** the arguments of one function, and the exact results */
+struct check_case_struct
+{
+  double *x;
+  double *y;          /**< second arguments, for atan2 and fmod */
+  long double *exact; /**< the exact results */
+  double *libm;       /**< libm's results */
+  int n;
+};
+typedef struct check_case_struct check_case;
+
+/** the functions checked */
+typedef enum
+{
+  log_fn,
+  exp_fn,
+  sin_fn,
+  sqrt_fn,
+  atan2_fn,
+  fmod_fn,
+  num_fns
+} check_fn;
+
+static const char *fn_names[num_fns] =
+{
+  "log", "exp", "sin", "sqrt", "atan2", "fmod"
+};
+
+/** state of the random numbers */
+static unsigned long long random_state = 0x9e3779b97f4a7c15ULL;
+
+/** private declarations */
+
+static void make_case(check_fn fn, check_case *c);
+static void add_argument(check_case *c, int *size, double x, double y);
+static double random_in_binade(int binade);
+static unsigned long long next_random(void);
+static void run_vector(check_fn fn, const check_case *c, double *r);
+static int check_results(check_fn fn, vector_isa isa, const check_case *c,
+                         const double *r);
+static double get_bound(check_fn fn, vector_isa isa, double x, double y,
+                        int *from_libm);
+static double ulp_error(double r, long double exact);
+static int same_double(double a, double b);
+
+
+/**
+ * Checks each function on each instruction set
+ */
+int main(int argc, char **argv)
+{
+  vector_isa best = get_best_vector_isa();
+  int failures = 0;
+  int fn;
+  int isa;
+
+  (void) argc;
+  (void) argv;
+
+  for (fn = 0; fn < num_fns; ++fn)
+  {
+    check_case c;
+    double *r;
+
+    make_case((check_fn) fn, &c);
+    r = malloc(sizeof(double) * c.n);
+    if (!r)
+    {
+      fprintf(stderr, "vector-math-check: out of memory\n");
+      return 1;
+    }
+
+    for (isa = generic_isa; isa <= avx512_isa; ++isa)
+    {
+      if (isa > (int) best)
+      {
+        printf("%-6s %-8s skipped: not supported here\n", fn_names[fn],
+               get_vector_isa_name((vector_isa) isa));
+        continue;
+      }
+      set_vector_isa((vector_isa) isa);
+      run_vector((check_fn) fn, &c, r);
+      if (!check_results((check_fn) fn, (vector_isa) isa, &c, r))
+        failures++;
+    }
+
+    free(r);
+    free(c.x);
+    free(c.y);
+    free(c.exact);
+    free(c.libm);
+  }
+
+  printf("%s\n", failures ? "FAILED" : "all bounds hold");
+  return failures ? 1 : 0;
+}
+
+
+/** @name Private functions */
+/*@{*/
+
+/**
+ * Makes the arguments for fn and works out the exact results
+ */
+static void make_case(check_fn fn, check_case *c)
+{
+  static const double specials[] =
+  {
+    0.0, -0.0, HUGE_VAL, -HUGE_VAL, NAN, DBL_MIN, -DBL_MIN, DBL_MAX,
+    -DBL_MAX, SMALLEST_DOUBLE, -SMALLEST_DOUBLE, 1.0, -1.0, 0.5, 2.0,
+    0x1p20, -0x1p20, 0x1.fffffffffffffp19, 709.78, -708.39, -745.13,
+    M_PI, M_PI_2, M_PI_4, 3 * M_PI_4
+  };
+  int num_specials = sizeof(specials) / sizeof(specials[0]);
+  int size = 0;
+  int binade;
+  int ii;
+  int jj;
+
+  memset(c, 0, sizeof(*c));
+
+  for (ii = 0; ii < num_specials; ++ii)
+  {
+    for (jj = 0; jj < num_specials; ++jj)
+      add_argument(c, &size, specials[ii], specials[jj]);
+  }
+
+  for (binade = -1074; binade <= 1023; ++binade)
+  {
+    for (ii = 0; ii < PER_BINADE; ++ii)
+    {
+      double x = random_in_binade(binade);
+      double y = random_in_binade(-1074 + (int) (next_random() % 2098));
+
+      if (next_random() & 1)
+        x = -x;
+      if (next_random() & 1)
+        y = -y;
+
+      /* exp only has finite, nonzero results on about [-745, 710] */
+      if (fn == exp_fn && binade > 9)
+        x = ldexp(x, 9 - binade);
+
+      /* fmod mostly by numbers near x, where it does the most work */
+      if (fn == fmod_fn && (ii & 1))
+        y = ldexp(y, binade - ilogb(y) - (int) (next_random() % 40));
+
+      add_argument(c, &size, x, y);
+    }
+  }
+
+  c->exact = malloc(sizeof(long double) * c->n);
+  c->libm = malloc(sizeof(double) * c->n);
+  if (!c->exact || !c->libm)
+  {
+    fprintf(stderr, "vector-math-check: out of memory\n");
+    exit(1);
+  }
+
+  for (ii = 0; ii < c->n; ++ii)
+  {
+    double x = c->x[ii];
+    double y = c->y[ii];
+
+    switch (fn)
+    {
+      case log_fn:
+        c->exact[ii] = logl(x);
+        c->libm[ii] = log(x);
+        break;
+      case exp_fn:
+        c->exact[ii] = expl(x);
+        c->libm[ii] = exp(x);
+        break;
+      case sin_fn:
+        c->exact[ii] = sinl(x);
+        c->libm[ii] = sin(x);
+        break;
+      case sqrt_fn:
+        c->exact[ii] = sqrtl(x);
+        c->libm[ii] = sqrt(x);
+        break;
+      case atan2_fn:
+        c->exact[ii] = atan2l(x, y);
+        c->libm[ii] = atan2(x, y);
+        break;
+      default:
+        c->exact[ii] = fmodl(x, y);
+        c->libm[ii] = fmod(x, y);
+    }
+  }
+}
+
+/**
+ * Adds an argument (or pair of them) to the case
+ */
+static void add_argument(check_case *c, int *size, double x, double y)
+{
+  if (c->n == *size)
+  {
+    *size = *size ? 2 * *size : 4096;
+    c->x = realloc(c->x, sizeof(double) * *size);
+    c->y = realloc(c->y, sizeof(double) * *size);
+    if (!c->x || !c->y)
+    {
+      fprintf(stderr, "vector-math-check: out of memory\n");
+      exit(1);
+    }
+  }
+
+  c->x[c->n] = x;
+  c->y[c->n] = y;
+  c->n++;
+}
+
+/**
+ * Returns a random positive double with exponent binade; below -1022,
+ * a subnormal of that size.
+ */
+static double random_in_binade(int binade)
+{
+  unsigned long long mantissa = next_random() >> 12;
+
+  if (binade < -1022)
+    return ldexp((double) ((mantissa >> (-1022 - binade)) |
+                           (1ULL << (52 - (-1022 - binade)))), -1074);
+  return ldexp(1.0 + mantissa * 0x1p-52, binade);
+}
+
+/**
+ * splitmix64
+ */
+static unsigned long long next_random(void)
+{
+  unsigned long long z = (random_state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * Computes fn of the case's arguments with the vector functions, a
+ * chunk at a time
+ */
+static void run_vector(check_fn fn, const check_case *c, double *r)
+{
+  int ii;
+
+  for (ii = 0; ii < c->n; ii += CHUNK)
+  {
+    int n = (c->n - ii < CHUNK) ? c->n - ii : CHUNK;
+    const double *x = c->x + ii;
+    const double *y = c->y + ii;
+
+    switch (fn)
+    {
+      case log_fn:    vector_log(x, r + ii, n);        break;
+      case exp_fn:    vector_exp(x, r + ii, n);        break;
+      case sin_fn:    vector_sin(x, r + ii, n);        break;
+      case sqrt_fn:   vector_sqrt(x, r + ii, n);       break;
+      case atan2_fn:  vector_atan2(x, y, r + ii, n);   break;
+      default:        vector_fmod(x, y, r + ii, n);
+    }
+  }
+}
+
+/**
+ * Compares the results with the bounds, printing the worst error.
+ * Returns 1 if they all hold.
+ */
+static int check_results(check_fn fn, vector_isa isa, const check_case *c,
+                         const double *r)
+{
+  double worst = 0;
+  int worst_at = -1;
+  int bad = 0;
+  int ii;
+
+  for (ii = 0; ii < c->n; ++ii)
+  {
+    int from_libm;
+    double bound = get_bound(fn, isa, c->x[ii], c->y[ii], &from_libm);
+    double error;
+
+    if (from_libm || bound == 0)
+    {
+      if (same_double(r[ii], c->libm[ii]))
+        continue;
+      error = HUGE_VAL;
+    }
+    else
+    {
+      error = ulp_error(r[ii], c->exact[ii]);
+      if (error > worst)
+        worst = error;
+      if (error < bound + LIBM_SLACK)
+        continue;
+    }
+
+    if (!bad++)
+      worst_at = ii;
+  }
+
+  printf("%-6s %-8s %8d args  worst %.3f ulp  %s\n", fn_names[fn],
+         get_vector_isa_name(isa), c->n, worst, bad ? "FAIL" : "ok");
+  if (bad)
+  {
+    printf("       %d bad, first (%a, %a): %a, libm %a\n", bad,
+           c->x[worst_at], c->y[worst_at], r[worst_at], c->libm[worst_at]);
+  }
+  return !bad;
+}
+
+/**
+ * Returns the bound on the error of fn at (x, y) on isa, from
+ * vector_math.h: 0 for results that must be libm's exactly, which
+ * *from_libm also says when the vector code hands the argument to libm.
+ */
+static double get_bound(check_fn fn, vector_isa isa, double x, double y,
+                        int *from_libm)
+{
+  *from_libm = 0;
+
+  switch (fn)
+  {
+    case log_fn:
+      return 1;
+
+    case exp_fn:
+    {
+      double e = exp(x);
+      return (e != 0 && fabs(e) < DBL_MIN) ? 2 : 1;
+    }
+
+    case sin_fn:
+      *from_libm = !(fabs(x) < 0x1p20);
+      return 1;
+
+    case sqrt_fn:
+      return 0;
+
+    case atan2_fn:
+      *from_libm = !isfinite(x) || !isfinite(y);
+      return 2;
+
+    default:
+      *from_libm = !(fabs(x / y) < 0x1p26) || !(fabs(y) > 0) ||
+                   !isfinite(y);
+      return (isa == sse2_isa) ? 1 : 0;
+  }
+}
+
+/**
+ * Returns the error of r against the exact value, in units in the last
+ * place of the double nearest it
+ */
+static double ulp_error(double r, long double exact)
+{
+  double rounded = (double) exact;
+  long double ulp;
+
+  if (isnan(rounded) || isinf(rounded))
+    return same_double(r, rounded) ? 0 : HUGE_VAL;
+  if (!isfinite(r))
+    return HUGE_VAL;
+
+  if (rounded == 0 || fabs(rounded) < DBL_MIN)
+    ulp = SMALLEST_DOUBLE;
+  else
+    ulp = ldexpl(1.0L, ilogb(rounded) - (DBL_MANT_DIG - 1));
+
+  return (double) (fabsl((long double) r - exact) / ulp);
+}
+
+/**
+ * Says if two doubles are the same, counting all NaNs the same and
+ * telling the zeros apart
+ */
+static int same_double(double a, double b)
+{
+  if (isnan(a) || isnan(b))
+    return isnan(a) && isnan(b);
+  return a == b && signbit(a) == signbit(b);
+}
+
+/*@}*/
@@ -0,0 +1,474 @@
+/**
+ * \file vector_math_impl.h
+ *
+ * \brief Vector versions of log, sin, exp, sqrt, atan2 and fmod, written
+ * once with the GCC/Clang vector extensions and compiled for each
+ * instruction set.
+ *
+ * This file has no include guard.  It is included once per instruction
+ * set, after defining
+ *  - VM_WIDTH:  the number of doubles in a vector (2, 4 or 8),
+ *  - VM_SUFFIX: a suffix added to every name, e.g. avx2,
+ *  - VM_ISA:    0 for plain C, 1 for SSE2, 2 for AVX2+FMA, 3 for AVX-512,
+ * and after turning on that instruction set with a target pragma.
+ * VM(name) is name_VM_SUFFIX, and VDOUBLE/VLONG are the vector types.
+ *
+ * The algorithms are those of fdlibm (log, exp, sin) and Cephes (atan);
+ * see vector_math.h for the error bounds.  Lanes with arguments outside
+ * the range the algorithms handle are computed by libm instead.
+ *
+ * \author Jonathan Cross
+ **/
+
+#include <math.h>
+
+#undef VM_PASTE2
+#undef VM_PASTE
+#undef VM
+#undef VDOUBLE
+#undef VLONG
+
+#define VM_PASTE2(a, b) a ## _ ## b
+#define VM_PASTE(a, b) VM_PASTE2(a, b)
+#define VM(name) VM_PASTE(name, VM_SUFFIX)
+
+typedef double VM(vdouble) __attribute__((vector_size(8 * VM_WIDTH)));
+typedef long long VM(vlong) __attribute__((vector_size(8 * VM_WIDTH)));
+
+#define VDOUBLE VM(vdouble)
+#define VLONG VM(vlong)
+
+
+/** @name Helpers */
+/*@{*/
+
+/** all lanes set to a */
+static inline VDOUBLE VM(vm_splat)(double a)
+{
+  VDOUBLE v;
+  int ii;
+  for (ii = 0; ii < VM_WIDTH; ++ii)
+    v[ii] = a;
+  return v;
+}
+
+/** all lanes set to a */
+static inline VLONG VM(vm_splatl)(long long a)
+{
+  VLONG v;
+  int ii;
+  for (ii = 0; ii < VM_WIDTH; ++ii)
+    v[ii] = a;
+  return v;
+}
+
+static inline VDOUBLE VM(vm_load)(const double *p)
+{
+  VDOUBLE v;
+  __builtin_memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void VM(vm_store)(double *p, VDOUBLE v)
+{
+  __builtin_memcpy(p, &v, sizeof(v));
+}
+
+/** lanes of a where mask is set, lanes of b elsewhere */
+static inline VDOUBLE VM(vm_select)(VLONG mask, VDOUBLE a, VDOUBLE b)
+{
+  return (VDOUBLE) (((VLONG) a & mask) | ((VLONG) b & ~mask));
+}
+
+/** nonzero if any lane of mask is set */
+static inline int VM(vm_any)(VLONG mask)
+{
+  long long any = 0;
+  int ii;
+  for (ii = 0; ii < VM_WIDTH; ++ii)
+    any |= mask[ii];
+  return any != 0;
+}
+
+static inline VDOUBLE VM(vm_abs)(VDOUBLE x)
+{
+  return (VDOUBLE) ((VLONG) x & 0x7fffffffffffffffLL);
+}
+
+/** the magnitude of mag with the sign of sgn */
+static inline VDOUBLE VM(vm_copysign)(VDOUBLE mag, VDOUBLE sgn)
+{
+  return (VDOUBLE) (((VLONG) mag & 0x7fffffffffffffffLL) |
+                    ((VLONG) sgn & VM(vm_splatl)(-0x7fffffffffffffffLL - 1)));
+}
+
+/** rounds to the nearest integer; |x| must be below 2^51 */
+static inline VDOUBLE VM(vm_round)(VDOUBLE x)
+{
+  return (x + 0x1.8p52) - 0x1.8p52;
+}
+
+/** rounds toward zero; |x| must be below 2^51 */
+static inline VDOUBLE VM(vm_trunc)(VDOUBLE x)
+{
+  VDOUBLE r = VM(vm_round)(x);
+  VLONG one = (VLONG) VM(vm_splat)(1.0);
+  VLONG too_big = (x >= 0.0) & (r > x);
+  VLONG too_small = (x < 0.0) & (r < x);
+  return r - (VDOUBLE) (too_big & one) + (VDOUBLE) (too_small & one);
+}
+
+/** converts an integer-valued double, |x| < 2^51, to an integer */
+static inline VLONG VM(vm_double2long)(VDOUBLE x)
+{
+  return (VLONG) (x + 0x1.8p52) - 0x4338000000000000LL;
+}
+
+/** converts an integer, |k| < 2^51, to a double */
+static inline VDOUBLE VM(vm_long2double)(VLONG k)
+{
+  return (VDOUBLE) (k + 0x4338000000000000LL) - 0x1.8p52;
+}
+
+/** 2^k, for -1022 <= k <= 1023 */
+static inline VDOUBLE VM(vm_pow2)(VLONG k)
+{
+  return (VDOUBLE) ((k + 1023) << 52);
+}
+
+#if VM_ISA == 3
+
+static inline VDOUBLE VM(vm_sqrt)(VDOUBLE x)
+{
+  return (VDOUBLE) _mm512_sqrt_pd((__m512d) x);
+}
+
+/** a*b + c with a single rounding */
+static inline VDOUBLE VM(vm_fma)(VDOUBLE a, VDOUBLE b, VDOUBLE c)
+{
+  return (VDOUBLE) _mm512_fmadd_pd((__m512d) a, (__m512d) b, (__m512d) c);
+}
+#define VM_HAVE_FMA 1
+
+#elif VM_ISA == 2
+
+static inline VDOUBLE VM(vm_sqrt)(VDOUBLE x)
+{
+  return (VDOUBLE) _mm256_sqrt_pd((__m256d) x);
+}
+
+static inline VDOUBLE VM(vm_fma)(VDOUBLE a, VDOUBLE b, VDOUBLE c)
+{
+  return (VDOUBLE) _mm256_fmadd_pd((__m256d) a, (__m256d) b, (__m256d) c);
+}
+#define VM_HAVE_FMA 1
+
+#elif VM_ISA == 1
+
+static inline VDOUBLE VM(vm_sqrt)(VDOUBLE x)
+{
+  return (VDOUBLE) _mm_sqrt_pd((__m128d) x);
+}
+#define VM_HAVE_FMA 0
+
+#else
+
+static inline VDOUBLE VM(vm_sqrt)(VDOUBLE x)
+{
+  int ii;
+  for (ii = 0; ii < VM_WIDTH; ++ii)
+    x[ii] = __builtin_sqrt(x[ii]);
+  return x;
+}
+
+static inline VDOUBLE VM(vm_fma)(VDOUBLE a, VDOUBLE b, VDOUBLE c)
+{
+  int ii;
+  for (ii = 0; ii < VM_WIDTH; ++ii)
+    a[ii] = __builtin_fma(a[ii], b[ii], c[ii]);
+  return a;
+}
+#define VM_HAVE_FMA 1
+
+#endif
+
+/*@}*/
+
+/** @name The functions */
+/*@{*/
+
+/**
+ * natural log; fdlibm's e_log.c with the branches turned into selects.
+ */
+static inline VDOUBLE VM(vm_log)(VDOUBLE x)
+{
+  const double ln2_hi = 6.93147180369123816490e-01;
+  const double ln2_lo = 1.90821492927058770002e-10;
+  const double Lg1 = 6.666666666666735130e-01;
+  const double Lg2 = 3.999999999940941908e-01;
+  const double Lg3 = 2.857142874366239149e-01;
+  const double Lg4 = 2.222219843214978396e-01;
+  const double Lg5 = 1.818357216161805012e-01;
+  const double Lg6 = 1.531383769920937332e-01;
+  const double Lg7 = 1.479819860511658591e-01;
+
+  /* scale subnormals up into the normal range */
+  VLONG sub = x < 0x1p-1022;
+  VDOUBLE xs = VM(vm_select)(sub, x * 0x1p52, x);
+  VLONG bits = (VLONG) xs;
+  VLONG k = ((bits >> 52) & 0x7ff) - 1023 - (sub & 52);
+
+  /* x = 2^k * m, with sqrt(2)/2 <= m < sqrt(2) */
+  VDOUBLE m = (VDOUBLE) ((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+  VLONG hi = m > 1.41421356237309504880;
+  m = VM(vm_select)(hi, m * 0.5, m);
+  k = k - hi;
+
+  VDOUBLE f = m - 1.0;
+  VDOUBLE s = f / (2.0 + f);
+  VDOUBLE dk = VM(vm_long2double)(k);
+  VDOUBLE z = s * s;
+  VDOUBLE R = z*(Lg1+z*(Lg2+z*(Lg3+z*(Lg4+z*(Lg5+z*(Lg6+z*Lg7))))));
+  VDOUBLE hfsq = 0.5 * f * f;
+  VDOUBLE result = dk*ln2_hi - ((hfsq - (s*(hfsq+R) + dk*ln2_lo)) - f);
+
+  /* special cases */
+  result = VM(vm_select)(x == 0.0, VM(vm_splat)(-HUGE_VAL), result);
+  result = VM(vm_select)((x < 0.0) | (x != x), VM(vm_splat)(NAN), result);
+  result = VM(vm_select)(x == HUGE_VAL, VM(vm_splat)(HUGE_VAL), result);
+
+  return result;
+}
+
+/**
+ * e^x; fdlibm's e_exp.c with the branches turned into selects.
+ */
+static inline VDOUBLE VM(vm_exp)(VDOUBLE x)
+{
+  const double ln2_hi = 6.93147180369123816490e-01;
+  const double ln2_lo = 1.90821492927058770002e-10;
+  const double invln2 = 1.44269504088896338700e+00;
+  const double P1 = 1.66666666666666019037e-01;
+  const double P2 = -2.77777777770155933842e-03;
+  const double P3 = 6.61375632143793436117e-05;
+  const double P4 = -1.65339022054652515390e-06;
+  const double P5 = 4.13813679705723846039e-08;
+  const double overflow = 7.09782712893383973096e+02;
+  const double underflow = -7.45133219101941108420e+02;
+
+  /* clamp so the reduction below stays in range; fixed up at the end */
+  VDOUBLE xc = VM(vm_select)(x > 710.0, VM(vm_splat)(710.0), x);
+  xc = VM(vm_select)(xc < -746.0, VM(vm_splat)(-746.0), xc);
+  xc = VM(vm_select)(x != x, VM(vm_splat)(0.0), xc);
+
+  /* x = k*ln2 + r, |r| <= 0.5*ln2 */
+  VDOUBLE dk = VM(vm_round)(xc * invln2);
+  VLONG k = VM(vm_double2long)(dk);
+  VDOUBLE hi = xc - dk * ln2_hi;
+  VDOUBLE lo = dk * ln2_lo;
+  VDOUBLE r = hi - lo;
+
+  VDOUBLE t = r * r;
+  VDOUBLE c = r - t*(P1+t*(P2+t*(P3+t*(P4+t*P5))));
+  VDOUBLE y = 1.0 - ((lo - (r*c)/(2.0-c)) - hi);
+
+  /* scale by 2^k in two steps, so that subnormal results work */
+  VLONG k1 = k >> 1;
+  y = y * VM(vm_pow2)(k1) * VM(vm_pow2)(k - k1);
+
+  /* special cases */
+  y = VM(vm_select)(x > overflow, VM(vm_splat)(HUGE_VAL), y);
+  y = VM(vm_select)(x < underflow, VM(vm_splat)(0.0), y);
+  y = VM(vm_select)(x != x, x, y);
+
+  return y;
+}
+
+/** sin of x+y on [-pi/4, pi/4], |y| tiny; fdlibm's k_sin.c */
+static inline VDOUBLE VM(vm_kernel_sin)(VDOUBLE x, VDOUBLE y)
+{
+  const double S1 = -1.66666666666666324348e-01;
+  const double S2 = 8.33333333332248946124e-03;
+  const double S3 = -1.98412698298579493134e-04;
+  const double S4 = 2.75573137070700676789e-06;
+  const double S5 = -2.50507602534068634195e-08;
+  const double S6 = 1.58969099521155010221e-10;
+
+  VDOUBLE z = x * x;
+  VDOUBLE v = z * x;
+  VDOUBLE r = S2+z*(S3+z*(S4+z*(S5+z*S6)));
+  return x - ((z*(0.5*y - v*r) - y) - v*S1);
+}
+
+/** cos of x+y on [-pi/4, pi/4], |y| tiny; fdlibm's k_cos.c */
+static inline VDOUBLE VM(vm_kernel_cos)(VDOUBLE x, VDOUBLE y)
+{
+  const double C1 = 4.16666666666666019037e-02;
+  const double C2 = -1.38888888888741095749e-03;
+  const double C3 = 2.48015872894767294178e-05;
+  const double C4 = -2.75573143513906633035e-07;
+  const double C5 = 2.08757232129817482790e-09;
+  const double C6 = -1.13596475577881948265e-11;
+
+  VDOUBLE z = x * x;
+  VDOUBLE r = z*(C1+z*(C2+z*(C3+z*(C4+z*(C5+z*C6)))));
+  VDOUBLE hz = 0.5 * z;
+  VDOUBLE w = 1.0 - hz;
+  return w + (((1.0 - w) - hz) + (z*r - x*y));
+}
+
+/**
+ * sine.  The argument is reduced by multiples of pi/2 split into three
+ * parts (fdlibm's "medium" reduction), which is good for |x| < 2^20.
+ * Larger arguments, infinities and NaNs go to libm.
+ */
+static inline VDOUBLE VM(vm_sin)(VDOUBLE x)
+{
+  const double invpio2 = 6.36619772367581382433e-01;
+  const double pio2_1 = 1.57079632673412561417e+00;   /* first 33 bits */
+  const double pio2_2 = 6.07710050630396597660e-11;   /* next 33 bits */
+  const double pio2_2t = 2.02226624879595063154e-21;  /* pi/2 - pio2_1 - pio2_2 */
+
+  VLONG out_of_range = ~(VM(vm_abs)(x) < 0x1p20);
+  VDOUBLE xr = VM(vm_select)(out_of_range, VM(vm_splat)(0.0), x);
+
+  VDOUBLE n = VM(vm_round)(xr * invpio2);
+  VDOUBLE r1 = xr - n * pio2_1;     /* exact */
+  VDOUBLE w = n * pio2_2;           /* exact */
+  VDOUBLE r = r1 - w;
+  VDOUBLE lo = ((r1 - r) - w) - n * pio2_2t;
+  VDOUBLE hi = r + lo;
+  lo = lo - (hi - r);
+
+  VLONG q = VM(vm_double2long)(n);
+  VDOUBLE s = VM(vm_kernel_sin)(hi, lo);
+  VDOUBLE c = VM(vm_kernel_cos)(hi, lo);
+  VDOUBLE result = VM(vm_select)((q & 1) != 0, c, s);
+  result = (VDOUBLE) ((VLONG) result ^
+                      (((q & 2) != 0) & VM(vm_splatl)(-0x7fffffffffffffffLL - 1)));
+
+  if (VM(vm_any)(out_of_range))
+  {
+    int ii;
+    for (ii = 0; ii < VM_WIDTH; ++ii)
+      if (out_of_range[ii])
+        result[ii] = sin(x[ii]);
+  }
+
+  return result;
+}
+
+/**
+ * atan2(y, x).  The smaller of |x|,|y| over the larger gives an angle
+ * in [0, pi/4], found with Cephes' atan; that is then reflected into
+ * the right octant.  Matches libm for signed zeros; lanes where x or y
+ * is infinite or NaN go to libm.
+ */
+static inline VDOUBLE VM(vm_atan2)(VDOUBLE y, VDOUBLE x)
+{
+  const double P0 = -8.750608600031904122785e-01;
+  const double P1 = -1.615753718733365076637e+01;
+  const double P2 = -7.500855792314704667340e+01;
+  const double P3 = -1.228866684490136173410e+02;
+  const double P4 = -6.485021904942025371773e+01;
+  const double Q0 = 2.485846490142306297962e+01;
+  const double Q1 = 1.650270098316988542046e+02;
+  const double Q2 = 4.328810604912902668951e+02;
+  const double Q3 = 4.853903996359136964868e+02;
+  const double Q4 = 1.945506571482613964425e+02;
+  const double morebits = 6.123233995736765886130e-17;
+  const double pio4 = 7.85398163397448309616e-01;
+  const double pio2 = 1.57079632679489661923e+00;
+  const double pio2_lo = 6.123233995736765886130e-17;
+  const double pi = 3.14159265358979311600e+00;
+  const double pi_lo = 1.22464679914735317720e-16;
+
+  VDOUBLE ax = VM(vm_abs)(x);
+  VDOUBLE ay = VM(vm_abs)(y);
+  VLONG not_finite = ~(ax < HUGE_VAL) | ~(ay < HUGE_VAL);
+
+  /* t = smaller / larger, in [0, 1] */
+  VLONG swap = ay > ax;
+  VDOUBLE num = VM(vm_select)(swap, ax, ay);
+  VDOUBLE den = VM(vm_select)(swap, ay, ax);
+  VDOUBLE t = num / den;
+  t = VM(vm_select)((den == 0.0) | not_finite, VM(vm_splat)(0.0), t);
+
+  /* Cephes atan on [0, 1] */
+  VLONG big = t > 0.66;
+  VDOUBLE u = VM(vm_select)(big, (t - 1.0) / (t + 1.0), t);
+  VDOUBLE z = u * u;
+  VDOUBLE p = (((P0*z + P1)*z + P2)*z + P3)*z + P4;
+  VDOUBLE q = ((((z + Q0)*z + Q1)*z + Q2)*z + Q3)*z + Q4;
+  VDOUBLE a = u * (z * p / q) + u;
+  a = a + VM(vm_select)(big, VM(vm_splat)(0.5 * morebits), VM(vm_splat)(0.0));
+  a = a + VM(vm_select)(big, VM(vm_splat)(pio4), VM(vm_splat)(0.0));
+
+  /* into the right octant, then the right half plane */
+  a = VM(vm_select)(swap, (pio2 - a) + pio2_lo, a);
+  a = VM(vm_select)((VLONG) x < 0, (pi - a) + pi_lo, a);
+  a = VM(vm_copysign)(a, y);
+
+  if (VM(vm_any)(not_finite))
+  {
+    int ii;
+    for (ii = 0; ii < VM_WIDTH; ++ii)
+      if (not_finite[ii])
+        a[ii] = atan2(y[ii], x[ii]);
+  }
+
+  return a;
+}
+
+/** |x| - n*|y|, computed exactly when n is the right quotient */
+static inline VDOUBLE VM(vm_fmod_remainder)(VDOUBLE ax, VDOUBLE n, VDOUBLE ay)
+{
+#if VM_HAVE_FMA
+  return VM(vm_fma)(-n, ay, ax);
+#else
+  /* split |y| into two 26 bit halves, so each product with n < 2^26
+   * is exact (Dekker); vm_fmod keeps |y| small enough for the split
+   * not to overflow */
+  VDOUBLE c = 134217729.0 * ay;
+  VDOUBLE yh = c - (c - ay);
+  VDOUBLE yl = ay - yh;
+  return (ax - n * yh) - n * yl;
+#endif
+}
+
+/**
+ * fmod(x, y): x - n*y for the integer n that truncates x/y, with the
+ * sign of x.  The quotient is corrected when x/y rounds to the wrong
+ * integer.  Lanes with |x/y| >= 2^26 (and y == 0, infinities, NaNs) go
+ * to libm, as do those with |y| > 2^995 without FMA.
+ */
+static inline VDOUBLE VM(vm_fmod)(VDOUBLE x, VDOUBLE y)
+{
+  VDOUBLE ax = VM(vm_abs)(x);
+  VDOUBLE ay = VM(vm_abs)(y);
+  VDOUBLE quot = ax / ay;
+#if VM_HAVE_FMA
+  VLONG out_of_range = ~(quot < 0x1p26) | ~(ay > 0.0) | ~(ay < HUGE_VAL);
+#else
+  VLONG out_of_range = ~(quot < 0x1p26) | ~(ay > 0.0) | ~(ay <= 0x1p995);
+#endif
+  VDOUBLE n = VM(vm_trunc)(VM(vm_select)(out_of_range, VM(vm_splat)(0.0), quot));
+  VDOUBLE r = VM(vm_fmod_remainder)(ax, n, ay);
+  VLONG one = (VLONG) VM(vm_splat)(1.0);
+
+  n = n - (VDOUBLE) ((r < 0.0) & one) + (VDOUBLE) ((r >= ay) & one);
+  r = VM(vm_fmod_remainder)(ax, n, ay);
+  r = VM(vm_copysign)(r, x);
+
+  if (VM(vm_any)(out_of_range))
+  {
+    int ii;
+    for (ii = 0; ii < VM_WIDTH; ++ii)
+      if (out_of_range[ii])
+        r[ii] = fmod(x[ii], y[ii]);
+  }
+
+  return r;
+}
+
+/*@}*/
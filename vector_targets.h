@@ -0,0 +1,35 @@
+/**
+ * \file vector_targets.h
+ *
+ * \brief Macros for compiling a block of code for one instruction set,
+ * and for finding out which instruction sets the processor has.
+ *
+ * \author Jonathan Cross
+ **/
+
+#ifndef VECTOR_TARGETS_H
+#define VECTOR_TARGETS_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VM_X86 1
+#include <immintrin.h>
+#else
+#define VM_X86 0
+#endif
+
+#define VM_PRAGMA(x) _Pragma(#x)
+
+/**
+ * Everything between BEGIN_TARGET("avx2,fma") and END_TARGET is
+ * compiled for that instruction set, whatever the compiler flags say.
+ */
+#if defined(__clang__)
+#define BEGIN_TARGET(t) \
+  VM_PRAGMA(clang attribute push (__attribute__((target(t))), apply_to = function))
+#define END_TARGET VM_PRAGMA(clang attribute pop)
+#else
+#define BEGIN_TARGET(t) VM_PRAGMA(GCC push_options) VM_PRAGMA(GCC target(t))
+#define END_TARGET VM_PRAGMA(GCC pop_options)
+#endif
+
+#endif